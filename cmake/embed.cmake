@@ -0,0 +1,57 @@
+# Writes a C++ source file holding the contents of FILES as byte arrays
+#
+# cmake -DROOT=<dir> -DFILES=<a|b|...> -DOUTPUT=<file.cpp> -P embed.cmake
+#
+# FILES are relative to ROOT and separated by '|'. Each file is registered
+# in agl::kEmbeddedResources under its relative name, e.g.
+# "shaders/unlit.vs" (see src/agl/resources.h).
+
+string(REPLACE "|" ";" FILES "${FILES}")
+
+# CMake regular expressions have no {n} repetition
+set(LINE "")
+foreach(I RANGE 1 16)
+  set(LINE "${LINE}0x..,")
+endforeach()
+
+set(DATA "")
+set(TABLE "")
+set(INDEX 0)
+foreach(NAME ${FILES})
+  file(READ "${ROOT}/${NAME}" HEX HEX)
+  file(SIZE "${ROOT}/${NAME}" SIZE)
+
+  # 16 bytes per line, plus a trailing zero so text can be used as a C string
+  string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," BYTES "${HEX}")
+  string(REGEX REPLACE "(${LINE})" "\\1\n  " BYTES "${BYTES}")
+
+  string(APPEND DATA "// ${NAME}\n")
+  string(APPEND DATA "constexpr unsigned char kData${INDEX}[] = {\n  ${BYTES}0x00\n};\n\n")
+  string(APPEND TABLE "  {\"${NAME}\", kData${INDEX}, ${SIZE}},\n")
+  math(EXPR INDEX "${INDEX} + 1")
+endforeach()
+
+set(SOURCE "// Generated by cmake/embed.cmake. Do not edit.
+
+#include \"agl/resources.h\"
+
+namespace agl {
+namespace {
+
+${DATA}}  // namespace
+
+extern const EmbeddedResource kEmbeddedResources[] = {
+${TABLE}  {0, 0, 0}
+};
+extern const int kNumEmbeddedResources = ${INDEX};
+
+}  // namespace agl
+")
+
+# Only touch the output when it changes, to avoid needless rebuilds
+if (EXISTS "${OUTPUT}")
+  file(READ "${OUTPUT}" OLD)
+endif()
+if (NOT "${OLD}" STREQUAL "${SOURCE}")
+  file(WRITE "${OUTPUT}" "${SOURCE}")
+endif()
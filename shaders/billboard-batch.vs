@@ -0,0 +1,33 @@
+#version 400
+
+layout (location = 0) in vec3 vPosition;
+layout (location = 1) in vec3 vOffset;  // per instance
+layout (location = 2) in vec4 vColor;   // per instance
+layout (location = 3) in float vSize;   // per instance
+layout (location = 4) in float vLayer;  // per instance
+
+uniform vec3 CameraPos;
+uniform mat4 MVP;
+
+out vec4 color;
+out vec2 uv;
+#ifdef TEXTURE_ARRAY
+flat out int layer;
+#endif
+
+void main()
+{
+  color = vColor;
+  uv = vPosition.xy;
+#ifdef TEXTURE_ARRAY
+  layer = int(vLayer);
+#endif
+
+  vec3 z = normalize(CameraPos - vOffset);
+  vec3 x = normalize(cross(vec3(0,1,0), z));
+  vec3 y = normalize(cross(z, x));
+  mat3 R = mat3(x, y, z);
+
+  vec3 eyePos = R * vSize * (vPosition - vec3(0.5, 0.5, 0.0)) + vOffset;
+  gl_Position = MVP * vec4(eyePos, 1.0);
+}
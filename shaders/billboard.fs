@@ -3,10 +3,21 @@
 in vec2 uv;
 in vec4 color;
 
+// in the TEXTURE_ARRAY variant, image is an array and layer is set by the
+// vertex shader
+#ifdef TEXTURE_ARRAY
+uniform sampler2DArray image;
+flat in int layer;
+#else
 uniform sampler2D image;
+#endif
 out vec4 FragColor;
 
 void main()
 {
+#ifdef TEXTURE_ARRAY
+  FragColor = color * texture(image, vec3(uv, layer));
+#else
   FragColor = color * texture(image, uv);
+#endif
 }
@@ -11,11 +11,18 @@ uniform mat4 MVP;
 
 out vec4 color;
 out vec2 uv;
+#ifdef TEXTURE_ARRAY
+uniform int imageLayer;
+flat out int layer;
+#endif
 
 void main()
 {
   color = Color;
   uv = vPosition.xy;
+#ifdef TEXTURE_ARRAY
+  layer = imageLayer;
+#endif
 
   vec3 z = normalize(CameraPos - Offset);
   vec3 x = normalize(cross(vec3(0,1,0), z));
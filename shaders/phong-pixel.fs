@@ -1,28 +1,60 @@
 #version 400
 
-
 struct LightSource {
   vec4 pos; // position of light in eye coordinates
   vec3 intensity; // light intensity
 };
 
-uniform LightSource Light;
+struct Spotlight {
+  vec4 pos; // where the light is located
+  vec3 intensity; // light intensity
+  vec3 dir; // direction of light
+  float exp; // angular attenuation factor
+  float innerCutOff; // this is a inner cut off of the spotlight
+  float outerCutOff; // this is the hard cutoff of light
+};
+
+struct FogInfo {
+  float maxDist; // distance where camera can only see fog
+  float minDist; // distance from eye, so that there is no fog
+  vec3 color; // color of fog
+};
+
+// written once per frame (binding 0)
+layout (std140) uniform FrameBlock {
+  mat4 View;
+  mat4 Projection;
+  LightSource Light;
+  Spotlight Spot;
+  FogInfo Fog;
+};
 
 struct MaterialProp {
   vec3 Ka; // reflect ambience
   vec3 Kd; // reflect diffusion
   vec3 Ks; // reflect specular
   float alpha; // specular exponent factor
+  vec3 outlineColor; // color of an edge
 };
 
-uniform MaterialProp Material;
+// one buffer per material (binding 1)
+layout (std140) uniform MaterialBlock {
+  MaterialProp Material;
+};
 
 in vec3 n_eye;
 in vec4 p_eye;
 
-// texture information
+// texture information, used by the HAS_UV variant; in the TEXTURE_ARRAY
+// variant the texture is a layer of a texture array
+#ifdef TEXTURE_ARRAY
+uniform sampler2DArray diffuseTexture;
+uniform int diffuseTextureLayer;
+#define sampleDiffuse(st) texture(diffuseTexture, vec3(st, diffuseTextureLayer))
+#else
 uniform sampler2D diffuseTexture;
-uniform bool HasUV; // tells if there are uv coordinates
+#define sampleDiffuse(st) texture(diffuseTexture, st)
+#endif
 in vec2 uv; // texture coordinates
 const float uvScale= 3.0f; // scales the coordinates
 
@@ -55,11 +87,11 @@ vec3 phong() {
     specular= Light.intensity * Material.Ks * pow(max(dot(r, v), 0), Material.alpha);
 
   vec3 color;
-  if (HasUV) {
-    color= (ambient + diffuse) * texture(diffuseTexture, uv * uvScale).xyz + specular;
-  } else {
-    color= ambient + diffuse + specular;
-  }
+#ifdef HAS_UV
+  color= (ambient + diffuse) * sampleDiffuse(uv * uvScale).xyz + specular;
+#else
+  color= ambient + diffuse + specular;
+#endif
 
   return color;
 }
@@ -1,8 +1,15 @@
 #version 400
 
-// texture information
+// texture information, used by the HAS_UV variant; in the TEXTURE_ARRAY
+// variant the texture is a layer of a texture array
+#ifdef TEXTURE_ARRAY
+uniform sampler2DArray diffuseTexture;
+uniform int diffuseTextureLayer;
+#define sampleDiffuse(st) texture(diffuseTexture, vec3(st, diffuseTextureLayer))
+#else
 uniform sampler2D diffuseTexture;
-uniform bool HasUV;
+#define sampleDiffuse(st) texture(diffuseTexture, st)
+#endif
 in vec2 uv;
 const float uvScale= 3.0f;
 
@@ -13,7 +20,9 @@ out vec4 FragColor;
 void main()
 {
    vec3 color= Intensity;
-   if (HasUV) color= color * texture(diffuseTexture, uv * uvScale).xyz;
+#ifdef HAS_UV
+   color= color * sampleDiffuse(uv * uvScale).xyz;
+#endif
    
    FragColor = vec4(color, 1.0);
 }
@@ -7,26 +7,51 @@ layout (location = 2) in vec2 vTextureCoords;
 uniform mat3 NormalMatrix;
 uniform mat4 ModelViewMatrix;
 uniform mat4 MVP;
-uniform bool HasUV;
 
 out vec3 Intensity; // outgoing intensity
 out vec2 uv; // outgoing texture coordinates
 
 struct LightSource {
   vec4 pos; // position of light in eye coordinates
-  vec3 intensity; // lightIntensity
+  vec3 intensity; // light intensity
 };
 
-uniform LightSource Light; 
+struct Spotlight {
+  vec4 pos; // where the light is located
+  vec3 intensity; // light intensity
+  vec3 dir; // direction of light
+  float exp; // angular attenuation factor
+  float innerCutOff; // this is a inner cut off of the spotlight
+  float outerCutOff; // this is the hard cutoff of light
+};
+
+struct FogInfo {
+  float maxDist; // distance where camera can only see fog
+  float minDist; // distance from eye, so that there is no fog
+  vec3 color; // color of fog
+};
+
+// written once per frame (binding 0)
+layout (std140) uniform FrameBlock {
+  mat4 View;
+  mat4 Projection;
+  LightSource Light;
+  Spotlight Spot;
+  FogInfo Fog;
+};
 
 struct MaterialProp {
-  vec3 Ka;    // reflect ambience
-  vec3 Kd;    // reflect specular
-  vec3 Ks;    // reflect specular
+  vec3 Ka; // reflect ambience
+  vec3 Kd; // reflect diffusion
+  vec3 Ks; // reflect specular
   float alpha; // specular exponent factor
+  vec3 outlineColor; // color of an edge
 };
 
-uniform MaterialProp Material; 
+// one buffer per material (binding 1)
+layout (std140) uniform MaterialBlock {
+  MaterialProp Material;
+};
 
 
 vec3 phong(vec4 p_eye, vec3 n_eye) {
@@ -4,6 +4,11 @@
 in vec3 n_eye;
 in vec4 p_eye;
 
+struct LightSource {
+  vec4 pos; // position of light in eye coordinates
+  vec3 intensity; // light intensity
+};
+
 struct Spotlight {
   vec4 pos; // where the light is located
   vec3 intensity; // light intensity
@@ -13,20 +18,44 @@ struct Spotlight {
   float outerCutOff; // this is the hard cutoff of light
 };
 
-uniform Spotlight Spot;
+struct FogInfo {
+  float maxDist; // distance where camera can only see fog
+  float minDist; // distance from eye, so that there is no fog
+  vec3 color; // color of fog
+};
 
-struct MaterialInfo {
-  vec3 Ka;
-  vec3 Kd;
-  vec3 Ks;
-  float alpha;
+// written once per frame (binding 0)
+layout (std140) uniform FrameBlock {
+  mat4 View;
+  mat4 Projection;
+  LightSource Light;
+  Spotlight Spot;
+  FogInfo Fog;
 };
 
-uniform MaterialInfo Material;
+struct MaterialProp {
+  vec3 Ka; // reflect ambience
+  vec3 Kd; // reflect diffusion
+  vec3 Ks; // reflect specular
+  float alpha; // specular exponent factor
+  vec3 outlineColor; // color of an edge
+};
+
+// one buffer per material (binding 1)
+layout (std140) uniform MaterialBlock {
+  MaterialProp Material;
+};
 
-// texture information
+// texture information, used by the HAS_UV variant; in the TEXTURE_ARRAY
+// variant the texture is a layer of a texture array
+#ifdef TEXTURE_ARRAY
+uniform sampler2DArray diffuseTexture;
+uniform int diffuseTextureLayer;
+#define sampleDiffuse(st) texture(diffuseTexture, vec3(st, diffuseTextureLayer))
+#else
 uniform sampler2D diffuseTexture;
-uniform bool HasUV;
+#define sampleDiffuse(st) texture(diffuseTexture, st)
+#endif
 in vec2 uv;
 const float uvScale= 3.0f;
 
@@ -64,11 +93,11 @@ vec3 phongSpot() {
     * pow(max(dot(h, n), 0.0f), Material.alpha);
 
   vec3 color;
-  if (HasUV) {
-    color= (ambient + diffuse) * texture(diffuseTexture, uv * uvScale).xyz + specular;
-  } else {
-    color= ambient + diffuse + specular;
-  }
+#ifdef HAS_UV
+  color= (ambient + diffuse) * sampleDiffuse(uv * uvScale).xyz + specular;
+#else
+  color= ambient + diffuse + specular;
+#endif
 
 
 
@@ -4,28 +4,62 @@ in vec3 n_eye;
 in vec4 p_eye;
 
 
-struct LightInfo {
-  vec4 pos;
-  vec3 intensity;
+struct LightSource {
+  vec4 pos; // position of light in eye coordinates
+  vec3 intensity; // light intensity
 };
 
-uniform LightInfo Light;
+struct Spotlight {
+  vec4 pos; // where the light is located
+  vec3 intensity; // light intensity
+  vec3 dir; // direction of light
+  float exp; // angular attenuation factor
+  float innerCutOff; // this is a inner cut off of the spotlight
+  float outerCutOff; // this is the hard cutoff of light
+};
+
+struct FogInfo {
+  float maxDist; // distance where camera can only see fog
+  float minDist; // distance from eye, so that there is no fog
+  vec3 color; // color of fog
+};
 
-struct MaterialInfo {
-  vec3 Ka; // ambient reflectivity
-  vec3 Kd; // diffuse reflectivity
+// written once per frame (binding 0)
+layout (std140) uniform FrameBlock {
+  mat4 View;
+  mat4 Projection;
+  LightSource Light;
+  Spotlight Spot;
+  FogInfo Fog;
+};
+
+struct MaterialProp {
+  vec3 Ka; // reflect ambience
+  vec3 Kd; // reflect diffusion
+  vec3 Ks; // reflect specular
+  float alpha; // specular exponent factor
   vec3 outlineColor; // color of an edge
 };
 
-uniform MaterialInfo Material;
+// one buffer per material (binding 1)
+layout (std140) uniform MaterialBlock {
+  MaterialProp Material;
+};
 
 const int levels= 3; // how many "shadings"
 const float scaleFactor= 1.0 / levels;
 //const float edgeThreshold= 0.25f;
 
-// texture information
+// texture information, used by the HAS_UV variant; in the TEXTURE_ARRAY
+// variant the texture is a layer of a texture array
+#ifdef TEXTURE_ARRAY
+uniform sampler2DArray diffuseTexture;
+uniform int diffuseTextureLayer;
+#define sampleDiffuse(st) texture(diffuseTexture, vec3(st, diffuseTextureLayer))
+#else
 uniform sampler2D diffuseTexture;
-uniform bool HasUV;
+#define sampleDiffuse(st) texture(diffuseTexture, st)
+#endif
 in vec2 uv;
 const float uvScale= 3.0f;
 
@@ -59,9 +93,9 @@ vec3 toonify() {
   vec3 diffuse= Material.Kd * floor(sDotn * levels) * scaleFactor;
 
   vec3 color= Light.intensity * (Material.Ka + diffuse);
-  if (HasUV) {
-    color= color * texture(diffuseTexture, uv * uvScale).xyz;
-  }
+#ifdef HAS_UV
+  color= color * sampleDiffuse(uv * uvScale).xyz;
+#endif
 
   return color;
 }
@@ -5,6 +5,7 @@
 #include <iostream>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/string_cast.hpp>
+#include "agl/simd.h"
 
 std::ostream& operator<<(std::ostream& o, const glm::mat4& m) {
   char line[1024];
@@ -55,3 +56,138 @@ std::ostream& operator<<(std::ostream& o, const glm::quat& v) {
   o << line;
   return o;
 }
+
+namespace agl {
+
+#ifdef AGL_HAS_SSE2
+
+#define AGL_SHUFFLE(a, b, x, y, z, w) \
+  _mm_shuffle_ps(a, b, _MM_SHUFFLE(w, z, y, x))
+#define AGL_SWIZZLE(a, x, y, z, w) AGL_SHUFFLE(a, a, x, y, z, w)
+
+// 2x2 matrices are stored row-major in one register as (m00, m01, m10, m11)
+
+// A * B
+static inline __m128 mat2Mul(__m128 a, __m128 b) {
+  return _mm_add_ps(_mm_mul_ps(a, AGL_SWIZZLE(b, 0, 3, 0, 3)),
+      _mm_mul_ps(AGL_SWIZZLE(a, 1, 0, 3, 2), AGL_SWIZZLE(b, 2, 1, 2, 1)));
+}
+
+// adjugate(A) * B
+static inline __m128 mat2AdjMul(__m128 a, __m128 b) {
+  return _mm_sub_ps(_mm_mul_ps(AGL_SWIZZLE(a, 3, 3, 0, 0), b),
+      _mm_mul_ps(AGL_SWIZZLE(a, 1, 1, 2, 2), AGL_SWIZZLE(b, 2, 3, 0, 1)));
+}
+
+// A * adjugate(B)
+static inline __m128 mat2MulAdj(__m128 a, __m128 b) {
+  return _mm_sub_ps(_mm_mul_ps(a, AGL_SWIZZLE(b, 3, 0, 3, 0)),
+      _mm_mul_ps(AGL_SWIZZLE(a, 1, 0, 3, 2), AGL_SWIZZLE(b, 2, 1, 2, 1)));
+}
+
+glm::mat4 mat4Mul(const glm::mat4& a, const glm::mat4& b) {
+  const float* pa = &a[0][0];
+  const float* pb = &b[0][0];
+  __m128 a0 = _mm_loadu_ps(pa);
+  __m128 a1 = _mm_loadu_ps(pa + 4);
+  __m128 a2 = _mm_loadu_ps(pa + 8);
+  __m128 a3 = _mm_loadu_ps(pa + 12);
+
+  glm::mat4 result;
+  float* pr = &result[0][0];
+  for (int i = 0; i < 4; i++) {
+    // column i of the result combines the columns of a weighted by column i
+    // of b
+    __m128 col = _mm_mul_ps(a0, _mm_set1_ps(pb[4 * i + 0]));
+    col = _mm_add_ps(col, _mm_mul_ps(a1, _mm_set1_ps(pb[4 * i + 1])));
+    col = _mm_add_ps(col, _mm_mul_ps(a2, _mm_set1_ps(pb[4 * i + 2])));
+    col = _mm_add_ps(col, _mm_mul_ps(a3, _mm_set1_ps(pb[4 * i + 3])));
+    _mm_storeu_ps(pr + 4 * i, col);
+  }
+  return result;
+}
+
+glm::mat4 mat4Inverse(const glm::mat4& m) {
+  // Block-wise inverse using 2x2 sub-matrices. The columns are treated as
+  // rows, so this computes inverse(transpose(m)); storing its rows as our
+  // columns yields inverse(m).
+  const float* pm = &m[0][0];
+  __m128 r0 = _mm_loadu_ps(pm);
+  __m128 r1 = _mm_loadu_ps(pm + 4);
+  __m128 r2 = _mm_loadu_ps(pm + 8);
+  __m128 r3 = _mm_loadu_ps(pm + 12);
+
+  __m128 A = _mm_movelh_ps(r0, r1);
+  __m128 B = _mm_movehl_ps(r1, r0);
+  __m128 C = _mm_movelh_ps(r2, r3);
+  __m128 D = _mm_movehl_ps(r3, r2);
+
+  // (|A|, |B|, |C|, |D|)
+  __m128 detSub = _mm_sub_ps(
+      _mm_mul_ps(AGL_SHUFFLE(r0, r2, 0, 2, 0, 2),
+          AGL_SHUFFLE(r1, r3, 1, 3, 1, 3)),
+      _mm_mul_ps(AGL_SHUFFLE(r0, r2, 1, 3, 1, 3),
+          AGL_SHUFFLE(r1, r3, 0, 2, 0, 2)));
+  __m128 detA = AGL_SWIZZLE(detSub, 0, 0, 0, 0);
+  __m128 detB = AGL_SWIZZLE(detSub, 1, 1, 1, 1);
+  __m128 detC = AGL_SWIZZLE(detSub, 2, 2, 2, 2);
+  __m128 detD = AGL_SWIZZLE(detSub, 3, 3, 3, 3);
+
+  __m128 DC = mat2AdjMul(D, C);
+  __m128 AB = mat2AdjMul(A, B);
+  __m128 X = _mm_sub_ps(_mm_mul_ps(detD, A), mat2Mul(B, DC));
+  __m128 W = _mm_sub_ps(_mm_mul_ps(detA, D), mat2Mul(C, AB));
+  __m128 Y = _mm_sub_ps(_mm_mul_ps(detB, C), mat2MulAdj(D, AB));
+  __m128 Z = _mm_sub_ps(_mm_mul_ps(detC, B), mat2MulAdj(A, DC));
+
+  // |M| = |A||D| + |B||C| - trace(adj(A)B adj(D)C)
+  __m128 tr = _mm_mul_ps(AB, AGL_SWIZZLE(DC, 0, 2, 1, 3));
+  tr = _mm_add_ps(tr, AGL_SWIZZLE(tr, 1, 0, 3, 2));
+  tr = _mm_add_ps(tr, AGL_SWIZZLE(tr, 2, 3, 0, 1));
+  __m128 detM = _mm_add_ps(_mm_mul_ps(detA, detD), _mm_mul_ps(detB, detC));
+  detM = _mm_sub_ps(detM, tr);
+
+  __m128 rDetM = _mm_div_ps(_mm_setr_ps(1.f, -1.f, -1.f, 1.f), detM);
+  X = _mm_mul_ps(X, rDetM);
+  Y = _mm_mul_ps(Y, rDetM);
+  Z = _mm_mul_ps(Z, rDetM);
+  W = _mm_mul_ps(W, rDetM);
+
+  glm::mat4 result;
+  float* pr = &result[0][0];
+  _mm_storeu_ps(pr, AGL_SHUFFLE(X, Y, 3, 1, 3, 1));
+  _mm_storeu_ps(pr + 4, AGL_SHUFFLE(X, Y, 2, 0, 2, 0));
+  _mm_storeu_ps(pr + 8, AGL_SHUFFLE(Z, W, 3, 1, 3, 1));
+  _mm_storeu_ps(pr + 12, AGL_SHUFFLE(Z, W, 2, 0, 2, 0));
+  return result;
+}
+
+#undef AGL_SWIZZLE
+#undef AGL_SHUFFLE
+
+#else
+
+glm::mat4 mat4Mul(const glm::mat4& a, const glm::mat4& b) {
+  return a * b;
+}
+
+glm::mat4 mat4Inverse(const glm::mat4& m) {
+  return glm::inverse(m);
+}
+
+#endif
+
+glm::mat3 normalMatrix(const glm::mat4& m) {
+  // inverse(M)^T = cofactor(M) / det(M), and the cofactor columns of a 3x3
+  // matrix are the cross products of its columns
+  glm::vec3 c0(m[0]);
+  glm::vec3 c1(m[1]);
+  glm::vec3 c2(m[2]);
+  glm::vec3 x = glm::cross(c1, c2);
+  float invDet = 1.0f / glm::dot(c0, x);
+  return glm::mat3(x * invDet,
+      glm::cross(c2, c0) * invDet,
+      glm::cross(c0, c1) * invDet);
+}
+
+}  // namespace agl
@@ -86,6 +86,30 @@ const float kINFINITY = std::numeric_limits<float>::infinity();
 
 namespace agl {
 
+/** 
+ * @brief Multiply two 4x4 matrices
+ *
+ * Equivalent to `a * b`. Uses SSE2 when available and falls back to glm
+ * otherwise.
+ */ 
+extern glm::mat4 mat4Mul(const glm::mat4& a, const glm::mat4& b);
+
+/** 
+ * @brief Invert a general 4x4 matrix
+ *
+ * Equivalent to `glm::inverse(m)`. Uses SSE2 when available and falls back
+ * to glm otherwise.
+ */ 
+extern glm::mat4 mat4Inverse(const glm::mat4& m);
+
+/** 
+ * @brief Compute the matrix for transforming normals
+ *
+ * Returns the inverse-transpose of the upper 3x3 of m, computed from the
+ * cofactors of its columns.
+ */ 
+extern glm::mat3 normalMatrix(const glm::mat4& m);
+
 /** 
  * @brief Return a random number between 0 and 1 [0, 1)
  */ 
@@ -0,0 +1,374 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/bvh.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include "agl/simd.h"
+
+using glm::vec3;
+
+namespace agl {
+
+namespace {
+
+const int kMaxLeafSize = 4;
+const int kNumBins = 16;
+
+// Deeper subtrees become leaves, which bounds the traversal stack
+const int kMaxDepth = 64;
+const int kStackSize = 3 * kMaxDepth + 1;
+
+struct Box {
+  vec3 min = vec3(FLT_MAX);
+  vec3 max = vec3(-FLT_MAX);
+
+  void grow(const vec3& p) {
+    min = glm::min(min, p);
+    max = glm::max(max, p);
+  }
+  void grow(const Box& box) {
+    min = glm::min(min, box.min);
+    max = glm::max(max, box.max);
+  }
+  float area() const {
+    vec3 d = max - min;
+    if (d.x < 0.0f) return 0.0f;  // empty
+    return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+  }
+};
+
+// Moller-Trumbore, for either winding
+inline bool intersectTriangle(const vec3& origin, const vec3& direction,
+    const vec3& v0, const vec3& e1, const vec3& e2, float tMin, float tMax,
+    float* t, float* u, float* v) {
+  vec3 p = glm::cross(direction, e2);
+  float det = glm::dot(e1, p);
+  if (std::fabs(det) < 1e-12f) return false;  // parallel
+  float invDet = 1.0f / det;
+  vec3 s = origin - v0;
+  float b1 = glm::dot(s, p) * invDet;
+  if (b1 < 0.0f || b1 > 1.0f) return false;
+  vec3 q = glm::cross(s, e1);
+  float b2 = glm::dot(direction, q) * invDet;
+  if (b2 < 0.0f || b1 + b2 > 1.0f) return false;
+  float distance = glm::dot(e2, q) * invDet;
+  if (distance <= tMin || distance >= tMax) return false;
+  *t = distance;
+  *u = b1;
+  *v = b2;
+  return true;
+}
+
+}  // namespace
+
+struct BVH::BuildNode {
+  Box bounds;
+  int left;  // the children, or -1 for a leaf
+  int right;
+  int first;  // a leaf's triangles, in Builder::refs
+  int count;
+};
+
+struct BVH::Builder {
+  std::vector<Box> boxes;  // per triangle
+  std::vector<vec3> centers;
+  std::vector<int> refs;  // triangle ids, reordered into leaves
+  std::vector<BuildNode> tree;
+
+  int build(int first, int count, int depth) {
+    Box bounds, centerBounds;
+    for (int i = first; i < first + count; i++) {
+      bounds.grow(boxes[refs[i]]);
+      centerBounds.grow(centers[refs[i]]);
+    }
+    int index = static_cast<int>(tree.size());
+    tree.push_back(BuildNode{bounds, -1, -1, first, count});
+    if (count <= kMaxLeafSize || depth >= kMaxDepth) return index;
+
+    // Bin the centers along each axis and pick the split with the lowest
+    // area * triangles of the two sides
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    int bestSplit = 0;
+    for (int axis = 0; axis < 3; axis++) {
+      float lo = centerBounds.min[axis];
+      float extent = centerBounds.max[axis] - lo;
+      if (extent <= 0.0f) continue;
+      float binScale = kNumBins / extent;
+      Box bins[kNumBins];
+      int counts[kNumBins] = {};
+      for (int i = first; i < first + count; i++) {
+        int bin = std::min(kNumBins - 1,
+            static_cast<int>((centers[refs[i]][axis] - lo) * binScale));
+        bins[bin].grow(boxes[refs[i]]);
+        counts[bin]++;
+      }
+
+      float leftCost[kNumBins];
+      Box left;
+      int leftCount = 0;
+      for (int i = 0; i < kNumBins - 1; i++) {
+        left.grow(bins[i]);
+        leftCount += counts[i];
+        leftCost[i] = left.area() * leftCount;
+      }
+      Box right;
+      int rightCount = 0;
+      for (int i = kNumBins - 1; i > 0; i--) {
+        right.grow(bins[i]);
+        rightCount += counts[i];
+        float cost = leftCost[i - 1] + right.area() * rightCount;
+        if (cost < bestCost) {
+          bestCost = cost;
+          bestAxis = axis;
+          bestSplit = i;
+        }
+      }
+    }
+
+    int mid = first + count / 2;
+    if (bestAxis >= 0) {
+      float lo = centerBounds.min[bestAxis];
+      float binScale = kNumBins / (centerBounds.max[bestAxis] - lo);
+      int* split = std::partition(&refs[first], &refs[first] + count,
+          [&](int id) {
+            int bin = std::min(kNumBins - 1,
+                static_cast<int>((centers[id][bestAxis] - lo) * binScale));
+            return bin < bestSplit;
+          });
+      int splitIndex = static_cast<int>(split - &refs[0]);
+      if (splitIndex > first && splitIndex < first + count) mid = splitIndex;
+    }
+    // else every center is the same point, so split the list in half
+
+    int left = build(first, mid - first, depth + 1);
+    int right = build(mid, first + count - mid, depth + 1);
+    tree[index].left = left;
+    tree[index].right = right;
+    return index;
+  }
+};
+
+BVH::BVH() : _minBounds(0.0f), _maxBounds(0.0f) {
+}
+
+BVH::~BVH() {
+}
+
+void BVH::build(const std::vector<float>& positions,
+    const std::vector<unsigned int>& indices) {
+  _nodes.clear();
+  _triangles.clear();
+  _minBounds = _maxBounds = vec3(0.0f);
+  int numTriangles = static_cast<int>(indices.size() / 3);
+  if (numTriangles == 0) return;
+
+  auto position = [&positions](unsigned int i) {
+    return vec3(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]);
+  };
+  Builder builder;
+  builder.boxes.resize(numTriangles);
+  builder.centers.resize(numTriangles);
+  builder.refs.resize(numTriangles);
+  for (int i = 0; i < numTriangles; i++) {
+    Box& box = builder.boxes[i];
+    for (int k = 0; k < 3; k++) box.grow(position(indices[i * 3 + k]));
+    builder.centers[i] = (box.min + box.max) * 0.5f;
+    builder.refs[i] = i;
+  }
+  builder.tree.reserve(2 * numTriangles / kMaxLeafSize + 1);
+  builder.build(0, numTriangles, 0);
+  _minBounds = builder.tree[0].bounds.min;
+  _maxBounds = builder.tree[0].bounds.max;
+
+  _triangles.resize(numTriangles);
+  for (int i = 0; i < numTriangles; i++) {
+    int id = builder.refs[i];
+    vec3 v0 = position(indices[id * 3]);
+    _triangles[i].v0 = v0;
+    _triangles[i].e1 = position(indices[id * 3 + 1]) - v0;
+    _triangles[i].e2 = position(indices[id * 3 + 2]) - v0;
+    _triangles[i].id = id;
+  }
+
+  _nodes.reserve(builder.tree.size() / 2 + 1);
+  collapse(builder.tree, 0);
+}
+
+int BVH::collapse(const std::vector<BuildNode>& tree, int index) {
+  // Replace the largest child by its two children until there are four
+  int children[4];
+  int n = 0;
+  if (tree[index].left < 0) {
+    children[n++] = index;  // the whole tree is one leaf
+  } else {
+    children[n++] = tree[index].left;
+    children[n++] = tree[index].right;
+  }
+  while (n < 4) {
+    int largest = -1;
+    float largestArea = -1.0f;
+    for (int i = 0; i < n; i++) {
+      const BuildNode& child = tree[children[i]];
+      if (child.left >= 0 && child.bounds.area() > largestArea) {
+        largest = i;
+        largestArea = child.bounds.area();
+      }
+    }
+    if (largest < 0) break;  // all leaves
+    int opened = children[largest];
+    children[largest] = tree[opened].left;
+    children[n++] = tree[opened].right;
+  }
+
+  int nodeIndex = static_cast<int>(_nodes.size());
+  _nodes.push_back(Node());
+  for (int i = 0; i < 4; i++) {
+    Node& node = _nodes[nodeIndex];
+    Box box;
+    if (i < n) box = tree[children[i]].bounds;
+    else box.min = box.max = vec3(0.0f);  // unused, see numChildren
+    node.minX[i] = box.min.x;
+    node.minY[i] = box.min.y;
+    node.minZ[i] = box.min.z;
+    node.maxX[i] = box.max.x;
+    node.maxY[i] = box.max.y;
+    node.maxZ[i] = box.max.z;
+    node.child[i] = 0;
+    node.count[i] = 0;
+  }
+  _nodes[nodeIndex].numChildren = n;
+  for (int i = 0; i < n; i++) {
+    const BuildNode& child = tree[children[i]];
+    if (child.left < 0) {
+      _nodes[nodeIndex].child[i] = child.first;
+      _nodes[nodeIndex].count[i] = child.count;
+    } else {
+      int childIndex = collapse(tree, children[i]);  // may move _nodes
+      _nodes[nodeIndex].child[i] = childIndex;
+    }
+  }
+  return nodeIndex;
+}
+
+bool BVH::intersect(const Ray& ray, RayHit* hit) const {
+  return traverse<false>(ray, hit);
+}
+
+bool BVH::occluded(const Ray& ray) const {
+  return traverse<true>(ray, 0);
+}
+
+template <bool kAnyHit>
+bool BVH::traverse(const Ray& ray, RayHit* hit) const {
+  if (_nodes.empty()) return false;
+
+  // Zero components would make 0 * inf = NaN in the slab test
+  vec3 direction = ray.direction;
+  for (int i = 0; i < 3; i++) {
+    if (std::fabs(direction[i]) < 1e-20f) {
+      direction[i] = std::copysign(1e-20f, direction[i]);
+    }
+  }
+  vec3 invDirection = 1.0f / direction;
+  const vec3& origin = ray.origin;
+  float tMax = ray.tMax;
+  bool found = false;
+
+#ifdef AGL_HAS_SSE2
+  const __m128 ox = _mm_set1_ps(origin.x);
+  const __m128 oy = _mm_set1_ps(origin.y);
+  const __m128 oz = _mm_set1_ps(origin.z);
+  const __m128 ix = _mm_set1_ps(invDirection.x);
+  const __m128 iy = _mm_set1_ps(invDirection.y);
+  const __m128 iz = _mm_set1_ps(invDirection.z);
+  const __m128 rayMin = _mm_set1_ps(ray.tMin);
+#endif
+
+  int stack[kStackSize];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    const Node& node = _nodes[stack[--top]];
+
+    // the distances to the four boxes, and which ones the ray enters
+    float tNear[4];
+    int mask = 0;
+#ifdef AGL_HAS_SSE2
+    __m128 x0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), ox), ix);
+    __m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX), ox), ix);
+    __m128 y0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), oy), iy);
+    __m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY), oy), iy);
+    __m128 z0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), oz), iz);
+    __m128 z1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ), oz), iz);
+    __m128 enter = _mm_max_ps(
+        _mm_max_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)),
+        _mm_max_ps(_mm_min_ps(z0, z1), rayMin));
+    __m128 exit = _mm_min_ps(
+        _mm_min_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)),
+        _mm_min_ps(_mm_max_ps(z0, z1), _mm_set1_ps(tMax)));
+    mask = _mm_movemask_ps(_mm_cmple_ps(enter, exit));
+    _mm_storeu_ps(tNear, enter);
+#else
+    for (int i = 0; i < 4; i++) {
+      float x0 = (node.minX[i] - origin.x) * invDirection.x;
+      float x1 = (node.maxX[i] - origin.x) * invDirection.x;
+      float y0 = (node.minY[i] - origin.y) * invDirection.y;
+      float y1 = (node.maxY[i] - origin.y) * invDirection.y;
+      float z0 = (node.minZ[i] - origin.z) * invDirection.z;
+      float z1 = (node.maxZ[i] - origin.z) * invDirection.z;
+      float enter = std::max(std::max(std::min(x0, x1), std::min(y0, y1)),
+          std::max(std::min(z0, z1), ray.tMin));
+      float exit = std::min(std::min(std::max(x0, x1), std::max(y0, y1)),
+          std::min(std::max(z0, z1), tMax));
+      if (enter <= exit) mask |= 1 << i;
+      tNear[i] = enter;
+    }
+#endif
+    mask &= (1 << node.numChildren) - 1;
+    if (mask == 0) continue;
+
+    // nearest first, so closer hits shorten the ray before farther boxes
+    int order[4];
+    int n = 0;
+    for (int i = 0; i < 4; i++) {
+      if (!(mask & (1 << i))) continue;
+      int k = n++;
+      while (k > 0 && tNear[order[k - 1]] > tNear[i]) {
+        order[k] = order[k - 1];
+        k--;
+      }
+      order[k] = i;
+    }
+
+    for (int k = 0; k < n; k++) {
+      int i = order[k];
+      if (node.count[i] == 0 || tNear[i] > tMax) continue;
+      const Triangle* triangle = &_triangles[node.child[i]];
+      for (int j = 0; j < node.count[i]; j++, triangle++) {
+        float t, u, v;
+        if (!intersectTriangle(origin, ray.direction, triangle->v0,
+            triangle->e1, triangle->e2, ray.tMin, tMax, &t, &u, &v)) {
+          continue;
+        }
+        if (kAnyHit) return true;
+        found = true;
+        tMax = t;
+        hit->t = t;
+        hit->triangle = triangle->id;
+        hit->u = u;
+        hit->v = v;
+      }
+    }
+    for (int k = n - 1; k >= 0; k--) {
+      int i = order[k];
+      if (node.count[i] == 0 && tNear[i] <= tMax) {
+        stack[top++] = node.child[i];
+      }
+    }
+  }
+  return found;
+}
+
+}  // namespace agl
@@ -0,0 +1,121 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_BVH_H_
+#define AGL_BVH_H_
+
+#include <cstdint>
+#include <vector>
+#include "agl/aglm.h"
+
+namespace agl {
+
+/**
+ * @brief A ray segment, origin + t * direction for tMin < t < tMax
+ */
+struct Ray {
+  glm::vec3 origin;
+  glm::vec3 direction;  // need not be normalized; t is in its units
+  float tMin;
+  float tMax;
+};
+
+/**
+ * @brief The closest intersection found by BVH::intersect()
+ */
+struct RayHit {
+  float t;
+  int triangle;  // index of the triangle in indices / 3
+  float u;  // barycentric weight of the triangle's second vertex
+  float v;  // barycentric weight of the triangle's third vertex
+};
+
+/**
+ * @brief Bounding volume hierarchy over a triangle mesh, for ray casting
+ *
+ * build() sorts the triangles into a binary tree with the surface area
+ * heuristic (SAH), then collapses it into a tree with four children per
+ * node. Traversal tests a ray against the four child boxes at once (SSE2)
+ * and visits the nearest first. Leaves hold up to four triangles, which
+ * are tested in both windings.
+ *
+ * ```
+ * BVH bvh;
+ * bvh.build(mesh.positions(), mesh.indices());
+ * Ray ray = {eye, direction, 0.0f, 1000.0f};
+ * RayHit hit;
+ * if (bvh.intersect(ray, &hit)) {
+ *   // hit.triangle, hit.t
+ * }
+ * ```
+ *
+ * Traversal only reads the tree, so any number of threads can cast rays
+ * at the same time.
+ */
+class BVH {
+ public:
+  BVH();
+  virtual ~BVH();
+
+  /**
+   * @brief Build the tree, replacing the previous one
+   * @param positions x, y, z per vertex
+   * @param indices Three vertex indices per triangle
+   */
+  void build(const std::vector<float>& positions,
+      const std::vector<unsigned int>& indices);
+
+  /**
+   * @brief Find the closest triangle along the ray
+   * @return false when nothing is hit, in which case hit is unchanged
+   */
+  bool intersect(const Ray& ray, RayHit* hit) const;
+
+  /**
+   * @brief Return whether any triangle is hit, e.g. for shadow rays
+   *
+   * Faster than intersect(), which has to find the closest hit.
+   */
+  bool occluded(const Ray& ray) const;
+
+  int numTriangles() const { return static_cast<int>(_triangles.size()); }
+  int numNodes() const { return static_cast<int>(_nodes.size()); }
+
+  /**
+   * @brief Return the corners of the box around every triangle
+   */
+  glm::vec3 minBounds() const { return _minBounds; }
+  glm::vec3 maxBounds() const { return _maxBounds; }
+
+ private:
+  // Four child boxes, stored per axis so they load as one SSE register
+  struct Node {
+    float minX[4], minY[4], minZ[4];
+    float maxX[4], maxY[4], maxZ[4];
+    int32_t child[4];  // a node index, or a leaf's first triangle
+    int32_t count[4];  // the triangles in a leaf, or 0 for a node
+    int numChildren;
+  };
+
+  // Precomputed for the Moller-Trumbore test
+  struct Triangle {
+    glm::vec3 v0;
+    glm::vec3 e1;  // v1 - v0
+    glm::vec3 e2;  // v2 - v0
+    int id;
+  };
+
+  struct BuildNode;
+  struct Builder;
+
+  int collapse(const std::vector<BuildNode>& tree, int index);
+  template <bool kAnyHit>
+  bool traverse(const Ray& ray, RayHit* hit) const;
+
+  std::vector<Node> _nodes;
+  std::vector<Triangle> _triangles;  // in the order the leaves use them
+  glm::vec3 _minBounds;
+  glm::vec3 _maxBounds;
+};
+
+}  // namespace agl
+#endif  // AGL_BVH_H_
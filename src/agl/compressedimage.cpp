@@ -0,0 +1,309 @@
+// Copyright 2021, Savvy Sine, alinen
+
+#include "agl/compressedimage.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include "agl/resources.h"
+
+namespace agl {
+
+namespace {
+
+// How each supported format is identified in KTX2 and DDS files
+struct BlockFormat {
+  GLenum format;
+  uint32_t vkFormat;     // KTX2
+  uint32_t dxgiFormat;   // DDS with a DX10 header, 0 if there is none
+  uint8_t colorModel;    // KTX2 data format descriptor
+  bool srgb;
+  int blockSize;
+};
+
+const BlockFormat kFormats[] = {
+  {GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 131, 0, 128, false, 8},
+  {GL_COMPRESSED_SRGB_S3TC_DXT1_EXT, 132, 0, 128, true, 8},
+  {GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 133, 71, 128, false, 8},
+  {GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, 134, 72, 128, true, 8},
+  {GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 137, 77, 130, false, 16},
+  {GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 138, 78, 130, true, 16},
+  {GL_COMPRESSED_RGBA_BPTC_UNORM, 145, 98, 134, false, 16},
+  {GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM, 146, 99, 134, true, 16},
+};
+
+const BlockFormat* findFormat(GLenum format) {
+  for (const BlockFormat& f : kFormats) {
+    if (f.format == format) return &f;
+  }
+  return 0;
+}
+
+const unsigned char kKTX2Id[12] = {
+  0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'
+};
+const size_t kKTX2HeaderSize = 80;  // identifier, header and index
+const size_t kKTX2LevelSize = 24;   // one entry of the level index
+const size_t kDDSHeaderSize = 128;  // magic and DDS_HEADER
+const size_t kDX10HeaderSize = 20;
+
+// Files are little endian, as are all platforms we build for
+uint32_t readU32(const std::string& data, size_t offset) {
+  uint32_t value;
+  memcpy(&value, data.data() + offset, sizeof(value));
+  return value;
+}
+
+uint64_t readU64(const std::string& data, size_t offset) {
+  uint64_t value;
+  memcpy(&value, data.data() + offset, sizeof(value));
+  return value;
+}
+
+void writeU32(std::string* data, size_t offset, uint32_t value) {
+  memcpy(&(*data)[offset], &value, sizeof(value));
+}
+
+void writeU64(std::string* data, size_t offset, uint64_t value) {
+  memcpy(&(*data)[offset], &value, sizeof(value));
+}
+
+size_t levelSize(int width, int height, int blockSize) {
+  size_t blocksX = std::max(1, (width + 3) / 4);
+  size_t blocksY = std::max(1, (height + 3) / 4);
+  return blocksX * blocksY * blockSize;
+}
+
+// Largest width or height accepted from a file
+const uint32_t kMaxDimension = 16384;
+
+// Checks the size and level count of a header before anything is allocated:
+// the levels must fit in dataSize bytes of the file
+bool validHeader(uint32_t width, uint32_t height, uint32_t numLevels,
+    GLenum format, size_t dataSize) {
+  if (width == 0 || height == 0 ||
+      width > kMaxDimension || height > kMaxDimension) {
+    return false;
+  }
+  uint32_t maxLevels = 1;  // floor(log2(max dimension)) + 1
+  for (uint32_t d = std::max(width, height); d > 1; d >>= 1) maxLevels++;
+  if (numLevels < 1 || numLevels > maxLevels) return false;
+
+  size_t total = 0;
+  for (uint32_t i = 0; i < numLevels; i++) {
+    total += levelSize(std::max(1u, width >> i), std::max(1u, height >> i),
+        CompressedImage::blockSize(format));
+  }
+  return total <= dataSize;
+}
+
+}  // namespace
+
+CompressedImage::CompressedImage() : _format(0), _width(0), _height(0) {}
+
+CompressedImage::CompressedImage(GLenum format, int width, int height) :
+  _format(format), _width(width), _height(height) {}
+
+int CompressedImage::blockSize(GLenum format) {
+  const BlockFormat* f = findFormat(format);
+  return f ? f->blockSize : 0;
+}
+
+void CompressedImage::setLevels(int numLevels) {
+  _levels.clear();
+  size_t offset = 0;
+  for (int i = 0; i < numLevels; i++) {
+    Level level;
+    level.width = std::max(1, _width >> i);
+    level.height = std::max(1, _height >> i);
+    level.offset = offset;
+    level.size = levelSize(level.width, level.height, blockSize(_format));
+    offset += level.size;
+    _levels.push_back(level);
+  }
+  _data.assign(offset, 0);
+}
+
+void CompressedImage::addLevel(const unsigned char* blocks, size_t size) {
+  int i = numLevels();
+  Level level;
+  level.width = std::max(1, _width >> i);
+  level.height = std::max(1, _height >> i);
+  level.offset = _data.size();
+  level.size = size;
+  _levels.push_back(level);
+  _data.insert(_data.end(), blocks, blocks + size);
+}
+
+bool CompressedImage::load(const std::string& filename) {
+  _levels.clear();
+  _data.clear();
+
+  std::string contents;
+  if (!readResource(filename, &contents)) return false;
+
+  if (contents.size() >= sizeof(kKTX2Id) &&
+      memcmp(contents.data(), kKTX2Id, sizeof(kKTX2Id)) == 0) {
+    return loadKTX2(contents);
+  }
+  if (contents.compare(0, 4, "DDS ") == 0) {
+    return loadDDS(contents);
+  }
+  return false;
+}
+
+bool CompressedImage::loadKTX2(const std::string& contents) {
+  if (contents.size() < kKTX2HeaderSize) return false;
+
+  uint32_t vkFormat = readU32(contents, 12);
+  uint32_t width = readU32(contents, 20);
+  uint32_t height = readU32(contents, 24);
+  uint32_t depth = readU32(contents, 28);
+  uint32_t layers = readU32(contents, 32);
+  uint32_t faces = readU32(contents, 36);
+  uint32_t numLevels = std::max(1u, readU32(contents, 40));
+  uint32_t supercompression = readU32(contents, 44);
+
+  // Only plain 2D textures, without array layers, faces or supercompression
+  if (depth > 1 || layers > 1 || faces != 1 || supercompression != 0) {
+    return false;
+  }
+
+  _format = 0;
+  for (const BlockFormat& f : kFormats) {
+    if (f.vkFormat == vkFormat) _format = f.format;
+  }
+  if (_format == 0) return false;
+
+  if (!validHeader(width, height, numLevels, _format, contents.size()) ||
+      contents.size() < kKTX2HeaderSize + numLevels * kKTX2LevelSize) {
+    return false;
+  }
+  _width = static_cast<int>(width);
+  _height = static_cast<int>(height);
+  setLevels(numLevels);
+  for (uint32_t i = 0; i < numLevels; i++) {
+    size_t entry = kKTX2HeaderSize + i * kKTX2LevelSize;
+    uint64_t offset = readU64(contents, entry);
+    uint64_t length = readU64(contents, entry + 8);
+    if (length != _levels[i].size || offset > contents.size() ||
+        length > contents.size() - offset) {
+      _levels.clear();
+      return false;
+    }
+    memcpy(&_data[_levels[i].offset], contents.data() + offset, length);
+  }
+  return true;
+}
+
+bool CompressedImage::loadDDS(const std::string& contents) {
+  if (contents.size() < kDDSHeaderSize) return false;
+
+  const uint32_t kMipMapCount = 0x20000;  // DDSD_MIPMAPCOUNT
+  const uint32_t kCubemap = 0x200;        // DDSCAPS2_CUBEMAP
+  uint32_t flags = readU32(contents, 8);
+  uint32_t height = readU32(contents, 12);
+  uint32_t width = readU32(contents, 16);
+  uint32_t numLevels = readU32(contents, 28);
+  std::string fourCC = contents.substr(84, 4);
+  uint32_t caps2 = readU32(contents, 112);
+  if (caps2 & kCubemap) return false;
+  if (!(flags & kMipMapCount) || numLevels == 0) numLevels = 1;
+
+  size_t offset = kDDSHeaderSize;
+  _format = 0;
+  if (fourCC == "DXT1") {
+    _format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+  } else if (fourCC == "DXT5") {
+    _format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+  } else if (fourCC == "DX10") {
+    if (contents.size() < kDDSHeaderSize + kDX10HeaderSize) return false;
+    uint32_t dxgiFormat = readU32(contents, kDDSHeaderSize);
+    uint32_t arraySize = readU32(contents, kDDSHeaderSize + 12);
+    if (arraySize > 1) return false;
+    for (const BlockFormat& f : kFormats) {
+      if (f.dxgiFormat != 0 && f.dxgiFormat == dxgiFormat) _format = f.format;
+    }
+    offset += kDX10HeaderSize;
+  }
+  if (_format == 0) return false;
+
+  // Levels follow the header, largest first
+  if (contents.size() < offset || !validHeader(width, height, numLevels,
+        _format, contents.size() - offset)) {
+    return false;
+  }
+  _width = static_cast<int>(width);
+  _height = static_cast<int>(height);
+  setLevels(numLevels);
+  memcpy(_data.data(), contents.data() + offset, _data.size());
+  return true;
+}
+
+bool CompressedImage::save(const std::string& filename) const {
+  const BlockFormat* f = findFormat(_format);
+  if (f == 0 || _levels.empty()) return false;
+
+  // Data format descriptor: one block, with a sample per compressed channel
+  bool bc3 = f->colorModel == 130;
+  uint32_t numSamples = bc3 ? 2 : 1;
+  uint32_t blockBytes = 24 + 16 * numSamples;
+  uint32_t dfdSize = 4 + blockBytes;
+
+  size_t dfdOffset = kKTX2HeaderSize + _levels.size() * kKTX2LevelSize;
+  std::string file(dfdOffset + dfdSize, '\0');
+
+  memcpy(&file[0], kKTX2Id, sizeof(kKTX2Id));
+  writeU32(&file, 12, f->vkFormat);
+  writeU32(&file, 16, 1);  // typeSize
+  writeU32(&file, 20, _width);
+  writeU32(&file, 24, _height);
+  writeU32(&file, 36, 1);  // faceCount
+  writeU32(&file, 40, static_cast<uint32_t>(_levels.size()));
+  writeU32(&file, 48, static_cast<uint32_t>(dfdOffset));
+  writeU32(&file, 52, dfdSize);
+
+  size_t d = dfdOffset;
+  writeU32(&file, d, dfdSize);
+  writeU32(&file, d + 4, 0);  // Khronos basic descriptor
+  writeU32(&file, d + 8, 2 | (blockBytes << 16));  // version 2
+  file[d + 12] = static_cast<char>(f->colorModel);
+  file[d + 13] = 1;                  // BT.709 primaries
+  file[d + 14] = f->srgb ? 2 : 1;    // sRGB or linear transfer
+  file[d + 16] = 3;                  // 4x4 texel blocks
+  file[d + 17] = 3;
+  file[d + 20] = static_cast<char>(f->blockSize);
+  for (uint32_t s = 0; s < numSamples; s++) {
+    size_t sample = d + 28 + 16 * s;
+    // BC3 stores alpha (channel 15) in the first 64 bits; otherwise one
+    // sample covers the block, with channel 1 marking BC1 with alpha
+    uint16_t bitOffset = (bc3 && s == 1) ? 64 : 0;
+    uint8_t bitLength = (bc3 || f->blockSize == 8) ? 63 : 127;
+    uint8_t channel = (bc3 && s == 0) ? 15 :
+        (f->vkFormat == 133 || f->vkFormat == 134) ? 1 : 0;
+    memcpy(&file[sample], &bitOffset, sizeof(bitOffset));
+    file[sample + 2] = static_cast<char>(bitLength);
+    file[sample + 3] = static_cast<char>(channel);
+    writeU32(&file, sample + 12, 0xFFFFFFFF);  // sampleUpper
+  }
+
+  // Levels are stored smallest first, each aligned to a block
+  for (int i = numLevels() - 1; i >= 0; i--) {
+    size_t offset = file.size();
+    offset += (f->blockSize - offset % f->blockSize) % f->blockSize;
+    file.resize(offset, '\0');
+    file.append(reinterpret_cast<const char*>(data(i)), _levels[i].size);
+
+    size_t entry = kKTX2HeaderSize + i * kKTX2LevelSize;
+    writeU64(&file, entry, offset);
+    writeU64(&file, entry + 8, _levels[i].size);
+    writeU64(&file, entry + 16, _levels[i].size);
+  }
+
+  std::ofstream out(filename, std::ios::out | std::ios::binary);
+  if (!out) return false;
+  out.write(file.data(), file.size());
+  return static_cast<bool>(out);
+}
+
+}  // namespace agl
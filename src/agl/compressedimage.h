@@ -0,0 +1,125 @@
+// Copyright 2021, Savvy Sine, alinen
+
+#ifndef AGL_COMPRESSEDIMAGE_H_
+#define AGL_COMPRESSEDIMAGE_H_
+
+#include <string>
+#include <vector>
+#include "agl/agl.h"
+
+// The formats CompressedImage supports, which the macOS core profile
+// headers do not declare
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#endif
+
+namespace agl {
+
+/**
+ * @brief Block-compressed texture data (BC1, BC3 or BC7) with its mip levels
+ *
+ * Compressed textures are uploaded to the GPU as they are stored, so they
+ * use 4x (BC3, BC7) to 8x (BC1) less memory and bandwidth than RGBA8.
+ * Files are usually produced offline with the tex-compress tool. Rows are
+ * stored top to bottom, as in Image.
+ *
+ * @see Renderer::loadTexture
+ */
+class CompressedImage {
+ public:
+  /**
+   * @brief A mip level: its size in pixels and where its blocks are stored
+   */
+  struct Level {
+    int width;
+    int height;
+    size_t offset;  // into the block data, in bytes
+    size_t size;    // in bytes
+  };
+
+  CompressedImage();
+
+  /**
+   * @brief Create an empty image of the given format and size
+   * @param format A GL compressed format, e.g. GL_COMPRESSED_RGBA_BPTC_UNORM
+   *
+   * Add the levels, largest first, with addLevel().
+   */
+  CompressedImage(GLenum format, int width, int height);
+
+  /**
+   * @brief Load a .ktx2 or .dds file
+   * @return false if the file cannot be read or its format is not BCn
+   *
+   * KTX2 files must not use supercompression. Files are found with
+   * readResource(), so they can be embedded in the executable.
+   */
+  bool load(const std::string& filename);
+
+  /**
+   * @brief Save as a .ktx2 file
+   */
+  bool save(const std::string& filename) const;
+
+  /**
+   * @brief Append the blocks of the next mip level
+   */
+  void addLevel(const unsigned char* blocks, size_t size);
+
+  /** @brief Return the GL compressed internal format
+   */
+  GLenum format() const { return _format; }
+
+  /** @brief Return the width in pixels of the first level
+   */
+  int width() const { return _width; }
+
+  /** @brief Return the height in pixels of the first level
+   */
+  int height() const { return _height; }
+
+  /** @brief Return the number of mip levels
+   */
+  int numLevels() const { return static_cast<int>(_levels.size()); }
+
+  /** @brief Return the given mip level (0 is the largest)
+   */
+  const Level& level(int i) const { return _levels[i]; }
+
+  /** @brief Return the blocks of the given mip level
+   */
+  const unsigned char* data(int i) const {
+    return _data.data() + _levels[i].offset;
+  }
+
+  /**
+   * @brief Return the number of bytes in a 4x4 block of the given format
+   * @return 8 or 16, or 0 if the format is not a supported BCn format
+   */
+  static int blockSize(GLenum format);
+
+ private:
+  bool loadKTX2(const std::string& contents);
+  bool loadDDS(const std::string& contents);
+  void setLevels(int numLevels);
+
+  GLenum _format;
+  int _width;
+  int _height;
+  std::vector<Level> _levels;
+  std::vector<unsigned char> _data;
+};
+
+}  // namespace agl
+#endif  // AGL_COMPRESSEDIMAGE_H_
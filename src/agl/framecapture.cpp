@@ -0,0 +1,293 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/framecapture.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include "agl/imagecodec.h"
+#include "agl/threadpool.h"
+
+namespace agl {
+
+// Encoded frames waiting per thread before endFrame() waits for them
+static const int kQueuedPerThread = 2;
+
+// Append one frame to a .y4m stream as 4:2:0 BT.601 (studio range)
+// The image holds rows bottom to top, as read from GL
+static bool writeY4MFrame(FILE* file, const Image& image) {
+  int w = image.width();
+  int h = image.height();
+  int cw = (w + 1) / 2;
+  int ch = (h + 1) / 2;
+  std::vector<unsigned char> yuv(w * h + 2 * cw * ch);
+  unsigned char* Y = &yuv[0];
+  unsigned char* U = Y + w * h;
+  unsigned char* V = U + cw * ch;
+
+  const unsigned char* pixels = image.data();
+  for (int y = 0; y < h; y++) {
+    const unsigned char* src = pixels + (h - 1 - y) * w * 4;
+    unsigned char* dst = Y + y * w;
+    for (int x = 0; x < w; x++, src += 4) {
+      dst[x] = static_cast<unsigned char>(
+          ((66 * src[0] + 129 * src[1] + 25 * src[2] + 128) >> 8) + 16);
+    }
+  }
+
+  // chroma from the average of each 2x2 block (clamped at odd edges)
+  for (int y = 0; y < ch; y++) {
+    int y0 = h - 1 - 2 * y;
+    int y1 = std::max(y0 - 1, 0);
+    const unsigned char* row0 = pixels + y0 * w * 4;
+    const unsigned char* row1 = pixels + y1 * w * 4;
+    for (int x = 0; x < cw; x++) {
+      int x0 = 2 * x * 4;
+      int x1 = std::min(2 * x + 1, w - 1) * 4;
+      int rgb[3];
+      for (int c = 0; c < 3; c++) {
+        rgb[c] = (row0[x0 + c] + row0[x1 + c] +
+            row1[x0 + c] + row1[x1 + c] + 2) >> 2;
+      }
+      U[y * cw + x] = static_cast<unsigned char>(
+          ((-38 * rgb[0] - 74 * rgb[1] + 112 * rgb[2] + 128) >> 8) + 128);
+      V[y * cw + x] = static_cast<unsigned char>(
+          ((112 * rgb[0] - 94 * rgb[1] - 18 * rgb[2] + 128) >> 8) + 128);
+    }
+  }
+
+  fputs("FRAME\n", file);
+  return fwrite(&yuv[0], 1, yuv.size(), file) == yuv.size();
+}
+
+FrameCapture::FrameCapture(int numBuffers, int numEncoders) :
+  _next(0),
+  _oldest(0),
+  _inFlight(0),
+  _recordMode(NONE),
+  _recordedFrames(0),
+  _video(0),
+  _videoWidth(0),
+  _videoHeight(0),
+  _videoFps(30),
+  _encoders(new ThreadPool(numEncoders)),
+  _videoWriter(0),
+  _failures(0) {
+  _ring.resize(std::max(numBuffers, 1));
+  for (Readback& readback : _ring) {
+    glGenBuffers(1, &readback.pbo);
+    readback.size = 0;
+    readback.fence = 0;
+    readback.width = readback.height = 0;
+  }
+}
+
+FrameCapture::~FrameCapture() {
+  stop();
+  delete _encoders;
+  delete _videoWriter;
+  for (Readback& readback : _ring) {
+    glDeleteBuffers(1, &readback.pbo);
+  }
+}
+
+void FrameCapture::save(const std::string& filename) {
+  _requested.push_back(filename);
+}
+
+bool FrameCapture::record(const std::string& filename, int fps) {
+  stop();
+
+  std::string ext = filename.substr(filename.find_last_of('.') + 1);
+  if (ext == "y4m") {
+    _video = fopen(filename.c_str(), "wb");
+    if (!_video) {
+      std::cout << "WARNING: cannot open " << filename << std::endl;
+      return false;
+    }
+    _videoFps = fps;  // the header is written with the first frame
+    if (!_videoWriter) _videoWriter = new ThreadPool(1);
+    _recordMode = Y4M;
+
+  } else {
+    if (filename.find('%') == std::string::npos) {
+      std::cout << "WARNING: " << filename <<
+        " needs a frame number, e.g. frame%04d.png" << std::endl;
+      return false;
+    }
+    _pattern = filename;
+    _recordMode = PNG;
+  }
+
+  _recordedFrames = 0;
+  _videoWidth = _videoHeight = 0;
+  return true;
+}
+
+void FrameCapture::stop() {
+  finish();
+  closeVideo();
+  _recordMode = NONE;
+}
+
+void FrameCapture::endFrame() {
+  if (_recordMode == PNG) {
+    std::vector<char> name(_pattern.size() + 32);
+    snprintf(&name[0], name.size(), _pattern.c_str(), _recordedFrames);
+    read(&name[0]);
+    _recordedFrames++;
+  } else if (_recordMode == Y4M) {
+    read("");
+    _recordedFrames++;
+  }
+
+  for (const std::string& filename : _requested) {
+    read(filename);
+  }
+  _requested.clear();
+
+  // hand over every read the GPU has finished, oldest first so that
+  // video frames stay in order
+  while (_inFlight > 0) {
+    GLenum status = glClientWaitSync(_ring[_oldest].fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) break;
+    collect(_ring[_oldest]);
+  }
+}
+
+bool FrameCapture::finish() {
+  while (_inFlight > 0) {
+    collect(_ring[_oldest]);
+  }
+  for (std::future<void>& job : _encoding) job.wait();
+  for (std::future<void>& job : _writing) job.wait();
+  _encoding.clear();
+  _writing.clear();
+  return _failures.exchange(0) == 0;
+}
+
+void FrameCapture::read(const std::string& filename) {
+  if (_inFlight == static_cast<int>(_ring.size())) {
+    collect(_ring[_oldest]);  // all buffers busy: wait for the oldest
+  }
+
+  GLint viewport[4];
+  glGetIntegerv(GL_VIEWPORT, viewport);
+
+  Readback& readback = _ring[_next];
+  readback.width = viewport[2];
+  readback.height = viewport[3];
+  readback.filename = filename;
+
+  GLsizeiptr size = readback.width * readback.height * 4;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+  if (readback.size < size) {
+    glBufferData(GL_PIXEL_PACK_BUFFER, size, 0, GL_STREAM_READ);
+    readback.size = size;
+  }
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(viewport[0], viewport[1], readback.width, readback.height,
+      GL_RGBA, GL_UNSIGNED_BYTE, 0);  // into the buffer, returns at once
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  _next = (_next + 1) % _ring.size();
+  _inFlight++;
+}
+
+void FrameCapture::collect(Readback& readback) {
+  GLenum status = glClientWaitSync(readback.fence, 0, 0);
+  while (status == GL_TIMEOUT_EXPIRED) {
+    status = glClientWaitSync(readback.fence,
+        GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);  // 1 ms
+  }
+  glDeleteSync(readback.fence);
+  readback.fence = 0;
+
+  GLsizeiptr size = readback.width * readback.height * 4;
+  Image image(readback.width, readback.height);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo);
+  void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size,
+      GL_MAP_READ_BIT);
+  if (pixels) {
+    memcpy(image.data(), pixels, size);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  _oldest = (_oldest + 1) % _ring.size();
+  _inFlight--;
+
+  if (!pixels) {
+    std::cout << "WARNING: cannot map captured frame" << std::endl;
+    _failures++;
+    return;
+  }
+  encode(std::move(image), readback.filename);
+}
+
+void FrameCapture::encode(Image&& image, const std::string& filename) {
+  std::shared_ptr<Image> frame = std::make_shared<Image>(std::move(image));
+
+  if (!filename.empty()) {
+    throttle(&_encoding);
+    ThreadPool* pool = _encoders;
+    std::atomic<int>* failures = &_failures;
+    _encoding.push_back(_encoders->run([frame, filename, pool, failures]() {
+      // rows are bottom to top; large frames are split over the pool
+      if (!writeImage(filename, *frame, true, pool)) {
+        std::cout << "WARNING: cannot save " << filename << std::endl;
+        (*failures)++;
+      }
+    }));
+    return;
+  }
+
+  if (!_video) return;  // recording was stopped
+  std::string header;
+  if (_videoWidth == 0) {
+    _videoWidth = frame->width();
+    _videoHeight = frame->height();
+    header = "YUV4MPEG2 W" + std::to_string(_videoWidth) +
+      " H" + std::to_string(_videoHeight) +
+      " F" + std::to_string(_videoFps) + ":1 Ip A1:1 C420jpeg\n";
+  } else if (frame->width() != _videoWidth ||
+      frame->height() != _videoHeight) {
+    std::cout << "WARNING: frame size changed while recording, "
+      "frame skipped" << std::endl;
+    _failures++;
+    return;
+  }
+
+  throttle(&_writing);
+  FILE* file = _video;
+  std::atomic<int>* failures = &_failures;
+  _writing.push_back(_videoWriter->run([frame, file, header, failures]() {
+    if (!header.empty()) fputs(header.c_str(), file);
+    if (!writeY4MFrame(file, *frame)) {
+      std::cout << "WARNING: cannot write video frame" << std::endl;
+      (*failures)++;
+    }
+  }));
+}
+
+void FrameCapture::throttle(std::deque<std::future<void>>* jobs) {
+  ThreadPool* pool = (jobs == &_encoding) ? _encoders : _videoWriter;
+  size_t limit = kQueuedPerThread * pool->size();
+  while (!jobs->empty() && (jobs->size() >= limit ||
+      jobs->front().wait_for(std::chrono::seconds(0)) ==
+        std::future_status::ready)) {
+    jobs->front().wait();
+    jobs->pop_front();
+  }
+}
+
+void FrameCapture::closeVideo() {
+  if (!_video) return;
+  for (std::future<void>& job : _writing) job.wait();
+  _writing.clear();
+  fclose(_video);
+  _video = 0;
+}
+
+}  // namespace agl
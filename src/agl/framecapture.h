@@ -0,0 +1,153 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_FRAMECAPTURE_H_
+#define AGL_FRAMECAPTURE_H_
+
+#include <atomic>
+#include <cstdio>
+#include <deque>
+#include <future>
+#include <string>
+#include <vector>
+#include "agl/agl.h"
+#include "agl/image.h"
+
+namespace agl {
+
+class ThreadPool;
+
+/**
+ * @brief Saves frames without stalling the render loop
+ *
+ * Frames are read into a ring of pixel pack buffers. glReadPixels returns
+ * immediately and the copy happens on the GPU; a later endFrame() maps the
+ * buffer once its fence has signaled (usually a frame or two later) and
+ * hands the pixels to background threads, which encode PNGs (or QOI
+ * files, by extension) with writeImage() or append to a Y4M video. The
+ * render thread only waits if every buffer is still in flight, or if the
+ * encoders fall more than a few frames behind.
+ *
+ * ```
+ * FrameCapture capture;
+ * capture.save("shot.png");       // single frame
+ * capture.record("orbit.y4m");    // or "frames/frame%04d.png"
+ * // in the render loop, after drawing and before swapping buffers
+ * capture.endFrame();
+ * // ...
+ * capture.stop();
+ * ```
+ *
+ * Requires a current GL context; all calls must come from its thread.
+ */
+class FrameCapture {
+ public:
+  /**
+   * @brief Create the capture ring
+   * @param numBuffers The number of frames that can be in flight on the GPU
+   * @param numEncoders The number of PNG encoding threads, or 0 for one
+   * per core
+   */
+  explicit FrameCapture(int numBuffers = 3, int numEncoders = 0);
+
+  /**
+   * @brief Finish all queued frames and release the buffers
+   */
+  virtual ~FrameCapture();
+
+  /**
+   * @brief Save the current frame to a .png file at the next endFrame()
+   */
+  void save(const std::string& filename);
+
+  /**
+   * @brief Start capturing every frame
+   * @param filename Either a .y4m file, which is written as a raw 4:2:0
+   * video stream, or a printf pattern for numbered .png or .qoi files,
+   * such as "frame%04d.png"
+   * @param fps The frame rate stored in the .y4m header
+   * @return false if the file cannot be opened or the pattern has no number
+   *
+   * Every frame passed to endFrame() is kept, so the result plays back
+   * smoothly even if the window ran slower than fps while recording.
+   */
+  bool record(const std::string& filename, int fps = 30);
+
+  /**
+   * @brief Stop recording and wait until the recorded frames are written
+   */
+  void stop();
+
+  /**
+   * @brief Return true between record() and stop()
+   */
+  bool recording() const { return _recordMode != NONE; }
+
+  /**
+   * @brief Return the number of frames captured since record()
+   */
+  int recordedFrames() const { return _recordedFrames; }
+
+  /**
+   * @brief Read the viewport if a frame was requested and hand finished
+   * reads to the encoders
+   *
+   * Call once per frame after drawing and before swapping buffers.
+   */
+  void endFrame();
+
+  /**
+   * @brief Wait until every requested frame has been written
+   * @return false if a frame since the last finish() could not be read
+   * back or written
+   */
+  bool finish();
+
+  /**
+   * @brief Return the threads that encode captured frames
+   */
+  ThreadPool* encoders() const { return _encoders; }
+
+ private:
+  enum RecordMode { NONE, PNG, Y4M };
+
+  struct Readback {
+    GLuint pbo;
+    GLsizeiptr size;  // allocated bytes
+    GLsync fence;     // 0 when the buffer is free
+    int width;
+    int height;
+    std::string filename;  // empty for video frames
+  };
+
+  void read(const std::string& filename);
+  void collect(Readback& readback);
+  void encode(Image&& image, const std::string& filename);
+  void throttle(std::deque<std::future<void>>* jobs);
+  void closeVideo();
+
+  std::vector<Readback> _ring;
+  int _next;     // the next buffer to read into
+  int _oldest;   // the oldest buffer in flight
+  int _inFlight;
+  std::vector<std::string> _requested;
+
+  RecordMode _recordMode;
+  std::string _pattern;  // for numbered image files
+  int _recordedFrames;
+  FILE* _video;
+  int _videoWidth;
+  int _videoHeight;
+  int _videoFps;
+
+  ThreadPool* _encoders;
+  ThreadPool* _videoWriter;  // a single thread keeps frames in order
+  std::deque<std::future<void>> _encoding;
+  std::deque<std::future<void>> _writing;
+  std::atomic<int> _failures;  // frames lost since the last finish()
+
+  FrameCapture(const FrameCapture&) = delete;
+  FrameCapture& operator=(const FrameCapture&) = delete;
+};
+
+}  // namespace agl
+#endif  // AGL_FRAMECAPTURE_H_
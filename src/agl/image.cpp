@@ -2,34 +2,65 @@
 
 #include "agl/image.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "agl/imagecodec.h"
+#include "agl/resources.h"
+#include "agl/simd.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb/stb_image_write.h"
 #define STB_IMAGE_IMPLEMENTATION
+// Images are decoded on several threads; stb's failure string is a global
+#define STBI_NO_FAILURE_STRINGS
 #include "stb/stb_image.h"
 
 namespace agl {
 using glm::vec3;
 using glm::vec4;
 
+namespace {
+
+// Rec. 601 luma, for storing colors in gray images
+unsigned char luma(const Pixel& color) {
+  return static_cast<unsigned char>(
+      (77 * color.r + 150 * color.g + 29 * color.b + 128) >> 8);
+}
+
+// Exact round(c * a / 255) for c, a in [0, 255]
+inline unsigned char mul255(int c, int a) {
+  int t = c * a + 128;
+  return static_cast<unsigned char>((t + (t >> 8)) >> 8);
+}
+
+}  // namespace
+
 Image::Image() :
   myData(0),
   myWidth(0),
   myHeight(0),
-  myLoaded(false) {
+  myChannels(4),
+  myStorage(NEW_ARRAY) {
 }
 
-Image::Image(int width, int height) :
-  myWidth(width), myHeight(height), myLoaded(false) {
-  myData = new unsigned char[4*width*height];
+Image::Image(int width, int height, int channels) :
+  myWidth(width), myHeight(height), myChannels(channels),
+  myStorage(NEW_ARRAY) {
+  assert(channels >= 1 && channels <= 4);
+  myData = new unsigned char[channels * width * height];
 }
 
-Image::Image(const Image& orig) {
-  myWidth = orig.myWidth;
-  myHeight = orig.myHeight;
-  myLoaded = false;
-  myData = new unsigned char[4 * myWidth * myHeight];
-  memcpy(myData, orig.myData, sizeof(unsigned char) * myWidth * myHeight * 4);
+Image::Image(int width, int height, int channels, unsigned char* data) :
+  myData(data), myWidth(width), myHeight(height), myChannels(channels),
+  myStorage(VIEW) {
+  assert(channels >= 1 && channels <= 4);
+}
+
+Image::Image(const Image& orig) : myData(0), myStorage(NEW_ARRAY) {
+  set(orig.myWidth, orig.myHeight, orig.myData, orig.myChannels);
 }
 
 Image& Image::operator=(const Image& orig) {
@@ -37,13 +68,37 @@ Image& Image::operator=(const Image& orig) {
     return *this;
   }
 
-  clear();
+  set(orig.myWidth, orig.myHeight, orig.myData, orig.myChannels);
+  return *this;
+}
+
+Image::Image(Image&& orig) noexcept :
+  myData(orig.myData),
+  myWidth(orig.myWidth),
+  myHeight(orig.myHeight),
+  myChannels(orig.myChannels),
+  myStorage(orig.myStorage) {
+  orig.myData = 0;
+  orig.myWidth = 0;
+  orig.myHeight = 0;
+  orig.myStorage = NEW_ARRAY;
+}
+
+Image& Image::operator=(Image&& orig) noexcept {
+  if (&orig == this) {
+    return *this;
+  }
 
+  clear();
+  myData = orig.myData;
   myWidth = orig.myWidth;
   myHeight = orig.myHeight;
-  myLoaded = false;
-  myData = new unsigned char[4 * myWidth * myHeight];
-  memcpy(myData, orig.myData, sizeof(unsigned char) * myWidth * myHeight * 4);
+  myChannels = orig.myChannels;
+  myStorage = orig.myStorage;
+  orig.myData = 0;
+  orig.myWidth = 0;
+  orig.myHeight = 0;
+  orig.myStorage = NEW_ARRAY;
   return *this;
 }
 
@@ -51,43 +106,88 @@ Image::~Image() {
   clear();
 }
 
-void Image::set(int width, int height, unsigned char* data) {
-  clear();
+void Image::set(int width, int height, unsigned char* data, int channels) {
+  assert(channels >= 1 && channels <= 4);
+  size_t size = static_cast<size_t>(width) * height * channels;
+  unsigned char* copy = new unsigned char[size];
+  if (data) memcpy(copy, data, size);
 
+  // data may point into this image, so it is freed after copying
+  clear();
+  myData = copy;
   myWidth = width;
   myHeight = height;
-  myLoaded = false;
-  myData = new unsigned char[4 * myWidth * myHeight];
-  memcpy(myData, data, sizeof(unsigned char) * myWidth * myHeight * 4);
+  myChannels = channels;
+  myStorage = NEW_ARRAY;
 }
 
 void Image::clear() {
-  if (myLoaded) {
+  if (myStorage == STB) {
     stbi_image_free(myData);
-    myData = 0;
-    myLoaded = false;
-  } else {
+  } else if (myStorage == NEW_ARRAY) {
     delete[] myData;
   }
+  myData = 0;
+  myStorage = NEW_ARRAY;
 }
 
-bool Image::load(const std::string& filename, bool flip) {
+bool Image::load(const std::string& filename, bool flip, int channels) {
   clear();
-  stbi_set_flip_vertically_on_load(flip);
 
+  std::string ext = filename.substr(filename.find_last_of('.') + 1);
+  if (ext == "qoi") {
+    std::string contents;
+    Image decoded;
+    bool gray = channels == 1 || channels == 2;
+    if (!readResource(filename, &contents) || !decodeQOI(
+        reinterpret_cast<const unsigned char*>(contents.data()),
+        contents.size(), &decoded, gray ? 4 : channels)) {
+      myWidth = myHeight = 0;
+      return false;
+    }
+    if (gray) {
+      *this = Image(decoded.width(), decoded.height(), channels);
+      for (int row = 0; row < myHeight; row++) {
+        for (int col = 0; col < myWidth; col++) {
+          set(row, col, decoded.get(row, col));
+        }
+      }
+    } else {
+      *this = std::move(decoded);
+    }
+    if (flip) flipRows();
+    return true;
+  }
+
+  // stb's flip setting is global, so images may be loaded on several
+  // threads at once only if it is never changed. Flip here instead.
   int x, y, n;
-  myData = stbi_load(filename.c_str(), &x, &y, &n, 4);
+  const EmbeddedResource* resource = findEmbeddedResource(filename);
+  if (resource) {
+    myData = stbi_load_from_memory(resource->data,
+        static_cast<int>(resource->size), &x, &y, &n, channels);
+  } else {
+    myData = stbi_load(resourcePath(filename).c_str(), &x, &y, &n, channels);
+  }
+  if (!myData) {
+    myWidth = myHeight = 0;
+    return false;
+  }
   myWidth = x;
   myHeight = y;
-  myLoaded = true;
-  return (myData != NULL);
+  myChannels = channels == 0 ? n : channels;
+  myStorage = STB;
+  if (flip) flipRows();
+  return true;
 }
 
-
 bool Image::save(const std::string& filename, bool flip) const {
+  std::string ext = filename.substr(filename.find_last_of('.') + 1);
+  if (ext == "qoi") return writeImage(filename, *this, flip);
+
   stbi_flip_vertically_on_write(flip);
   int result = stbi_write_png(filename.c_str(), myWidth, myHeight,
-    4, (unsigned char*) myData, myWidth*4);
+    myChannels, myData, myWidth * myChannels);
   return (result == 1);
 }
 
@@ -95,46 +195,276 @@ Pixel Image::get(int row, int col) const {
   assert(row >= 0 && row < myHeight);
   assert(col >= 0 && col < myWidth);
 
-  int idx = (row*myWidth + col) * 4;
-  unsigned char r = myData[idx + 0];
-  unsigned char g = myData[idx + 1];
-  unsigned char b = myData[idx + 2];
-  unsigned char a = myData[idx + 3];
-  return Pixel{r, g, b, a};
+  const unsigned char* p = myData + (row * myWidth + col) * myChannels;
+  switch (myChannels) {
+    case 1: return Pixel{p[0], p[0], p[0], 255};
+    case 2: return Pixel{p[0], p[0], p[0], p[1]};
+    case 3: return Pixel{p[0], p[1], p[2], 255};
+  }
+  return Pixel{p[0], p[1], p[2], p[3]};
 }
 
 void Image::set(int row, int col, const Pixel& color) {
   assert(row >= 0 && row < myHeight);
   assert(col >= 0 && col < myWidth);
 
-  int idx = (row*myWidth + col) * 4;
-  myData[idx + 0] = color.r;
-  myData[idx + 1] = color.g;
-  myData[idx + 2] = color.b;
-  myData[idx + 3] = color.a;
+  unsigned char* p = myData + (row * myWidth + col) * myChannels;
+  switch (myChannels) {
+    case 1:
+      p[0] = luma(color);
+      break;
+    case 2:
+      p[0] = luma(color);
+      p[1] = color.a;
+      break;
+    default:
+      p[0] = color.r;
+      p[1] = color.g;
+      p[2] = color.b;
+      if (myChannels == 4) p[3] = color.a;
+  }
 }
 
 vec4 Image::getVec4(int i, int j) const {
-  assert(i >= 0 && i < myHeight);
-  assert(j >= 0 && j < myWidth);
+  Pixel p = get(i, j);
+  return glm::vec4(p.r, p.g, p.b, p.a) / 255.0f;
+}
+
+vec4 Image::sample(const glm::vec2& st) const {
+  if (myWidth == 0 || myHeight == 0) return vec4(1.0f);
+  int w = myWidth;
+  int h = myHeight;
+  float x = (st.x - std::floor(st.x)) * w - 0.5f;
+  float y = (st.y - std::floor(st.y)) * h - 0.5f;
+  float fx = std::floor(x);
+  float fy = std::floor(y);
+  float tx = x - fx;
+  float ty = y - fy;
+  int x0 = (static_cast<int>(fx) + w) % w;
+  int y0 = (static_cast<int>(fy) + h) % h;
+  int x1 = (x0 + 1) % w;
+  int y1 = (y0 + 1) % h;
 
-  unsigned int idx = (i * myWidth + j) * 4;
-  unsigned char r = myData[idx + 0];
-  unsigned char g = myData[idx + 1];
-  unsigned char b = myData[idx + 2];
-  unsigned char a = myData[idx + 3];
-  return glm::vec4(r, g, b, a) / 255.0f;
+  const unsigned char* data = myData;
+  int channels = myChannels;
+  auto texel = [data, w, channels](int px, int py) {
+    const unsigned char* p = data + (py * w + px) * channels;
+    switch (channels) {
+      case 1: return vec4(p[0], p[0], p[0], 255);
+      case 2: return vec4(p[0], p[0], p[0], p[1]);
+      case 3: return vec4(p[0], p[1], p[2], 255);
+      default: return vec4(p[0], p[1], p[2], p[3]);
+    }
+  };
+  vec4 top = glm::mix(texel(x0, y0), texel(x1, y0), tx);
+  vec4 bottom = glm::mix(texel(x0, y1), texel(x1, y1), tx);
+  return glm::mix(top, bottom, ty) / 255.0f;
 }
 
 void Image::setVec4(int i, int j, const vec4 & c) {
-  assert(i >= 0 && i < myHeight);
-  assert(j >= 0 && j < myWidth);
-
-  int idx = (i * myWidth + j) * 4;
-  myData[idx + 0] = (unsigned char) (c[0] * 255.999);
-  myData[idx + 1] = (unsigned char) (c[1] * 255.999);
-  myData[idx + 2] = (unsigned char) (c[2] * 255.999);
-  myData[idx + 3] = (unsigned char) (c[3] * 255.999);
+  set(i, j, Pixel{
+      (unsigned char) (c[0] * 255.999),
+      (unsigned char) (c[1] * 255.999),
+      (unsigned char) (c[2] * 255.999),
+      (unsigned char) (c[3] * 255.999)});
+}
+
+void Image::toFloat(float* values) const {
+  size_t size = static_cast<size_t>(myWidth) * myHeight * myChannels;
+  const float scale = 1.0f / 255.0f;
+  size_t i = 0;
+#ifdef AGL_HAS_SSE2
+  const __m128 scale4 = _mm_set1_ps(scale);
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= size; i += 16) {
+    __m128i bytes = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(myData + i));
+    __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+    __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+    __m128i ints[4] = {
+      _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+      _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)};
+    for (int k = 0; k < 4; k++) {
+      _mm_storeu_ps(values + i + 4 * k,
+          _mm_mul_ps(_mm_cvtepi32_ps(ints[k]), scale4));
+    }
+  }
+#endif
+  for (; i < size; i++) {
+    values[i] = myData[i] * scale;
+  }
+}
+
+std::vector<float> Image::toFloat() const {
+  std::vector<float> values(static_cast<size_t>(myWidth) * myHeight *
+      myChannels);
+  toFloat(values.data());
+  return values;
+}
+
+void Image::flipRows() {
+  size_t rowSize = static_cast<size_t>(myWidth) * myChannels;
+  std::vector<unsigned char> row(rowSize);
+  for (int i = 0; i < myHeight / 2; i++) {
+    unsigned char* top = myData + i * rowSize;
+    unsigned char* bottom = myData + (myHeight - 1 - i) * rowSize;
+    memcpy(row.data(), top, rowSize);
+    memcpy(top, bottom, rowSize);
+    memcpy(bottom, row.data(), rowSize);
+  }
+}
+
+void Image::premultiply() {
+  if (myChannels == 1 || myChannels == 3) return;
+
+  size_t numPixels = static_cast<size_t>(myWidth) * myHeight;
+  if (myChannels == 2) {
+    for (size_t i = 0; i < numPixels; i++) {
+      myData[2 * i] = mul255(myData[2 * i], myData[2 * i + 1]);
+    }
+    return;
+  }
+
+  size_t i = 0;
+#ifdef AGL_HAS_SSE2
+  // four pixels at a time, widened to two pixels per register
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i half = _mm_set1_epi16(128);
+  const __m128i alphaMask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+  for (; i + 4 <= numPixels; i += 4) {
+    __m128i* p = reinterpret_cast<__m128i*>(myData + 4 * i);
+    __m128i bytes = _mm_loadu_si128(p);
+    __m128i halves[2] = {
+      _mm_unpacklo_epi8(bytes, zero), _mm_unpackhi_epi8(bytes, zero)};
+    for (__m128i& c : halves) {
+      __m128i a = _mm_shufflehi_epi16(
+          _mm_shufflelo_epi16(c, _MM_SHUFFLE(3, 3, 3, 3)),
+          _MM_SHUFFLE(3, 3, 3, 3));
+      __m128i t = _mm_add_epi16(_mm_mullo_epi16(c, a), half);
+      t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+      c = _mm_or_si128(_mm_andnot_si128(alphaMask, t),
+          _mm_and_si128(alphaMask, c));
+    }
+    _mm_storeu_si128(p, _mm_packus_epi16(halves[0], halves[1]));
+  }
+#endif
+  for (; i < numPixels; i++) {
+    unsigned char* p = myData + 4 * i;
+    for (int c = 0; c < 3; c++) p[c] = mul255(p[c], p[3]);
+  }
+}
+
+Image Image::resize(int width, int height) const {
+  Image result(width, height, myChannels);
+  int channels = myChannels;
+  size_t rowSize = static_cast<size_t>(myWidth) * channels;
+
+  // Bilinear weights in 1/256ths, sampling at pixel centers clamped to the
+  // edges. Columns are precomputed since every row uses them.
+  std::vector<int> x0(width), x1(width), wx(width);
+  for (int x = 0; x < width; x++) {
+    float sx = std::max(0.0f, (x + 0.5f) * myWidth / width - 0.5f);
+    int i = std::min(static_cast<int>(sx), myWidth - 1);
+    x0[x] = i * channels;
+    x1[x] = std::min(i + 1, myWidth - 1) * channels;
+    wx[x] = static_cast<int>((sx - i) * 256 + 0.5f);
+  }
+
+  // rows are blended first, into 8.8 fixed point
+  std::vector<uint16_t> blended(rowSize);
+  for (int y = 0; y < height; y++) {
+    float sy = std::max(0.0f, (y + 0.5f) * myHeight / height - 0.5f);
+    int i = std::min(static_cast<int>(sy), myHeight - 1);
+    const unsigned char* row0 = myData + i * rowSize;
+    const unsigned char* row1 = myData + std::min(i + 1, myHeight - 1) *
+        rowSize;
+    int wy = static_cast<int>((sy - i) * 256 + 0.5f);
+
+    size_t k = 0;
+#ifdef AGL_HAS_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w0 = _mm_set1_epi16(static_cast<short>(256 - wy));
+    const __m128i w1 = _mm_set1_epi16(static_cast<short>(wy));
+    for (; k + 16 <= rowSize; k += 16) {
+      __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + k));
+      __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + k));
+      __m128i lo = _mm_add_epi16(
+          _mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), w0),
+          _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), w1));
+      __m128i hi = _mm_add_epi16(
+          _mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), w0),
+          _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), w1));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(&blended[k]), lo);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(&blended[k + 8]), hi);
+    }
+#endif
+    for (; k < rowSize; k++) {
+      blended[k] = static_cast<uint16_t>(row0[k] * (256 - wy) +
+          row1[k] * wy);
+    }
+
+    unsigned char* out = result.myData + static_cast<size_t>(y) * width *
+        channels;
+    for (int x = 0; x < width; x++) {
+      for (int c = 0; c < channels; c++) {
+        int value = blended[x0[x] + c] * (256 - wx[x]) +
+            blended[x1[x] + c] * wx[x];
+        *out++ = static_cast<unsigned char>((value + (1 << 15)) >> 16);
+      }
+    }
+  }
+  return result;
+}
+
+Image Image::downsample() const {
+  int width = std::max(1, myWidth / 2);
+  int height = std::max(1, myHeight / 2);
+  int channels = myChannels;
+  Image result(width, height, channels);
+  size_t rowSize = static_cast<size_t>(myWidth) * channels;
+
+  for (int y = 0; y < height; y++) {
+    const unsigned char* row0 = myData + 2 * y * rowSize;
+    const unsigned char* row1 = myData + std::min(2 * y + 1, myHeight - 1) *
+        rowSize;
+    unsigned char* out = result.myData + static_cast<size_t>(y) * width *
+        channels;
+
+    int x = 0;
+#ifdef AGL_HAS_SSE2
+    if (channels == 4) {
+      // two output pixels from four input pixels of each row
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i two = _mm_set1_epi16(2);
+      for (; 2 * x + 4 <= myWidth; x += 2) {
+        __m128i a = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(row0 + 8 * x));
+        __m128i b = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(row1 + 8 * x));
+        __m128i left = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+            _mm_unpacklo_epi8(b, zero));
+        __m128i right = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+            _mm_unpackhi_epi8(b, zero));
+        left = _mm_add_epi16(left, _mm_srli_si128(left, 8));
+        right = _mm_add_epi16(right, _mm_srli_si128(right, 8));
+        __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(left, right), two);
+        __m128i avg = _mm_srli_epi16(sum, 2);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(out + 4 * x),
+            _mm_packus_epi16(avg, avg));
+      }
+    }
+#endif
+    for (; x < width; x++) {
+      int left = 2 * x * channels;
+      int right = std::min(2 * x + 1, myWidth - 1) * channels;
+      for (int c = 0; c < channels; c++) {
+        int sum = row0[left + c] + row0[right + c] + row1[left + c] +
+            row1[right + c];
+        out[x * channels + c] = static_cast<unsigned char>((sum + 2) >> 2);
+      }
+    }
+  }
+  return result;
 }
 
 }  // namespace agl
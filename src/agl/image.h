@@ -5,6 +5,7 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 #include "agl/aglm.h"
 
 namespace agl {
@@ -22,30 +23,50 @@ struct Pixel {
 };
 
 /**
- * @brief Implements loading, modifying, and saving RGBA images
+ * @brief Implements loading, modifying, and saving images
+ *
+ * Pixels are stored row by row with 1 (gray), 2 (gray and alpha), 3 (RGB)
+ * or 4 (RGBA) unsigned char channels. Images are RGBA unless another
+ * channel count is requested. get() and set() convert to and from RGBA.
  */
 class Image {
  public:
   Image();
-  Image(int width, int height);
+  Image(int width, int height, int channels = 4);
+
+  /**
+   * @brief Create a view of pixels owned elsewhere, without copying them
+   * @param data Rows of width * channels bytes, which must outlive the view
+   *
+   * Changes to the image change data. Copies of a view own their pixels.
+   */
+  Image(int width, int height, int channels, unsigned char* data);
+
   Image(const Image& orig);
   Image& operator=(const Image& orig);
+  Image(Image&& orig) noexcept;
+  Image& operator=(Image&& orig) noexcept;
 
   virtual ~Image();
 
   /** 
-   * @brief Load the given filename (.png)
+   * @brief Load the given filename (.png, .jpg or .qoi)
    * @param filename The file to load, relative to the running directory
    * @param flip Whether the file should flipped vertally when loaded
+   * @param channels The number of channels to store, or 0 to keep as many
+   * as the file has
    * 
    * @verbinclude sprites.cpp
    */
-  bool load(const std::string& filename, bool flip = false);
+  bool load(const std::string& filename, bool flip = false, int channels = 4);
 
   /** 
-   * @brief Save the image to the given filename (.png)
+   * @brief Save the image to the given filename (.png or .qoi)
    * @param filename The file to load, relative to the running directory
    * @param flip Whether the file should flipped vertally before being saved
+   *
+   * writeImage() encodes PNGs several times faster, optionally on several
+   * threads, at a slightly larger file size.
    */
   bool save(const std::string& filename, bool flip = true) const;
 
@@ -57,22 +78,30 @@ class Image {
    */
   inline int height() const { return myHeight; }
 
+  /** @brief Return the number of channels per pixel (1 to 4)
+   */
+  inline int channels() const { return myChannels; }
+
+  /** @brief Return whether the pixels are owned by someone else
+   */
+  inline bool isView() const { return myStorage == VIEW; }
+
   /** 
-   * @brief Return the RGBA data
+   * @brief Return the pixel data
    *
-   * Data will have size width * height * 4 (RGBA)
+   * Data will have size width * height * channels
    */
   inline unsigned char* data() const { return myData; }
 
   /**
-   * @brief Replace image RGBA data
+   * @brief Replace image data with a copy of the given data
    * @param width The new image width
    * @param height The new image height
    *
    * This call will replace the old data with the new data. Data should 
-   * match the size width * height * 4
+   * match the size width * height * channels
    */
-  void set(int width, int height, unsigned char* data);
+  void set(int width, int height, unsigned char* data, int channels = 4);
 
   /**
    * @brief Get the pixel at index (row, col)
@@ -111,14 +140,74 @@ class Image {
    */ 
   glm::vec4 getVec4(int row, int col) const;
 
+  /**
+   * @brief Sample with bilinear filtering, repeating the image, like a GL
+   * texture with GL_LINEAR and GL_REPEAT
+   * @param st Texture coordinates; (0, 0) is the start of row 0
+   *
+   * Gray images are returned as (v, v, v, 1). vec4 colors are in range [0,1]
+   */
+  glm::vec4 sample(const glm::vec2& st) const;
+
+  /** @name Bulk operations
+   * These process whole rows at a time, using SSE2 where available
+   */
+  ///@{
+  /**
+   * @brief Convert every channel of every pixel to a float in [0,1]
+   * @param values Room for width * height * channels floats
+   */
+  void toFloat(float* values) const;
+
+  /**
+   * @brief Return every channel of every pixel as a float in [0,1]
+   */
+  std::vector<float> toFloat() const;
+
+  /**
+   * @brief Flip the image vertically, in place
+   */
+  void flipRows();
+
+  /**
+   * @brief Multiply the color channels by alpha, in place
+   *
+   * Does nothing for images without alpha (1 or 3 channels).
+   */
+  void premultiply();
+
+  /**
+   * @brief Return a copy scaled to the given size with bilinear filtering
+   */
+  Image resize(int width, int height) const;
+
+  /**
+   * @brief Return a copy of half the size, averaging each 2x2 block
+   *
+   * Sizes are halved rounding down, as for GL mipmaps, so the last row or
+   * column of an odd size is dropped; a size of 1 stays 1, with its rows
+   * or columns averaged in pairs along the other axis. Repeated calls build
+   * a mip chain down to 1x1.
+   */
+  Image downsample() const;
+  ///@}
+
  private:
   void clear();
 
+  // How myData is freed
+  enum Storage {
+    NEW_ARRAY,  // allocated with new[]
+    STB,        // returned by stb_image
+    VIEW        // not owned
+  };
+
  private:
   unsigned char* myData;
-  unsigned int myWidth;
-  unsigned int myHeight;
-  bool myLoaded;
+  int myWidth;
+  int myHeight;
+  int myChannels;
+  Storage myStorage;
 };
 }  // namespace agl
 #endif  // AGL_IMAGE_H_
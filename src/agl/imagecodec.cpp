@@ -0,0 +1,736 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/imagecodec.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "agl/threadpool.h"
+
+namespace agl {
+
+namespace {
+
+// Uncompressed bytes per PNG strip
+const size_t kStripBytes = 256 * 1024;
+
+// LZ77 parameters. Deflate allows matches of 3 to 258 bytes up to 32 KB
+// back; only matches of 4 or more are searched for, with one candidate
+// per hash, which is much faster and rarely worse on image rows.
+const int kHashBits = 15;
+const int kMinMatch = 4;
+const int kMaxMatch = 258;
+const size_t kWindowSize = 32768;
+
+const int kLengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19,
+  23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const int kLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+  2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const int kDistBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97,
+  129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193,
+  12289, 16385, 24577};
+const int kDistExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Order in which the code length code lengths are stored
+const int kCodeLengthOrder[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// Lookup tables from match length and distance to deflate codes
+struct Tables {
+  uint8_t lengthCode[kMaxMatch + 1];
+  uint8_t distCode[512];  // distances up to 256, then (distance - 1) >> 7
+  uint32_t crc[256];
+
+  Tables() {
+    for (int code = 0; code < 29; code++) {
+      int end = code < 28 ? kLengthBase[code + 1] : kMaxMatch + 1;
+      for (int len = kLengthBase[code]; len < end; len++) {
+        lengthCode[len] = code;
+      }
+    }
+    for (int code = 0; code < 30; code++) {
+      int end = code < 29 ? kDistBase[code + 1] : 32769;
+      for (int dist = kDistBase[code]; dist < end; dist++) {
+        if (dist <= 256) distCode[dist - 1] = code;
+        else distCode[256 + ((dist - 1) >> 7)] = code;
+      }
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; k++) c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+      crc[n] = c;
+    }
+  }
+};
+
+const Tables& tables() {
+  static const Tables theTables;
+  return theTables;
+}
+
+inline int distanceCode(int dist) {
+  const Tables& t = tables();
+  return dist <= 256 ? t.distCode[dist - 1] :
+    t.distCode[256 + ((dist - 1) >> 7)];
+}
+
+uint32_t crc32(uint32_t crc, const unsigned char* data, size_t size) {
+  const uint32_t* table = tables().crc;
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++) {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+const uint32_t kAdlerBase = 65521;
+
+uint32_t adler32(uint32_t adler, const unsigned char* data, size_t size) {
+  uint32_t s1 = adler & 0xffff;
+  uint32_t s2 = adler >> 16;
+  while (size > 0) {
+    size_t n = std::min(size, static_cast<size_t>(5552));  // no overflow
+    for (size_t i = 0; i < n; i++) {
+      s1 += data[i];
+      s2 += s1;
+    }
+    s1 %= kAdlerBase;
+    s2 %= kAdlerBase;
+    data += n;
+    size -= n;
+  }
+  return s1 | (s2 << 16);
+}
+
+// The checksum of A followed by B, from their checksums (as in zlib)
+uint32_t adler32Combine(uint32_t adlerA, uint32_t adlerB, size_t sizeB) {
+  uint32_t rem = static_cast<uint32_t>(sizeB % kAdlerBase);
+  uint32_t sum1 = adlerA & 0xffff;
+  uint32_t sum2 = (rem * sum1) % kAdlerBase;
+  sum1 += (adlerB & 0xffff) + kAdlerBase - 1;
+  sum2 += (adlerA >> 16) + (adlerB >> 16) + kAdlerBase - rem;
+  if (sum1 >= kAdlerBase) sum1 -= kAdlerBase;
+  if (sum1 >= kAdlerBase) sum1 -= kAdlerBase;
+  if (sum2 >= (kAdlerBase << 1)) sum2 -= (kAdlerBase << 1);
+  if (sum2 >= kAdlerBase) sum2 -= kAdlerBase;
+  return sum1 | (sum2 << 16);
+}
+
+inline uint32_t read32(const unsigned char* p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+inline uint64_t read64(const unsigned char* p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+void putBE32(std::vector<unsigned char>* out, uint32_t v) {
+  out->push_back(v >> 24);
+  out->push_back((v >> 16) & 0xff);
+  out->push_back((v >> 8) & 0xff);
+  out->push_back(v & 0xff);
+}
+
+// Writes bits least significant first, as deflate expects
+class BitWriter {
+ public:
+  explicit BitWriter(std::vector<unsigned char>* out) :
+    _out(out), _bits(0), _count(0) {}
+
+  void put(uint32_t value, int numBits) {
+    _bits |= static_cast<uint64_t>(value) << _count;
+    _count += numBits;
+    while (_count >= 8) {
+      _out->push_back(static_cast<unsigned char>(_bits));
+      _bits >>= 8;
+      _count -= 8;
+    }
+  }
+
+  void align() {
+    if (_count > 0) put(0, 8 - _count);
+  }
+
+ private:
+  std::vector<unsigned char>* _out;
+  uint64_t _bits;
+  int _count;
+};
+
+// Sets the code length of each symbol so that no code is longer than
+// maxLength. Unused symbols get length 0, unless fewer than two are used.
+void huffmanLengths(const uint32_t* freq, int numSymbols, int maxLength,
+    uint8_t* lengths) {
+  std::fill(lengths, lengths + numSymbols, 0);
+  std::vector<int> symbols;
+  for (int i = 0; i < numSymbols; i++) {
+    if (freq[i] > 0) symbols.push_back(i);
+  }
+  int m = static_cast<int>(symbols.size());
+  if (m < 2) {
+    // decoders want complete codes, so use two 1-bit codes
+    int used = (m == 1) ? symbols[0] : 0;
+    lengths[used] = 1;
+    lengths[used == 0 ? 1 : 0] = 1;
+    return;
+  }
+  std::sort(symbols.begin(), symbols.end(), [freq](int a, int b) {
+    return freq[a] < freq[b] || (freq[a] == freq[b] && a < b);
+  });
+
+  // Leaves are sorted and new nodes are made in increasing weight, so two
+  // queues replace a heap. Every node is made after its children.
+  std::vector<uint64_t> weight(2 * m - 1);
+  std::vector<int> parent(2 * m - 1, 0);
+  for (int i = 0; i < m; i++) weight[i] = freq[symbols[i]];
+  int leaf = 0, node = m;
+  for (int next = m; next < 2 * m - 1; next++) {
+    int pick[2];
+    for (int k = 0; k < 2; k++) {
+      if (leaf < m && (node >= next || weight[leaf] <= weight[node])) {
+        pick[k] = leaf++;
+      } else {
+        pick[k] = node++;
+      }
+    }
+    weight[next] = weight[pick[0]] + weight[pick[1]];
+    parent[pick[0]] = parent[pick[1]] = next;
+  }
+  std::vector<int> depth(2 * m - 1, 0);
+  std::vector<int> count(maxLength + 1, 0);
+  for (int i = 2 * m - 3; i >= 0; i--) {
+    depth[i] = depth[parent[i]] + 1;
+    if (i < m) count[std::min(depth[i], maxLength)]++;
+  }
+
+  // Clamping made the code over-full; lengthen shorter codes until it
+  // fits again (the approach used by miniz)
+  uint32_t total = 0;
+  for (int len = 1; len <= maxLength; len++) {
+    total += count[len] << (maxLength - len);
+  }
+  while (total != (1u << maxLength)) {
+    count[maxLength]--;
+    for (int len = maxLength - 1; len > 0; len--) {
+      if (count[len] > 0) {
+        count[len]--;
+        count[len + 1] += 2;
+        break;
+      }
+    }
+    total--;
+  }
+
+  // the least frequent symbols get the longest codes
+  int s = 0;
+  for (int len = maxLength; len > 0; len--) {
+    for (int k = 0; k < count[len]; k++) lengths[symbols[s++]] = len;
+  }
+}
+
+// Canonical codes for the given lengths, bit reversed for BitWriter
+void huffmanCodes(const uint8_t* lengths, int numSymbols, uint16_t* codes) {
+  int count[16] = {0};
+  for (int i = 0; i < numSymbols; i++) count[lengths[i]]++;
+  count[0] = 0;
+  int next[16] = {0};
+  int code = 0;
+  for (int len = 1; len < 16; len++) {
+    code = (code + count[len - 1]) << 1;
+    next[len] = code;
+  }
+  for (int i = 0; i < numSymbols; i++) {
+    int len = lengths[i];
+    if (len == 0) continue;
+    int c = next[len]++;
+    int reversed = 0;
+    for (int k = 0; k < len; k++) reversed |= ((c >> k) & 1) << (len - 1 - k);
+    codes[i] = static_cast<uint16_t>(reversed);
+  }
+}
+
+struct Token {
+  uint16_t value;     // literal byte, or match length
+  uint16_t distance;  // 0 for literals
+};
+
+// Deflates data as one dynamic Huffman block (not final) followed by an
+// empty stored block. The stored block ends the strip on a byte boundary,
+// so the next strip's blocks can be appended as they are.
+void deflateStrip(const unsigned char* data, size_t size,
+    std::vector<unsigned char>* out) {
+  uint32_t litFreq[286] = {0};
+  uint32_t distFreq[30] = {0};
+  std::vector<Token> tokens;
+  tokens.reserve(size / 4);
+
+  // greedy LZ77 with one candidate per hash
+  std::vector<int32_t> head(1 << kHashBits, -1);
+  auto hash = [](uint32_t v) { return (v * 2654435761u) >> (32 - kHashBits); };
+  size_t i = 0;
+  while (i < size) {
+    size_t length = 0;
+    size_t distance = 0;
+    if (i + kMinMatch <= size) {
+      uint32_t h = hash(read32(data + i));
+      int32_t candidate = head[h];
+      head[h] = static_cast<int32_t>(i);
+      if (candidate >= 0 && i - candidate <= kWindowSize &&
+          read32(data + candidate) == read32(data + i)) {
+        size_t maxLength = std::min(static_cast<size_t>(kMaxMatch), size - i);
+        const unsigned char* a = data + candidate;
+        const unsigned char* b = data + i;
+        length = kMinMatch;
+        while (length + 8 <= maxLength &&
+            read64(a + length) == read64(b + length)) {
+          length += 8;
+        }
+        while (length < maxLength && a[length] == b[length]) length++;
+        distance = i - candidate;
+      }
+    }
+
+    if (length >= kMinMatch) {
+      tokens.push_back(Token{static_cast<uint16_t>(length),
+          static_cast<uint16_t>(distance)});
+      litFreq[257 + tables().lengthCode[length]]++;
+      distFreq[distanceCode(static_cast<int>(distance))]++;
+      size_t end = i + length;
+      for (i++; i < end && i + kMinMatch <= size; i++) {
+        head[hash(read32(data + i))] = static_cast<int32_t>(i);
+      }
+      i = end;
+    } else {
+      tokens.push_back(Token{data[i], 0});
+      litFreq[data[i]]++;
+      i++;
+    }
+  }
+  litFreq[256] = 1;  // end of block
+
+  uint8_t litLengths[286];
+  uint8_t distLengths[30];
+  uint16_t litCodes[286] = {0};
+  uint16_t distCodes[30] = {0};
+  huffmanLengths(litFreq, 286, 15, litLengths);
+  huffmanLengths(distFreq, 30, 15, distLengths);
+  huffmanCodes(litLengths, 286, litCodes);
+  huffmanCodes(distLengths, 30, distCodes);
+
+  int numLit = 286;
+  while (numLit > 257 && litLengths[numLit - 1] == 0) numLit--;
+  int numDist = 30;
+  while (numDist > 1 && distLengths[numDist - 1] == 0) numDist--;
+
+  // run length encode the code lengths with symbols 16 to 18
+  std::vector<uint8_t> all(litLengths, litLengths + numLit);
+  all.insert(all.end(), distLengths, distLengths + numDist);
+  struct Run { uint8_t symbol, extra; };
+  std::vector<Run> runs;
+  uint32_t clenFreq[19] = {0};
+  for (size_t k = 0; k < all.size();) {
+    uint8_t len = all[k];
+    size_t run = 1;
+    while (k + run < all.size() && all[k + run] == len) run++;
+    k += run;
+    if (len == 0) {
+      while (run >= 11) {
+        size_t n = std::min(run, static_cast<size_t>(138));
+        runs.push_back(Run{18, static_cast<uint8_t>(n - 11)});
+        run -= n;
+      }
+      if (run >= 3) {
+        runs.push_back(Run{17, static_cast<uint8_t>(run - 3)});
+        run = 0;
+      }
+    } else {
+      runs.push_back(Run{len, 0});
+      run--;
+      while (run >= 3) {
+        size_t n = std::min(run, static_cast<size_t>(6));
+        runs.push_back(Run{16, static_cast<uint8_t>(n - 3)});
+        run -= n;
+      }
+    }
+    for (; run > 0; run--) runs.push_back(Run{len, 0});
+  }
+  for (const Run& r : runs) clenFreq[r.symbol]++;
+
+  uint8_t clenLengths[19];
+  uint16_t clenCodes[19] = {0};
+  huffmanLengths(clenFreq, 19, 7, clenLengths);
+  huffmanCodes(clenLengths, 19, clenCodes);
+  int numClen = 19;
+  while (numClen > 4 && clenLengths[kCodeLengthOrder[numClen - 1]] == 0) {
+    numClen--;
+  }
+
+  BitWriter bits(out);
+  bits.put(0, 1);  // not the final block
+  bits.put(2, 2);  // dynamic Huffman codes
+  bits.put(numLit - 257, 5);
+  bits.put(numDist - 1, 5);
+  bits.put(numClen - 4, 4);
+  for (int k = 0; k < numClen; k++) {
+    bits.put(clenLengths[kCodeLengthOrder[k]], 3);
+  }
+  for (const Run& r : runs) {
+    bits.put(clenCodes[r.symbol], clenLengths[r.symbol]);
+    if (r.symbol == 16) bits.put(r.extra, 2);
+    else if (r.symbol == 17) bits.put(r.extra, 3);
+    else if (r.symbol == 18) bits.put(r.extra, 7);
+  }
+
+  for (const Token& token : tokens) {
+    if (token.distance == 0) {
+      bits.put(litCodes[token.value], litLengths[token.value]);
+      continue;
+    }
+    int lc = tables().lengthCode[token.value];
+    bits.put(litCodes[257 + lc], litLengths[257 + lc]);
+    bits.put(token.value - kLengthBase[lc], kLengthExtra[lc]);
+    int dc = distanceCode(token.distance);
+    bits.put(distCodes[dc], distLengths[dc]);
+    bits.put(token.distance - kDistBase[dc], kDistExtra[dc]);
+  }
+  bits.put(litCodes[256], litLengths[256]);
+
+  // empty stored block: header, pad to a byte, then LEN = 0, NLEN = ~0
+  bits.put(0, 3);
+  bits.align();
+  const unsigned char empty[4] = {0x00, 0x00, 0xff, 0xff};
+  out->insert(out->end(), empty, empty + 4);
+}
+
+inline int paeth(int a, int b, int c) {
+  int pa = abs(b - c);
+  int pb = abs(a - c);
+  int pc = abs(a + b - 2 * c);
+  return (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+}
+
+inline uint32_t sumAbs(const unsigned char* bytes, int size) {
+  uint32_t sum = 0;
+  for (int x = 0; x < size; x++) {
+    int v = bytes[x];
+    sum += v < 128 ? v : 256 - v;
+  }
+  return sum;
+}
+
+// Writes the filter type and filtered bytes of a row, choosing the filter
+// with the smallest sum of absolute values (the usual PNG heuristic).
+// prev is zero for the first row; scratch holds 4 rows.
+void filterRow(const unsigned char* row, const unsigned char* prev,
+    int rowBytes, int bpp, unsigned char* out, unsigned char* scratch) {
+  unsigned char* sub = scratch;
+  unsigned char* up = sub + rowBytes;
+  unsigned char* average = up + rowBytes;
+  unsigned char* predicted = average + rowBytes;
+  for (int x = 0; x < bpp; x++) {
+    sub[x] = row[x];
+    up[x] = row[x] - prev[x];
+    average[x] = row[x] - (prev[x] >> 1);
+    predicted[x] = row[x] - prev[x];
+  }
+  for (int x = bpp; x < rowBytes; x++) {
+    int a = row[x - bpp];
+    int b = prev[x];
+    int c = prev[x - bpp];
+    sub[x] = row[x] - a;
+    up[x] = row[x] - b;
+    average[x] = row[x] - ((a + b) >> 1);
+    predicted[x] = row[x] - paeth(a, b, c);
+  }
+
+  const unsigned char* filtered[5] = {row, sub, up, average, predicted};
+  int best = 0;
+  uint32_t bestSum = sumAbs(row, rowBytes);
+  for (int filter = 1; filter < 5; filter++) {
+    uint32_t sum = sumAbs(filtered[filter], rowBytes);
+    if (sum < bestSum) {
+      bestSum = sum;
+      best = filter;
+    }
+  }
+  out[0] = static_cast<unsigned char>(best);
+  memcpy(out + 1, filtered[best], rowBytes);
+}
+
+void appendChunk(std::vector<unsigned char>* png, const char* type,
+    const unsigned char* data, size_t size) {
+  putBE32(png, static_cast<uint32_t>(size));
+  size_t start = png->size();
+  png->insert(png->end(), type, type + 4);
+  if (size > 0) png->insert(png->end(), data, data + size);
+  putBE32(png, crc32(0, &(*png)[start], size + 4));
+}
+
+bool writeFile(const std::string& filename,
+    const std::vector<unsigned char>& data) {
+  FILE* file = fopen(filename.c_str(), "wb");
+  if (!file) return false;
+  size_t written = fwrite(data.data(), 1, data.size(), file);
+  return fclose(file) == 0 && written == data.size();
+}
+
+const unsigned char kQOIMagic[4] = {'q', 'o', 'i', 'f'};
+const unsigned char kQOIEnd[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+inline int qoiHash(const unsigned char* px) {
+  return (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+}
+
+}  // namespace
+
+bool encodePNG(const Image& image, std::vector<unsigned char>* png,
+    bool flip, ThreadPool* pool) {
+  int w = image.width();
+  int h = image.height();
+  int bpp = image.channels();
+  if (w <= 0 || h <= 0 || !image.data()) return false;
+
+  size_t rowBytes = static_cast<size_t>(w) * bpp;
+  int rowsPerStrip = static_cast<int>(
+      std::max(static_cast<size_t>(1), kStripBytes / (rowBytes + 1)));
+  int numStrips = (h + rowsPerStrip - 1) / rowsPerStrip;
+
+  struct Strip {
+    std::vector<unsigned char> chunk;
+    uint32_t adler;
+    size_t size;  // filtered bytes
+  };
+  std::vector<Strip> strips(numStrips);
+
+  auto source = [&image, flip, h, rowBytes](int y) {
+    return image.data() + (flip ? h - 1 - y : y) * rowBytes;
+  };
+
+  parallelFor(numStrips, pool, [&](int s) {
+    int y0 = s * rowsPerStrip;
+    int y1 = std::min(h, y0 + rowsPerStrip);
+    std::vector<unsigned char> filtered((y1 - y0) * (rowBytes + 1));
+    std::vector<unsigned char> scratch(rowBytes * 4);
+    std::vector<unsigned char> zeros(y0 == 0 ? rowBytes : 0);
+    for (int y = y0; y < y1; y++) {
+      filterRow(source(y), y > 0 ? source(y - 1) : &zeros[0],
+          static_cast<int>(rowBytes), bpp,
+          &filtered[(y - y0) * (rowBytes + 1)], &scratch[0]);
+    }
+
+    Strip& strip = strips[s];
+    strip.adler = adler32(1, &filtered[0], filtered.size());
+    strip.size = filtered.size();
+
+    // the chunk is built in place: length, type, data, then its CRC
+    std::vector<unsigned char>& chunk = strip.chunk;
+    chunk.reserve(filtered.size() / 2 + 64);
+    chunk.resize(8);
+    memcpy(&chunk[4], "IDAT", 4);
+    if (s == 0) {
+      chunk.push_back(0x78);  // zlib header: deflate, 32 KB window
+      chunk.push_back(0x01);
+    }
+    deflateStrip(&filtered[0], filtered.size(), &chunk);
+    uint32_t size = static_cast<uint32_t>(chunk.size() - 8);
+    for (int k = 0; k < 4; k++) chunk[k] = (size >> (24 - 8 * k)) & 0xff;
+    putBE32(&chunk, crc32(0, &chunk[4], size + 4));
+  });
+
+  static const unsigned char kSignature[8] = {
+    0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  static const unsigned char kColorType[5] = {0, 0, 4, 2, 6};
+  png->assign(kSignature, kSignature + 8);
+
+  std::vector<unsigned char> header;
+  putBE32(&header, w);
+  putBE32(&header, h);
+  header.push_back(8);  // bits per channel
+  header.push_back(kColorType[bpp]);
+  header.push_back(0);  // deflate
+  header.push_back(0);  // adaptive filtering
+  header.push_back(0);  // not interlaced
+  appendChunk(png, "IHDR", header.data(), header.size());
+
+  uint32_t adler = 1;
+  for (const Strip& strip : strips) {
+    png->insert(png->end(), strip.chunk.begin(), strip.chunk.end());
+    adler = adler32Combine(adler, strip.adler, strip.size);
+  }
+
+  // an empty final block with fixed codes, then the zlib checksum
+  std::vector<unsigned char> tail = {0x03, 0x00};
+  putBE32(&tail, adler);
+  appendChunk(png, "IDAT", tail.data(), tail.size());
+  appendChunk(png, "IEND", 0, 0);
+  return true;
+}
+
+bool encodeQOI(const Image& image, std::vector<unsigned char>* qoi,
+    bool flip) {
+  int w = image.width();
+  int h = image.height();
+  int n = image.channels();
+  if (w <= 0 || h <= 0 || !image.data()) return false;
+  int channels = (n == 2 || n == 4) ? 4 : 3;
+
+  // worst case: every pixel written in full
+  qoi->resize(14 + static_cast<size_t>(w) * h * (channels + 1) + 8);
+  unsigned char* out = &(*qoi)[0];
+  memcpy(out, kQOIMagic, 4);
+  for (int k = 0; k < 4; k++) out[4 + k] = (w >> (24 - 8 * k)) & 0xff;
+  for (int k = 0; k < 4; k++) out[8 + k] = (h >> (24 - 8 * k)) & 0xff;
+  out[12] = channels;
+  out[13] = 0;  // sRGB
+  out += 14;
+
+  unsigned char index[64][4];
+  memset(index, 0, sizeof(index));
+  unsigned char prev[4] = {0, 0, 0, 255};
+  unsigned char px[4];
+  int run = 0;
+  const size_t rowBytes = static_cast<size_t>(w) * n;
+
+  for (int y = 0; y < h; y++) {
+    const unsigned char* src = image.data() + (flip ? h - 1 - y : y) * rowBytes;
+    for (int x = 0; x < w; x++, src += n) {
+      if (n >= 3) {
+        px[0] = src[0];
+        px[1] = src[1];
+        px[2] = src[2];
+        px[3] = n == 4 ? src[3] : 255;
+      } else {
+        px[0] = px[1] = px[2] = src[0];
+        px[3] = n == 2 ? src[1] : 255;
+      }
+
+      if (read32(px) == read32(prev)) {
+        run++;
+        if (run == 62 || (y == h - 1 && x == w - 1)) {
+          *out++ = 0xc0 | (run - 1);
+          run = 0;
+        }
+        continue;
+      }
+      if (run > 0) {
+        *out++ = 0xc0 | (run - 1);
+        run = 0;
+      }
+
+      int slot = qoiHash(px);
+      if (read32(index[slot]) == read32(px)) {
+        *out++ = static_cast<unsigned char>(slot);
+      } else {
+        memcpy(index[slot], px, 4);
+        if (px[3] == prev[3]) {
+          int dr = static_cast<signed char>(px[0] - prev[0]);
+          int dg = static_cast<signed char>(px[1] - prev[1]);
+          int db = static_cast<signed char>(px[2] - prev[2]);
+          int drg = dr - dg;
+          int dbg = db - dg;
+          if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 &&
+              db >= -2 && db <= 1) {
+            *out++ = 0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+          } else if (drg >= -8 && drg <= 7 && dg >= -32 && dg <= 31 &&
+              dbg >= -8 && dbg <= 7) {
+            *out++ = 0x80 | (dg + 32);
+            *out++ = (drg + 8) << 4 | (dbg + 8);
+          } else {
+            *out++ = 0xfe;
+            *out++ = px[0];
+            *out++ = px[1];
+            *out++ = px[2];
+          }
+        } else {
+          *out++ = 0xff;
+          memcpy(out, px, 4);
+          out += 4;
+        }
+      }
+      memcpy(prev, px, 4);
+    }
+  }
+
+  memcpy(out, kQOIEnd, 8);
+  out += 8;
+  qoi->resize(out - &(*qoi)[0]);
+  return true;
+}
+
+bool decodeQOI(const unsigned char* data, size_t size, Image* image,
+    int channels) {
+  if (size < 14 + 8 || memcmp(data, kQOIMagic, 4) != 0) return false;
+  uint32_t w = 0, h = 0;
+  for (int k = 0; k < 4; k++) w = (w << 8) | data[4 + k];
+  for (int k = 0; k < 4; k++) h = (h << 8) | data[8 + k];
+  int stored = data[12];
+  if (w == 0 || h == 0 || (stored != 3 && stored != 4)) return false;
+  if (static_cast<uint64_t>(w) * h > (1u << 28)) return false;  // corrupt?
+  if (channels == 0) channels = stored;
+  if (channels != 3 && channels != 4) return false;
+
+  *image = Image(w, h, channels);
+  unsigned char* dst = image->data();
+  unsigned char index[64][4];
+  memset(index, 0, sizeof(index));
+  unsigned char px[4] = {0, 0, 0, 255};
+  size_t p = 14;
+  size_t end = size - 8;
+  int run = 0;
+
+  for (size_t i = 0, n = static_cast<size_t>(w) * h; i < n; i++) {
+    if (run > 0) {
+      run--;
+    } else if (p < end) {
+      int b1 = data[p++];
+      if (b1 == 0xfe) {
+        if (p + 3 > end) return false;
+        memcpy(px, data + p, 3);
+        p += 3;
+      } else if (b1 == 0xff) {
+        if (p + 4 > end) return false;
+        memcpy(px, data + p, 4);
+        p += 4;
+      } else if ((b1 & 0xc0) == 0x00) {
+        memcpy(px, index[b1], 4);
+      } else if ((b1 & 0xc0) == 0x40) {
+        px[0] += ((b1 >> 4) & 3) - 2;
+        px[1] += ((b1 >> 2) & 3) - 2;
+        px[2] += (b1 & 3) - 2;
+      } else if ((b1 & 0xc0) == 0x80) {
+        if (p >= end) return false;
+        int b2 = data[p++];
+        int dg = (b1 & 0x3f) - 32;
+        px[0] += dg - 8 + ((b2 >> 4) & 0x0f);
+        px[1] += dg;
+        px[2] += dg - 8 + (b2 & 0x0f);
+      } else {
+        run = b1 & 0x3f;
+      }
+      memcpy(index[qoiHash(px)], px, 4);
+    } else {
+      return false;  // truncated
+    }
+
+    memcpy(dst, px, channels);
+    dst += channels;
+  }
+  return true;
+}
+
+bool writeImage(const std::string& filename, const Image& image,
+    bool flip, ThreadPool* pool) {
+  std::string ext = filename.substr(filename.find_last_of('.') + 1);
+  std::vector<unsigned char> data;
+  bool encoded = (ext == "qoi") ? encodeQOI(image, &data, flip) :
+      encodePNG(image, &data, flip, pool);
+  return encoded && writeFile(filename, data);
+}
+
+}  // namespace agl
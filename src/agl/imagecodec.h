@@ -0,0 +1,64 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_IMAGECODEC_H_
+#define AGL_IMAGECODEC_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "agl/image.h"
+
+namespace agl {
+
+class ThreadPool;
+
+/**
+ * @brief Encode an image as a PNG, compressing strips of rows in parallel
+ * @param image The image to encode (1 to 4 channels)
+ * @param png Set to the contents of the .png file
+ * @param flip Write the rows bottom to top, e.g. for pixels read from GL
+ * @param pool Workers to compress strips on, or 0 to use only the calling
+ * thread. The calling thread always helps, so this may be called from a
+ * job running on the same pool.
+ * @return false if the image is empty
+ *
+ * Each strip of about 256 KB is filtered and deflated on its own and
+ * written as a separate IDAT chunk; strips end with an empty stored block
+ * so they concatenate into one valid zlib stream. This trades a few
+ * percent of file size (matches do not reach into the previous strip) for
+ * speed, and the output does not depend on the number of threads.
+ */
+bool encodePNG(const Image& image, std::vector<unsigned char>* png,
+    bool flip = false, ThreadPool* pool = 0);
+
+/**
+ * @brief Encode an image in the QOI format (https://qoiformat.org)
+ * @param image The image to encode. Gray images are stored as RGB(A).
+ * @param qoi Set to the contents of the .qoi file
+ * @param flip Write the rows bottom to top
+ * @return false if the image is empty
+ *
+ * QOI is lossless and encodes at close to memory speed, at the cost of
+ * larger files than PNG. Use it for captures that are converted later.
+ */
+bool encodeQOI(const Image& image, std::vector<unsigned char>* qoi,
+    bool flip = false);
+
+/**
+ * @brief Decode a QOI file
+ * @param channels The number of channels to return (3 or 4), or 0 for
+ * the number stored in the file
+ * @return false if the data is not a valid QOI file
+ */
+bool decodeQOI(const unsigned char* data, size_t size, Image* image,
+    int channels = 4);
+
+/**
+ * @brief Save an image as .png (with encodePNG) or .qoi, by file extension
+ * @return false if the file cannot be written
+ */
+bool writeImage(const std::string& filename, const Image& image,
+    bool flip = false, ThreadPool* pool = 0);
+
+}  // namespace agl
+#endif  // AGL_IMAGECODEC_H_
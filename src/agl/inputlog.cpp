@@ -0,0 +1,114 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/inputlog.h"
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace agl {
+
+static const char* kTypeNames[] = {"key-down", "key-up", "mouse-down",
+  "mouse-up", "mouse-move", "scroll"};
+static const int kNumTypes = 6;
+
+// A GLFW key code, or a letter or digit, which GLFW codes as its
+// (capital) ascii value
+static bool parseKey(const std::string& token, int* key) {
+  if (token.size() == 1 && isalnum(static_cast<unsigned char>(token[0]))) {
+    *key = toupper(static_cast<unsigned char>(token[0]));
+    return true;
+  }
+  char* end;
+  *key = static_cast<int>(strtol(token.c_str(), &end, 10));
+  return !token.empty() && *end == '\0';
+}
+
+InputLog::InputLog() : _next(0), _mouse(0.0f) {
+}
+
+bool InputLog::load(const std::string& filename) {
+  std::ifstream file(filename);
+  if (!file) {
+    std::cout << "WARNING: cannot read input log " << filename << std::endl;
+    return false;
+  }
+
+  _events.clear();
+  _next = 0;
+  _keys.clear();
+  _buttons.clear();
+  std::string line;
+  int lineNumber = 0;
+  bool ok = true;
+  while (std::getline(file, line)) {
+    lineNumber++;
+    line = line.substr(0, line.find('#'));
+    std::istringstream values(line);
+    Event event = {};
+    std::string type, code;
+    if (!(values >> event.frame)) continue;  // blank line
+
+    values >> type;
+    int t = 0;
+    while (t < kNumTypes && type != kTypeNames[t]) t++;
+    event.type = static_cast<Type>(t);
+    bool valid = t < kNumTypes;
+    if (event.type == MOUSE_MOVE || event.type == SCROLL) {
+      valid = valid && (values >> event.x >> event.y);
+    } else if (valid) {
+      valid = (values >> code >> event.mods) && parseKey(code, &event.code);
+    }
+    if (!valid || (!_events.empty() && event.frame < _events.back().frame)) {
+      std::cout << "WARNING: " << filename << ":" << lineNumber <<
+        ": cannot read event '" << line << "'" << std::endl;
+      ok = false;
+      continue;
+    }
+    _events.push_back(event);
+  }
+  return ok;
+}
+
+bool InputLog::save(const std::string& filename) const {
+  std::ofstream file(filename);
+  if (!file) {
+    std::cout << "WARNING: cannot write input log " << filename << std::endl;
+    return false;
+  }
+  file << "# frame event values\n";
+  for (const Event& event : _events) {
+    file << event.frame << " " << kTypeNames[event.type] << " ";
+    if (event.type == MOUSE_MOVE || event.type == SCROLL) {
+      file << event.x << " " << event.y << "\n";
+    } else {
+      file << event.code << " " << event.mods << "\n";
+    }
+  }
+  return static_cast<bool>(file);
+}
+
+void InputLog::add(const Event& event) {
+  _events.push_back(event);
+}
+
+int InputLog::lastFrame() const {
+  return _events.empty() ? -1 : _events.back().frame;
+}
+
+bool InputLog::next(int frame, Event* event) {
+  if (_next >= _events.size() || _events[_next].frame > frame) return false;
+  *event = _events[_next++];
+  switch (event->type) {
+    case KEY_DOWN: _keys.insert(event->code); break;
+    case KEY_UP: _keys.erase(event->code); break;
+    case MOUSE_DOWN: _buttons.insert(event->code); break;
+    case MOUSE_UP: _buttons.erase(event->code); break;
+    case MOUSE_MOVE: _mouse = glm::vec2(event->x, event->y); break;
+    case SCROLL: break;
+  }
+  return true;
+}
+
+}  // namespace agl
@@ -0,0 +1,98 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_INPUTLOG_H_
+#define AGL_INPUTLOG_H_
+
+#include <set>
+#include <string>
+#include <vector>
+#include "agl/aglm.h"
+
+namespace agl {
+
+/**
+ * @brief A list of input events stamped with the frame they arrived in
+ *
+ * Window records the keyboard, mouse and scroll events it receives into a
+ * log and can play a log back instead of the real devices, so that the
+ * same session can be drawn again frame for frame. Logs are text files with
+ * one event per line, which are also easy to write by hand:
+ *
+ * ```
+ * # frame event values
+ * 0 mouse-move 250 250
+ * 0 mouse-down 0 0        # button, mods (0 is the left button)
+ * 1 mouse-move 260 250
+ * 2 mouse-up 0 0
+ * 3 scroll 0 -1           # dx, dy
+ * 4 key-down N 0          # key, mods: a GLFW key code or a letter
+ * 4 key-up N 0
+ * ```
+ *
+ * Events of frame f are handled before frame f is drawn. Blank lines and
+ * text after '#' are ignored.
+ */
+class InputLog {
+ public:
+  enum Type {KEY_DOWN, KEY_UP, MOUSE_DOWN, MOUSE_UP, MOUSE_MOVE, SCROLL};
+
+  struct Event {
+    int frame;
+    Type type;
+    int code;  // key or mouse button
+    int mods;
+    float x, y;  // mouse position or scroll offset
+  };
+
+  InputLog();
+
+  /**
+   * @brief Read a log, replacing the current events
+   * @return (bool) Returns false if the file cannot be read or has errors
+   */
+  bool load(const std::string& filename);
+
+  /**
+   * @brief Write the events to a file
+   */
+  bool save(const std::string& filename) const;
+
+  /**
+   * @brief Append an event; events must be added in frame order
+   */
+  void add(const Event& event);
+
+  const std::vector<Event>& events() const { return _events; }
+
+  /**
+   * @brief Return the frame of the last event, or -1 if there are none
+   */
+  int lastFrame() const;
+
+  /** @name Playback
+   */
+  ///@{
+  /**
+   * @brief Return the next event of the given frame or earlier
+   * @return (bool) Returns false when no such event is left
+   *
+   * Also updates the keys, buttons and cursor position that the played
+   * events have left pressed.
+   */
+  bool next(int frame, Event* event);
+
+  bool keyIsDown(int key) const { return _keys.count(key) > 0; }
+  bool mouseIsDown(int button) const { return _buttons.count(button) > 0; }
+  glm::vec2 mousePosition() const { return _mouse; }
+  ///@}
+
+ private:
+  std::vector<Event> _events;
+  size_t _next;
+  std::set<int> _keys;
+  std::set<int> _buttons;
+  glm::vec2 _mouse;
+};
+
+}  // namespace agl
+#endif  // AGL_INPUTLOG_H_
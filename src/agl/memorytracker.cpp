@@ -0,0 +1,162 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/memorytracker.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <utility>
+
+namespace agl {
+
+namespace {
+
+struct Allocation {
+  std::string name;
+  size_t bytes;
+};
+
+struct TrackerState {
+  std::mutex mutex;
+  std::map<std::pair<const void*, int>, Allocation> allocations;
+  float interval = 0.0f;  // seconds between prints, 0 for none
+  std::chrono::steady_clock::time_point lastPrint;
+};
+
+// Never destroyed: meshes in static objects may be released during exit
+TrackerState& state() {
+  static TrackerState* theState = new TrackerState();
+  return *theState;
+}
+
+const char* kTypeNames[MemoryTracker::NUM_TYPES] = {
+  "gpu buffers", "gpu textures", "cpu meshes"};
+
+}  // namespace
+
+size_t MemoryTracker::Usage::total() const {
+  size_t sum = 0;
+  for (size_t b : bytes) sum += b;
+  return sum;
+}
+
+void MemoryTracker::track(const void* owner, Type type,
+    const std::string& name, size_t bytes) {
+  TrackerState& s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  s.allocations[std::make_pair(owner, static_cast<int>(type))] =
+    Allocation{name, bytes};
+}
+
+void MemoryTracker::release(const void* owner, Type type) {
+  TrackerState& s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  s.allocations.erase(std::make_pair(owner, static_cast<int>(type)));
+}
+
+void MemoryTracker::release(const void* owner) {
+  TrackerState& s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  // an owner's entries are adjacent, ordered by type
+  auto it = s.allocations.lower_bound(std::make_pair(owner, 0));
+  while (it != s.allocations.end() && it->first.first == owner) {
+    it = s.allocations.erase(it);
+  }
+}
+
+size_t MemoryTracker::total(Type type) {
+  TrackerState& s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  size_t sum = 0;
+  for (const auto& it : s.allocations) {
+    if (it.first.second == type) sum += it.second.bytes;
+  }
+  return sum;
+}
+
+std::vector<MemoryTracker::Usage> MemoryTracker::usage() {
+  std::map<std::string, Usage> byName;
+  {
+    TrackerState& s = state();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    for (const auto& it : s.allocations) {
+      Usage& usage = byName[it.second.name];
+      if (usage.name.empty()) {
+        usage = Usage{it.second.name, {0}};
+      }
+      usage.bytes[it.first.second] += it.second.bytes;
+    }
+  }
+
+  std::vector<Usage> result;
+  for (const auto& it : byName) result.push_back(it.second);
+  std::stable_sort(result.begin(), result.end(),
+      [](const Usage& a, const Usage& b) { return a.total() > b.total(); });
+  return result;
+}
+
+std::string MemoryTracker::format(size_t bytes) {
+  char text[32];
+  if (bytes < 1024) {
+    snprintf(text, sizeof(text), "%d B", static_cast<int>(bytes));
+  } else if (bytes < 1024 * 1024) {
+    snprintf(text, sizeof(text), "%.1f KB", bytes / 1024.0);
+  } else {
+    snprintf(text, sizeof(text), "%.1f MB", bytes / (1024.0 * 1024.0));
+  }
+  return text;
+}
+
+void MemoryTracker::print(std::ostream& out) {
+  std::vector<Usage> all = usage();
+  size_t totals[NUM_TYPES] = {0};
+  size_t width = 4;
+  for (const Usage& u : all) {
+    for (int t = 0; t < NUM_TYPES; t++) totals[t] += u.bytes[t];
+    width = std::max(width, u.name.size());
+  }
+
+  out << "memory:";
+  for (int t = 0; t < NUM_TYPES; t++) {
+    out << (t ? ", " : " ") << format(totals[t]) << " " << kTypeNames[t];
+  }
+  out << "\n";
+  char line[512];
+  width = std::min(width, static_cast<size_t>(400));
+  snprintf(line, sizeof(line), "  %-*s %13s %13s %13s\n",
+      static_cast<int>(width), "name", kTypeNames[0], kTypeNames[1],
+      kTypeNames[2]);
+  out << line;
+  for (const Usage& u : all) {
+    snprintf(line, sizeof(line), "  %-*s %13s %13s %13s\n",
+        static_cast<int>(width), u.name.c_str(), format(u.bytes[0]).c_str(),
+        format(u.bytes[1]).c_str(), format(u.bytes[2]).c_str());
+    out << line;
+  }
+  out.flush();
+}
+
+void MemoryTracker::printEvery(float seconds) {
+  TrackerState& s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  s.interval = std::max(0.0f, seconds);
+  s.lastPrint = std::chrono::steady_clock::now();
+}
+
+void MemoryTracker::update() {
+  TrackerState& s = state();
+  {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (s.interval <= 0.0f) return;
+    auto now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<float>(now - s.lastPrint).count() <
+        s.interval) {
+      return;
+    }
+    s.lastPrint = now;
+  }
+  print();
+}
+
+}  // namespace agl
@@ -0,0 +1,104 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_MEMORYTRACKER_H_
+#define AGL_MEMORYTRACKER_H_
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace agl {
+
+/**
+ * @brief Counts the bytes agl holds in GPU buffers, textures and CPU-side
+ * mesh data, by resource name
+ *
+ * Meshes report their vertex and index buffers when they are created
+ * (named with Mesh::setName(); PLYMesh uses its file name), dynamic meshes
+ * also their CPU copy, PLYMesh its loaded arrays, and Renderer its
+ * textures, render targets and uniform buffers (named by their keys).
+ * Texture sizes are computed from their format, size and mipmaps, so they
+ * are what the driver needs at least rather than what it allocates.
+ *
+ * ```
+ * size_t textures = MemoryTracker::total(MemoryTracker::GPU_TEXTURE);
+ * MemoryTracker::print();          // a table of every resource
+ * MemoryTracker::printEvery(5.0);  // or set AGL_MEMORY=5
+ * ```
+ *
+ * All functions are thread safe.
+ */
+class MemoryTracker {
+ public:
+  enum Type {
+    GPU_BUFFER,   // vertex, index and uniform buffers
+    GPU_TEXTURE,  // textures, cubemaps and render targets
+    CPU_MESH,     // vertex and index arrays kept in main memory
+    NUM_TYPES
+  };
+
+  /**
+   * @brief The bytes of every type held under one name
+   */
+  struct Usage {
+    std::string name;
+    size_t bytes[NUM_TYPES];
+    size_t total() const;
+  };
+
+  /**
+   * @brief Set the bytes of one type that an object holds
+   * @param owner The object, which releases them with release()
+   * @param type The kind of memory
+   * @param name The resource name to attribute the bytes to
+   * @param bytes The size; replaces an earlier value for owner and type
+   */
+  static void track(const void* owner, Type type, const std::string& name,
+      size_t bytes);
+
+  /**
+   * @brief Forget the bytes of one type that owner holds
+   */
+  static void release(const void* owner, Type type);
+
+  /**
+   * @brief Forget all the bytes that owner holds
+   */
+  static void release(const void* owner);
+
+  /**
+   * @brief Return the bytes of one type held by all objects
+   */
+  static size_t total(Type type);
+
+  /**
+   * @brief Return the bytes held under each name, largest total first
+   */
+  static std::vector<Usage> usage();
+
+  /**
+   * @brief Write the totals and a table of usage()
+   */
+  static void print(std::ostream& out = std::cout);
+
+  /**
+   * @brief Print every given number of seconds, or never if 0
+   *
+   * Printing happens in update(), which Window calls every frame.
+   */
+  static void printEvery(float seconds);
+
+  /**
+   * @brief Print if printEvery()'s interval has passed
+   */
+  static void update();
+
+  /**
+   * @brief Return a size as e.g. "1.5 MB"
+   */
+  static std::string format(size_t bytes);
+};
+
+}  // namespace agl
+#endif  // AGL_MEMORYTRACKER_H_
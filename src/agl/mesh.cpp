@@ -1,11 +1,16 @@
 // Copyright, 2020, Savvy Sine, Aline Normoyle
 #include "agl/mesh.h"
+#include <algorithm>
 #include <iostream>
+#include "agl/memorytracker.h"
+#include "agl/trace.h"
 
 using glm::vec4;
 
 namespace agl {
 
+MeshUploadStats Mesh::_uploadStats;
+
 void Mesh::initBuffers(
   std::vector<GLfloat> * points,
   std::vector<GLfloat> * normals,
@@ -14,6 +19,7 @@ void Mesh::initBuffers(
   std::vector<GLfloat> * tangents
 ) {
   if (_initialized) return;
+  TraceZone zone("Mesh::initBuffers", _name);
 
   // Must have data for points
   if (points == nullptr) {
@@ -23,6 +29,8 @@ void Mesh::initBuffers(
 
   _initialized = true;
   _hasUV = (texCoords != nullptr);
+  _hasColor = (colors != nullptr);
+  _hasTangent = (tangents != nullptr);
   _nVerts = points->size() / 3;  // assumes xyz positions
 
   GLuint type = GL_STATIC_DRAW;
@@ -36,21 +44,21 @@ void Mesh::initBuffers(
   }
 
   // The base mesh does not use an indexed buffer but subclasses might
-  // Reserve the first ID for the index buffer, so that buffers are stored
-  // similarly for all subclasses
-  _buffers.push_back(0);
+  // Buffers are stored by attribute, with 0 for missing attributes, so that
+  // buffers are stored similarly for all subclasses
+  _buffers.assign(NUM_ATTRIBUTES, 0);
 
   // Based on OpenGL 4.0 Shading language cookbook (David Wolf)
   GLuint posBuf = 0, normBuf = 0, tcBuf = 0, tangentBuf = 0, cBuf = 0;
   glGenBuffers(1, &posBuf);
-  _buffers.push_back(posBuf);
+  _buffers[POSITION] = posBuf;
   glBindBuffer(GL_ARRAY_BUFFER, posBuf);
   glBufferData(GL_ARRAY_BUFFER,
       points->size() * sizeof(GLfloat), points->data(), type);
 
   if (normals != nullptr) {
     glGenBuffers(1, &normBuf);
-    _buffers.push_back(normBuf);
+    _buffers[NORMAL] = normBuf;
     glBindBuffer(GL_ARRAY_BUFFER, normBuf);
     glBufferData(GL_ARRAY_BUFFER,
         normals->size() * sizeof(GLfloat), normals->data(), type);
@@ -58,7 +66,7 @@ void Mesh::initBuffers(
 
   if (texCoords != nullptr) {
     glGenBuffers(1, &tcBuf);
-    _buffers.push_back(tcBuf);
+    _buffers[UV] = tcBuf;
     glBindBuffer(GL_ARRAY_BUFFER, tcBuf);
     glBufferData(GL_ARRAY_BUFFER,
         texCoords->size() * sizeof(GLfloat), texCoords->data(), type);
@@ -66,7 +74,7 @@ void Mesh::initBuffers(
 
   if (colors != nullptr) {
     glGenBuffers(1, &cBuf);
-    _buffers.push_back(cBuf);
+    _buffers[COLOR] = cBuf;
     glBindBuffer(GL_ARRAY_BUFFER, cBuf);
     glBufferData(GL_ARRAY_BUFFER,
         colors->size() * sizeof(GLfloat), colors->data(), type);
@@ -74,7 +82,7 @@ void Mesh::initBuffers(
 
   if (tangents != nullptr) {
     glGenBuffers(1, &tangentBuf);
-    _buffers.push_back(tangentBuf);
+    _buffers[TANGENT] = tangentBuf;
     glBindBuffer(GL_ARRAY_BUFFER, tangentBuf);
     glBufferData(GL_ARRAY_BUFFER,
         tangents->size() * sizeof(GLfloat), tangents->data(), type);
@@ -115,16 +123,36 @@ void Mesh::initBuffers(
   }
 
   glBindVertexArray(0);
+
+  size_t floats = points->size();
+  for (std::vector<GLfloat>* v : {normals, texCoords, colors, tangents}) {
+    if (v != nullptr) floats += v->size();
+  }
+  trackMemory(floats * sizeof(GLfloat));
 }
 
 Mesh::~Mesh() {
   deleteBuffers();
+  MemoryTracker::release(this);
+}
+
+void Mesh::trackMemory(size_t bufferBytes) const {
+  const std::string& name = _name.empty() ? "unnamed mesh" : _name;
+  MemoryTracker::track(this, MemoryTracker::GPU_BUFFER, name, bufferBytes);
+  size_t dataBytes = 0;
+  for (const std::vector<GLfloat>& data : _data) {
+    dataBytes += data.capacity() * sizeof(GLfloat);
+  }
+  if (dataBytes > 0) {
+    MemoryTracker::track(this, MemoryTracker::CPU_MESH, name, dataBytes);
+  }
 }
 
 void Mesh::deleteBuffers() {
   if (_buffers.size() > 0) {
     glDeleteBuffers((GLsizei)_buffers.size(), _buffers.data());
     _buffers.clear();
+    MemoryTracker::release(this, MemoryTracker::GPU_BUFFER);
   }
 
   if (_vao != 0) {
@@ -157,6 +185,36 @@ void Mesh::setVertexData(VertexAttribute type,
   if (stride >= 4) {
     _data[type][vertexId*stride + 3] = pos.w;
   }
+
+  DirtyRange& dirty = _dirty[type];
+  if (dirty.first > dirty.last) {
+    dirty.first = dirty.last = vertexId;
+  } else {
+    dirty.first = std::min(dirty.first, vertexId);
+    dirty.last = std::max(dirty.last, vertexId);
+  }
+}
+
+void Mesh::uploadDirty() const {
+  bool uploaded = false;
+  for (int i = POSITION; i < NUM_ATTRIBUTES; i++) {
+    DirtyRange& dirty = _dirty[i];
+    if (dirty.first > dirty.last || _buffers[i] == 0) continue;
+
+    int stride = _data[i].size() / _nVerts;
+    GLintptr offset = dirty.first * stride * sizeof(GLfloat);
+    GLsizeiptr size = (dirty.last - dirty.first + 1) * stride * sizeof(GLfloat);
+
+    glBindBuffer(GL_ARRAY_BUFFER, _buffers[i]);
+    glBufferSubData(GL_ARRAY_BUFFER, offset, size,
+        _data[i].data() + dirty.first * stride);
+    _uploadStats.bytes += size;
+    _uploadStats.uploads++;
+    uploaded = true;
+
+    dirty = DirtyRange();
+  }
+  if (!uploaded) _uploadStats.skipped++;
 }
 
 vec4 Mesh::vertexData(VertexAttribute type, int vertexId) const {
@@ -2,12 +2,24 @@
 #ifndef AGL_MESH_H_
 #define AGL_MESH_H_
 
+#include <string>
 #include <vector>
 #include "agl/agl.h"
 #include "agl/aglm.h"
 
 namespace agl {
 
+/**
+ * @brief Counters for vertex data sent to the GPU by dynamic meshes
+ *
+ * @see Mesh::uploadStats()
+ */
+struct MeshUploadStats {
+  unsigned long bytes = 0;    // bytes sent with glBufferSubData
+  unsigned long uploads = 0;  // glBufferSubData calls
+  unsigned long skipped = 0;  // renders with nothing to upload
+};
+
 /**
  * @brief Base class for meshes
  * 
@@ -31,16 +43,44 @@ class Mesh {
    */ 
   virtual void render() const = 0;
 
+  /**
+   * @brief Create the vertex buffers now instead of on the first render
+   */
+  void prepare() const {
+    if (!_initialized) const_cast<Mesh*>(this)->init();
+  }
+
   /**
    * @brief Return the vertex array object corresponding to this mesh
    */ 
   GLuint vao() const { return _vao; }
 
+  /**
+   * @brief Set the name that MemoryTracker reports this mesh's memory
+   * under; call before the mesh is first drawn
+   */
+  void setName(const std::string& name) { _name = name; }
+
+  /**
+   * @brief Return the name given with setName()
+   */
+  const std::string& name() const { return _name; }
+
   /**
    * @brief Return whether this mesh has UV coordinates defined.
    */ 
   bool hasUV() const { return _hasUV; }
 
+  /**
+   * @brief Return whether this mesh has per-vertex colors defined.
+   */
+  bool hasColor() const { return _hasColor; }
+
+  /**
+   * @brief Return whether this mesh has tangents defined.
+   */
+  bool hasTangent() const { return _hasTangent; }
+
   /**
    * @brief Query whether or not this is a dynamic mesh
    * 
@@ -56,14 +96,40 @@ class Mesh {
    */
   bool isDynamic() const { return _isDynamic; }
 
+  /**
+   * @brief Return the amount of dynamic vertex data uploaded so far
+   *
+   * Dynamic meshes only upload the vertex range changed with setVertexData
+   * since the last render. The counters are shared by all meshes.
+   * @see resetUploadStats()
+   */
+  static MeshUploadStats uploadStats() { return _uploadStats; }
+
+  /**
+   * @brief Reset the upload counters to zero
+   * @see uploadStats()
+   */
+  static void resetUploadStats() { _uploadStats = MeshUploadStats(); }
+
  protected:
   GLuint _nVerts = 0;      // Number of unique vertices
   GLuint _vao = 0;         // The Vertex Array Object
   bool _hasUV = false;
+  bool _hasColor = false;
+  bool _hasTangent = false;
   bool _isDynamic = false;
   bool _initialized = false;
-  std::vector<GLuint> _buffers;   // vertex buffers
+  std::vector<GLuint> _buffers;   // vertex buffers, indexed by attribute
   std::vector<GLfloat> _data[6];  // State for dynamic meshes
+  std::string _name;
+
+  // Range of vertices changed since the last upload (empty if first > last)
+  struct DirtyRange {
+    int first = 0;
+    int last = -1;
+  };
+  mutable DirtyRange _dirty[6];
+  static MeshUploadStats _uploadStats;
   enum VertexAttribute {
     INDEX = 0,
     POSITION,
@@ -159,6 +225,16 @@ class Mesh {
     std::vector<GLfloat>* tangents = nullptr);
 
   virtual void deleteBuffers();
+
+  // Report the vertex buffers' bytes and _data to MemoryTracker
+  void trackMemory(size_t bufferBytes) const;
+
+  /**
+   * @brief Upload the vertex ranges changed with setVertexData
+   *
+   * Called from render() for dynamic meshes. The vertex array should be bound.
+   */
+  void uploadDirty() const;
 };
 
 }  // namespace agl
@@ -12,15 +12,7 @@ void PointMesh::render() const {
 
   glBindVertexArray(_vao);
 
-  if (_isDynamic) {
-    for (int i = 1; i < NUM_ATTRIBUTES; i++) {
-      if (_data[i].size() > 0) {
-        glBindBuffer(GL_ARRAY_BUFFER, _buffers[i]);
-        glBufferData(GL_ARRAY_BUFFER, _data[i].size() * sizeof(GLfloat),
-            _data[i].data(), GL_DYNAMIC_DRAW);
-      }
-    }
-  }
+  if (_isDynamic) uploadDirty();
 
   glDrawArrays(GL_POINTS, 0, _nVerts * 3);
   glBindVertexArray(0);
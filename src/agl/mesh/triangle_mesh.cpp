@@ -1,6 +1,7 @@
 // Copyright, 2020, Savvy Sine, Aline Normoyle
 #include "agl/mesh/triangle_mesh.h"
 #include <iostream>
+#include "agl/trace.h"
 
 using glm::vec4;
 
@@ -14,6 +15,7 @@ void TriangleMesh::initBuffers(
   std::vector<GLfloat> * tangents
 ) {
   if (_initialized) return;
+  TraceZone zone("TriangleMesh::initBuffers", _name);
 
   // Must have data for indices, points, and normals
   if (indices == nullptr || points == nullptr || normals == nullptr) {
@@ -24,6 +26,7 @@ void TriangleMesh::initBuffers(
 
   _initialized = true;
   _hasUV = (texCoords != nullptr);
+  _hasTangent = (tangents != nullptr);
   _nIndices = (GLuint)indices->size();
   _nVerts = points->size() / 3;  // assumes xyz positions
 
@@ -37,28 +40,29 @@ void TriangleMesh::initBuffers(
   }
 
   // Based on OpenGL 4.0 Shading language cookbook (David Wolf)
+  _buffers.assign(NUM_ATTRIBUTES, 0);
   GLuint indexBuf = 0, posBuf = 0, normBuf = 0, tcBuf = 0, tangentBuf = 0;
   glGenBuffers(1, &indexBuf);
-  _buffers.push_back(indexBuf);
+  _buffers[INDEX] = indexBuf;
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuf);
   glBufferData(GL_ELEMENT_ARRAY_BUFFER,
       indices->size() * sizeof(GLuint), indices->data(), type);
 
   glGenBuffers(1, &posBuf);
-  _buffers.push_back(posBuf);
+  _buffers[POSITION] = posBuf;
   glBindBuffer(GL_ARRAY_BUFFER, posBuf);
   glBufferData(GL_ARRAY_BUFFER,
       points->size() * sizeof(GLfloat), points->data(), type);
 
   glGenBuffers(1, &normBuf);
-  _buffers.push_back(normBuf);
+  _buffers[NORMAL] = normBuf;
   glBindBuffer(GL_ARRAY_BUFFER, normBuf);
   glBufferData(GL_ARRAY_BUFFER,
       normals->size() * sizeof(GLfloat), normals->data(), type);
 
   if (texCoords != nullptr) {
     glGenBuffers(1, &tcBuf);
-    _buffers.push_back(tcBuf);
+    _buffers[UV] = tcBuf;
     glBindBuffer(GL_ARRAY_BUFFER, tcBuf);
     glBufferData(GL_ARRAY_BUFFER,
         texCoords->size() * sizeof(GLfloat), texCoords->data(), type);
@@ -66,7 +70,7 @@ void TriangleMesh::initBuffers(
 
   if (tangents != nullptr) {
     glGenBuffers(1, &tangentBuf);
-    _buffers.push_back(tangentBuf);
+    _buffers[TANGENT] = tangentBuf;
     glBindBuffer(GL_ARRAY_BUFFER, tangentBuf);
     glBufferData(GL_ARRAY_BUFFER,
         tangents->size() * sizeof(GLfloat), tangents->data(), type);
@@ -101,6 +105,11 @@ void TriangleMesh::initBuffers(
   }
 
   glBindVertexArray(0);
+
+  size_t floats = points->size() + normals->size();
+  if (texCoords != nullptr) floats += texCoords->size();
+  if (tangents != nullptr) floats += tangents->size();
+  trackMemory(indices->size() * sizeof(GLuint) + floats * sizeof(GLfloat));
 }
 
 void TriangleMesh::render() const {
@@ -109,15 +118,7 @@ void TriangleMesh::render() const {
 
   glBindVertexArray(_vao);
 
-  if (_isDynamic) {
-    for (int i = 1; i < NUM_ATTRIBUTES; i++) {
-      if (_data[i].size() > 0) {
-        glBindBuffer(GL_ARRAY_BUFFER, _buffers[i]);
-        glBufferData(GL_ARRAY_BUFFER, _data[i].size() * sizeof(GLfloat),
-            _data[i].data(), GL_DYNAMIC_DRAW);
-      }
-    }
-  }
+  if (_isDynamic) uploadDirty();
 
   glDrawElements(GL_TRIANGLES, _nIndices, GL_UNSIGNED_INT, 0);
   glBindVertexArray(0);
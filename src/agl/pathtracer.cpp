@@ -0,0 +1,348 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/pathtracer.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include "agl/threadpool.h"
+
+using glm::mat3;
+using glm::mat4;
+using glm::vec2;
+using glm::vec3;
+using glm::vec4;
+
+namespace agl {
+
+namespace {
+
+const int kTileSize = 16;
+
+// the uvScale constant of the GL shaders
+const float kUVScale = 3.0f;
+
+// Paths stop at random after this many bounces, in proportion to how
+// little light they still carry
+const int kRouletteBounces = 2;
+
+inline uint32_t hash(uint32_t x) {
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+// Small generator with a state per pixel and pass, so the image does not
+// depend on which thread traced which tile
+struct Random {
+  uint32_t state;
+  float next() {
+    state = state * 747796405u + 2891336453u;
+    return (hash(state) >> 8) * (1.0f / 16777216.0f);
+  }
+};
+
+// A direction around n with probability cos(theta) / pi
+vec3 cosineDirection(const vec3& n, Random* random) {
+  float r = std::sqrt(random->next());
+  float phi = 2.0f * static_cast<float>(M_PI) * random->next();
+  vec3 tangent = std::fabs(n.x) > 0.5f ? vec3(0, 1, 0) : vec3(1, 0, 0);
+  tangent = glm::normalize(glm::cross(tangent, n));
+  vec3 bitangent = glm::cross(n, tangent);
+  return r * std::cos(phi) * tangent + r * std::sin(phi) * bitangent +
+    std::sqrt(std::max(0.0f, 1.0f - r * r)) * n;
+}
+
+}  // namespace
+
+PathTracer::PathTracer(int numThreads) :
+  _width(1),
+  _height(1),
+  _background(0.0f),
+  _eye(0.0f),
+  _forward(0, 0, -1),
+  _right(1, 0, 0),
+  _up(0, 1, 0),
+  _tanHalfFov(std::tan(glm::radians(30.0f))),
+  _aspect(1.0f),
+  _near(0.1f),
+  _far(1000.0f),
+  _lightPos(0, 0, 0, 1),
+  _lightIntensity(1.0f),
+  _bounces(2),
+  _sceneChanged(false),
+  _epsilon(1e-4f),
+  _samples(0),
+  _rays(0),
+  _imageDirty(true) {
+  if (numThreads <= 0) {
+    numThreads = static_cast<int>(std::thread::hardware_concurrency());
+  }
+  // the calling thread traces too
+  if (numThreads > 1) _pool.reset(new ThreadPool(numThreads - 1));
+  resize(1, 1);
+}
+
+PathTracer::~PathTracer() {
+}
+
+int PathTracer::numThreads() const {
+  return _pool ? _pool->size() + 1 : 1;
+}
+
+void PathTracer::resize(int width, int height) {
+  _width = std::max(width, 1);
+  _height = std::max(height, 1);
+  _image = Image(_width, _height);
+  restart();
+}
+
+void PathTracer::background(const vec3& color) {
+  _background = color;
+  restart();
+}
+
+void PathTracer::perspective(float fovRadians, float aspect, float near,
+    float far) {
+  _tanHalfFov = std::tan(fovRadians * 0.5f);
+  _aspect = aspect;
+  _near = near;
+  _far = far;
+  restart();
+}
+
+void PathTracer::lookAt(const vec3& lookfrom, const vec3& lookat,
+    const vec3& up) {
+  _eye = lookfrom;
+  _forward = glm::normalize(lookat - lookfrom);
+  _right = glm::normalize(glm::cross(_forward, up));
+  _up = glm::cross(_right, _forward);
+  restart();
+}
+
+void PathTracer::setLight(const vec4& pos, const vec3& intensity) {
+  _lightPos = pos;
+  _lightIntensity = intensity;
+  restart();
+}
+
+void PathTracer::setBounces(int bounces) {
+  _bounces = std::max(bounces, 0);
+  restart();
+}
+
+void PathTracer::addMesh(const std::vector<float>& positions,
+    const std::vector<float>& normals,
+    const std::vector<float>& texCoords,
+    const std::vector<unsigned int>& indices,
+    const mat4& transform, const Material& material) {
+  size_t numVertices = positions.size() / 3;
+  bool hasNormals = normals.size() >= numVertices * 3;
+  bool hasUV = texCoords.size() >= numVertices * 2;
+  mat3 normalMatrix = glm::transpose(glm::inverse(mat3(transform)));
+  unsigned int base = static_cast<unsigned int>(_positions.size() / 3);
+  for (size_t i = 0; i < numVertices; i++) {
+    vec3 p = vec3(transform * vec4(positions[i * 3], positions[i * 3 + 1],
+        positions[i * 3 + 2], 1.0f));
+    _positions.push_back(p.x);
+    _positions.push_back(p.y);
+    _positions.push_back(p.z);
+    _normals.push_back(hasNormals ? glm::normalize(normalMatrix *
+        vec3(normals[i * 3], normals[i * 3 + 1], normals[i * 3 + 2])) :
+        vec3(0.0f));
+    _texCoords.push_back(hasUV ?
+        vec2(texCoords[i * 2], texCoords[i * 2 + 1]) : vec2(0.0f));
+  }
+  for (unsigned int index : indices) _indices.push_back(base + index);
+
+  Material meshMaterial = material;
+  if (!hasUV) meshMaterial.texture = 0;
+  _materials.push_back(meshMaterial);
+  _triangleMaterials.resize(_indices.size() / 3,
+      static_cast<int>(_materials.size()) - 1);
+  _sceneChanged = true;
+  restart();
+}
+
+void PathTracer::clearScene() {
+  _positions.clear();
+  _normals.clear();
+  _texCoords.clear();
+  _indices.clear();
+  _triangleMaterials.clear();
+  _materials.clear();
+  _sceneChanged = true;
+  restart();
+}
+
+void PathTracer::restart() {
+  _sum.assign(static_cast<size_t>(_width) * _height, vec3(0.0f));
+  _samples = 0;
+  _rays = 0;
+  _imageDirty = true;
+}
+
+void PathTracer::renderPass() {
+  if (_sceneChanged) {
+    _bvh.build(_positions, _indices);
+    float size = glm::length(_bvh.maxBounds() - _bvh.minBounds());
+    _epsilon = std::max(size * 1e-5f, 1e-6f);
+    _sceneChanged = false;
+  }
+  int tilesX = (_width + kTileSize - 1) / kTileSize;
+  int tilesY = (_height + kTileSize - 1) / kTileSize;
+  parallelFor(tilesX * tilesY, _pool.get(), [this](int tile) {
+    traceTile(tile);
+  });
+  _samples++;
+  _imageDirty = true;
+}
+
+void PathTracer::traceTile(int tile) {
+  int tilesX = (_width + kTileSize - 1) / kTileSize;
+  int x0 = (tile % tilesX) * kTileSize;
+  int y0 = (tile / tilesX) * kTileSize;
+  int x1 = std::min(x0 + kTileSize, _width);
+  int y1 = std::min(y0 + kTileSize, _height);
+  uint32_t passSeed = hash(static_cast<uint32_t>(_samples) * 0x9e3779b9u);
+  int64_t rays = 0;
+  for (int y = y0; y < y1; y++) {
+    for (int x = x0; x < x1; x++) {
+      int pixel = y * _width + x;
+      uint32_t seed = hash(static_cast<uint32_t>(pixel) ^ passSeed);
+
+      // the first pass samples pixel centers, like the GL image
+      float jx = 0.5f, jy = 0.5f;
+      if (_samples > 0) {
+        Random random = {seed};
+        jx = random.next();
+        jy = random.next();
+      }
+      float sx = (2.0f * (x + jx) / _width - 1.0f) * _tanHalfFov * _aspect;
+      float sy = (2.0f * (y + jy) / _height - 1.0f) * _tanHalfFov;
+      Ray ray;
+      ray.origin = _eye;
+      ray.direction = glm::normalize(_forward + sx * _right + sy * _up);
+      ray.tMin = _near;
+      ray.tMax = _far / glm::dot(ray.direction, _forward);
+      _sum[pixel] += trace(ray, hash(seed), &rays);
+    }
+  }
+  _rays += rays;
+}
+
+vec3 PathTracer::trace(const Ray& cameraRay, uint32_t seed,
+    int64_t* rays) const {
+  Random random = {seed};
+  vec3 radiance(0.0f);
+  vec3 throughput(1.0f);
+  Ray ray = cameraRay;
+  for (int bounce = 0; ; bounce++) {
+    RayHit hit;
+    (*rays)++;
+    if (!_bvh.intersect(ray, &hit)) {
+      radiance += throughput * _background;
+      break;
+    }
+
+    unsigned int i0 = _indices[hit.triangle * 3];
+    unsigned int i1 = _indices[hit.triangle * 3 + 1];
+    unsigned int i2 = _indices[hit.triangle * 3 + 2];
+    auto position = [this](unsigned int i) {
+      return vec3(_positions[i * 3], _positions[i * 3 + 1],
+          _positions[i * 3 + 2]);
+    };
+    vec3 p0 = position(i0);
+    vec3 geometricNormal = glm::normalize(
+        glm::cross(position(i1) - p0, position(i2) - p0));
+    float w = 1.0f - hit.u - hit.v;
+    vec3 n = _normals[i0] * w + _normals[i1] * hit.u + _normals[i2] * hit.v;
+    n = glm::dot(n, n) > 0.0f ? glm::normalize(n) : geometricNormal;
+    // both sides are lit, from the side the ray came from
+    if (glm::dot(geometricNormal, ray.direction) > 0.0f) {
+      geometricNormal = -geometricNormal;
+    }
+    if (glm::dot(n, geometricNormal) < 0.0f) n = -n;
+
+    const Material& material = _materials[_triangleMaterials[hit.triangle]];
+    vec3 diffuseTexture(1.0f);
+    if (material.texture) {
+      vec2 uv = _texCoords[i0] * w + _texCoords[i1] * hit.u +
+        _texCoords[i2] * hit.v;
+      diffuseTexture = vec3(material.texture->sample(uv * kUVScale));
+    }
+
+    // phong() of phong-pixel.fs, in world coordinates, with a shadow ray
+    vec3 p = ray.origin + hit.t * ray.direction;
+    vec3 origin = p + geometricNormal * _epsilon;
+    Ray shadow;
+    shadow.origin = origin;
+    shadow.tMin = 0.0f;
+    if (_lightPos.w == 0.0f) {
+      shadow.direction = glm::normalize(vec3(_lightPos));
+      shadow.tMax = _far;
+    } else {
+      shadow.direction = vec3(_lightPos) - origin;
+      shadow.tMax = 1.0f;  // the light's position
+    }
+    vec3 s = glm::normalize(shadow.direction);
+    float sDotn = std::max(glm::dot(s, n), 0.0f);
+    vec3 ambient = _bounces == 0 ? _lightIntensity * material.Ka : vec3(0.0f);
+    vec3 diffuse(0.0f);
+    vec3 specular(0.0f);
+    if (sDotn > 0.0f && glm::dot(s, geometricNormal) > 0.0f) {
+      (*rays)++;
+      if (!_bvh.occluded(shadow)) {
+        vec3 v = -glm::normalize(ray.direction);
+        vec3 r = 2.0f * sDotn * n - s;
+        diffuse = _lightIntensity * material.Kd * sDotn;
+        specular = _lightIntensity * material.Ks *
+          std::pow(std::max(glm::dot(r, v), 0.0f), material.alpha);
+      }
+    }
+    radiance += throughput * ((ambient + diffuse) * diffuseTexture +
+        specular);
+
+    if (bounce >= _bounces) break;
+
+    // Sampling the cosine-weighted hemisphere cancels the cosine and pi of
+    // a Lambert surface, leaving the diffuse color as the weight
+    throughput *= material.Kd * diffuseTexture;
+    if (bounce >= kRouletteBounces) {
+      float survive = std::min(0.95f, std::max(throughput.x,
+          std::max(throughput.y, throughput.z)));
+      if (random.next() >= survive) break;
+      throughput /= survive;
+    }
+    ray.origin = origin;
+    ray.direction = cosineDirection(n, &random);
+    if (glm::dot(ray.direction, geometricNormal) <= 0.0f) break;
+    ray.tMin = 0.0f;
+    ray.tMax = _far;
+  }
+  return radiance;
+}
+
+const Image& PathTracer::image() {
+  if (_imageDirty) {
+    float scale = _samples > 0 ? 1.0f / _samples : 0.0f;
+    unsigned char* data = _image.data();
+    parallelFor(_height, _pool.get(), [this, data, scale](int y) {
+      for (int x = 0; x < _width; x++) {
+        vec3 c = glm::clamp(_sum[y * _width + x] * scale, vec3(0.0f),
+            vec3(1.0f)) * 255.0f + 0.5f;
+        unsigned char* pixel = data + (y * _width + x) * 4;
+        pixel[0] = static_cast<unsigned char>(c.x);
+        pixel[1] = static_cast<unsigned char>(c.y);
+        pixel[2] = static_cast<unsigned char>(c.z);
+        pixel[3] = 255;
+      }
+    });
+    _imageDirty = false;
+  }
+  return _image;
+}
+
+}  // namespace agl
@@ -0,0 +1,206 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_PATHTRACER_H_
+#define AGL_PATHTRACER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "agl/aglm.h"
+#include "agl/bvh.h"
+#include "agl/image.h"
+
+namespace agl {
+
+class ThreadPool;
+
+/**
+ * @brief Ray traces triangle meshes on the CPU, for reference images
+ *
+ * Meshes are lit by one point or directional light with the Phong model of
+ * the GL shaders (the Ka, Kd, Ks and alpha of a MaterialBlock), plus hard
+ * shadows and diffuse light bounced between surfaces. With no bounces the
+ * image matches phong-pixel apart from the shadows, which makes it a
+ * reference for checking the shaders.
+ *
+ * Each call to renderPass() adds one jittered sample per pixel to the
+ * running average, so the image refines progressively. The image is split
+ * into 16x16 tiles which the threads take one at a time, and rays are cast
+ * against one BVH over every mesh, in world coordinates.
+ *
+ * ```
+ * PathTracer tracer;
+ * tracer.resize(640, 480);
+ * tracer.perspective(glm::radians(60.0f), 640.0f / 480.0f, 0.1f, 100.0f);
+ * tracer.lookAt(vec3(0, 0, 10), vec3(0));
+ * tracer.setLight(vec4(0, 10, 10, 1), vec3(0.9f));
+ * tracer.addMesh(positions, normals, texCoords, indices, mat4(1.0f),
+ *     material);
+ * for (int i = 0; i < 64; i++) tracer.renderPass();
+ * tracer.image().save("reference.png");
+ * ```
+ *
+ * Changing the camera, light, size or scene restarts the average. Images
+ * are stored bottom row first, like pixels read from GL.
+ */
+class PathTracer {
+ public:
+  /**
+   * @brief The fields of mesh-viewer's MaterialBlock, and the diffuse
+   * texture
+   */
+  struct Material {
+    glm::vec3 Ka;
+    glm::vec3 Kd;
+    glm::vec3 Ks;
+    float alpha;
+    const Image* texture;  // or 0; sampled with the shaders' uvScale
+  };
+
+  /**
+   * @brief Create a tracer with a 1x1 image
+   * @param numThreads The number of threads to trace with, or 0 for one
+   * per core
+   */
+  explicit PathTracer(int numThreads = 0);
+  virtual ~PathTracer();
+
+  /**
+   * @brief Set the size of the image
+   */
+  void resize(int width, int height);
+
+  int width() const { return _width; }
+  int height() const { return _height; }
+
+  /**
+   * @brief Return the number of threads that trace
+   */
+  int numThreads() const;
+
+  /**
+   * @brief Set the color of rays that leave the scene
+   */
+  void background(const glm::vec3& color);
+
+  /** @name Camera
+   * @see Renderer
+   */
+  ///@{
+  void perspective(float fovRadians, float aspect, float near, float far);
+  void lookAt(const glm::vec3& lookfrom, const glm::vec3& lookat,
+      const glm::vec3& up = glm::vec3(0, 1, 0));
+  ///@}
+
+  /**
+   * @brief Set the light
+   * @param pos The position in world coordinates, or a direction towards
+   * the light when w is 0
+   */
+  void setLight(const glm::vec4& pos, const glm::vec3& intensity);
+
+  /**
+   * @brief Set how many times rays bounce off diffuse surfaces
+   *
+   * 0 traces direct light only, plus the constant ambient term (Ka) of the
+   * GL shaders. With bounces, light reflected by other surfaces replaces
+   * the ambient term.
+   */
+  void setBounces(int bounces);
+
+  /**
+   * @brief Add a mesh to the scene
+   * @param positions x, y, z per vertex
+   * @param normals x, y, z per vertex, or empty for flat shading
+   * @param texCoords s, t per vertex, or empty
+   * @param indices Three vertex indices per triangle
+   * @param transform The mesh's model matrix
+   */
+  void addMesh(const std::vector<float>& positions,
+      const std::vector<float>& normals,
+      const std::vector<float>& texCoords,
+      const std::vector<unsigned int>& indices,
+      const glm::mat4& transform, const Material& material);
+
+  /**
+   * @brief Remove every mesh
+   */
+  void clearScene();
+
+  /**
+   * @brief Add one sample per pixel to the image
+   *
+   * The first pass after a change rebuilds the BVH when the scene changed.
+   */
+  void renderPass();
+
+  /**
+   * @brief Return the number of samples per pixel so far
+   */
+  int samples() const { return _samples; }
+
+  /**
+   * @brief Return the rays cast (camera, bounce and shadow rays) since
+   * the average restarted
+   */
+  int64_t rays() const { return _rays; }
+
+  /**
+   * @brief Return the average of the samples so far, bottom row first
+   */
+  const Image& image();
+
+  /**
+   * @brief Return the BVH over the scene, as of the last pass
+   */
+  const BVH& bvh() const { return _bvh; }
+
+ private:
+  glm::vec3 trace(const Ray& cameraRay, uint32_t seed, int64_t* rays) const;
+  void traceTile(int tile);
+  void restart();
+
+  int _width;
+  int _height;
+  glm::vec3 _background;
+
+  // camera, in world coordinates
+  glm::vec3 _eye;
+  glm::vec3 _forward;
+  glm::vec3 _right;
+  glm::vec3 _up;
+  float _tanHalfFov;
+  float _aspect;
+  float _near;
+  float _far;
+
+  glm::vec4 _lightPos;
+  glm::vec3 _lightIntensity;
+  int _bounces;
+
+  // the scene in world coordinates, flattened into one mesh
+  std::vector<float> _positions;
+  std::vector<glm::vec3> _normals;  // zero when the mesh had none
+  std::vector<glm::vec2> _texCoords;  // zero when the mesh had none
+  std::vector<unsigned int> _indices;
+  std::vector<int> _triangleMaterials;
+  std::vector<Material> _materials;
+  BVH _bvh;
+  bool _sceneChanged;
+  float _epsilon;  // offset of secondary ray origins, from the scene size
+
+  std::vector<glm::vec3> _sum;  // of the samples per pixel
+  int _samples;
+  std::atomic<int64_t> _rays;
+  bool _imageDirty;
+  Image _image;
+
+  std::unique_ptr<ThreadPool> _pool;
+
+  PathTracer(const PathTracer&) = delete;
+  PathTracer& operator=(const PathTracer&) = delete;
+};
+
+}  // namespace agl
+#endif  // AGL_PATHTRACER_H_
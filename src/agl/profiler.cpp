@@ -0,0 +1,291 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace agl {
+
+static float millisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<float, std::milli>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+const int Profiler::kWindow;
+
+// Upper edges of the histogram bins in milliseconds, around common frame
+// budgets; the last bin holds everything slower
+static const float kHistogramEdges[] = {0.5f, 1.0f, 2.0f, 4.0f, 8.0f,
+  16.7f, 33.3f, 50.0f, 100.0f};
+static const int kNumEdges = 9;
+
+// The nearest rank percentile of sorted values, as in Samples
+static float sortedPercentile(const std::vector<float>& sorted, float p) {
+  int count = static_cast<int>(sorted.size());
+  int k = std::min(count - 1, static_cast<int>(std::ceil(p * count)) - 1);
+  return sorted[std::max(k, 0)];
+}
+
+static void writeStats(FILE* file, const std::vector<float>& values) {
+  fprintf(file, "{\"count\": %d", static_cast<int>(values.size()));
+  if (values.empty()) {
+    fprintf(file, "}");
+    return;
+  }
+  std::vector<float> sorted(values);
+  std::sort(sorted.begin(), sorted.end());
+  double sum = 0;
+  int bins[kNumEdges + 1] = {0};
+  for (float ms : sorted) {
+    sum += ms;
+    int bin = 0;
+    while (bin < kNumEdges && ms > kHistogramEdges[bin]) bin++;
+    bins[bin]++;
+  }
+  fprintf(file, ", \"mean\": %.4f, \"min\": %.4f, \"p50\": %.4f, "
+      "\"p90\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f",
+      sum / sorted.size(), sorted.front(), sortedPercentile(sorted, 0.5f),
+      sortedPercentile(sorted, 0.9f), sortedPercentile(sorted, 0.95f),
+      sortedPercentile(sorted, 0.99f), sorted.back());
+  fprintf(file, ", \"histogram\": {\"upper_ms\": [");
+  for (int i = 0; i < kNumEdges; i++) {
+    fprintf(file, "%s%g", i ? ", " : "", kHistogramEdges[i]);
+  }
+  fprintf(file, ", null], \"counts\": [");
+  for (int i = 0; i <= kNumEdges; i++) {
+    fprintf(file, "%s%d", i ? ", " : "", bins[i]);
+  }
+  fprintf(file, "]}}");
+}
+
+static void writeValues(FILE* file, const std::vector<float>& values) {
+  fprintf(file, "[");
+  for (size_t i = 0; i < values.size(); i++) {
+    fprintf(file, "%s%.4f", i ? ", " : "", values[i]);
+  }
+  fprintf(file, "]");
+}
+
+Profiler::Samples::Samples() : _values(kWindow, 0.0f), _count(0), _next(0),
+  _keepHistory(false) {
+}
+
+void Profiler::Samples::add(float ms) {
+  if (_keepHistory) _history.push_back(ms);
+  _values[_next] = ms;
+  _next = (_next + 1) % kWindow;
+  _count = std::min(_count + 1, kWindow);
+}
+
+float Profiler::Samples::last() const {
+  if (_count == 0) return 0.0f;
+  return _values[(_next + kWindow - 1) % kWindow];
+}
+
+float Profiler::Samples::percentile(float p) const {
+  if (_count == 0) return 0.0f;
+  // the newest _count values end just before _next
+  std::vector<float> sorted(_count);
+  for (int i = 0; i < _count; i++) {
+    sorted[i] = _values[(_next + kWindow - _count + i) % kWindow];
+  }
+  int k = std::min(_count - 1,
+      static_cast<int>(std::ceil(p * _count)) - 1);
+  k = std::max(k, 0);
+  std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+  return sorted[k];
+}
+
+Profiler::Profiler() : _current(0), _inFrame(false), _frameDrawCalls(0),
+  _keepHistory(false) {
+  _frame.name = "frame";
+  _frame.depth = 0;
+  _frame.drawCalls = 0;
+}
+
+Profiler::~Profiler() {
+}
+
+void Profiler::keepHistory(bool keep) {
+  _keepHistory = keep;
+  _frame.cpu.keepHistory(keep);
+  _frame.gpu.keepHistory(keep);
+  for (Pass& pass : _passes) {
+    pass.cpu.keepHistory(keep);
+    pass.gpu.keepHistory(keep);
+  }
+}
+
+bool Profiler::save(const std::string& filename,
+    const std::vector<float>& wallTimes, bool frameTimes) const {
+  FILE* file = fopen(filename.c_str(), "w");
+  if (!file) return false;
+  fprintf(file, "{\n  \"frames\": %d,\n  \"frame\": {\n",
+      static_cast<int>(_frame.cpu.history().size()));
+  if (!wallTimes.empty()) {
+    fprintf(file, "    \"wall_ms\": ");
+    writeStats(file, wallTimes);
+    fprintf(file, ",\n");
+  }
+  fprintf(file, "    \"cpu_ms\": ");
+  writeStats(file, _frame.cpu.history());
+  fprintf(file, ",\n    \"gpu_ms\": ");
+  writeStats(file, _frame.gpu.history());
+  if (frameTimes) {
+    if (!wallTimes.empty()) {
+      fprintf(file, ",\n    \"wall_frame_ms\": ");
+      writeValues(file, wallTimes);
+    }
+    fprintf(file, ",\n    \"cpu_frame_ms\": ");
+    writeValues(file, _frame.cpu.history());
+    fprintf(file, ",\n    \"gpu_frame_ms\": ");
+    writeValues(file, _frame.gpu.history());
+  }
+  fprintf(file, "\n  },\n  \"passes\": [");
+  for (size_t i = 0; i < _passes.size(); i++) {
+    fprintf(file, "%s\n    {\"name\": \"%s\", \"depth\": %d,\n",
+        i ? "," : "", _passes[i].name.c_str(), _passes[i].depth);
+    fprintf(file, "     \"cpu_ms\": ");
+    writeStats(file, _passes[i].cpu.history());
+    fprintf(file, ",\n     \"gpu_ms\": ");
+    writeStats(file, _passes[i].gpu.history());
+    fprintf(file, "}");
+  }
+  fprintf(file, "\n  ]\n}\n");
+  return fclose(file) == 0;
+}
+
+void Profiler::cleanup() {
+  for (FrameQueries& frame : _queries) {
+    if (!frame.queries.empty()) {
+      glDeleteQueries(static_cast<GLsizei>(frame.queries.size()),
+          frame.queries.data());
+    }
+    frame.queries.clear();
+    frame.records.clear();
+    frame.used = 0;
+  }
+}
+
+GLuint Profiler::nextQuery() {
+  FrameQueries& frame = _queries[_current];
+  if (frame.used == static_cast<int>(frame.queries.size())) {
+    GLuint query;
+    glGenQueries(1, &query);
+    frame.queries.push_back(query);
+  }
+  return frame.queries[frame.used++];
+}
+
+void Profiler::beginFrame(int drawCalls) {
+  if (_inFrame) endFrame(drawCalls);
+  _inFrame = true;
+  _open.clear();
+  _frameStart = std::chrono::steady_clock::now();
+  _frameDrawCalls = drawCalls;
+
+  Record record = {-1, nextQuery(), 0};
+  glQueryCounter(record.start, GL_TIMESTAMP);
+  _queries[_current].records.push_back(record);
+}
+
+void Profiler::endFrame(int drawCalls) {
+  if (!_inFrame) return;
+  while (!_open.empty()) end(drawCalls);  // unbalanced begin()
+  _inFrame = false;
+
+  FrameQueries& current = _queries[_current];
+  current.records[0].end = nextQuery();
+  glQueryCounter(current.records[0].end, GL_TIMESTAMP);
+  _frame.cpu.add(millisecondsSince(_frameStart));
+  _frame.drawCalls = drawCalls - _frameDrawCalls;
+  for (size_t i = 0; i < _passes.size(); i++) {
+    if (!_totals[i].ran) continue;
+    _passes[i].cpu.add(_totals[i].cpu);
+    _passes[i].drawCalls = _totals[i].drawCalls;
+    _totals[i] = FrameTotal{false, 0.0f, 0};
+  }
+
+  // the oldest frame in flight is reused next
+  _current = (_current + 1) % kFramesInFlight;
+  collect(&_queries[_current]);
+}
+
+void Profiler::collect(FrameQueries* frame) {
+  if (frame->records.empty()) return;
+
+  // Timestamps complete in order, so the frame's last one tells whether
+  // all are ready. If not, forget them rather than wait.
+  GLuint last = frame->records[0].end;
+  GLint available = 0;
+  glGetQueryObjectiv(last, GL_QUERY_RESULT_AVAILABLE, &available);
+  if (!available) {
+    glDeleteQueries(static_cast<GLsizei>(frame->queries.size()),
+        frame->queries.data());
+    frame->queries.clear();
+  } else {
+    std::vector<float> gpu(_passes.size(), -1.0f);
+    for (const Record& record : frame->records) {
+      GLuint64 start = 0, end = 0;
+      glGetQueryObjectui64v(record.start, GL_QUERY_RESULT, &start);
+      glGetQueryObjectui64v(record.end, GL_QUERY_RESULT, &end);
+      float ms = end > start ? (end - start) * 1e-6f : 0.0f;
+      if (record.pass < 0) {
+        _frame.gpu.add(ms);
+      } else {
+        gpu[record.pass] = std::max(gpu[record.pass], 0.0f) + ms;
+      }
+    }
+    for (size_t i = 0; i < gpu.size(); i++) {
+      if (gpu[i] >= 0.0f) _passes[i].gpu.add(gpu[i]);
+    }
+  }
+  frame->records.clear();
+  frame->used = 0;
+}
+
+void Profiler::begin(const std::string& name, int drawCalls) {
+  if (!_inFrame) return;  // e.g. drawing in setup()
+  auto it = _passIndex.find(name);
+  int index;
+  if (it == _passIndex.end()) {
+    index = static_cast<int>(_passes.size());
+    _passIndex[name] = index;
+    _passes.push_back(Pass());
+    _passes.back().name = name;
+    _passes.back().drawCalls = 0;
+    _passes.back().cpu.keepHistory(_keepHistory);
+    _passes.back().gpu.keepHistory(_keepHistory);
+    _totals.push_back(FrameTotal{false, 0.0f, 0});
+  } else {
+    index = it->second;
+  }
+  _passes[index].depth = static_cast<int>(_open.size());
+
+  FrameQueries& frame = _queries[_current];
+  Record record = {index, nextQuery(), 0};
+  glQueryCounter(record.start, GL_TIMESTAMP);
+  frame.records.push_back(record);
+  OpenScope scope = {index, static_cast<int>(frame.records.size()) - 1,
+    std::chrono::steady_clock::now(), drawCalls};
+  _open.push_back(scope);
+}
+
+void Profiler::end(int drawCalls) {
+  if (_open.empty()) return;
+  OpenScope scope = _open.back();
+  _open.pop_back();
+
+  FrameQueries& frame = _queries[_current];
+  GLuint query = nextQuery();
+  glQueryCounter(query, GL_TIMESTAMP);
+  frame.records[scope.record].end = query;
+
+  FrameTotal& total = _totals[scope.pass];
+  total.ran = true;
+  total.cpu += millisecondsSince(scope.start);
+  total.drawCalls += drawCalls - scope.drawCalls;
+}
+
+}  // namespace agl
@@ -0,0 +1,183 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_PROFILER_H_
+#define AGL_PROFILER_H_
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include "agl/agl.h"
+
+namespace agl {
+
+/**
+ * @brief Times named passes of each frame on the CPU and the GPU
+ *
+ * GPU times come from GL_TIMESTAMP queries written at the start and end of
+ * each pass. Results are read three frames after they were issued, and
+ * only once GL reports them available, so timing never makes the CPU wait
+ * for the GPU. The HUD therefore shows GPU times a few frames late.
+ *
+ * Renderer owns a profiler and calls beginFrame() and endFrame() for
+ * Window, so applications only mark passes:
+ *
+ * ```
+ * renderer.beginProfile("model");
+ * renderer.mesh(mesh);
+ * renderer.endProfile();
+ * ```
+ *
+ * Passes may nest, and a pass begun several times in a frame counts the
+ * sum. Each keeps its last kWindow frames, from which the median (p50)
+ * and 99th percentile (p99) are computed.
+ */
+class Profiler {
+ public:
+  static const int kWindow = 120;  // frames in the sliding window
+
+  /**
+   * @brief The last kWindow values of one measurement, in milliseconds
+   */
+  class Samples {
+   public:
+    Samples();
+    void add(float ms);
+    bool empty() const { return _count == 0; }
+    float last() const;
+    float percentile(float p) const;  // p in [0, 1]
+
+    // every value added while keeping history, oldest first
+    void keepHistory(bool keep) { _keepHistory = keep; }
+    const std::vector<float>& history() const { return _history; }
+
+   private:
+    std::vector<float> _values;
+    int _count;
+    int _next;
+    bool _keepHistory;
+    std::vector<float> _history;
+  };
+
+  /**
+   * @brief The measurements of one named pass
+   */
+  struct Pass {
+    std::string name;
+    int depth;       // nesting level when last timed, 0 at the top
+    Samples cpu;
+    Samples gpu;
+    int drawCalls;   // in the last frame it ran
+  };
+
+  Profiler();
+  virtual ~Profiler();
+
+  /**
+   * @brief Start a frame
+   * @param drawCalls The renderer's draw call count
+   */
+  void beginFrame(int drawCalls);
+
+  /**
+   * @brief End the frame and collect GPU times from earlier frames
+   */
+  void endFrame(int drawCalls);
+
+  /**
+   * @brief Start timing a pass; end it with end()
+   */
+  void begin(const std::string& name, int drawCalls);
+
+  /**
+   * @brief Stop timing the most recently begun pass
+   */
+  void end(int drawCalls);
+
+  /**
+   * @brief Return the whole frame's measurements
+   */
+  const Pass& frame() const { return _frame; }
+
+  /**
+   * @brief Return the passes in the order they were first timed
+   */
+  const std::vector<Pass>& passes() const { return _passes; }
+
+  /**
+   * @brief Keep the times of every frame, not only the last kWindow
+   *
+   * For benchmarks; the history grows by a few bytes per pass per frame.
+   */
+  void keepHistory(bool keep);
+
+  /**
+   * @brief Write the kept times of the frame and each pass as JSON
+   * @param filename The .json file
+   * @param wallTimes Whole frames timed by the caller, e.g. from one swap
+   * of the buffers to the next, in milliseconds; may be empty
+   * @param frameTimes Also write the frame's times one by one
+   * @return (bool) Returns false if the file cannot be written
+   *
+   * For the CPU and GPU times of each, gives the count, mean, minimum,
+   * p50, p90, p95, p99 and maximum and a histogram, in milliseconds. GPU
+   * times that were not ready in time are missing, so there may be fewer
+   * GPU times than CPU times.
+   */
+  bool save(const std::string& filename,
+      const std::vector<float>& wallTimes = std::vector<float>(),
+      bool frameTimes = true) const;
+
+  /**
+   * @brief Delete the GL queries; call while the context is current
+   */
+  void cleanup();
+
+ private:
+  static const int kFramesInFlight = 3;
+
+  // One begin/end pair of timestamps; pass -1 is the frame
+  struct Record {
+    int pass;
+    GLuint start;
+    GLuint end;
+  };
+
+  struct OpenScope {
+    int pass;
+    int record;
+    std::chrono::steady_clock::time_point start;
+    int drawCalls;
+  };
+
+  struct FrameQueries {
+    std::vector<GLuint> queries;  // pool, reused every kFramesInFlight
+    int used = 0;
+    std::vector<Record> records;
+  };
+
+  // A pass's totals this frame, for passes begun more than once
+  struct FrameTotal {
+    bool ran;
+    float cpu;
+    int drawCalls;
+  };
+
+  GLuint nextQuery();
+  void collect(FrameQueries* frame);
+
+  Pass _frame;
+  std::vector<Pass> _passes;
+  std::vector<FrameTotal> _totals;  // per pass
+  std::map<std::string, int> _passIndex;
+  std::vector<OpenScope> _open;
+  FrameQueries _queries[kFramesInFlight];
+  int _current;
+  bool _inFrame;
+  std::chrono::steady_clock::time_point _frameStart;
+  int _frameDrawCalls;
+  bool _keepHistory;
+};
+
+}  // namespace agl
+#endif  // AGL_PROFILER_H_
@@ -1,10 +1,18 @@
 // Copyright 2020, Savvy Sine, Aline Normoyle
 
 #include "agl/renderer.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <fstream>
 #include <sstream>
 #include "agl/image.h"
+#include "agl/memorytracker.h"
+#include "agl/resources.h"
 #include "agl/shader.h"
+#include "agl/streambuffer.h"
+#include "agl/threadpool.h"
+#include "agl/trace.h"
 #include "agl/mesh/sphere.h"
 #include "agl/mesh/cube.h"
 #include "agl/mesh/cylinder.h"
@@ -32,6 +40,52 @@ using std::vector;
 
 int Renderer::PrimitiveSubdivision = 8;
 
+// Batch sizes: a full section is flushed early
+static const int kLinesPerSection = 16384;
+static const int kSpritesPerSection = 8192;
+
+struct LineVertex {
+  vec3 position;
+  vec3 color;
+};
+
+struct SpriteInstance {
+  vec3 offset;
+  vec4 color;
+  float size;
+  float layer;  // in the texture array, if the texture is one
+};
+
+static_assert(sizeof(LineVertex) == 6 * sizeof(float),
+    "LineVertex must be tightly packed");
+static_assert(sizeof(SpriteInstance) == 9 * sizeof(float),
+    "SpriteInstance must be tightly packed");
+
+// Uniforms set by the renderer on every draw
+static constexpr UniformId kMVP = uniformId("MVP");
+static constexpr UniformId kModelViewMatrix = uniformId("ModelViewMatrix");
+static constexpr UniformId kNormalMatrix = uniformId("NormalMatrix");
+static constexpr UniformId kModelMatrix = uniformId("ModelMatrix");
+static constexpr UniformId kCameraPos = uniformId("CameraPos");
+static constexpr UniformId kOffset = uniformId("Offset");
+static constexpr UniformId kColor = uniformId("Color");
+static constexpr UniformId kSize = uniformId("Size");
+
+// Shaders the renderer loads the first time they are used
+struct BuiltinShader {
+  const char* name;
+  const char* vs;
+  const char* fs;
+};
+
+static const BuiltinShader kBuiltinShaders[] = {
+  {"lines", "../shaders/lines.vs", "../shaders/lines.fs"},
+  {"sprite", "../shaders/billboard.vs", "../shaders/billboard.fs"},
+  {"sprite-batch", "../shaders/billboard-batch.vs", "../shaders/billboard.fs"},
+  {"text", "../shaders/text.vs", "../shaders/text.fs"},
+  {"cubemap", "../shaders/cubemap.vs", "../shaders/cubemap.fs"},
+};
+
 Renderer::Renderer() {
   _cube = 0;
   _cone = 0;
@@ -46,9 +100,38 @@ Renderer::Renderer() {
 
   _fontNormal = FONS_INVALID;
   _fs = NULL;
-
+  _fontColor = glfonsRGBA(255, 255, 255, 255);
+  _fontSize = 20.0;
+
+  mBBVboPosId = 0;
+  mBBVaoId = 0;
+  mVboLinePosId = 0;
+  mVboLineColorId = 0;
+  mVaoLineId = 0;
+
+  _workers = 0;
+  _screenFramebuffer = 0;
+  _hasS3TC = false;
+  _hasBPTC = false;
   _currentShader = 0;
+  _shaderFeatures = 0;
+  _textureFeatures = 0;
   _initialized = false;
+
+  _stack.reserve(kStackReserve);
+  _trs = mat4(1.0);
+  _modelViewDirty = true;
+  _mvpDirty = true;
+
+  _lineBatch = 0;
+  _spriteBatch = 0;
+  _lineBatchVao = 0;
+  _spriteBatchVao = 0;
+  _lineBatchCount = 0;
+  _spriteBatchCount = 0;
+  _spriteBatchTexture = Texture{0, 0, GL_TEXTURE_2D, -1};
+  _spriteBatchBlendMode = DEFAULT;
+  _drawCalls = 0;
 }
 
 Renderer::~Renderer() {
@@ -84,7 +167,43 @@ void Renderer::cleanup() {
     delete it.second;
   }
   _shaders.clear();
+  // joins the workers, which may still be decoding pending textures
+  delete _workers;
+  _workers = 0;
+  _pendingTextures.clear();
+  for (auto& it : _textures) MemoryTracker::release(&it.second);
   _textures.clear();
+  _boundTextures.clear();
+
+  glDeleteBuffers(1, &mBBVboPosId);
+  glDeleteVertexArrays(1, &mBBVaoId);
+  glDeleteBuffers(1, &mVboLinePosId);
+  glDeleteBuffers(1, &mVboLineColorId);
+  glDeleteVertexArrays(1, &mVaoLineId);
+  mBBVboPosId = 0;
+  mBBVaoId = 0;
+  mVboLinePosId = 0;
+  mVboLineColorId = 0;
+  mVaoLineId = 0;
+
+  delete _lineBatch;
+  delete _spriteBatch;
+  glDeleteVertexArrays(1, &_lineBatchVao);
+  glDeleteVertexArrays(1, &_spriteBatchVao);
+  _lineBatch = 0;
+  _spriteBatch = 0;
+  _lineBatchVao = 0;
+  _spriteBatchVao = 0;
+  _lineBatchCount = 0;
+  _spriteBatchCount = 0;
+
+  for (auto& it : _uniformBuffers) {
+    glDeleteBuffers(1, &it.second.bufferId);
+    MemoryTracker::release(&it.second);
+  }
+  _uniformBuffers.clear();
+  _boundUniformBuffers.clear();
+  _profiler.cleanup();
   _initialized = false;
 }
 
@@ -98,6 +217,16 @@ vec3 Renderer::cameraPosition() const {
 }
 
 void Renderer::init() {
+#ifndef APPLE
+  if (GLEW_KHR_parallel_shader_compile) {
+    glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);  // let the driver decide
+  }
+  _hasS3TC = GLEW_EXT_texture_compression_s3tc;
+  _hasBPTC = GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+#else
+  _hasS3TC = true;  // all Macs sample S3TC; BPTC needs GL 4.2
+#endif
+
   glEnable(GL_DEPTH_TEST);
   glEnable(GL_CULL_FACE);
   glCullFace(GL_BACK);
@@ -108,29 +237,79 @@ void Renderer::init() {
   ortho(-halfw, halfw, -halfh, halfh, -10.0f, 10.0f);
   lookAt(vec3(0, 0, 2), vec3(0, 0, 0));
 
-  initLines();
-  initBillboards();
-  initText();
-  loadShader("cubemap", "../shaders/cubemap.vs", "../shaders/cubemap.fs");
+  // The default shader is needed right away. Other built-in shaders, the
+  // font, and the primitives are created the first time they are used.
   loadShader("unlit", "../shaders/unlit.vs", "../shaders/unlit.fs");
 
-  _cube = new Cube(1.0f);
-  _cone = new Cylinder(0.5f, 0.01, 1, PrimitiveSubdivision);
-  _capsule = new Capsule(0.25, 0.5, PrimitiveSubdivision, PrimitiveSubdivision);
-  _cylinder = new Cylinder(0.5, 1.0, PrimitiveSubdivision);
-  _teapot = new Teapot(13, mat4(1.0));
-  _torus = new Torus(0.5, 0.25, PrimitiveSubdivision, PrimitiveSubdivision);
-  _plane = new Plane(1.0, 1.0, 1.0, 1.0);
-  _sphere = new Sphere(0.5f, PrimitiveSubdivision, PrimitiveSubdivision);
-  _skybox = new SkyBox(1);
   _trs = mat4(1.0);
+  _stack.clear();
+  _modelViewDirty = true;
   _initialized = true;
 
   beginShader("unlit");  
 }
 
+void Renderer::warmup() {
+  for (const BuiltinShader& builtin : kBuiltinShaders) {
+    if (_shaders.count(builtin.name) == 0) loadBuiltinShader(builtin.name);
+  }
+  if (mVaoLineId == 0) initLines();
+  if (mBBVaoId == 0) initBillboards();
+  if (_lineBatch == 0 || _spriteBatch == 0) initBatches();
+  if (_fs == NULL) initText();
+
+  initPrimitives();
+  Mesh* meshes[] = {_cube, _cone, _capsule, _cylinder, _teapot,
+      _torus, _plane, _sphere};
+  for (Mesh* m : meshes) {
+    m->prepare();
+  }
+  if (_skybox == 0) _skybox = new SkyBox(1);
+  finishVariants();
+}
+
+// Mesh objects are cheap; their vertex data is built on first render
+void Renderer::initPrimitives() {
+  if (_cube == 0) _cube = new Cube(1.0f);
+  if (_cone == 0) _cone = new Cylinder(0.5f, 0.01, 1, PrimitiveSubdivision);
+  if (_capsule == 0) {
+    _capsule = new Capsule(0.25, 0.5,
+        PrimitiveSubdivision, PrimitiveSubdivision);
+  }
+  if (_cylinder == 0) {
+    _cylinder = new Cylinder(0.5, 1.0, PrimitiveSubdivision);
+  }
+  if (_teapot == 0) _teapot = new Teapot(13, mat4(1.0));
+  if (_torus == 0) {
+    _torus = new Torus(0.5, 0.25, PrimitiveSubdivision, PrimitiveSubdivision);
+  }
+  if (_plane == 0) _plane = new Plane(1.0, 1.0, 1.0, 1.0);
+  if (_sphere == 0) {
+    _sphere = new Sphere(0.5f, PrimitiveSubdivision, PrimitiveSubdivision);
+  }
+
+  // as reported by MemoryTracker
+  _cube->setName("cube");
+  _cone->setName("cone");
+  _capsule->setName("capsule");
+  _cylinder->setName("cylinder");
+  _teapot->setName("teapot");
+  _torus->setName("torus");
+  _plane->setName("plane");
+  _sphere->setName("sphere");
+}
+
+bool Renderer::loadBuiltinShader(const std::string& name) {
+  for (const BuiltinShader& builtin : kBuiltinShaders) {
+    if (name == builtin.name) {
+      loadShader(name, builtin.vs, builtin.fs);
+      return true;
+    }
+  }
+  return false;
+}
+
 void Renderer::initLines() {
-  loadShader("lines", "../shaders/lines.vs", "../shaders/lines.fs");
   const float positions[] = {
     0.0f, 0.0f, 1.0f,
     1.0f, 0.0f, 0.0f
@@ -177,26 +356,52 @@ void Renderer::initBillboards() {
   glEnableVertexAttribArray(0);
   glBindBuffer(GL_ARRAY_BUFFER, mBBVboPosId);  // bind before setting data
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, static_cast<GLubyte*>(0));
+}
+
+void Renderer::initBatches() {
+  if (mBBVaoId == 0) initBillboards();
+  _lineBatch = new StreamBuffer(kLinesPerSection * 2 * sizeof(LineVertex));
+  _spriteBatch = new StreamBuffer(kSpritesPerSection * sizeof(SpriteInstance));
+
+  // attribute offsets are set when flushing, since the section moves
+  glGenVertexArrays(1, &_lineBatchVao);
+  glBindVertexArray(_lineBatchVao);
+  glEnableVertexAttribArray(0);
+  glEnableVertexAttribArray(1);
 
-  loadShader("sprite",
-      "../shaders/billboard.vs",
-      "../shaders/billboard.fs");
+  glGenVertexArrays(1, &_spriteBatchVao);
+  glBindVertexArray(_spriteBatchVao);
+  glEnableVertexAttribArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, mBBVboPosId);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, static_cast<GLubyte*>(0));
+  for (int i = 1; i <= 4; i++) {
+    glEnableVertexAttribArray(i);
+    glVertexAttribDivisor(i, 1);
+  }
 }
 
 void Renderer::initText() {
-    loadShader("text", "../shaders/text.vs", "../shaders/text.fs");
+    // fontstash binds its atlas to the active unit when creating and
+    // updating it, past _boundTextures, so keep that on the font's own slot
+    glActiveTexture(GL_TEXTURE0 + GLFONS_FONT_TEXTURE_SLOT);
     _fs = glfonsCreate(512, 512, FONS_ZERO_TOPLEFT);
     if (_fs == NULL) {
       printf("Could not create stash.\n");
     }
 
-    _fontNormal = fonsAddFont(_fs, "sans", "../fonts/DroidSerif-Regular.ttf");
+    const char* fontFile = "../fonts/DroidSerif-Regular.ttf";
+    const EmbeddedResource* font = findEmbeddedResource(fontFile);
+    if (font) {
+      // fontstash only reads the data, and must not free it
+      _fontNormal = fonsAddFontMem(_fs, "sans",
+          const_cast<unsigned char*>(font->data),
+          static_cast<int>(font->size), 0);
+    } else {
+      _fontNormal = fonsAddFont(_fs, "sans", resourcePath(fontFile).c_str());
+    }
     if (_fontNormal == FONS_INVALID) {
       printf("Could not add font normal.\n");
     }
-
-    _fontColor = glfonsRGBA(255, 255, 255, 255);
-    _fontSize = 20.0;
 }
 
 void Renderer::blendMode(BlendMode mode) {
@@ -218,27 +423,60 @@ void Renderer::blendMode(BlendMode mode) {
 
 void Renderer::perspective(float fovRadians,
     float aspect, float near, float far) {
+  flushBatches();
   _projectionMatrix = glm::perspective(fovRadians, aspect, near, far);
+  _mvpDirty = true;
 }
 
 void Renderer::ortho(float minx, float maxx,
     float miny, float maxy, float minz, float maxz) {
+  flushBatches();
   _projectionMatrix = glm::ortho(minx, maxx, miny, maxy, minz, maxz);
+  _mvpDirty = true;
 }
 
 void Renderer::lookAt(const vec3& lookfrom,
     const vec3& lookat, const vec3& up) {
+  flushBatches();
   _lookfrom = lookfrom;
   _viewMatrix = glm::lookAt(lookfrom, lookat, up);
+  _modelViewDirty = true;
 }
 
 void Renderer::texture(const std::string& uniformName,
     const std::string& textureName) {
-  assert(_textures.count(textureName) != 0);
+  finishTexture(textureName, true);
+  auto it = _textures.find(textureName);
+  assert(it != _textures.end());
+  const Texture& tex = it->second;
+
+  bindTexture(tex.texId, tex.target, tex.slot);
+  setUniform(uniformName, tex.slot);
+  if (tex.layer >= 0) {
+    // the id of uniformName + "Layer", without building the string
+    setUniform(uniformId("Layer", uniformId(uniformName.c_str())), tex.layer);
+  }
+  if (tex.target == GL_TEXTURE_2D_ARRAY) {
+    _textureFeatures |= ShaderFeature::TEXTURE_ARRAY;
+  } else {
+    _textureFeatures &= ~ShaderFeature::TEXTURE_ARRAY;
+  }
+}
+
+int Renderer::textureLayer(const std::string& textureName) const {
+  auto it = _textures.find(textureName);
+  return it != _textures.end() ? it->second.layer : -1;
+}
+
+void Renderer::bindTexture(GLuint texId, GLenum target, int slot) {
+  if (slot >= (int) _boundTextures.size()) {
+    _boundTextures.resize(slot + 1, 0);
+  }
+  if (_boundTextures[slot] == texId) return;
 
-  glActiveTexture(GL_TEXTURE0 + _textures[textureName].slot);
-  glBindTexture(GL_TEXTURE_2D, _textures[textureName].texId);
-  setUniform(uniformName, _textures[textureName].slot);
+  glActiveTexture(GL_TEXTURE0 + slot);
+  glBindTexture(target, texId);
+  _boundTextures[slot] = texId;
 }
 
 void Renderer::fontColor(const glm::vec4& c) {
@@ -254,17 +492,20 @@ void Renderer::fontSize(int s) {
 }
 
 float Renderer::textWidth(const std::string& s) {
+  if (_fs == NULL) initText();
   float w = fonsTextBounds(_fs, 0, 0, s.c_str(), NULL, NULL);
   return w;
 }
 
 float Renderer::textHeight() {
+  if (_fs == NULL) initText();
   float lineh = 0;
   fonsVertMetrics(_fs, NULL, NULL, &lineh);
   return lineh;
 }
 
 void Renderer::text(const std::string& text, float x, float y) {
+  if (_fs == NULL) initText();
   float viewport[4]; 
   glGetFloatv(GL_VIEWPORT, viewport);
 
@@ -272,11 +513,14 @@ void Renderer::text(const std::string& text, float x, float y) {
   BlendMode m = _blendMode;
   blendMode(BLEND);
   beginShader("text");
-  setUniform("MVP", ortho);
+  setUniform(kMVP, ortho);
+  setUniform("fontTexture", GLFONS_FONT_TEXTURE_SLOT);
+  glActiveTexture(GL_TEXTURE0 + GLFONS_FONT_TEXTURE_SLOT);
 
   fonsSetSize(_fs, _fontSize);
   fonsSetFont(_fs, _fontNormal);
   fonsSetColor(_fs, _fontColor);
+  _drawCalls++;
   fonsDrawText(_fs, x, y, text.c_str(), NULL);
   //std::cout << viewport[2] << " " << viewport[3] << std::endl;
 
@@ -287,9 +531,10 @@ void Renderer::text(const std::string& text, float x, float y) {
 void Renderer::line(const glm::vec3& p1, const glm::vec3& p2,
     const glm::vec3& c1, const glm::vec3& c2) {
   assert(_initialized);
+  if (mVaoLineId == 0) initLines();
 
-  mat4 mvp = _projectionMatrix * _viewMatrix * _trs;
-  setUniform("MVP", mvp);
+  updateMatrices();
+  setUniform(kMVP, _mvp);
 
   GLfloat positions[6];
   positions[0] = p1.x;
@@ -314,120 +559,275 @@ void Renderer::line(const glm::vec3& p1, const glm::vec3& p2,
   glBindBuffer(GL_ARRAY_BUFFER, mVboLineColorId);
   glBufferData(GL_ARRAY_BUFFER, 6 * sizeof(float), colors, GL_DYNAMIC_DRAW);
 
+  _drawCalls++;
   glDrawArrays(GL_LINES, 0, 2);
 }
 
+void Renderer::batchLine(const glm::vec3& p1, const glm::vec3& p2,
+    const glm::vec3& c1, const glm::vec3& c2) {
+  assert(_initialized);
+
+  if (_lineBatch == 0) initBatches();
+
+  LineVertex* v = static_cast<LineVertex*>(
+      _lineBatch->reserve(2 * sizeof(LineVertex)));
+  if (!v) {
+    flushLines();
+    _lineBatch->advance();
+    v = static_cast<LineVertex*>(_lineBatch->reserve(2 * sizeof(LineVertex)));
+  }
+  v[0].position = vec3(_trs * vec4(p1, 1.0f));
+  v[0].color = c1;
+  v[1].position = vec3(_trs * vec4(p2, 1.0f));
+  v[1].color = c2;
+  _lineBatchCount += 2;
+}
+
+void Renderer::batchSprite(const std::string& textureName,
+    const glm::vec3& pos, const glm::vec4& color, float size) {
+  assert(_initialized);
+  finishTexture(textureName, true);
+  auto it = _textures.find(textureName);
+  assert(it != _textures.end());
+  const Texture& tex = it->second;
+  if (_spriteBatch == 0) initBatches();
+
+  // sprites using different layers of one texture array share a draw call
+  if (_spriteBatchCount > 0 && (tex.texId != _spriteBatchTexture.texId ||
+      _blendMode != _spriteBatchBlendMode)) {
+    flushSprites();
+  }
+  _spriteBatchTexture = tex;
+  _spriteBatchBlendMode = _blendMode;
+
+  SpriteInstance* s = static_cast<SpriteInstance*>(
+      _spriteBatch->reserve(sizeof(SpriteInstance)));
+  if (!s) {
+    flushSprites();
+    _spriteBatch->advance();
+    s = static_cast<SpriteInstance*>(
+        _spriteBatch->reserve(sizeof(SpriteInstance)));
+  }
+  s->offset = vec3(_trs * vec4(pos, 1.0f));
+  s->color = color;
+  s->size = size;
+  s->layer = static_cast<float>(std::max(tex.layer, 0));
+  _spriteBatchCount++;
+}
+
+void Renderer::flushBatches() {
+  if (_lineBatchCount > 0) flushLines();
+  if (_spriteBatchCount > 0) flushSprites();
+}
+
+void Renderer::flushLines() {
+  if (_lineBatchCount == 0) return;
+
+  GLintptr offset = _lineBatch->commit();
+  GLsizei stride = sizeof(LineVertex);
+
+  beginShader("lines");
+  setUniform(kMVP, mat4Mul(_projectionMatrix, _viewMatrix));
+
+  glBindVertexArray(_lineBatchVao);
+  glBindBuffer(GL_ARRAY_BUFFER, _lineBatch->id());
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride,
+      reinterpret_cast<GLubyte*>(offset));
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride,
+      reinterpret_cast<GLubyte*>(offset + sizeof(vec3)));
+  _drawCalls++;
+  glDrawArrays(GL_LINES, 0, _lineBatchCount);
+  endShader();
+  _lineBatchCount = 0;
+}
+
+void Renderer::flushSprites() {
+  if (_spriteBatchCount == 0) return;
+
+  GLintptr offset = _spriteBatch->commit();
+  GLsizei stride = sizeof(SpriteInstance);
+
+  BlendMode mode = _blendMode;
+  blendMode(_spriteBatchBlendMode);
+  beginShader("sprite-batch");
+  if (_spriteBatchTexture.target == GL_TEXTURE_2D_ARRAY) {
+    _textureFeatures = ShaderFeature::TEXTURE_ARRAY;
+  }
+  useVariant(0);
+  setUniform(kMVP, mat4Mul(_projectionMatrix, _viewMatrix));
+  setUniform(kCameraPos, _lookfrom);
+  bindTexture(_spriteBatchTexture.texId, _spriteBatchTexture.target,
+      _spriteBatchTexture.slot);
+  setUniform("image", _spriteBatchTexture.slot);
+
+  glBindVertexArray(_spriteBatchVao);
+  glBindBuffer(GL_ARRAY_BUFFER, _spriteBatch->id());
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride,
+      reinterpret_cast<GLubyte*>(offset));
+  glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride,
+      reinterpret_cast<GLubyte*>(offset + sizeof(vec3)));
+  glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, stride,
+      reinterpret_cast<GLubyte*>(offset + sizeof(vec3) + sizeof(vec4)));
+  glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, stride,
+      reinterpret_cast<GLubyte*>(offset + sizeof(vec3) + sizeof(vec4) +
+      sizeof(float)));
+  _drawCalls++;
+  glDrawArraysInstanced(GL_TRIANGLES, 0, 6, _spriteBatchCount);
+  endShader();
+  blendMode(mode);
+  _spriteBatchCount = 0;
+}
+
 void Renderer::sprite(const glm::vec3& pos,
     const glm::vec4& color, float size) {
   assert(_initialized);
+  if (mBBVaoId == 0) initBillboards();
 
-  mat4 mvp = _projectionMatrix * _viewMatrix * _trs;
-  setUniform("MVP", mvp);
-  setUniform("CameraPos", _lookfrom);
-  setUniform("Offset", pos);
-  setUniform("Color", color);
-  setUniform("Size", size);
+  useVariant(0);
+  updateMatrices();
+  setUniform(kMVP, _mvp);
+  setUniform(kCameraPos, _lookfrom);
+  setUniform(kOffset, pos);
+  setUniform(kColor, color);
+  setUniform(kSize, size);
 
   glBindVertexArray(mBBVaoId);
+  _drawCalls++;
   glDrawArrays(GL_TRIANGLES, 0, 6);
 }
 
 void Renderer::cubemap(const std::string& uniformName,
     const std::string& textureName) {
-  assert(_textures.count(textureName) != 0);
+  auto it = _textures.find(textureName);
+  assert(it != _textures.end());
 
-  glBindTexture(GL_TEXTURE_CUBE_MAP, _textures[textureName].texId);
-  setUniform(uniformName, _textures[textureName].slot);
+  bindTexture(it->second.texId, GL_TEXTURE_CUBE_MAP, it->second.slot);
+  setUniform(uniformName, it->second.slot);
 }
 
 void Renderer::skybox(float size) {
   assert(_initialized);
+  if (_skybox == 0) _skybox = new SkyBox(1);
 
   mat4 s = glm::scale(mat4(1.0f), vec3(size));
-  mat4 mvp = _projectionMatrix * _viewMatrix * s;
-  setUniform("MVP", mvp);
+  mat4 mvp = mat4Mul(_projectionMatrix, mat4Mul(_viewMatrix, s));
+  setUniform(kMVP, mvp);
+  _drawCalls++;
   _skybox->render();
 }
 
 void Renderer::push() {
-  _stack.push_front(_trs);
+  _stack.push_back(_trs);
 }
 
 void Renderer::pop() {
-  if (_stack.size() == 0) return;
-  _trs = _stack.front();
-  _stack.pop_front();
+  if (_stack.empty()) return;
+  _trs = _stack.back();
+  _stack.pop_back();
+  _modelViewDirty = true;
 }
 
 void Renderer::identity() {
   _trs = mat4(1.0);
+  _modelViewDirty = true;
 }
 
 void Renderer::scale(const vec3& xyz) {
-  _trs = _trs * glm::scale(mat4(1.0), xyz);
+  _trs = glm::scale(_trs, xyz);
+  _modelViewDirty = true;
 }
 
 void Renderer::translate(const vec3& xyz) {
-  _trs = _trs * glm::translate(mat4(1.0), xyz);
+  _trs = glm::translate(_trs, xyz);
+  _modelViewDirty = true;
 }
 
 void Renderer::rotate(float angleRad, const vec3& axis) {
-  _trs = _trs * glm::rotate(mat4(1.0), angleRad, axis);
+  _trs = glm::rotate(_trs, angleRad, axis);
+  _modelViewDirty = true;
 }
 
 void Renderer::rotate(const quat& orientation) {
-  _trs = _trs * glm::mat4(orientation);
+  _trs = mat4Mul(_trs, glm::mat4_cast(orientation));
+  _modelViewDirty = true;
 }
 
 void Renderer::transform(const glm::mat4& trs) {
-  _trs = _trs * trs;
+  _trs = mat4Mul(_trs, trs);
+  _modelViewDirty = true;
+}
+
+void Renderer::updateMatrices() {
+  if (_modelViewDirty) {
+    _modelView = mat4Mul(_viewMatrix, _trs);
+    _normalMatrix = normalMatrix(_modelView);
+    _modelViewDirty = false;
+    _mvpDirty = true;
+  }
+  if (_mvpDirty) {
+    _mvp = mat4Mul(_projectionMatrix, _modelView);
+    _mvpDirty = false;
+  }
 }
 
 void Renderer::teapot() {
+  if (_teapot == 0) initPrimitives();
   mesh(*_teapot);
 }
 
 void Renderer::plane() {
+  if (_plane == 0) initPrimitives();
   mesh(*_plane);
 }
 
 void Renderer::cylinder() {
+  if (_cylinder == 0) initPrimitives();
   mesh(*_cylinder);
 }
 
 void Renderer::capsule() {
+  if (_capsule == 0) initPrimitives();
   mesh(*_capsule);
 }
 
 void Renderer::torus() {
+  if (_torus == 0) initPrimitives();
   mesh(*_torus);
 }
 
 void Renderer::cone() {
+  if (_cone == 0) initPrimitives();
   mesh(*_cone);
 }
 
 void Renderer::cube() {
+  if (_cube == 0) initPrimitives();
   mesh(*_cube);
 }
 
 void Renderer::sphere() {
+  if (_sphere == 0) initPrimitives();
   mesh(*_sphere);
 }
 
 void Renderer::mesh(const Mesh& mesh) {
   assert(_initialized);
 
-  mat4 mv = _viewMatrix * _trs;
-  mat4 mvp = _projectionMatrix * mv;
-  mat3 nmv = transpose(inverse(mat3(vec3(mv[0]), vec3(mv[1]), vec3(mv[2]))));
-
-  setUniform("MVP", mvp);
-  setUniform("ModelViewMatrix", mv);
-  setUniform("NormalMatrix", nmv);
-  setUniform("ModelMatrix", _trs);
-  setUniform("HasUV", mesh.hasUV());
-
+  // attributes are known once the mesh's buffers exist
+  mesh.prepare();
+  unsigned features = 0;
+  if (mesh.hasUV()) features |= ShaderFeature::HAS_UV;
+  if (mesh.hasColor()) features |= ShaderFeature::HAS_COLOR;
+  if (mesh.hasTangent()) features |= ShaderFeature::HAS_TANGENT;
+  useVariant(features);
+
+  updateMatrices();
+  setUniform(kMVP, _mvp);
+  setUniform(kModelViewMatrix, _modelView);
+  setUniform(kNormalMatrix, _normalMatrix);
+  setUniform(kModelMatrix, _trs);
+
+  _drawCalls++;
   mesh.render();
 }
 
@@ -437,18 +837,96 @@ void Renderer::cleanupShaders() {
   }
 }
 
+void Renderer::beginFrame() {
+  _drawCalls = 0;
+  _profiler.beginFrame(_drawCalls);
+}
+
+void Renderer::endFrame() {
+  // one fence per frame; batches within the frame share a section
+  flushBatches();
+  if (_lineBatch) _lineBatch->advance();
+  if (_spriteBatch) _spriteBatch->advance();
+  _profiler.endFrame(_drawCalls);
+}
+
+void Renderer::beginProfile(const std::string& name) {
+  // batched lines and sprites belong to the pass that queued them
+  flushBatches();
+  _profiler.begin(name, _drawCalls);
+}
+
+void Renderer::endProfile() {
+  flushBatches();
+  _profiler.end(_drawCalls);
+}
+
+void Renderer::profileHud(float x, float y) {
+  const char* headers[] = {"cpu ms", "p50", "p99", "gpu ms", "p50", "p99",
+    "draws"};
+  const int numColumns = 7;
+  float lineHeight = textHeight();
+  float indent = textWidth("  ");
+  float nameWidth = textWidth(_profiler.frame().name);
+  for (const Profiler::Pass& pass : _profiler.passes()) {
+    nameWidth = std::max(nameWidth,
+        textWidth(pass.name) + (pass.depth + 1) * indent);
+  }
+  nameWidth += indent;
+  float columnWidth = textWidth("000.00") * 1.25f;
+
+  // numbers are right-aligned in their columns
+  auto cell = [&](int column, const std::string& value, float baseline) {
+    float right = x + nameWidth + (column + 1) * columnWidth;
+    text(value, right - textWidth(value), baseline);
+  };
+
+  y += lineHeight;
+  for (int i = 0; i < numColumns; i++) cell(i, headers[i], y);
+
+  auto row = [&](const Profiler::Pass& pass, int depth) {
+    y += lineHeight;
+    text(pass.name, x + depth * indent, y);
+    const Profiler::Samples* samples[2] = {&pass.cpu, &pass.gpu};
+    char value[32];
+    for (int i = 0; i < 2; i++) {
+      float ms[3] = {samples[i]->last(), samples[i]->percentile(0.5f),
+        samples[i]->percentile(0.99f)};
+      for (int k = 0; k < 3; k++) {
+        if (samples[i]->empty()) {
+          cell(i * 3 + k, "-", y);
+        } else {
+          snprintf(value, sizeof(value), "%.2f", ms[k]);
+          cell(i * 3 + k, value, y);
+        }
+      }
+    }
+    cell(6, std::to_string(pass.drawCalls), y);
+  };
+  row(_profiler.frame(), 0);
+  for (const Profiler::Pass& pass : _profiler.passes()) {
+    row(pass, pass.depth + 1);
+  }
+}
+
 void Renderer::beginShader(const std::string& shaderName) {
+  if (_shaders.count(shaderName) == 0) loadBuiltinShader(shaderName);
   assert(_shaders.count(shaderName) != 0);
 
-  _shaderStack.push_front(_currentShader);
+  _shaderStack.push_front(std::make_pair(_currentShader, _textureFeatures));
+  _textureFeatures = 0;
   _currentShader = _shaders[shaderName];
+  if (!finishShader(_currentShader, false)) {
+    _currentShader = _shaders["unlit"];
+  }
   _currentShader->use();
 }
 
 void Renderer::endShader() {
   assert(_shaderStack.size() > 0);
 
-  _currentShader = _shaderStack.front();
+  _currentShader = _shaderStack.front().first;
+  _textureFeatures = _shaderStack.front().second;
   _shaderStack.pop_front();
 
   if (_currentShader != nullptr) {
@@ -459,6 +937,32 @@ void Renderer::endShader() {
   }
 }
 
+// Switches to the variant of the current shader for the given features of
+// the geometry, plus those set with shaderFeature() and those of the
+// textures bound for the shader
+void Renderer::useVariant(unsigned features) {
+  if (_currentShader->features() == 0) return;
+
+  Shader* shader = _currentShader->variant(
+      features | _shaderFeatures | _textureFeatures);
+  if (!finishShader(shader, false)) {
+    shader = _currentShader->variant(0);  // compiling; draw without features
+  }
+  if (shader != _currentShader) {
+    shader->use();
+    shader->copyUniforms();
+    _currentShader = shader;
+  }
+}
+
+void Renderer::shaderFeature(ShaderFeature::Bits feature, bool enabled) {
+  if (enabled) {
+    _shaderFeatures |= feature;
+  } else {
+    _shaderFeatures &= ~feature;
+  }
+}
+
 void Renderer::setUniform(const std::string& name, float x, float y, float z) {
   assert(_currentShader != nullptr);
   _currentShader->setUniform(name.c_str(), x, y, z);
@@ -521,6 +1025,64 @@ void Renderer::setUniform(const std::string& name, GLuint val) {
   _currentShader->setUniform(name.c_str(), val);
 }
 
+void Renderer::setUniform(UniformId id, float x, float y, float z) {
+  assert(_currentShader != nullptr);
+  _currentShader->setUniform(id, x, y, z);
+}
+
+void Renderer::setUniform(UniformId id, const glm::vec2 &v) {
+  assert(_currentShader != nullptr);
+  _currentShader->setUniform(id, v);
+}
+
+void Renderer::setUniform(UniformId id, const glm::vec3 &v) {
+  assert(_currentShader != nullptr);
+  _currentShader->setUniform(id, v);
+}
+
+void Renderer::setUniform(UniformId id, const glm::vec4 &v) {
+  assert(_currentShader != nullptr);
+  _currentShader->setUniform(id, v);
+}
+
+void Renderer::setUniform(UniformId id, const glm::mat4 &m) {
+  assert(_currentShader != nullptr);
+  _currentShader->setUniform(id, m);
+}
+
+void Renderer::setUniform(UniformId id, const glm::mat3 &m) {
+  assert(_currentShader != nullptr);
+  _currentShader->setUniform(id, m);
+}
+
+void Renderer::setUniform(UniformId id, float val) {
+  assert(_currentShader != nullptr);
+  _currentShader->setUniform(id, val);
+}
+
+void Renderer::setUniform(UniformId id, int val) {
+  assert(_currentShader != nullptr);
+  _currentShader->setUniform(id, val);
+}
+
+void Renderer::setUniform(UniformId id, bool val) {
+  assert(_currentShader != nullptr);
+  _currentShader->setUniform(id, val);
+}
+
+void Renderer::setUniform(UniformId id, GLuint val) {
+  assert(_currentShader != nullptr);
+  _currentShader->setUniform(id, val);
+}
+
+UniformStats Renderer::uniformStats() const {
+  return Shader::uniformStats();
+}
+
+void Renderer::resetUniformStats() {
+  Shader::resetUniformStats();
+}
+
 void Renderer::loadCubemap(const std::string& name,
     const string& dir, int slot) {
   vector<string> faces = {
@@ -536,33 +1098,69 @@ void Renderer::loadCubemap(const std::string& name,
 
 void Renderer::loadCubemap(const std::string& name,
     const vector<string>& faces, int slot) {
-  vector<Image> images;
-  for (string filename : faces) {
-      Image img;
-      img.load(filename);
-      images.push_back(img);
+  vector<Image> images(faces.size());
+  vector<std::future<void>> decoded;
+  for (size_t i = 0; i < faces.size(); i++) {
+    Image* image = &images[i];
+    const string& filename = faces[i];
+    decoded.push_back(workers()->run([image, &filename]() {
+      image->load(filename);
+    }));
+  }
+  for (std::future<void>& face : decoded) {
+    face.get();
   }
   loadCubemap(name, images, slot);
 }
 
-void Renderer::loadCubemap(const std::string& name,
-    const vector<Image>& faces, int slot) {
-  if (slot == GLFONS_FONT_TEXTURE_SLOT) {
-    std::cout << "WARNING: slot " << slot << " conflicts with font texture\n";
+// Number of levels in a full mip chain, down to 1x1
+static int mipLevels(int width, int height) {
+  int levels = 1;
+  for (int size = std::max(width, height); size > 1; size /= 2) {
+    levels++;
   }
-  glEnable(GL_TEXTURE0 + slot);
-  glActiveTexture(GL_TEXTURE0 + slot);
+  return levels;
+}
 
-  GLuint texId;
-  if (_textures.count(name) == 0) {
-    glGenTextures(1, &texId);
-    Texture tex{texId, slot};
-    _textures[name] = tex;
+// Bytes of a texture with the given levels of its mip chain
+static size_t textureBytes(int width, int height, int bytesPerTexel,
+    int levels, int layers = 1) {
+  size_t bytes = 0;
+  for (int i = 0; i < levels; i++) {
+    bytes += static_cast<size_t>(std::max(1, width >> i)) *
+      std::max(1, height >> i) * bytesPerTexel * layers;
+  }
+  return bytes;
+}
 
-  } else {
-    texId = _textures[name].texId;
+// Upload format for an image's channels
+static GLenum pixelFormat(const Image& image) {
+  switch (image.channels()) {
+    case 1: return GL_RED;
+    case 2: return GL_RG;
+    case 3: return GL_RGB;
   }
-  glBindTexture(GL_TEXTURE_CUBE_MAP, texId);
+  return GL_RGBA;
+}
+
+// Trilinear filtering, plus anisotropic filtering when supported
+static void mipmapFilter(GLenum target) {
+  glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+#ifndef APPLE
+  if (GLEW_ARB_texture_filter_anisotropic ||
+      GLEW_EXT_texture_filter_anisotropic) {
+    GLfloat maxAnisotropy = 1.0f;
+    glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisotropy);
+    glTexParameterf(target, GL_TEXTURE_MAX_ANISOTROPY_EXT,
+        std::min(maxAnisotropy, 16.0f));
+  }
+#endif
+}
+
+void Renderer::loadCubemap(const std::string& name,
+    const vector<Image>& faces, int slot) {
+  createTexture(name, GL_TEXTURE_CUBE_MAP, slot);
 
   GLuint targets[] = {
     GL_TEXTURE_CUBE_MAP_POSITIVE_X,
@@ -572,52 +1170,268 @@ void Renderer::loadCubemap(const std::string& name,
     GL_TEXTURE_CUBE_MAP_POSITIVE_Z,
     GL_TEXTURE_CUBE_MAP_NEGATIVE_Z};
 
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
   for (int i = 0; i < faces.size(); i++) {
     if (faces[i].data()) {
       glTexImage2D(targets[i],
         0, GL_RGBA, faces[i].width(), faces[i].height(),
-        0, GL_RGBA, GL_UNSIGNED_BYTE, faces[i].data());
+        0, pixelFormat(faces[i]), GL_UNSIGNED_BYTE, faces[i].data());
     }
   }
-  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+  mipmapFilter(GL_TEXTURE_CUBE_MAP);
+  if (!faces.empty()) {
+    int w = faces[0].width();
+    int h = faces[0].height();
+    MemoryTracker::track(&_textures[name], MemoryTracker::GPU_TEXTURE, name,
+        textureBytes(w, h, 4, mipLevels(w, h), 6));
+  }
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 }
 
+// Loads the .ktx2 or .dds file with the same base name as fileName, if
+// there is one in a format the GPU supports
+static bool loadCompressed(const string& fileName, bool s3tc, bool bptc,
+    CompressedImage* image) {
+  string base = fileName.substr(0, fileName.find_last_of('.'));
+  for (const char* ext : {".ktx2", ".dds"}) {
+    if (!image->load(base + ext)) continue;
+
+    GLenum format = image->format();
+    bool isBPTC = format == GL_COMPRESSED_RGBA_BPTC_UNORM ||
+        format == GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM;
+    if (isBPTC ? bptc : s3tc) return true;
+  }
+  *image = CompressedImage();
+  return false;
+}
+
 void Renderer::loadTexture(const std::string& name,
     const std::string& fileName, int slot) {
+  TraceZone zone("Renderer::loadTexture", fileName);
+  CompressedImage compressed;
+  if (loadCompressed(fileName, _hasS3TC, _hasBPTC, &compressed)) {
+    loadTexture(name, compressed, slot);
+    return;
+  }
+
   Image img;
   img.load(fileName);
   loadTexture(name, img, slot);
 }
 
-void Renderer::loadTexture(const std::string& name,
-    const Image& image, int slot) {
+void Renderer::loadTextureAsync(const std::string& name,
+    const std::string& fileName, int slot) {
+  PendingTexture pending;
+  pending.image = std::make_shared<Image>();
+  pending.compressed = std::make_shared<CompressedImage>();
+  pending.slot = slot;
+
+  std::shared_ptr<Image> image = pending.image;
+  std::shared_ptr<CompressedImage> compressed = pending.compressed;
+  bool s3tc = _hasS3TC;
+  bool bptc = _hasBPTC;
+  pending.decoded = workers()->run([=]() {
+    TraceZone zone("decode texture", fileName);
+    if (!loadCompressed(fileName, s3tc, bptc, compressed.get())) {
+      image->load(fileName);
+    }
+  });
+  _pendingTextures[name] = std::move(pending);
+}
+
+bool Renderer::textureReady(const std::string& name) {
+  return finishTexture(name, false);
+}
+
+void Renderer::finishTextureLoads() {
+  while (!_pendingTextures.empty()) {
+    finishTexture(_pendingTextures.begin()->first, true);
+  }
+}
+
+// Creates a texture once its file has been decoded
+bool Renderer::finishTexture(const std::string& name, bool wait) {
+  auto it = _pendingTextures.find(name);
+  if (it == _pendingTextures.end()) return _textures.count(name) != 0;
+
+  PendingTexture& pending = it->second;
+  if (!wait && pending.decoded.wait_for(std::chrono::seconds(0)) !=
+      std::future_status::ready) {
+    return false;
+  }
+
+  pending.decoded.get();
+  if (pending.compressed->numLevels() > 0) {
+    loadTexture(name, *pending.compressed, pending.slot);
+  } else {
+    if (pending.image->data() == 0) {
+      std::cout << "WARNING: could not load texture " << name << std::endl;
+    }
+    loadTexture(name, *pending.image, pending.slot);
+  }
+  _pendingTextures.erase(it);
+  return true;
+}
+
+ThreadPool* Renderer::workers() {
+  if (_workers == 0) _workers = new ThreadPool();
+  return _workers;
+}
+
+GLuint Renderer::createTexture(const std::string& name,
+    GLenum target, int slot) {
   if (slot == GLFONS_FONT_TEXTURE_SLOT) {
     std::cout << "WARNING: slot " << slot << " conflicts with font texture\n";
   }
-  glEnable(GL_TEXTURE0 + slot);
-  glActiveTexture(GL_TEXTURE0 + slot);
+
+  // Storage is immutable, so a reloaded texture gets a new texture object.
+  // Layers of an array are replaced without deleting the whole array.
+  auto it = _textures.find(name);
+  if (it != _textures.end() && it->second.layer < 0) {
+    GLuint oldId = it->second.texId;
+    glDeleteTextures(1, &oldId);
+    for (GLuint& bound : _boundTextures) {
+      if (bound == oldId) bound = 0;  // the id may be reused
+    }
+    for (auto layer = _textures.begin(); layer != _textures.end();) {
+      if (layer->second.texId == oldId && layer->first != name) {
+        layer = _textures.erase(layer);
+      } else {
+        ++layer;
+      }
+    }
+  }
 
   GLuint texId;
-  if (_textures.count(name) == 0) {
-    glGenTextures(1, &texId);
-    _textures[name] = Texture{texId, slot};
-  } else {
-    //std::cout << "Warning: texture already registered with name: " << 
-        //name << std::endl;
-    texId = _textures[name].texId;
+  glGenTextures(1, &texId);
+  _textures[name] = Texture{texId, slot, target, -1};
+  bindTexture(texId, target, slot);
+  return texId;
+}
+
+void Renderer::loadTextureArray(const std::string& name,
+    const vector<string>& textureNames, const vector<string>& fileNames,
+    int slot) {
+  vector<Image> images(fileNames.size());
+  vector<std::future<void>> decoded;
+  for (int i = 0; i < fileNames.size(); i++) {
+    Image* image = &images[i];
+    const string& fileName = fileNames[i];
+    decoded.push_back(workers()->run([image, fileName]() {
+      image->load(fileName);
+    }));
+  }
+  for (std::future<void>& done : decoded) done.get();
+  loadTextureArray(name, textureNames, images, slot);
+}
+
+void Renderer::loadTextureArray(const std::string& name,
+    const vector<string>& textureNames, const vector<Image>& images,
+    int slot) {
+  assert(textureNames.size() == images.size());
+  int width = 1;
+  int height = 1;
+  for (const Image& image : images) {
+    width = std::max(width, image.width());
+    height = std::max(height, image.height());
+  }
+
+  GLuint texId = createTexture(name, GL_TEXTURE_2D_ARRAY, slot);
+  glTexStorage3D(GL_TEXTURE_2D_ARRAY, mipLevels(width, height), GL_RGBA8,
+      width, height, static_cast<GLsizei>(images.size()));
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (int i = 0; i < images.size(); i++) {
+    if (images[i].data() == 0) {
+      std::cout << "WARNING: could not load texture " << textureNames[i]
+          << std::endl;
+      continue;
+    }
+    Image scaled;
+    const Image* layer = &images[i];
+    if (layer->width() != width || layer->height() != height) {
+      scaled = layer->resize(width, height);
+      layer = &scaled;
+    }
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, width, height, 1,
+        pixelFormat(*layer), GL_UNSIGNED_BYTE, layer->data());
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+  mipmapFilter(GL_TEXTURE_2D_ARRAY);
+
+  MemoryTracker::track(&_textures[name], MemoryTracker::GPU_TEXTURE, name,
+      textureBytes(width, height, 4, mipLevels(width, height),
+        static_cast<int>(images.size())));
+
+  for (int i = 0; i < textureNames.size(); i++) {
+    _pendingTextures.erase(textureNames[i]);
+    if (textureNames[i] != name) {
+      // counted with the array
+      MemoryTracker::release(&_textures[textureNames[i]]);
+    }
+    _textures[textureNames[i]] = Texture{texId, slot, GL_TEXTURE_2D_ARRAY, i};
   }
+}
 
-  glBindTexture(GL_TEXTURE_2D, texId);
-  glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, image.width(), image.height());
+void Renderer::loadTexture(const std::string& name,
+    const Image& image, int slot) {
+  static const GLenum kInternalFormats[] = {GL_R8, GL_RG8, GL_RGB8, GL_RGBA8};
+  TraceZone zone("upload texture", name);
+  createTexture(name, GL_TEXTURE_2D, slot);
+  glTexStorage2D(GL_TEXTURE_2D, mipLevels(image.width(), image.height()),
+      kInternalFormats[image.channels() - 1], image.width(), image.height());
+
+  // rows of 1 and 3 channel images are not 4-byte aligned
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
   glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.width(), image.height(),
-      GL_RGBA, GL_UNSIGNED_BYTE, image.data());
+      pixelFormat(image), GL_UNSIGNED_BYTE, image.data());
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  if (image.channels() <= 2) {
+    // gray images are sampled as gray rather than red
+    GLint swizzle[] = {GL_RED, GL_RED, GL_RED,
+        image.channels() == 2 ? GL_GREEN : GL_ONE};
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+  }
 
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glGenerateMipmap(GL_TEXTURE_2D);
+  mipmapFilter(GL_TEXTURE_2D);
+  MemoryTracker::track(&_textures[name], MemoryTracker::GPU_TEXTURE, name,
+      textureBytes(image.width(), image.height(), image.channels(),
+        mipLevels(image.width(), image.height())));
+}
+
+void Renderer::loadTexture(const std::string& name,
+    const CompressedImage& image, int slot) {
+  if (image.numLevels() == 0) {
+    std::cout << "WARNING: compressed texture " << name << " is empty\n";
+    return;
+  }
+  TraceZone zone("upload texture", name);
+  createTexture(name, GL_TEXTURE_2D, slot);
+  glTexStorage2D(GL_TEXTURE_2D, image.numLevels(), image.format(),
+      image.width(), image.height());
+  size_t bytes = 0;
+  for (int i = 0; i < image.numLevels(); i++) {
+    const CompressedImage::Level& level = image.level(i);
+    glCompressedTexSubImage2D(GL_TEXTURE_2D, i, 0, 0,
+        level.width, level.height, image.format(),
+        static_cast<GLsizei>(level.size), image.data(i));
+    bytes += level.size;
+  }
+  MemoryTracker::track(&_textures[name], MemoryTracker::GPU_TEXTURE, name,
+      bytes);
+
+  if (image.numLevels() > 1) {
+    mipmapFilter(GL_TEXTURE_2D);
+  } else {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  }
 }
 
 void Renderer::loadShader(const std::string& name,
@@ -634,12 +1448,126 @@ void Renderer::loadShader(const std::string& name,
   shader->link();
   //std::cout << "Loaded shader: " << name << std::endl;
 
+  for (auto it : _uniformBlockBindings) {
+    shader->bindUniformBlock(it.first.c_str(), it.second);
+  }
+
   _shaders[name] = shader;
 }
 
+void Renderer::loadShaderAsync(const std::string& name,
+    const std::string& vs, const std::string& fs) {
+  Shader* shader = new Shader();
+  shader->compileShader(vs);
+  shader->compileShader(fs);
+  shader->linkAsync();
+  finishShader(shader, false);  // ready now if loaded from the cache
+  _shaders[name] = shader;
+}
+
+bool Renderer::shaderReady(const std::string& name) {
+  if (_shaders.count(name) == 0) loadBuiltinShader(name);
+  assert(_shaders.count(name) != 0);
+  return finishShader(_shaders[name], false);
+}
+
+void Renderer::finishShaderLoads() {
+  for (auto it : _shaders) {
+    finishShader(it.second, true);
+  }
+  finishVariants();
+}
+
+// Compiles every variant of the linked shaders, all started before any is
+// waited on so that the driver can compile them in parallel
+void Renderer::finishVariants() {
+  std::vector<Shader*> variants;
+  for (auto it : _shaders) {
+    Shader* shader = it.second;
+    unsigned features = shader->features();
+    if (!shader->isLinked() || features == 0) continue;
+    // every nonzero subset of features
+    for (unsigned f = features; f != 0; f = (f - 1) & features) {
+      variants.push_back(shader->variant(f));
+    }
+  }
+  for (Shader* variant : variants) {
+    finishShader(variant, true);
+  }
+}
+
+// Completes a pending shader once the driver is done with it
+bool Renderer::finishShader(Shader* shader, bool wait) {
+  if (!shader->isPending()) return shader->isLinked();
+
+  if (wait) {
+    shader->link();
+  } else if (!shader->isReady()) {
+    return false;
+  }
+
+  for (auto it : _uniformBlockBindings) {
+    shader->bindUniformBlock(it.first.c_str(), it.second);
+  }
+  return true;
+}
+
+void Renderer::uniformBlockBinding(const std::string& blockName,
+    int binding) {
+  _uniformBlockBindings[blockName] = binding;
+  for (auto it : _shaders) {
+    // pending shaders pick up bindings when they finish
+    if (it.second->isLinked()) {
+      it.second->bindUniformBlock(blockName.c_str(), binding);
+    }
+  }
+}
+
+void Renderer::loadUniformBuffer(const std::string& name, int binding,
+    GLsizeiptr size, const void* data) {
+  GLuint bufferId;
+  if (_uniformBuffers.count(name) == 0) {
+    glGenBuffers(1, &bufferId);
+  } else {
+    bufferId = _uniformBuffers[name].bufferId;
+  }
+  _uniformBuffers[name] = UniformBuffer{bufferId, binding};
+
+  glBindBuffer(GL_UNIFORM_BUFFER, bufferId);
+  glBufferData(GL_UNIFORM_BUFFER, size, data, GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+  MemoryTracker::track(&_uniformBuffers[name], MemoryTracker::GPU_BUFFER,
+      name, size);
+}
+
+void Renderer::updateUniformBuffer(const std::string& name,
+    const void* data, GLsizeiptr size, GLintptr offset) {
+  auto it = _uniformBuffers.find(name);
+  assert(it != _uniformBuffers.end());
+
+  glBindBuffer(GL_UNIFORM_BUFFER, it->second.bufferId);
+  glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void Renderer::uniformBuffer(const std::string& name) {
+  auto it = _uniformBuffers.find(name);
+  assert(it != _uniformBuffers.end());
+
+  const UniformBuffer& buffer = it->second;
+  if (buffer.binding >= (int) _boundUniformBuffers.size()) {
+    _boundUniformBuffers.resize(buffer.binding + 1, 0);
+  }
+  if (_boundUniformBuffers[buffer.binding] == buffer.bufferId) return;
+
+  glBindBufferBase(GL_UNIFORM_BUFFER, buffer.binding, buffer.bufferId);
+  _boundUniformBuffers[buffer.binding] = buffer.bufferId;
+}
+
 void Renderer::beginRenderTexture(const std::string& targetName) {
   assert(_renderTextures.count(targetName) != 0);
   assert(_activeRenderTexture == "");
+  flushBatches();
 
   RenderTexture& tex = _renderTextures[targetName];
   glBindFramebuffer(GL_FRAMEBUFFER, tex.handleId);
@@ -652,11 +1580,12 @@ void Renderer::beginRenderTexture(const std::string& targetName) {
 
 void Renderer::endRenderTexture() {
   assert(_activeRenderTexture.size() != 0);
+  flushBatches();
   glFlush();
 
   // unbind fbo and revert to default (the screen)
   RenderTexture target = _renderTextures[_activeRenderTexture];
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, _screenFramebuffer);
   glViewport(target.winProps[0],
              target.winProps[1],
              target.winProps[2],
@@ -667,27 +1596,19 @@ void Renderer::endRenderTexture() {
 
 void Renderer::loadRenderTexture(const std::string& name,
     int slot, int width, int height) {
-  if (slot == GLFONS_FONT_TEXTURE_SLOT) {
-    std::cout << "WARNING: slot " << slot << " conflicts with font texture\n";
-  }
   // Generate and bind the framebuffer
   GLuint fboHandle;
   glGenFramebuffers(1, &fboHandle);
   glBindFramebuffer(GL_FRAMEBUFFER, fboHandle);
 
-  // Create the texture object
-  GLuint renderTex;
-  glGenTextures(1, &renderTex);
-  glActiveTexture(GL_TEXTURE0 + slot);  // put in given slot!!
-  glBindTexture(GL_TEXTURE_2D, renderTex);
+  // Create the texture object, saved as an available texture with the
+  // same name
+  GLuint renderTex = createTexture(name, GL_TEXTURE_2D, slot);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA,
       GL_UNSIGNED_BYTE, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-  // save texture as an available texture object with the same name
-  _textures[name] = Texture{renderTex, slot};
-
   // Bind the texture to the FBO
   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
       GL_TEXTURE_2D, renderTex, 0);
@@ -719,9 +1640,12 @@ void Renderer::loadRenderTexture(const std::string& name,
   target.width = width;
   target.height = height;
   _renderTextures[name] = target;
+  // the color texture and the depth buffer
+  MemoryTracker::track(&_textures[name], MemoryTracker::GPU_TEXTURE, name,
+      textureBytes(width, height, 4 + 4, 1));
 
   // unbind fbo and revert to default (the screen)
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glBindFramebuffer(GL_FRAMEBUFFER, _screenFramebuffer);
 }
 
 
@@ -5,12 +5,18 @@
 
 #include <vector>
 #include <list>
+#include <utility>
 #include <string>
 #include <map>
+#include <future>
+#include <memory>
 #include "agl/agl.h"
 #include "agl/aglm.h"
+#include "agl/compressedimage.h"
 #include "agl/image.h"
 #include "agl/mesh.h"
+#include "agl/profiler.h"
+#include "agl/shader.h"
 
 namespace agl {
 
@@ -55,6 +61,16 @@ class Renderer {
    */
   void cleanup();
 
+  /**
+   * @brief Create all built-in resources now instead of on first use
+   *
+   * The built-in shaders ("lines", "sprite", "text", "cubemap", ...), the
+   * font, and the primitive meshes are normally created the first time they
+   * are drawn, so a program only pays for what it uses. Call warmup() from
+   * setup() to pay the whole cost before the first frame instead.
+   */
+  void warmup();
+
   /**
    * @brief Return whether the Renderer is ready for drawing
    * @return Returns true if initialized; false otherwise
@@ -174,6 +190,42 @@ class Renderer {
   void loadShader(const std::string& name,
       const std::string& vs, const std::string& fs);
 
+  /**
+   * @brief Start loading a GLSL shader without waiting for it to compile
+   * @param name A nickname for the shader to be used in beginShader()
+   * @param vs The vertex shader file name
+   * @param vs The fragment shader file name
+   *
+   * The compile and link are issued immediately but not waited on. When the
+   * driver supports GL_KHR_parallel_shader_compile, several shaders compile
+   * at once on background threads. Until the shader is ready, beginShader()
+   * with this name uses the "unlit" shader instead.
+   * ```
+   * for (std::string name : names) {
+   *   renderer.loadShaderAsync(name, name + ".vs", name + ".fs");
+   * }
+   * ```
+   * @see shaderReady
+   * @see finishShaderLoads
+   */
+  void loadShaderAsync(const std::string& name,
+      const std::string& vs, const std::string& fs);
+
+  /**
+   * @brief Return whether the given shader has finished compiling
+   *
+   * Does not block. Shaders loaded with loadShader() are always ready.
+   */
+  bool shaderReady(const std::string& name);
+
+  /**
+   * @brief Wait until all shaders loaded with loadShaderAsync() are ready
+   *
+   * Also compiles the variants of every shader (see shaderFeature), so that
+   * no draw waits for one later.
+   */
+  void finishShaderLoads();
+
   /**
    * @brief Set active shader to use for rendering.
    *
@@ -199,6 +251,22 @@ class Renderer {
    */
   void endShader();
 
+  /**
+   * @brief Enable or disable a compile-time shader feature
+   * @param feature A feature bit, such as ShaderFeature::FOG
+   * @param enabled Whether later draws use shaders with the feature defined
+   *
+   * Shaders may test for features with `#ifdef`, e.g. `#ifdef HAS_UV`. Such
+   * shaders are compiled once for each combination of features they are
+   * drawn with, in the background the first time it is used; until it is
+   * ready, draws use the shader without features. finishShaderLoads() and
+   * warmup() compile every combination up front instead. HAS_UV, HAS_COLOR
+   * and HAS_TANGENT are set automatically from the attributes of each mesh.
+   * Other features, such as FOG and SPOT, are set with this function.
+   * @see Shader::variant
+   */
+  void shaderFeature(ShaderFeature::Bits feature, bool enabled);
+
   /**
    * @brief Render to a texture instead of to the screen
    * @targetName The name of the texture target
@@ -236,6 +304,14 @@ class Renderer {
   void loadRenderTexture(const std::string& name, int slot,
       int width, int height);
 
+  /**
+   * @brief Set the framebuffer that endRenderTexture() returns to
+   *
+   * This is 0 (the window) unless the window is headless and draws into
+   * a framebuffer object.
+   */
+  void setScreenFramebuffer(GLuint fbo) { _screenFramebuffer = fbo; }
+
   /**
    * @brief Clear all active shaders
    *
@@ -311,6 +387,80 @@ class Renderer {
    */
   void setUniform(const std::string& name, GLuint val);
 
+  /**
+   * @brief Set a uniform parameter using a precomputed id
+   *
+   * Ids are computed from the uniform name with agl::uniformId, typically
+   * once as a constant. This avoids hashing the name on every call.
+   * ```
+   * static const UniformId kTime = uniformId("Time");
+   * renderer.setUniform(kTime, elapsedTime());
+   * ```
+   * Only uniforms that are active in the current shader can be set by id.
+   */
+  void setUniform(UniformId id, float x, float y, float z);
+
+  /**
+   * @copydoc setUniform(UniformId,float,float,float)
+   */
+  void setUniform(UniformId id, const glm::vec2 &v);
+
+  /**
+   * @copydoc setUniform(UniformId,float,float,float)
+   */
+  void setUniform(UniformId id, const glm::vec3 &v);
+
+  /**
+   * @copydoc setUniform(UniformId,float,float,float)
+   */
+  void setUniform(UniformId id, const glm::vec4 &v);
+
+  /**
+   * @copydoc setUniform(UniformId,float,float,float)
+   */
+  void setUniform(UniformId id, const glm::mat4 &m);
+
+  /**
+   * @copydoc setUniform(UniformId,float,float,float)
+   */
+  void setUniform(UniformId id, const glm::mat3 &m);
+
+  /**
+   * @copydoc setUniform(UniformId,float,float,float)
+   */
+  void setUniform(UniformId id, float val);
+
+  /**
+   * @copydoc setUniform(UniformId,float,float,float)
+   */
+  void setUniform(UniformId id, int val);
+
+  /**
+   * @copydoc setUniform(UniformId,float,float,float)
+   */
+  void setUniform(UniformId id, bool val);
+
+  /**
+   * @copydoc setUniform(UniformId,float,float,float)
+   */
+  void setUniform(UniformId id, GLuint val);
+
+  /**
+   * @brief Return the number of uniform uploads issued and skipped
+   *
+   * Each shader keeps a copy of the last value sent for every uniform.
+   * Setting a uniform to the value it already holds does not call OpenGL and
+   * is counted as skipped.
+   * @see resetUniformStats()
+   */
+  UniformStats uniformStats() const;
+
+  /**
+   * @brief Reset the uniform upload counters to zero
+   * @see uniformStats()
+   */
+  void resetUniformStats();
+
   /**
    * @brief Set a uniform sampler parameter in the currently active shader
    *
@@ -318,11 +468,24 @@ class Renderer {
    * should already be loaded. The textureName should match the key given when
    * the texture is loaded.
    *
+   * The texture is only rebound when another texture was bound to its slot
+   * since. If it is a layer of a texture array, the current shader draws
+   * with its TEXTURE_ARRAY variant until endShader() or until a 2D texture
+   * is set, and the layer is set in the int uniform named uniformName +
+   * "Layer", so switching between layers of the same array never rebinds.
+   *
    * @see loadTexture
+   * @see loadTextureArray
    * @verbinclude sprites.cpp
    */
   void texture(const std::string& uniformName, const std::string& textureName);
 
+  /**
+   * @brief Return the layer of the given texture in its texture array
+   * @return The layer, or -1 if the texture is not part of an array
+   */
+  int textureLayer(const std::string& textureName) const;
+
   /**
    * @brief Set a uniform sampler parameter in the currently active shader
    *
@@ -335,6 +498,64 @@ class Renderer {
    */
   void cubemap(const std::string& uniformName, const std::string& texName);
 
+  /** @name Uniform buffers
+   * @brief Uniform buffers hold uniform blocks shared between shaders
+   */
+  ///@{
+  /**
+   * @brief Source the uniform block with the given name from a binding point
+   * @param blockName The name of the uniform block in the shader source
+   * @param binding The uniform buffer binding point
+   *
+   * Applies to all loaded shaders and to shaders loaded afterwards. Shaders
+   * that do not declare the block are unaffected. Blocks should use the
+   * std140 layout so that C++ structs can mirror them.
+   * ```
+   * layout (std140) uniform FrameBlock {
+   *   mat4 View;
+   *   vec4 LightPos;
+   * };
+   * ```
+   * @see loadUniformBuffer
+   */
+  void uniformBlockBinding(const std::string& blockName, int binding);
+
+  /**
+   * @brief Create a uniform buffer associated with a binding point
+   * @param name A nickname for the buffer to be used in uniformBuffer()
+   * @param binding The binding point the buffer is attached to when used
+   * @param size The size of the buffer in bytes
+   * @param data Initial contents (may be null)
+   *
+   * Buffers are typically loaded in setup(). A frame-constant block (camera,
+   * lights) is written once per frame with updateUniformBuffer() while
+   * constant blocks (materials) are written once and switched with
+   * uniformBuffer().
+   * @see uniformBlockBinding
+   */
+  void loadUniformBuffer(const std::string& name, int binding,
+      GLsizeiptr size, const void* data = nullptr);
+
+  /**
+   * @brief Replace the contents of a uniform buffer
+   * @param name The nickname given in loadUniformBuffer()
+   * @param data The new contents
+   * @param size The number of bytes to write
+   * @param offset The offset in bytes at which to start writing
+   */
+  void updateUniformBuffer(const std::string& name,
+      const void* data, GLsizeiptr size, GLintptr offset = 0);
+
+  /**
+   * @brief Attach a uniform buffer to its binding point
+   * @param name The nickname given in loadUniformBuffer()
+   *
+   * All shaders whose blocks use the buffer's binding point read from this
+   * buffer until another buffer is attached to the same binding point.
+   */
+  void uniformBuffer(const std::string& name);
+  ///@}
+
   /** @name Loading textures
    * @brief Textures should typically be loaded from setup()
    */
@@ -342,6 +563,10 @@ class Renderer {
   /**
    * @brief Load a texture from a file
    *
+   * If a block-compressed .ktx2 or .dds file with the same base name exists
+   * (e.g. brick.ktx2 next to brick.png) and the GPU supports its format, it
+   * is uploaded instead, along with its mip levels.
+   * @see CompressedImage
    * @verbinclude sprites.cpp
    */
   void loadTexture(const std::string& name,
@@ -352,6 +577,74 @@ class Renderer {
    */
   void loadTexture(const std::string& name, const Image& img, int slot);
 
+  /**
+   * @brief Load a texture from block-compressed data
+   *
+   * The levels in the image are uploaded as they are. A single level is
+   * sampled without mipmaps, since the GPU cannot generate them for
+   * compressed formats.
+   */
+  void loadTexture(const std::string& name,
+      const CompressedImage& img, int slot);
+
+  /**
+   * @brief Start loading a texture from a file on a worker thread
+   *
+   * Files loaded this way are decoded in parallel. The texture is created
+   * when it is first used, or by textureReady() or finishTextureLoads().
+   * ```
+   * for (std::string name : names) {
+   *   renderer.loadTextureAsync(name, "../textures/" + name + ".png", 0);
+   * }
+   * ```
+   * @see finishTextureLoads
+   */
+  void loadTextureAsync(const std::string& name,
+      const std::string& filename, int slot);
+
+  /**
+   * @brief Return whether the given texture has been loaded
+   *
+   * Does not block. Creates the texture if its file has been decoded.
+   */
+  bool textureReady(const std::string& name);
+
+  /**
+   * @brief Wait until all textures loaded with loadTextureAsync() are ready
+   */
+  void finishTextureLoads();
+
+  /**
+   * @brief Pack several textures into one texture array
+   * @param name The key for the whole array
+   * @param textureNames The key for each layer
+   * @param fileNames The image for each layer
+   * @param slot The slot of the array, shared by all its layers
+   *
+   * Each layer remains usable by its own name in texture() and
+   * batchSprite(). Images are decoded in parallel. Layers must have the same
+   * size, so smaller images are scaled up to the size of the largest.
+   * ```
+   * std::vector<std::string> names = {"brick", "marble", "wood"};
+   * std::vector<std::string> files;
+   * for (const std::string& name : names) {
+   *   files.push_back("../textures/" + name + ".png");
+   * }
+   * renderer.loadTextureArray("materials", names, files, 0);
+   * renderer.texture("diffuseTexture", "marble");  // sets layer 1
+   * ```
+   */
+  void loadTextureArray(const std::string& name,
+      const std::vector<std::string>& textureNames,
+      const std::vector<std::string>& fileNames, int slot);
+
+  /**
+   * @brief Pack several images into one texture array
+   */
+  void loadTextureArray(const std::string& name,
+      const std::vector<std::string>& textureNames,
+      const std::vector<Image>& images, int slot);
+
   /**
    * @brief Load a cube map
    */
@@ -359,6 +652,8 @@ class Renderer {
 
   /**
    * @brief Load a cube map
+   *
+   * The six faces are decoded in parallel.
    */
   void loadCubemap(const std::string& name,
       const std::vector<std::string>& names, int slot);
@@ -388,6 +683,8 @@ class Renderer {
    *   // draw arm
    * renderer.pop();
    * ```
+   * The stack has room for 64 matrices up front and grows past that, so
+   * push() and pop() do not allocate for typical hierarchies.
    * @verbinclude shapes.cpp
    */
   void push();
@@ -502,6 +799,51 @@ class Renderer {
   void line(const glm::vec3& p1, const glm::vec3& p2,
       const glm::vec3& c1, const glm::vec3& c2);
 
+  /**
+   * @brief Queue a line to be drawn together with other batched lines
+   * @param p1 The location of the first point
+   * @param p2 The location of the second point
+   * @param c1 The color of the first point
+   * @param c2 The color of the second point
+   *
+   * The points are transformed by the current matrix when queued. Batched
+   * lines are drawn with the "lines" shader in a single draw call when the
+   * batch is flushed, usually at the end of the frame.
+   * ```
+   * for (int i = 0; i < mesh.numVertices(); i++) {
+   *   vec3 p = mesh.vertexData(POSITION, i);
+   *   vec3 n = mesh.vertexData(NORMAL, i);
+   *   renderer.batchLine(p, p + 0.1f * n, vec3(1), vec3(0, 0, 1));
+   * }
+   * ```
+   * @see flushBatches()
+   */
+  void batchLine(const glm::vec3& p1, const glm::vec3& p2,
+      const glm::vec3& c1, const glm::vec3& c2);
+
+  /**
+   * @brief Queue a sprite to be drawn together with other batched sprites
+   * @param textureName The texture to draw the sprite with
+   * @param pos The location of the center of the sprite
+   * @param color The color of the sprite
+   * @param size The size (width/height) of the billboard
+   *
+   * The position is transformed by the current matrix when queued. Sprites
+   * are drawn as instanced billboards, one draw call per run of sprites that
+   * share a texture and blend mode.
+   * @see flushBatches()
+   */
+  void batchSprite(const std::string& textureName,
+      const glm::vec3& pos, const glm::vec4& color, float size);
+
+  /**
+   * @brief Draw all queued lines and sprites
+   *
+   * Called automatically by Window after draw(), and before the camera,
+   * projection or render target change.
+   */
+  void flushBatches();
+
   /**
    * @brief Draws text using the current font size and color
    * @param text The phrase to display
@@ -614,10 +956,64 @@ class Renderer {
   void mesh(const Mesh& m);
   ///@}
 
+  /** @name Profiling
+   * Window calls beginFrame() and endFrame() around draw().
+   * @see Profiler
+   */
+  ///@{
+  void beginFrame();
+  void endFrame();
+
+  /**
+   * @brief Time the following draws as the pass with this name
+   *
+   * Passes may nest; each beginProfile() needs a matching endProfile().
+   */
+  void beginProfile(const std::string& name);
+
+  /**
+   * @brief End the most recent pass started by beginProfile()
+   */
+  void endProfile();
+
+  /**
+   * @brief Return the draw calls issued by the renderer this frame
+   *
+   * Text counts one call per text().
+   */
+  int drawCalls() const { return _drawCalls; }
+
+  /**
+   * @brief Return the CPU and GPU times of the frame and its passes
+   */
+  const Profiler& profiler() const { return _profiler; }
+  Profiler& profiler() { return _profiler; }
+
+  /**
+   * @brief Draw the frame and pass times and draw calls with text()
+   * @param x The left of the table, in screen coordinates
+   * @param y The top of the table, in screen coordinates
+   *
+   * Shows the last value, p50 and p99 of the CPU and GPU milliseconds. Wrap
+   * it in its own pass to include the cost of the text.
+   */
+  void profileHud(float x, float y);
+  ///@}
+
  private:
   void initBillboards();
   void initLines();
   void initText();
+  void initBatches();
+  void initPrimitives();
+  bool loadBuiltinShader(const std::string& name);
+  bool finishShader(class Shader* shader, bool wait);
+  void finishVariants();
+  bool finishTexture(const std::string& name, bool wait);
+  class ThreadPool* workers();
+  GLuint createTexture(const std::string& name, GLenum target, int slot);
+  void bindTexture(GLuint texId, GLenum target, int slot);
+  void useVariant(unsigned features);
 
  private:
   bool _initialized;
@@ -627,8 +1023,23 @@ class Renderer {
   struct Texture {
     GLuint texId;
     int slot;
+    GLenum target;
+    int layer;  // in a GL_TEXTURE_2D_ARRAY, or -1
   };
   std::map<std::string, Texture> _textures;
+  std::vector<GLuint> _boundTextures;  // per slot, to skip redundant binds
+
+  // textures being decoded by _workers
+  struct PendingTexture {
+    std::shared_ptr<Image> image;
+    std::shared_ptr<CompressedImage> compressed;  // used if it has levels
+    std::future<void> decoded;
+    int slot;
+  };
+  std::map<std::string, PendingTexture> _pendingTextures;
+  class ThreadPool* _workers;
+  bool _hasS3TC;  // BC1 and BC3 textures can be sampled
+  bool _hasBPTC;  // BC7 textures can be sampled
 
   // render targets
   struct RenderTexture {
@@ -642,14 +1053,29 @@ class Renderer {
   };
   std::map<std::string, RenderTexture> _renderTextures;
   std::string _activeRenderTexture;
+  GLuint _screenFramebuffer;
+
+  // uniform buffers
+  struct UniformBuffer {
+    GLuint bufferId;
+    int binding;
+  };
+  std::map<std::string, UniformBuffer> _uniformBuffers;
+  std::map<std::string, int> _uniformBlockBindings;
+  std::vector<GLuint> _boundUniformBuffers;  // buffer at each binding point
 
   // shaders
   class Shader* _currentShader;
   std::map<std::string, class Shader*> _shaders;
-  std::list<Shader*> _shaderStack;
-
-  // matrix stack
-  std::list<glm::mat4> _stack;
+  // shaders and _textureFeatures to restore in endShader()
+  std::list<std::pair<Shader*, unsigned>> _shaderStack;
+  unsigned _shaderFeatures;  // features not derived from meshes
+  unsigned _textureFeatures;  // of textures bound for the current shader
+
+  // matrix stack; reserved up front so push/pop do not allocate until a
+  // hierarchy is deeper than any before it
+  static const int kStackReserve = 64;
+  std::vector<glm::mat4> _stack;
   glm::mat4 _trs;
 
   // perspective and view
@@ -657,6 +1083,14 @@ class Renderer {
   glm::mat4 _viewMatrix;
   glm::vec3 _lookfrom;
 
+  // matrices derived from _trs, view and projection; recomputed lazily
+  void updateMatrices();
+  glm::mat4 _modelView;
+  glm::mat4 _mvp;
+  glm::mat3 _normalMatrix;
+  bool _modelViewDirty;
+  bool _mvpDirty;
+
   // default meshes
   class Cube* _cube;
   class Cylinder* _cone;
@@ -677,6 +1111,22 @@ class Renderer {
   GLuint mVboLineColorId;
   GLuint mVaoLineId;
 
+  // Batched lines and sprites
+  void flushLines();
+  void flushSprites();
+  class StreamBuffer* _lineBatch;
+  class StreamBuffer* _spriteBatch;
+  GLuint _lineBatchVao;
+  GLuint _spriteBatchVao;
+  GLsizei _lineBatchCount;    // number of vertices queued
+  GLsizei _spriteBatchCount;  // number of sprites queued
+  Texture _spriteBatchTexture;
+  BlendMode _spriteBatchBlendMode;
+
+  // Profiling
+  Profiler _profiler;
+  int _drawCalls;  // since beginFrame()
+
   // Text
   int _fontNormal;
   unsigned int _fontColor;
@@ -0,0 +1,75 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/resources.h"
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace agl {
+
+#ifdef AGL_EMBED_RESOURCES
+// Defined in the file generated by cmake/embed.cmake
+extern const EmbeddedResource kEmbeddedResources[];
+extern const int kNumEmbeddedResources;
+#endif
+
+// The name a file is embedded under: its path without leading "../" or "./"
+static std::string resourceName(const std::string& fileName) {
+  size_t start = 0;
+  while (true) {
+    if (fileName.compare(start, 3, "../") == 0) {
+      start += 3;
+    } else if (fileName.compare(start, 2, "./") == 0) {
+      start += 2;
+    } else {
+      break;
+    }
+  }
+  return fileName.substr(start);
+}
+
+// The file in AGL_RESOURCE_DIR, or "" if there is none
+static std::string overridePath(const std::string& fileName) {
+  const char* dir = getenv("AGL_RESOURCE_DIR");
+  if (dir == 0 || dir[0] == '\0') return "";
+
+  std::string path = std::string(dir) + "/" + resourceName(fileName);
+  std::ifstream file(path);
+  return file ? path : "";
+}
+
+const EmbeddedResource* findEmbeddedResource(const std::string& fileName) {
+#ifdef AGL_EMBED_RESOURCES
+  if (overridePath(fileName) != "") return 0;
+
+  std::string name = resourceName(fileName);
+  for (int i = 0; i < kNumEmbeddedResources; i++) {
+    if (name == kEmbeddedResources[i].name) return &kEmbeddedResources[i];
+  }
+#endif
+  return 0;
+}
+
+std::string resourcePath(const std::string& fileName) {
+  std::string path = overridePath(fileName);
+  return path != "" ? path : fileName;
+}
+
+bool readResource(const std::string& fileName, std::string* contents) {
+  const EmbeddedResource* resource = findEmbeddedResource(fileName);
+  if (resource) {
+    contents->assign(reinterpret_cast<const char*>(resource->data),
+        resource->size);
+    return true;
+  }
+
+  std::ifstream file(resourcePath(fileName), std::ios::in | std::ios::binary);
+  if (!file) return false;
+
+  std::stringstream data;
+  data << file.rdbuf();
+  *contents = data.str();
+  return true;
+}
+
+}  // namespace agl
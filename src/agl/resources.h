@@ -0,0 +1,52 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_RESOURCES_H_
+#define AGL_RESOURCES_H_
+
+#include <cstddef>
+#include <string>
+
+namespace agl {
+
+/**
+ * @brief A file compiled into the executable
+ *
+ * When built with AGL_EMBED_RESOURCES, the shaders, default font and
+ * textures are embedded by cmake/embed.cmake under their path relative to
+ * the project directory, e.g. "shaders/unlit.vs".
+ */
+struct EmbeddedResource {
+  const char* name;
+  const unsigned char* data;  // followed by a zero byte
+  size_t size;                // in bytes, not counting the zero
+};
+
+/**
+ * @brief Return the embedded copy of a file, or 0 if it should be read from
+ * disk
+ * @param fileName The path used to load the file, e.g. "../shaders/unlit.vs"
+ *
+ * Leading "../" and "./" are ignored when matching names. If the
+ * environment variable AGL_RESOURCE_DIR is set and the file exists in that
+ * directory, the file on disk overrides the embedded copy.
+ * @see resourcePath
+ */
+const EmbeddedResource* findEmbeddedResource(const std::string& fileName);
+
+/**
+ * @brief Return the path to read a file from when it is not embedded
+ *
+ * This is the file in AGL_RESOURCE_DIR when it exists, otherwise fileName.
+ */
+std::string resourcePath(const std::string& fileName);
+
+/**
+ * @brief Read a file from memory if it is embedded, otherwise from disk
+ * @param fileName The path used to load the file
+ * @param contents Set to the contents of the file
+ * @return false if the file is neither embedded nor readable from disk
+ */
+bool readResource(const std::string& fileName, std::string* contents);
+
+}  // namespace agl
+#endif  // AGL_RESOURCES_H_
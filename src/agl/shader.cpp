@@ -1,14 +1,24 @@
 // Copyright 2011, OpenGL 4.0 Shading language cookbook (David Wolf)
 
 #include "agl/shader.h"
+#include "agl/resources.h"
+#include "agl/trace.h"
 #include <sys/stat.h>
-#include <fstream>
+#ifdef WIN32
+#include <direct.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
 #include <sstream>
 
 namespace agl {
 
-using std::ifstream;
-using std::ios;
 using std::string;
 
 namespace GLSLShaderInfo {
@@ -33,9 +43,32 @@ struct ShaderFileExtension extensions[] = {
 };
 }  // namespace GLSLShaderInfo
 
-Shader::Shader() : handle(0), linked(false) {}
+namespace ShaderFeature {
+
+const char* name(unsigned feature) {
+  switch (feature) {
+    case HAS_UV: return "HAS_UV";
+    case HAS_COLOR: return "HAS_COLOR";
+    case HAS_TANGENT: return "HAS_TANGENT";
+    case FOG: return "FOG";
+    case SPOT: return "SPOT";
+    case TEXTURE_ARRAY: return "TEXTURE_ARRAY";
+  }
+  return "";
+}
+
+}  // namespace ShaderFeature
+
+UniformStats Shader::stats;
+std::string Shader::cacheDir = "../cache";
+
+Shader::Shader() : handle(0), linked(false), pending(false),
+  fromCache(false), usedFeatures(0), base(0) {}
 
 Shader::~Shader() {
+  for (auto it : variants) {
+    delete it.second;
+  }
   if (handle == 0) return;
 
   // Query the number of attached shaders
@@ -91,11 +124,18 @@ string Shader::getExtension(const std::string& nameStr) {
 }
 
 void Shader::compileShader(const std::string& fileName, GLSLShader::Type type) {
-  if (!fileExists(fileName)) {
+  TraceZone zone("Shader::compileShader", fileName);
+  // Embedded shaders are used unless overridden on disk
+  string code;
+  if (!readResource(fileName, &code)) {
     string message = string("Shader: ") + fileName + " not found.";
     throw GLSLProgramException(message);
   }
 
+  compileSource(code, type);
+}
+
+void Shader::compileSource(const string &source, GLSLShader::Type type) {
   if (handle <= 0) {
     handle = glCreateProgram();
     if (handle == 0) {
@@ -103,36 +143,132 @@ void Shader::compileShader(const std::string& fileName, GLSLShader::Type type) {
     }
   }
 
-  ifstream inFile(fileName, ios::in);
-  if (!inFile) {
-    string message = string("Unable to open: ") + fileName;
-    throw GLSLProgramException(message);
+  Stage stage;
+  stage.type = type;
+  stage.source = source;
+  stages.push_back(stage);
+  sources.push_back(stage);
+  usedFeatures |= findFeatures(source);
+}
+
+unsigned Shader::findFeatures(const string& source) {
+  unsigned features = 0;
+  for (int i = 0; i < ShaderFeature::NUM_FEATURES; i++) {
+    string name = ShaderFeature::name(1u << i);
+    size_t pos = source.find(name);
+    while (pos != string::npos) {
+      // match whole identifiers only, e.g. not FOG in FOG_DENSITY
+      size_t end = pos + name.size();
+      bool start = pos == 0 ||
+          !(isalnum(source[pos - 1]) || source[pos - 1] == '_');
+      bool stop = end == source.size() ||
+          !(isalnum(source[end]) || source[end] == '_');
+      if (start && stop) {
+        features |= 1u << i;
+        break;
+      }
+      pos = source.find(name, end);
+    }
+  }
+  return features;
+}
+
+string Shader::addDefines(const string& source, unsigned features) {
+  // #version must stay first, so the defines go on the following lines
+  size_t version = source.find("#version");
+  size_t insert = 0;
+  int line = 1;
+  if (version != string::npos) {
+    insert = source.find('\n', version);
+    insert = (insert == string::npos) ? source.size() : insert + 1;
+    line += static_cast<int>(std::count(source.begin(),
+          source.begin() + insert, '\n'));
+  }
+
+  std::ostringstream defines;
+  for (int i = 0; i < ShaderFeature::NUM_FEATURES; i++) {
+    if (features & (1u << i)) {
+      defines << "#define " << ShaderFeature::name(1u << i) << "\n";
+    }
   }
+  // keep line numbers in compile errors matching the file
+  defines << "#line " << line << "\n";
 
-  // Get file contents
-  std::stringstream code;
-  code << inFile.rdbuf();
-  inFile.close();
+  string result = source;
+  if (insert == source.size() && insert > 0 && source[insert - 1] != '\n') {
+    result += "\n";
+    insert++;
+  }
+  return result.insert(insert, defines.str());
+}
 
-  compileSource(code.str(), type);
+unsigned Shader::features() const {
+  return base ? base->usedFeatures : usedFeatures;
 }
 
-void Shader::compileSource(const string &source, GLSLShader::Type type) {
-  if (handle <= 0) {
-    handle = glCreateProgram();
-    if (handle == 0) {
-      throw GLSLProgramException("Unable to create shader program.");
+Shader* Shader::variant(unsigned features) {
+  if (base) return base->variant(features);
+
+  features &= usedFeatures;
+  if (features == 0) return this;
+
+  auto it = variants.find(features);
+  if (it != variants.end()) return it->second;
+
+  Shader* shader = new Shader();
+  for (const Stage& stage : sources) {
+    shader->compileSource(addDefines(stage.source, features), stage.type);
+  }
+  // the injected defines are not features of the variant itself
+  shader->usedFeatures = 0;
+  shader->sources.clear();
+  shader->base = this;
+  variants[features] = shader;
+  shader->linkAsync();  // errors are thrown when it finishes
+  return shader;
+}
+
+void Shader::copyUniforms() {
+  const Shader* owner = base ? base : this;
+  for (const auto& it : owner->latest) {
+    const Uniform& value = it.second;
+    Uniform* uniform = getUniform(it.first);
+    if (uniform->size == value.size &&
+        memcmp(uniform->value, value.value, value.size) == 0) {
+      continue;
     }
+    memcpy(uniform->value, value.value, value.size);
+    uniform->type = value.type;
+    uniform->size = value.size;
+    if (uniform->location == -1) continue;
+    uploadValue(uniform);
+    stats.issued++;
+  }
+}
+
+// Variants, and shaders bound before they finished linking, get their
+// uniform block bindings once they are linked
+void Shader::applyBlockBindings() {
+  auto bindings = base ? base->blockBindings : blockBindings;
+  for (auto binding : bindings) {
+    bindUniformBlock(binding.first.c_str(), binding.second);
   }
+}
 
-  GLuint shaderHandle = glCreateShader(type);
+void Shader::compileStage(const Stage& stage) {
+  GLuint shaderHandle = glCreateShader(stage.type);
 
-  const char *c_code = source.c_str();
+  const char *c_code = stage.source.c_str();
   glShaderSource(shaderHandle, 1, &c_code, NULL);
 
-  // Compile the shader
+  // Compile the shader; the status is checked when the program is linked so
+  // that the driver can compile stages in parallel
   glCompileShader(shaderHandle);
+  glAttachShader(handle, shaderHandle);
+  compiled.push_back(shaderHandle);
+}
 
+void Shader::checkStage(GLuint shaderHandle) {
   // Check for errors
   int result;
   glGetShaderiv(shaderHandle, GL_COMPILE_STATUS, &result);
@@ -152,20 +288,73 @@ void Shader::compileSource(const string &source, GLSLShader::Type type) {
     msg = "Shader compilation failed.\n";
     msg += logString;
     throw GLSLProgramException(msg);
-
-  } else {
-    // Compile succeeded, attach shader
-    glAttachShader(handle, shaderHandle);
   }
 }
 
 void Shader::link() {
-  if (linked) return;
+  TraceZone zone("Shader::link");
+  linkAsync();
+  if (pending) finishLink();
+}
+
+void Shader::linkAsync() {
+  if (linked || pending) return;
+  TraceZone zone("Shader::linkAsync");
   if (handle <= 0) {
     throw GLSLProgramException("Program has not been compiled.");
   }
 
+  cacheFile = cacheFileName();
+  if (cacheFile != "" && loadBinary(cacheFile)) {
+    findUniformLocations();
+    stages.clear();
+    if (usedFeatures == 0) sources.clear();
+    fromCache = true;
+    linked = true;
+    applyBlockBindings();
+    return;
+  }
+
+  for (const Stage& stage : stages) {
+    compileStage(stage);
+  }
+  stages.clear();
+  if (usedFeatures == 0) sources.clear();
+
+  if (cacheFile != "") {
+    glProgramParameteri(handle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
   glLinkProgram(handle);
+  pending = true;
+}
+
+bool Shader::isReady() {
+  if (linked) return true;
+  if (!pending) return false;
+
+#ifndef __APPLE__
+  if (GLEW_KHR_parallel_shader_compile) {
+    GLint done = GL_FALSE;
+    glGetProgramiv(handle, GL_COMPLETION_STATUS_KHR, &done);
+    if (done == GL_FALSE) return false;
+  }
+#endif
+
+  finishLink();
+  return true;
+}
+
+bool Shader::isPending() const {
+  return pending;
+}
+
+void Shader::finishLink() {
+  TraceZone zone("Shader::finishLink");
+  pending = false;
+  for (GLuint shaderHandle : compiled) {
+    checkStage(shaderHandle);
+  }
+  compiled.clear();
 
   int status = 0;
   glGetProgramiv(handle, GL_LINK_STATUS, &status);
@@ -188,11 +377,125 @@ void Shader::link() {
   } else {
     findUniformLocations();
     linked = true;
+    applyBlockBindings();
+    if (cacheFile != "") saveBinary(cacheFile);
+  }
+}
+
+bool Shader::loadedFromCache() const {
+  return fromCache;
+}
+
+void Shader::setCacheDirectory(const std::string& dir) {
+  cacheDir = dir;
+}
+
+const std::string& Shader::cacheDirectory() {
+  return cacheDir;
+}
+
+// The key covers the stage sources and the driver, since binaries are only
+// valid for the GL implementation that produced them
+string Shader::cacheFileName() {
+  if (cacheDir == "" || stages.empty()) return "";
+
+  GLint numFormats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+  if (numFormats == 0) return "";
+
+  uint64_t hash = 14695981039346656037ull;
+  auto addBytes = [&hash](const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+      hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+  };
+  auto addString = [&addBytes](const char* str) {
+    if (str) addBytes(str, strlen(str) + 1);
+  };
+  addString(reinterpret_cast<const char*>(glGetString(GL_VENDOR)));
+  addString(reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+  addString(reinterpret_cast<const char*>(glGetString(GL_VERSION)));
+  for (const Stage& stage : stages) {
+    addBytes(&stage.type, sizeof(stage.type));
+    addString(stage.source.c_str());
+  }
+
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.bin",
+      static_cast<unsigned long long>(hash));
+  return cacheDir + "/" + name;
+}
+
+// Cache files hold the binary format followed by the program binary
+bool Shader::loadBinary(const std::string& fileName) {
+  FILE* file = fopen(fileName.c_str(), "rb");
+  if (!file) return false;
+
+  GLenum format = 0;
+  std::vector<char> binary;
+  bool ok = fread(&format, sizeof(format), 1, file) == 1;
+  if (ok) {
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file) - static_cast<long>(sizeof(format));
+    fseek(file, sizeof(format), SEEK_SET);
+    ok = size > 0;
+    if (ok) {
+      binary.resize(size);
+      ok = fread(binary.data(), 1, size, file) == static_cast<size_t>(size);
+    }
+  }
+  fclose(file);
+  if (!ok) return false;
+
+  // The driver rejects binaries from other versions; compile in that case
+  glProgramBinary(handle, format, binary.data(), (GLsizei) binary.size());
+  GLint status = GL_FALSE;
+  glGetProgramiv(handle, GL_LINK_STATUS, &status);
+  return status == GL_TRUE;
+}
+
+void Shader::saveBinary(const std::string& fileName) {
+  GLint length = 0;
+  glGetProgramiv(handle, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) return;
+
+  std::vector<char> binary(length);
+  GLenum format = 0;
+  glGetProgramBinary(handle, length, NULL, &format, binary.data());
+
+#ifdef WIN32
+  _mkdir(cacheDir.c_str());
+#else
+  mkdir(cacheDir.c_str(), 0755);
+#endif
+  // Other processes may compile the same shader at the same time, so write
+  // a file of our own and rename it into place, which readers never see
+  // half written
+#ifdef WIN32
+  int pid = _getpid();
+#else
+  int pid = getpid();
+#endif
+  static std::atomic<int> theCount(0);
+  string tmpName = fileName + "." + std::to_string(pid) + "." +
+    std::to_string(theCount++) + ".tmp";
+  FILE* file = fopen(tmpName.c_str(), "wb");
+  if (!file) return;
+  bool ok = fwrite(&format, sizeof(format), 1, file) == 1;
+  ok = fwrite(binary.data(), 1, binary.size(), file) == binary.size() && ok;
+  ok = fclose(file) == 0 && ok;
+#ifdef WIN32
+  if (ok) remove(fileName.c_str());  // rename does not replace on Windows
+#endif
+  if (!ok || rename(tmpName.c_str(), fileName.c_str()) != 0) {
+    remove(tmpName.c_str());
   }
 }
 
 void Shader::findUniformLocations() {
-  uniformLocations.clear();
+  uniforms.clear();
+  std::unordered_map<UniformId, string> names;
 
   GLint numUniforms = 0;
 #ifdef __APPLE__
@@ -209,8 +512,7 @@ void Shader::findUniformLocations() {
     GLenum type;
     GLsizei written;
     glGetActiveUniform(handle, i, maxLen, &written, &size, &type, name);
-    GLint location = glGetUniformLocation(handle, name);
-    uniformLocations[name] = glGetUniformLocation(handle, name);
+    addUniform(name, glGetUniformLocation(handle, name), &names);
   }
   delete[] name;
 #else
@@ -229,12 +531,38 @@ void Shader::findUniformLocations() {
     GLint nameBufSize = results[0] + 1;
     char * name = new char[nameBufSize];
     glGetProgramResourceName(handle, GL_UNIFORM, i, nameBufSize, NULL, name);
-    uniformLocations[name] = results[2];
+    addUniform(name, results[2], &names);
     delete [] name;
   }
 #endif
 }
 
+void Shader::addUniform(const char *name, GLint location,
+    std::unordered_map<UniformId, string>* names) {
+  string key = name;
+
+  // Arrays are reported as "name[0]" but are usually set by "name"
+  size_t bracket = key.rfind("[0]");
+  if (bracket != string::npos && bracket + 3 == key.size()) {
+    key = key.substr(0, bracket);
+  }
+
+  UniformId id = uniformId(key.c_str());
+  auto pos = names->find(id);
+  if (pos != names->end() && pos->second != key) {
+    throw GLSLProgramException("Uniform names " + pos->second +
+        " and " + key + " have the same id.");
+  }
+  (*names)[id] = key;
+
+  Uniform uniform;
+  uniform.id = id;
+  uniform.location = location;
+  uniform.type = GL_NONE;
+  uniform.size = 0;
+  uniforms[id] = uniform;
+}
+
 void Shader::use() {
   if (handle <= 0 || (!linked)) {
     throw GLSLProgramException("Shader has not been linked");
@@ -258,58 +586,212 @@ void Shader::bindFragDataLocation(GLuint location, const char *name) {
   glBindFragDataLocation(handle, location, name);
 }
 
+void Shader::bindUniformBlock(const char *blockName, GLuint binding) {
+  // querying a program that is still linking would wait for it
+  if (linked) {
+    GLuint index = glGetUniformBlockIndex(handle, blockName);
+    if (index != GL_INVALID_INDEX) {
+      glUniformBlockBinding(handle, index, binding);
+    }
+  }
+
+  blockBindings[blockName] = binding;
+  for (auto it : variants) {
+    it.second->bindUniformBlock(blockName, binding);
+  }
+}
+
 void Shader::setUniform(const char *name, float x, float y, float z) {
-  GLint loc = getUniformLocation(name);
-  glUniform3f(loc, x, y, z);
+  upload(getUniform(uniformId(name), name), glm::vec3(x, y, z));
 }
 
 void Shader::setUniform(const char *name, const glm::vec3 &v) {
-  this->setUniform(name, v.x, v.y, v.z);
+  upload(getUniform(uniformId(name), name), v);
 }
 
 void Shader::setUniform(const char *name, const glm::vec4 &v) {
-  GLint loc = getUniformLocation(name);
-  glUniform4f(loc, v.x, v.y, v.z, v.w);
+  upload(getUniform(uniformId(name), name), v);
 }
 
 void Shader::setUniform(const char *name, const glm::vec2 &v) {
-  GLint loc = getUniformLocation(name);
-  glUniform2f(loc, v.x, v.y);
+  upload(getUniform(uniformId(name), name), v);
 }
 
 void Shader::setUniform(const char *name, const glm::mat4 &m) {
-  GLint loc = getUniformLocation(name);
-  glUniformMatrix4fv(loc, 1, GL_FALSE, &m[0][0]);
+  upload(getUniform(uniformId(name), name), m);
 }
 
 void Shader::setUniform(const char *name, const std::vector<glm::mat4> &ms) {
+  // Arrays are not shadowed; they are uploaded every time
   GLint loc = getUniformLocation(name);
   glUniformMatrix4fv(loc, ms.size(), GL_FALSE, &ms[0][0][0]);
+  stats.issued++;
 }
 
 void Shader::setUniform(const char *name, const glm::mat3 &m) {
-  GLint loc = getUniformLocation(name);
-  glUniformMatrix3fv(loc, 1, GL_FALSE, &m[0][0]);
+  upload(getUniform(uniformId(name), name), m);
 }
 
 void Shader::setUniform(const char *name, float val) {
-  GLint loc = getUniformLocation(name);
-  glUniform1f(loc, val);
+  upload(getUniform(uniformId(name), name), val);
 }
 
 void Shader::setUniform(const char *name, int val) {
-  GLint loc = getUniformLocation(name);
-  glUniform1i(loc, val);
+  upload(getUniform(uniformId(name), name), val);
 }
 
 void Shader::setUniform(const char *name, GLuint val) {
-  GLint loc = getUniformLocation(name);
-  glUniform1ui(loc, val);
+  upload(getUniform(uniformId(name), name), val);
 }
 
 void Shader::setUniform(const char *name, bool val) {
-  int loc = getUniformLocation(name);
-  glUniform1i(loc, val);
+  upload(getUniform(uniformId(name), name), static_cast<int>(val));
+}
+
+void Shader::setUniform(UniformId id, float x, float y, float z) {
+  upload(getUniform(id), glm::vec3(x, y, z));
+}
+
+void Shader::setUniform(UniformId id, const glm::vec2 &v) {
+  upload(getUniform(id), v);
+}
+
+void Shader::setUniform(UniformId id, const glm::vec3 &v) {
+  upload(getUniform(id), v);
+}
+
+void Shader::setUniform(UniformId id, const glm::vec4 &v) {
+  upload(getUniform(id), v);
+}
+
+void Shader::setUniform(UniformId id, const glm::mat4 &m) {
+  upload(getUniform(id), m);
+}
+
+void Shader::setUniform(UniformId id, const glm::mat3 &m) {
+  upload(getUniform(id), m);
+}
+
+void Shader::setUniform(UniformId id, float val) {
+  upload(getUniform(id), val);
+}
+
+void Shader::setUniform(UniformId id, int val) {
+  upload(getUniform(id), val);
+}
+
+void Shader::setUniform(UniformId id, bool val) {
+  upload(getUniform(id), static_cast<int>(val));
+}
+
+void Shader::setUniform(UniformId id, GLuint val) {
+  upload(getUniform(id), val);
+}
+
+void Shader::upload(Uniform* uniform, const glm::vec2 &v) {
+  if (needsUpload(uniform, GL_FLOAT_VEC2, &v, sizeof(v))) {
+    glUniform2f(uniform->location, v.x, v.y);
+  }
+}
+
+void Shader::upload(Uniform* uniform, const glm::vec3 &v) {
+  if (needsUpload(uniform, GL_FLOAT_VEC3, &v, sizeof(v))) {
+    glUniform3f(uniform->location, v.x, v.y, v.z);
+  }
+}
+
+void Shader::upload(Uniform* uniform, const glm::vec4 &v) {
+  if (needsUpload(uniform, GL_FLOAT_VEC4, &v, sizeof(v))) {
+    glUniform4f(uniform->location, v.x, v.y, v.z, v.w);
+  }
+}
+
+void Shader::upload(Uniform* uniform, const glm::mat4 &m) {
+  if (needsUpload(uniform, GL_FLOAT_MAT4, &m, sizeof(m))) {
+    glUniformMatrix4fv(uniform->location, 1, GL_FALSE, &m[0][0]);
+  }
+}
+
+void Shader::upload(Uniform* uniform, const glm::mat3 &m) {
+  if (needsUpload(uniform, GL_FLOAT_MAT3, &m, sizeof(m))) {
+    glUniformMatrix3fv(uniform->location, 1, GL_FALSE, &m[0][0]);
+  }
+}
+
+void Shader::upload(Uniform* uniform, float val) {
+  if (needsUpload(uniform, GL_FLOAT, &val, sizeof(val))) {
+    glUniform1f(uniform->location, val);
+  }
+}
+
+void Shader::upload(Uniform* uniform, int val) {
+  if (needsUpload(uniform, GL_INT, &val, sizeof(val))) {
+    glUniform1i(uniform->location, val);
+  }
+}
+
+void Shader::upload(Uniform* uniform, GLuint val) {
+  if (needsUpload(uniform, GL_UNSIGNED_INT, &val, sizeof(val))) {
+    glUniform1ui(uniform->location, val);
+  }
+}
+
+bool Shader::needsUpload(Uniform* uniform, GLenum type,
+    const void *value, GLsizei size) {
+  Shader* owner = base ? base : this;
+  if (owner->usedFeatures != 0) {
+    Uniform& last = owner->latest[uniform->id];
+    memcpy(last.value, value, size);
+    last.type = type;
+    last.size = size;
+  }
+
+  if (uniform->size == size && memcmp(uniform->value, value, size) == 0) {
+    stats.skipped++;
+    return false;
+  }
+
+  memcpy(uniform->value, value, size);
+  uniform->type = type;
+  uniform->size = size;
+  if (uniform->location == -1) {
+    stats.skipped++;
+    return false;
+  }
+  stats.issued++;
+  return true;
+}
+
+void Shader::uploadValue(Uniform* uniform) {
+  const GLfloat* v = uniform->value;
+  switch (uniform->type) {
+    case GL_FLOAT: glUniform1fv(uniform->location, 1, v); break;
+    case GL_FLOAT_VEC2: glUniform2fv(uniform->location, 1, v); break;
+    case GL_FLOAT_VEC3: glUniform3fv(uniform->location, 1, v); break;
+    case GL_FLOAT_VEC4: glUniform4fv(uniform->location, 1, v); break;
+    case GL_FLOAT_MAT3:
+      glUniformMatrix3fv(uniform->location, 1, GL_FALSE, v);
+      break;
+    case GL_FLOAT_MAT4:
+      glUniformMatrix4fv(uniform->location, 1, GL_FALSE, v);
+      break;
+    case GL_INT:
+      glUniform1iv(uniform->location, 1,
+          reinterpret_cast<const GLint*>(v));
+      break;
+    case GL_UNSIGNED_INT:
+      glUniform1uiv(uniform->location, 1,
+          reinterpret_cast<const GLuint*>(v));
+      break;
+  }
+}
+
+const UniformStats& Shader::uniformStats() {
+  return stats;
+}
+
+void Shader::resetUniformStats() {
+  stats = UniformStats();
 }
 
 void Shader::printActiveUniforms() {
@@ -543,14 +1025,24 @@ void Shader::validate() {
   }
 }
 
-int Shader::getUniformLocation(const char *name) {
-  auto pos = uniformLocations.find(name);
-
-  if (pos == uniformLocations.end()) {
-    uniformLocations[name] = glGetUniformLocation(handle, name);
+Shader::Uniform* Shader::getUniform(UniformId id, const char *name) {
+  auto pos = uniforms.find(id);
+  if (pos != uniforms.end()) {
+    return &pos->second;
   }
 
-  return uniformLocations[name];
+  // Not reported at link time. Without a name we cannot query the location,
+  // so the uniform is treated as inactive.
+  Uniform uniform;
+  uniform.id = id;
+  uniform.location = name ? glGetUniformLocation(handle, name) : -1;
+  uniform.type = GL_NONE;
+  uniform.size = 0;
+  return &(uniforms[id] = uniform);
+}
+
+GLint Shader::getUniformLocation(const char *name) {
+  return getUniform(uniformId(name), name)->location;
 }
 
 bool Shader::fileExists(const string &fileName) {
@@ -7,8 +7,10 @@
 #pragma warning(disable : 4290)
 #endif
 
+#include <cstdint>
 #include <string>
-#include <map>
+#include <unordered_map>
+#include <vector>
 #include <stdexcept>
 #include "agl/agl.h"
 #include "agl/aglm.h"
@@ -34,6 +36,45 @@ namespace GLSLShader {
   };
 }  // namespace GLSLShader
 
+// Precomputed handle for a uniform variable: the 32-bit FNV-1a hash of its
+// name. Ids can be computed at compile time and are resolved to locations
+// when the program is linked, so hot paths never build or compare strings.
+// Passing the id of a prefix as hash continues it, so
+// uniformId("Layer", uniformId(name)) is the id of name + "Layer".
+typedef uint32_t UniformId;
+
+constexpr UniformId uniformId(const char *name,
+    UniformId hash = 2166136261u) {
+  while (*name) {
+    hash = (hash ^ static_cast<unsigned char>(*name++)) * 16777619u;
+  }
+  return hash;
+}
+
+// Compile-time features. Shader sources test for them with #ifdef and
+// Shader::variant() compiles one program per combination that is used.
+namespace ShaderFeature {
+  enum Bits {
+    HAS_UV = 1 << 0,       // mesh has texture coordinates
+    HAS_COLOR = 1 << 1,    // mesh has vertex colors
+    HAS_TANGENT = 1 << 2,  // mesh has tangents
+    FOG = 1 << 3,
+    SPOT = 1 << 4,
+    TEXTURE_ARRAY = 1 << 5,  // textures are layers of a texture array
+  };
+  const int NUM_FEATURES = 6;
+
+  // Returns the #define name of a single feature bit
+  const char* name(unsigned feature);
+}  // namespace ShaderFeature
+
+// Counts of uniform uploads across all programs. An upload is skipped when
+// the value matches the program's shadow copy or the uniform is inactive.
+struct UniformStats {
+  unsigned long issued = 0;
+  unsigned long skipped = 0;
+};
+
 class Shader {
  public:
   Shader();
@@ -43,7 +84,31 @@ class Shader {
   void compileShader(const std::string& fileName, GLSLShader::Type type);
   void compileSource(const std::string &source, GLSLShader::Type type);
 
+  // Stages are compiled by link(), unless a program binary for the same
+  // sources and driver is found in the cache directory
   void link();
+  bool loadedFromCache() const;
+
+  // Issue the compile and link without waiting for the driver. isReady()
+  // returns false while GL_KHR_parallel_shader_compile reports the program
+  // as still compiling, and otherwise finishes linking (throwing on errors)
+  void linkAsync();
+  bool isReady();
+  bool isPending() const;
+  // Features tested by the sources (0 if the shader has no variants)
+  unsigned features() const;
+
+  // Return the program compiled with the #defines for the given features,
+  // starting its compile and link with linkAsync() on first use, so check
+  // isReady() before using it. Features the sources do not test for are
+  // ignored, so the variant for 0 is the shader itself. Variants are owned
+  // by the shader they were created from
+  Shader* variant(unsigned features);
+
+  // Upload the values last set on any variant of this shader that this
+  // program does not have yet. This shader must be in use
+  void copyUniforms();
+
   void validate();
   void use();
   int getHandle();
@@ -51,6 +116,7 @@ class Shader {
 
   void bindAttribLocation(GLuint location, const char *name);
   void bindFragDataLocation(GLuint location, const char *name);
+  void bindUniformBlock(const char *blockName, GLuint binding);
 
   void setUniform(const char *name, float x, float y, float z);
   void setUniform(const char *name, const glm::vec2 &v);
@@ -64,8 +130,26 @@ class Shader {
   void setUniform(const char *name, bool val);
   void setUniform(const char *name, GLuint val);
 
+  void setUniform(UniformId id, float x, float y, float z);
+  void setUniform(UniformId id, const glm::vec2 &v);
+  void setUniform(UniformId id, const glm::vec3 &v);
+  void setUniform(UniformId id, const glm::vec4 &v);
+  void setUniform(UniformId id, const glm::mat4 &m);
+  void setUniform(UniformId id, const glm::mat3 &m);
+  void setUniform(UniformId id, float val);
+  void setUniform(UniformId id, int val);
+  void setUniform(UniformId id, bool val);
+  void setUniform(UniformId id, GLuint val);
+
   void findUniformLocations();
 
+  static const UniformStats& uniformStats();
+  static void resetUniformStats();
+
+  // Directory for cached program binaries; an empty string disables caching
+  static void setCacheDirectory(const std::string& dir);
+  static const std::string& cacheDirectory();
+
   void printActiveUniforms();
   void printActiveUniformBlocks();
   void printActiveAttribs();
@@ -73,11 +157,65 @@ class Shader {
   const char *getTypeString(GLenum type);
 
  private:
+  // Location and last uploaded value of a uniform. Values are compared
+  // bytewise, so ints and floats share the same storage.
+  struct Uniform {
+    UniformId id;
+    GLint location;
+    GLenum type;
+    GLsizei size;
+    GLfloat value[16];
+  };
+
+  // Source of a stage waiting to be compiled at link time
+  struct Stage {
+    GLSLShader::Type type;
+    std::string source;
+  };
+
   GLuint handle;
   bool linked;
-  std::map<std::string, int> uniformLocations;
-
+  bool pending;
+  bool fromCache;
+  std::vector<Stage> stages;
+  std::vector<GLuint> compiled;  // stages whose status is not checked yet
+  std::string cacheFile;
+  std::unordered_map<UniformId, Uniform> uniforms;
+  // on the shader variants are created from: the value last set on any of
+  // them, which copyUniforms() brings a program up to date with
+  std::unordered_map<UniformId, Uniform> latest;
+  unsigned usedFeatures;
+  std::vector<Stage> sources;  // kept for variants when usedFeatures != 0
+  std::unordered_map<unsigned, Shader*> variants;
+  std::unordered_map<std::string, GLuint> blockBindings;
+  Shader* base;  // the shader this variant was created from
+  static UniformStats stats;
+  static std::string cacheDir;
+
+  Uniform* getUniform(UniformId id, const char *name = nullptr);
+  bool needsUpload(Uniform* uniform, GLenum type,
+      const void *value, GLsizei size);
+  void uploadValue(Uniform* uniform);
+  void upload(Uniform* uniform, const glm::vec2 &v);
+  void upload(Uniform* uniform, const glm::vec3 &v);
+  void upload(Uniform* uniform, const glm::vec4 &v);
+  void upload(Uniform* uniform, const glm::mat4 &m);
+  void upload(Uniform* uniform, const glm::mat3 &m);
+  void upload(Uniform* uniform, float val);
+  void upload(Uniform* uniform, int val);
+  void upload(Uniform* uniform, GLuint val);
+  void addUniform(const char *name, GLint location,
+      std::unordered_map<UniformId, std::string>* names);
   GLint getUniformLocation(const char *name);
+  void compileStage(const Stage& stage);
+  void checkStage(GLuint shaderHandle);
+  void finishLink();
+  void applyBlockBindings();
+  std::string cacheFileName();
+  bool loadBinary(const std::string& fileName);
+  void saveBinary(const std::string& fileName);
+  static unsigned findFeatures(const std::string& source);
+  static std::string addDefines(const std::string& source, unsigned features);
   bool fileExists(const std::string &fileName);
   std::string getExtension(const std::string& fileName);
 
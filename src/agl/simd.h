@@ -0,0 +1,15 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_SIMD_H_
+#define AGL_SIMD_H_
+
+// AGL_HAS_SSE2 is defined, and the SSE2 intrinsics are declared, when the
+// compiler targets SSE2. It is part of every x86-64 CPU; other CPUs use the
+// scalar code paths.
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AGL_HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+#endif  // AGL_SIMD_H_
@@ -0,0 +1,876 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/softwarerenderer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <glm/gtc/matrix_transform.hpp>
+#include "agl/simd.h"
+#include "agl/threadpool.h"
+
+namespace agl {
+
+using glm::mat3;
+using glm::mat4;
+using glm::vec2;
+using glm::vec3;
+using glm::vec4;
+
+namespace {
+
+const int kTileSize = 64;
+const int kBlockSize = 8;
+const int kBlocksPerTile = kTileSize / kBlockSize;
+const int kSubpixelBits = 4;
+const int kSubpixels = 1 << kSubpixelBits;
+
+// Triangles are clipped to this many pixels beyond the image center so
+// that fixed point edge functions cannot overflow
+const float kGuardBand = 8192.0f;
+
+// Triangles per binning job, and vertices per transform job
+const int kTrianglesPerChunk = 4096;
+const int kVerticesPerJob = 8192;
+
+// the uvScale constant of the GL shaders
+const float kUVScale = 3.0f;
+
+inline uint32_t packColor(const vec3& color) {
+  vec3 c = glm::clamp(color, vec3(0.0f), vec3(1.0f)) * 255.0f + 0.5f;
+  return static_cast<uint32_t>(c.x) | (static_cast<uint32_t>(c.y) << 8) |
+    (static_cast<uint32_t>(c.z) << 16) | 0xFF000000u;
+}
+
+}  // namespace
+
+struct SoftwareRenderer::Vertex {
+  vec4 clip;
+  vec3 eyePos;
+  vec3 eyeNormal;
+  vec2 uv;
+  vec3 color;  // vertex lighting, the normal color, or the flat color
+
+  static Vertex lerp(const Vertex& a, const Vertex& b, float t) {
+    Vertex v;
+    v.clip = glm::mix(a.clip, b.clip, t);
+    v.eyePos = glm::mix(a.eyePos, b.eyePos, t);
+    v.eyeNormal = glm::mix(a.eyeNormal, b.eyeNormal, t);
+    v.uv = glm::mix(a.uv, b.uv, t);
+    v.color = glm::mix(a.color, b.color, t);
+    return v;
+  }
+};
+
+// A front facing triangle in window coordinates, after clipping
+struct SoftwareRenderer::Triangle {
+  const Vertex* v[3];
+  int x[3];  // in 1/16 pixels
+  int y[3];
+  float z[3];  // window depth, 0 to 1
+  float invW[3];
+  int minX, minY, maxX, maxY;  // pixels whose centers may be covered
+  float minZ;
+  int state;
+};
+
+struct SoftwareRenderer::Chunk {
+  std::vector<Triangle> triangles;
+  std::vector<std::vector<uint32_t>> bins;  // per tile, into triangles
+  std::deque<Vertex> clipped;  // vertices made by clipping
+  int binned;
+  int entries;
+
+  void reset(int numTiles) {
+    triangles.clear();
+    clipped.clear();
+    bins.resize(numTiles);
+    for (std::vector<uint32_t>& bin : bins) bin.clear();
+    binned = 0;
+    entries = 0;
+  }
+};
+
+struct SoftwareRenderer::Tile {
+  int x0, y0;  // lower left pixel
+  int width, height;
+  std::vector<uint32_t> color;  // kTileSize x kTileSize, bottom row first
+  std::vector<float> depth;
+  float maxDepth[kBlocksPerTile * kBlocksPerTile];  // farthest per block
+  int blocksSkipped;
+};
+
+SoftwareRenderer::SoftwareRenderer(int numThreads) :
+  _width(0),
+  _height(0),
+  _tilesX(0),
+  _tilesY(0),
+  _background(0.0f),
+  _needsClear(true),
+  _imageDirty(true),
+  _projectionMatrix(1.0f),
+  _viewMatrix(1.0f),
+  _trs(1.0f),
+  _numChunks(0),
+  _numVertexBuffers(0) {
+  if (numThreads <= 0) {
+    numThreads = static_cast<int>(std::thread::hardware_concurrency());
+  }
+  // the calling thread draws too
+  if (numThreads > 1) _pool.reset(new ThreadPool(numThreads - 1));
+  _stats = Stats();
+  endShader();
+  setLight(vec4(0, 0, 0, 1), vec3(1.0f));
+  setSpotlight(vec4(0, 0, 0, 1), vec3(1.0f), vec3(0, 0, -1), 1.0f,
+      std::cos(glm::radians(15.0f)), std::cos(glm::radians(22.5f)));
+  setFog(0.0f, 100.0f, vec3(0.1f));
+  setMaterial(vec3(0.1f), vec3(0.8f), vec3(0.5f), 32.0f);
+  setColor(vec3(1.0f));
+  texture(0);
+  resize(1, 1);
+}
+
+SoftwareRenderer::~SoftwareRenderer() {
+}
+
+int SoftwareRenderer::numThreads() const {
+  return _pool ? _pool->size() + 1 : 1;
+}
+
+void SoftwareRenderer::resize(int width, int height) {
+  _width = std::max(width, 1);
+  _height = std::max(height, 1);
+  _tilesX = (_width + kTileSize - 1) / kTileSize;
+  _tilesY = (_height + kTileSize - 1) / kTileSize;
+  _tiles.resize(_tilesX * _tilesY);
+  for (int ty = 0; ty < _tilesY; ty++) {
+    for (int tx = 0; tx < _tilesX; tx++) {
+      Tile& tile = _tiles[ty * _tilesX + tx];
+      tile.x0 = tx * kTileSize;
+      tile.y0 = ty * kTileSize;
+      tile.width = std::min(kTileSize, _width - tile.x0);
+      tile.height = std::min(kTileSize, _height - tile.y0);
+      tile.color.resize(kTileSize * kTileSize);
+      tile.depth.resize(kTileSize * kTileSize);
+    }
+  }
+  _image = Image(_width, _height);
+  clear();
+}
+
+void SoftwareRenderer::background(const vec3& color) {
+  _background = color;
+}
+
+void SoftwareRenderer::clear() {
+  _needsClear = true;
+  _imageDirty = true;
+  _numChunks = 0;
+  _numVertexBuffers = 0;
+  _states.clear();
+  _stats = Stats();
+}
+
+void SoftwareRenderer::perspective(float fovRadians, float aspect,
+    float near, float far) {
+  _projectionMatrix = glm::perspective(fovRadians, aspect, near, far);
+}
+
+void SoftwareRenderer::ortho(float minx, float maxx, float miny, float maxy,
+    float minz, float maxz) {
+  _projectionMatrix = glm::ortho(minx, maxx, miny, maxy, minz, maxz);
+}
+
+void SoftwareRenderer::lookAt(const vec3& lookfrom, const vec3& lookat,
+    const vec3& up) {
+  _viewMatrix = glm::lookAt(lookfrom, lookat, up);
+}
+
+void SoftwareRenderer::push() {
+  _stack.push_back(_trs);
+}
+
+void SoftwareRenderer::pop() {
+  if (_stack.empty()) return;
+  _trs = _stack.back();
+  _stack.pop_back();
+}
+
+void SoftwareRenderer::identity() {
+  _trs = mat4(1.0f);
+}
+
+void SoftwareRenderer::scale(const vec3& xyz) {
+  _trs = glm::scale(_trs, xyz);
+}
+
+void SoftwareRenderer::translate(const vec3& xyz) {
+  _trs = glm::translate(_trs, xyz);
+}
+
+void SoftwareRenderer::rotate(float angleRad, const vec3& axis) {
+  _trs = glm::rotate(_trs, angleRad, axis);
+}
+
+void SoftwareRenderer::transform(const mat4& trs) {
+  _trs = _trs * trs;
+}
+
+void SoftwareRenderer::beginShader(const std::string& name) {
+  if (name == "normals") {
+    _state.shading = NORMALS;
+  } else if (name == "only-color" || name == "unlit") {
+    _state.shading = ONLY_COLOR;
+  } else if (name == "phong-vertex") {
+    _state.shading = PHONG_VERTEX;
+  } else if (name == "phong-pixel") {
+    _state.shading = PHONG_PIXEL;
+  } else if (name == "spotlight") {
+    _state.shading = SPOTLIGHT;
+  } else if (name == "toon") {
+    _state.shading = TOON;
+  } else if (name == "fog") {
+    _state.shading = FOG;
+  } else {
+    std::cout << "WARNING: the software renderer has no shader " <<
+      name << ", drawing normals\n";
+    _state.shading = NORMALS;
+  }
+}
+
+void SoftwareRenderer::endShader() {
+  _state.shading = NORMALS;
+}
+
+void SoftwareRenderer::setLight(const vec4& pos, const vec3& intensity) {
+  _state.lightPos = pos;
+  _state.lightIntensity = intensity;
+}
+
+void SoftwareRenderer::setSpotlight(const vec4& pos, const vec3& intensity,
+    const vec3& dir, float exponent, float innerCutOff, float outerCutOff) {
+  _state.spotPos = pos;
+  _state.spotIntensity = intensity;
+  _state.spotDir = dir;
+  _state.spotExp = exponent;
+  _state.spotInnerCutOff = innerCutOff;
+  _state.spotOuterCutOff = outerCutOff;
+}
+
+void SoftwareRenderer::setFog(float minDist, float maxDist,
+    const vec3& color) {
+  _state.fogMinDist = minDist;
+  _state.fogMaxDist = maxDist;
+  _state.fogColor = color;
+}
+
+void SoftwareRenderer::setMaterial(const vec3& Ka, const vec3& Kd,
+    const vec3& Ks, float alpha) {
+  _state.Ka = Ka;
+  _state.Kd = Kd;
+  _state.Ks = Ks;
+  _state.alpha = alpha;
+}
+
+void SoftwareRenderer::setColor(const vec3& color) {
+  _state.color = color;
+}
+
+void SoftwareRenderer::texture(const Image* image) {
+  _state.texture = image;
+}
+
+// The phong() function of phong-vertex.vs, phong-pixel.fs and fog.fs
+static vec3 phong(const vec4& lightPos, const vec3& intensity,
+    const vec3& Ka, const vec3& Kd, const vec3& Ks, float alpha,
+    const vec3& p, const vec3& n, vec3* specularOut) {
+  vec3 s = lightPos.w == 0.0f ? glm::normalize(vec3(lightPos)) :
+    glm::normalize(vec3(lightPos) - p);
+  vec3 v = glm::normalize(-p);
+  vec3 ambient = intensity * Ka;
+  float sDotn = std::max(glm::dot(s, n), 0.0f);
+  vec3 diffuse = intensity * Kd * sDotn;
+  vec3 r = 2.0f * sDotn * n - s;
+  vec3 specular(0.0f);
+  if (sDotn > 0.0f) {
+    specular = intensity * Ks *
+      std::pow(std::max(glm::dot(r, v), 0.0f), alpha);
+  }
+  *specularOut = specular;
+  return ambient + diffuse;
+}
+
+void SoftwareRenderer::shadeVertex(const DrawState& state, const mat4& mvp,
+    const mat4& modelView, const mat3& normalMatrix, const float* p,
+    const float* n, const float* uv, Vertex* out) const {
+  vec4 position(p[0], p[1], p[2], 1.0f);
+  vec3 normal(n[0], n[1], n[2]);
+  out->clip = mvp * position;
+  out->eyePos = vec3(modelView * position);
+  out->eyeNormal = glm::normalize(normalMatrix * normal);
+  out->uv = uv ? vec2(uv[0], uv[1]) : vec2(0.0f);
+
+  if (state.shading == NORMALS) {
+    out->color = (normal + 1.0f) * 0.5f;
+  } else if (state.shading == PHONG_VERTEX) {
+    vec3 specular;
+    out->color = phong(state.lightPos, state.lightIntensity, state.Ka,
+        state.Kd, state.Ks, state.alpha, out->eyePos, out->eyeNormal,
+        &specular) + specular;
+  } else {
+    out->color = state.color;
+  }
+}
+
+void SoftwareRenderer::mesh(const std::vector<float>& positions,
+    const std::vector<float>& normals,
+    const std::vector<float>& texCoords,
+    const std::vector<unsigned int>& indices) {
+  int numVertices = static_cast<int>(positions.size() / 3);
+  int numTriangles = static_cast<int>(indices.size() / 3);
+  if (numVertices == 0 || numTriangles == 0) return;
+  if (normals.size() < positions.size()) {
+    std::cout << "WARNING: software mesh needs a normal per vertex\n";
+    return;
+  }
+  bool hasUV = texCoords.size() >= static_cast<size_t>(numVertices) * 2;
+
+  int stateIndex = static_cast<int>(_states.size());
+  _states.push_back(_state);
+  _states.back().hasUV = hasUV;
+  const DrawState& state = _states.back();
+  _stats.triangles += numTriangles;
+  _imageDirty = true;
+
+  mat4 modelView = _viewMatrix * _trs;
+  mat4 mvp = _projectionMatrix * modelView;
+  mat3 normalMatrix = glm::transpose(glm::inverse(mat3(modelView)));
+
+  // vertices are transformed once, in parallel
+  if (_numVertexBuffers == static_cast<int>(_vertices.size())) {
+    _vertices.emplace_back();
+  }
+  std::vector<Vertex>& vertices = _vertices[_numVertexBuffers++];
+  vertices.resize(numVertices);
+  int numJobs = (numVertices + kVerticesPerJob - 1) / kVerticesPerJob;
+  parallelFor(numJobs, _pool.get(), [&](int job) {
+    int end = std::min(numVertices, (job + 1) * kVerticesPerJob);
+    for (int i = job * kVerticesPerJob; i < end; i++) {
+      shadeVertex(state, mvp, modelView, normalMatrix, &positions[i * 3],
+          &normals[i * 3], hasUV ? &texCoords[i * 2] : 0, &vertices[i]);
+    }
+  });
+
+  // then triangles are clipped, set up and binned in chunks
+  int numChunks = (numTriangles + kTrianglesPerChunk - 1) / kTrianglesPerChunk;
+  int firstChunk = _numChunks;
+  _numChunks += numChunks;
+  while (static_cast<int>(_chunks.size()) < _numChunks) {
+    _chunks.emplace_back(new Chunk());
+  }
+  int numTiles = _tilesX * _tilesY;
+  parallelFor(numChunks, _pool.get(), [&](int job) {
+    Chunk* chunk = _chunks[firstChunk + job].get();
+    chunk->reset(numTiles);
+    int end = std::min(numTriangles, (job + 1) * kTrianglesPerChunk);
+    for (int t = job * kTrianglesPerChunk; t < end; t++) {
+      unsigned int i0 = indices[t * 3];
+      unsigned int i1 = indices[t * 3 + 1];
+      unsigned int i2 = indices[t * 3 + 2];
+      if (std::max(std::max(i0, i1), i2) >=
+          static_cast<unsigned int>(numVertices)) {
+        continue;
+      }
+      clipTriangle(chunk, stateIndex, &vertices[i0], &vertices[i1],
+          &vertices[i2]);
+    }
+  });
+
+  for (int c = firstChunk; c < _numChunks; c++) {
+    _stats.binned += _chunks[c]->binned;
+    _stats.tileEntries += _chunks[c]->entries;
+  }
+}
+
+void SoftwareRenderer::cube() {
+  // the same faces, winding and texture coordinates as Cube(1)
+  static const float kCorner[6][4][3] = {
+    {{-1, -1, 1}, {1, -1, 1}, {1, 1, 1}, {-1, 1, 1}},        // front
+    {{1, -1, 1}, {1, -1, -1}, {1, 1, -1}, {1, 1, 1}},        // right
+    {{-1, -1, -1}, {-1, 1, -1}, {1, 1, -1}, {1, -1, -1}},    // back
+    {{-1, -1, 1}, {-1, 1, 1}, {-1, 1, -1}, {-1, -1, -1}},    // left
+    {{-1, -1, 1}, {-1, -1, -1}, {1, -1, -1}, {1, -1, 1}},    // bottom
+    {{-1, 1, 1}, {1, 1, 1}, {1, 1, -1}, {-1, 1, -1}}};       // top
+  static const float kNormal[6][3] = {{0, 0, 1}, {1, 0, 0}, {0, 0, -1},
+    {-1, 0, 0}, {0, -1, 0}, {0, 1, 0}};
+  static std::vector<float> positions, normals, texCoords;
+  static std::vector<unsigned int> indices;
+  if (positions.empty()) {
+    const float uv[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+    for (int f = 0; f < 6; f++) {
+      for (int v = 0; v < 4; v++) {
+        for (int i = 0; i < 3; i++) {
+          positions.push_back(kCorner[f][v][i] * 0.5f);
+          normals.push_back(kNormal[f][i]);
+        }
+        texCoords.push_back(uv[v][0]);
+        texCoords.push_back(uv[v][1]);
+      }
+      unsigned int base = f * 4;
+      for (unsigned int i : {0u, 1u, 2u, 0u, 2u, 3u}) {
+        indices.push_back(base + i);
+      }
+    }
+  }
+  mesh(positions, normals, texCoords, indices);
+}
+
+void SoftwareRenderer::clipTriangle(Chunk* chunk, int state,
+    const Vertex* a, const Vertex* b, const Vertex* c) {
+  // near plane and the guard band, as ax + by + cz + dw >= 0
+  float gx = kGuardBand * 2.0f / _width;
+  float gy = kGuardBand * 2.0f / _height;
+  const vec4 planes[5] = {vec4(0, 0, 1, 1), vec4(-1, 0, 0, gx),
+    vec4(1, 0, 0, gx), vec4(0, -1, 0, gy), vec4(0, 1, 0, gy)};
+
+  // reject triangles outside the view volume, accept those inside
+  // the planes, and clip the rest
+  const Vertex* v[3] = {a, b, c};
+  int outside[3] = {0, 0, 0};
+  int beyond = 0x3F;  // view volume sides all three vertices are outside
+  for (int i = 0; i < 3; i++) {
+    const vec4& p = v[i]->clip;
+    for (int k = 0; k < 5; k++) {
+      if (glm::dot(planes[k], p) < 0) outside[i] |= 1 << k;
+    }
+    int sides = (p.x > p.w ? 1 : 0) | (p.x < -p.w ? 2 : 0) |
+      (p.y > p.w ? 4 : 0) | (p.y < -p.w ? 8 : 0) |
+      (p.z > p.w ? 16 : 0) | (p.z < -p.w ? 32 : 0);
+    beyond &= sides;
+  }
+  if (beyond) return;
+  if ((outside[0] | outside[1] | outside[2]) == 0) {
+    setupTriangle(chunk, state, a, b, c);
+    return;
+  }
+
+  // Sutherland-Hodgman, keeping the vertex order (and so the winding)
+  Vertex polygon[2][9];
+  int count = 3;
+  for (int i = 0; i < 3; i++) polygon[0][i] = *v[i];
+  int in = 0;
+  for (int k = 0; k < 5 && count >= 3; k++) {
+    if (((outside[0] | outside[1] | outside[2]) & (1 << k)) == 0) continue;
+    const Vertex* src = polygon[in];
+    Vertex* dst = polygon[1 - in];
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+      const Vertex& p = src[i];
+      const Vertex& q = src[(i + 1) % count];
+      float dp = glm::dot(planes[k], p.clip);
+      float dq = glm::dot(planes[k], q.clip);
+      if (dp >= 0) dst[n++] = p;
+      if ((dp >= 0) != (dq >= 0)) {
+        dst[n++] = Vertex::lerp(p, q, dp / (dp - dq));
+      }
+    }
+    count = n;
+    in = 1 - in;
+  }
+  if (count < 3) return;
+
+  std::deque<Vertex>& clipped = chunk->clipped;
+  size_t first = clipped.size();
+  clipped.insert(clipped.end(), polygon[in], polygon[in] + count);
+  for (int i = 1; i + 1 < count; i++) {
+    setupTriangle(chunk, state, &clipped[first], &clipped[first + i],
+        &clipped[first + i + 1]);
+  }
+}
+
+void SoftwareRenderer::setupTriangle(Chunk* chunk, int state,
+    const Vertex* a, const Vertex* b, const Vertex* c) {
+  Triangle triangle;
+  triangle.v[0] = a;
+  triangle.v[1] = b;
+  triangle.v[2] = c;
+  triangle.state = state;
+  float scaleX = 0.5f * _width * kSubpixels;
+  float scaleY = 0.5f * _height * kSubpixels;
+  for (int i = 0; i < 3; i++) {
+    const vec4& p = triangle.v[i]->clip;
+    float invW = 1.0f / p.w;
+    triangle.invW[i] = invW;
+    triangle.x[i] = static_cast<int>(std::lround((p.x * invW + 1.0f) * scaleX));
+    triangle.y[i] = static_cast<int>(std::lround((p.y * invW + 1.0f) * scaleY));
+    triangle.z[i] = p.z * invW * 0.5f + 0.5f;
+  }
+
+  // counterclockwise triangles face the camera; cull the rest
+  int64_t area =
+    int64_t(triangle.x[1] - triangle.x[0]) * (triangle.y[2] - triangle.y[0]) -
+    int64_t(triangle.x[2] - triangle.x[0]) * (triangle.y[1] - triangle.y[0]);
+  if (area <= 0) return;
+
+  // pixels with centers inside the bounds
+  const int half = kSubpixels / 2;
+  int minX = std::min(std::min(triangle.x[0], triangle.x[1]), triangle.x[2]);
+  int maxX = std::max(std::max(triangle.x[0], triangle.x[1]), triangle.x[2]);
+  int minY = std::min(std::min(triangle.y[0], triangle.y[1]), triangle.y[2]);
+  int maxY = std::max(std::max(triangle.y[0], triangle.y[1]), triangle.y[2]);
+  triangle.minX = std::max(0, (minX - half + kSubpixels - 1) >> kSubpixelBits);
+  triangle.maxX = std::min(_width - 1, (maxX - half) >> kSubpixelBits);
+  triangle.minY = std::max(0, (minY - half + kSubpixels - 1) >> kSubpixelBits);
+  triangle.maxY = std::min(_height - 1, (maxY - half) >> kSubpixelBits);
+  if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) return;
+  triangle.minZ = std::min(std::min(triangle.z[0], triangle.z[1]),
+      triangle.z[2]);
+
+  uint32_t index = static_cast<uint32_t>(chunk->triangles.size());
+  chunk->triangles.push_back(triangle);
+  chunk->binned++;
+  for (int ty = triangle.minY / kTileSize; ty <= triangle.maxY / kTileSize;
+      ty++) {
+    for (int tx = triangle.minX / kTileSize; tx <= triangle.maxX / kTileSize;
+        tx++) {
+      chunk->bins[ty * _tilesX + tx].push_back(index);
+      chunk->entries++;
+    }
+  }
+}
+
+void SoftwareRenderer::finish() {
+  if (!_needsClear && _numChunks == 0) return;
+  parallelFor(_tilesX * _tilesY, _pool.get(), [this](int tile) {
+    rasterizeTile(tile);
+  });
+  for (const Tile& tile : _tiles) _stats.blocksSkipped += tile.blocksSkipped;
+  _needsClear = false;
+  _numChunks = 0;
+  _numVertexBuffers = 0;
+  _states.clear();
+}
+
+const Image& SoftwareRenderer::image() {
+  finish();
+  if (_imageDirty) {
+    parallelFor(_tilesX * _tilesY, _pool.get(), [this](int t) {
+      const Tile& tile = _tiles[t];
+      for (int y = 0; y < tile.height; y++) {
+        memcpy(_image.data() + ((tile.y0 + y) * _width + tile.x0) * 4,
+            &tile.color[y * kTileSize], tile.width * 4);
+      }
+    });
+    _imageDirty = false;
+  }
+  return _image;
+}
+
+SoftwareRenderer::Stats SoftwareRenderer::stats() const {
+  return _stats;
+}
+
+void SoftwareRenderer::rasterizeTile(int tileIndex) {
+  Tile& tile = _tiles[tileIndex];
+  tile.blocksSkipped = 0;
+  if (_needsClear) {
+    std::fill(tile.color.begin(), tile.color.end(), packColor(_background));
+    std::fill(tile.depth.begin(), tile.depth.end(), 1.0f);
+    std::fill(tile.maxDepth, tile.maxDepth + kBlocksPerTile * kBlocksPerTile,
+        1.0f);
+  }
+  // in the order queued: chunks, then triangles within a chunk
+  for (int c = 0; c < _numChunks; c++) {
+    const Chunk& chunk = *_chunks[c];
+    for (uint32_t index : chunk.bins[tileIndex]) {
+      rasterizeTriangle(&tile, chunk.triangles[index]);
+    }
+  }
+}
+
+// Returns a bit per pixel of a row of up to 8 pixels: whether the pixel is
+// inside every edge that crosses the block
+static inline unsigned coverRow(const int32_t* edges, const int32_t* stepX,
+    int numEdges, int count) {
+  unsigned inside = (1u << count) - 1;
+#ifdef AGL_HAS_SSE2
+  __m128i negative0 = _mm_setzero_si128();
+  __m128i negative1 = _mm_setzero_si128();
+  for (int e = 0; e < numEdges; e++) {
+    int32_t step = stepX[e];
+    __m128i lane = _mm_add_epi32(_mm_set1_epi32(edges[e]),
+        _mm_setr_epi32(0, step, 2 * step, 3 * step));
+    negative0 = _mm_or_si128(negative0, lane);
+    negative1 = _mm_or_si128(negative1,
+        _mm_add_epi32(lane, _mm_set1_epi32(4 * step)));
+  }
+  unsigned outside = _mm_movemask_ps(_mm_castsi128_ps(negative0)) |
+    (_mm_movemask_ps(_mm_castsi128_ps(negative1)) << 4);
+  return inside & ~outside;
+#else
+  for (int e = 0; e < numEdges; e++) {
+    for (int i = 0; i < count; i++) {
+      if (edges[e] + i * stepX[e] < 0) inside &= ~(1u << i);
+    }
+  }
+  return inside;
+#endif
+}
+
+// Returns a bit per pixel whose depth is less than the stored depth. The
+// row starts offset pixels into the block whose row begins at depth, so
+// the loads never pass the block's last pixel, which may end the tile.
+static inline unsigned depthTestRow(const float* depth, int offset, float z,
+    float dzdx, unsigned candidates) {
+#ifdef AGL_HAS_SSE2
+  __m128 lanes = _mm_sub_ps(_mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f),
+      _mm_set1_ps(static_cast<float>(offset)));
+  __m128 step = _mm_set1_ps(dzdx);
+  __m128 z0 = _mm_add_ps(_mm_set1_ps(z), _mm_mul_ps(lanes, step));
+  __m128 z1 = _mm_add_ps(_mm_set1_ps(z),
+      _mm_mul_ps(_mm_add_ps(lanes, _mm_set1_ps(4.0f)), step));
+  unsigned less = _mm_movemask_ps(_mm_cmplt_ps(z0, _mm_loadu_ps(depth))) |
+    (_mm_movemask_ps(_mm_cmplt_ps(z1, _mm_loadu_ps(depth + 4))) << 4);
+  return candidates & (less >> offset);
+#else
+  unsigned pass = 0;
+  for (int i = 0; i < kBlockSize - offset; i++) {
+    if ((candidates & (1u << i)) && z + i * dzdx < depth[offset + i]) {
+      pass |= 1u << i;
+    }
+  }
+  return pass;
+#endif
+}
+
+static float blockMaxDepth(const float* depth) {
+#ifdef AGL_HAS_SSE2
+  __m128 m = _mm_loadu_ps(depth);
+  for (int y = 0; y < kBlockSize; y++) {
+    m = _mm_max_ps(m, _mm_loadu_ps(depth + y * kTileSize));
+    m = _mm_max_ps(m, _mm_loadu_ps(depth + y * kTileSize + 4));
+  }
+  m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+  m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtss_f32(m);
+#else
+  float m = depth[0];
+  for (int y = 0; y < kBlockSize; y++) {
+    for (int x = 0; x < kBlockSize; x++) {
+      m = std::max(m, depth[y * kTileSize + x]);
+    }
+  }
+  return m;
+#endif
+}
+
+void SoftwareRenderer::rasterizeTriangle(Tile* tile,
+    const Triangle& triangle) {
+  int x0 = std::max(triangle.minX, tile->x0);
+  int x1 = std::min(triangle.maxX, tile->x0 + tile->width - 1);
+  int y0 = std::max(triangle.minY, tile->y0);
+  int y1 = std::min(triangle.maxY, tile->y0 + tile->height - 1);
+  if (x0 > x1 || y0 > y1) return;
+
+  // Edge i is opposite vertex i, so its function is proportional to the
+  // barycentric coordinate of vertex i: E = dx * (py - ya) - dy * (px - xa)
+  // for the edge from a to b. Pixels on an edge are drawn only for top and
+  // left edges, so shared edges are drawn once.
+  const int* X = triangle.x;
+  const int* Y = triangle.y;
+  int64_t A[3], B[3], C[3];
+  int bias[3];
+  for (int i = 0; i < 3; i++) {
+    int a = (i + 1) % 3;
+    int b = (i + 2) % 3;
+    int64_t dx = X[b] - X[a];
+    int64_t dy = Y[b] - Y[a];
+    A[i] = -dy;
+    B[i] = dx;
+    C[i] = dy * X[a] - dx * Y[a];
+    bool topLeft = dy < 0 || (dy == 0 && dx < 0);
+    bias[i] = topLeft ? 0 : 1;
+    C[i] -= bias[i];
+  }
+  auto edgeAt = [&](int i, int px, int py) {
+    int64_t sx = int64_t(px) * kSubpixels + kSubpixels / 2;
+    int64_t sy = int64_t(py) * kSubpixels + kSubpixels / 2;
+    return A[i] * sx + B[i] * sy + C[i];
+  };
+
+  // screen space planes for depth and the barycentric coordinates, in
+  // pixels; the coordinates are divided by w when shading
+  double area = double(X[1] - X[0]) * (Y[2] - Y[0]) -
+    double(X[2] - X[0]) * (Y[1] - Y[0]);
+  float b0[3], bA[3], bB[3];  // at the center of pixel (x0, y0), and steps
+  for (int i = 0; i < 3; i++) {
+    b0[i] = static_cast<float>((edgeAt(i, x0, y0) + bias[i]) / area);
+    bA[i] = static_cast<float>(A[i] * kSubpixels / area);
+    bB[i] = static_cast<float>(B[i] * kSubpixels / area);
+  }
+  float dzdx = bA[0] * triangle.z[0] + bA[1] * triangle.z[1] +
+    bA[2] * triangle.z[2];
+  float dzdy = bB[0] * triangle.z[0] + bB[1] * triangle.z[1] +
+    bB[2] * triangle.z[2];
+  float z0 = b0[0] * triangle.z[0] + b0[1] * triangle.z[1] +
+    b0[2] * triangle.z[2];
+
+  const DrawState& state = _states[triangle.state];
+  int bx0 = (x0 - tile->x0) / kBlockSize;
+  int bx1 = (x1 - tile->x0) / kBlockSize;
+  int by0 = (y0 - tile->y0) / kBlockSize;
+  int by1 = (y1 - tile->y0) / kBlockSize;
+  for (int by = by0; by <= by1; by++) {
+    for (int bx = bx0; bx <= bx1; bx++) {
+      float& maxDepth = tile->maxDepth[by * kBlocksPerTile + bx];
+      if (triangle.minZ >= maxDepth) {
+        tile->blocksSkipped++;  // behind everything drawn here
+        continue;
+      }
+
+      // the part of the block inside the triangle's bounds
+      int rx0 = std::max(x0, tile->x0 + bx * kBlockSize);
+      int rx1 = std::min(x1, tile->x0 + bx * kBlockSize + kBlockSize - 1);
+      int ry0 = std::max(y0, tile->y0 + by * kBlockSize);
+      int ry1 = std::min(y1, tile->y0 + by * kBlockSize + kBlockSize - 1);
+
+      // classify each edge by its value at the corners
+      int32_t rowEdge[3];
+      int32_t stepX[3];
+      int64_t stepY[3];
+      int64_t start[3];
+      int numEdges = 0;
+      bool rejected = false;
+      for (int i = 0; i < 3 && !rejected; i++) {
+        int64_t e00 = edgeAt(i, rx0, ry0);
+        int64_t e10 = edgeAt(i, rx1, ry0);
+        int64_t e01 = edgeAt(i, rx0, ry1);
+        int64_t e11 = edgeAt(i, rx1, ry1);
+        int64_t lo = std::min(std::min(e00, e10), std::min(e01, e11));
+        int64_t hi = std::max(std::max(e00, e10), std::max(e01, e11));
+        if (hi < 0) {
+          rejected = true;
+        } else if (lo < 0) {
+          // crosses the block, so its values here fit in 32 bits
+          start[numEdges] = e00;
+          stepX[numEdges] = static_cast<int32_t>(A[i] * kSubpixels);
+          stepY[numEdges] = B[i] * kSubpixels;
+          numEdges++;
+        }
+      }
+      if (rejected) continue;
+
+      int count = rx1 - rx0 + 1;
+      bool wrote = false;
+      for (int y = ry0; y <= ry1; y++) {
+        for (int e = 0; e < numEdges; e++) {
+          rowEdge[e] = static_cast<int32_t>(start[e] + (y - ry0) * stepY[e]);
+        }
+        unsigned covered = coverRow(rowEdge, stepX, numEdges, count);
+        if (!covered) continue;
+
+        int lx = rx0 - tile->x0;
+        int ly = y - tile->y0;
+        float* depth = &tile->depth[ly * kTileSize + lx];
+        float dx = static_cast<float>(rx0 - x0);
+        float dy = static_cast<float>(y - y0);
+        float z = z0 + dzdx * dx + dzdy * dy;
+        int offset = lx - bx * kBlockSize;  // rx0 is often mid-block
+        unsigned pass = depthTestRow(depth - offset, offset, z, dzdx,
+            covered);
+        if (!pass) continue;
+        wrote = true;
+
+        uint32_t* color = &tile->color[ly * kTileSize + lx];
+        for (int i = 0; i < count; i++) {
+          if (!(pass & (1u << i))) continue;
+          float px = dx + i;
+          float l[3];
+          for (int k = 0; k < 3; k++) {
+            l[k] = (b0[k] + bA[k] * px + bB[k] * dy) * triangle.invW[k];
+          }
+          float sum = l[0] + l[1] + l[2];
+          depth[i] = z + dzdx * i;
+          color[i] = packColor(shadePixel(state, triangle,
+              l[0] / sum, l[1] / sum, l[2] / sum));
+        }
+      }
+      if (wrote) {
+        maxDepth = blockMaxDepth(&tile->depth[
+            by * kBlockSize * kTileSize + bx * kBlockSize]);
+      }
+    }
+  }
+}
+
+vec3 SoftwareRenderer::shadePixel(const DrawState& state,
+    const Triangle& triangle, float l0, float l1, float l2) const {
+  const Vertex& a = *triangle.v[0];
+  const Vertex& b = *triangle.v[1];
+  const Vertex& c = *triangle.v[2];
+  vec3 color = a.color * l0 + b.color * l1 + c.color * l2;
+  if (state.shading == NORMALS || state.shading == ONLY_COLOR) {
+    return color;
+  }
+
+  vec3 diffuseTexture(1.0f);
+  if (state.hasUV && state.texture) {
+    vec2 uv = a.uv * l0 + b.uv * l1 + c.uv * l2;
+    diffuseTexture = vec3(state.texture->sample(uv * kUVScale));
+  }
+  if (state.shading == PHONG_VERTEX) return color * diffuseTexture;
+
+  vec3 p = a.eyePos * l0 + b.eyePos * l1 + c.eyePos * l2;
+  vec3 n = glm::normalize(a.eyeNormal * l0 + b.eyeNormal * l1 +
+      c.eyeNormal * l2);
+  vec3 specular;
+
+  switch (state.shading) {
+    case TOON: {
+      // toon.fs: three levels of diffuse light, no specular
+      const float levels = 3.0f;
+      vec3 s = state.lightPos.w == 0.0f ?
+        glm::normalize(vec3(state.lightPos)) :
+        glm::normalize(vec3(state.lightPos) - p);
+      float sDotn = std::max(glm::dot(s, n), 0.0f);
+      vec3 diffuse = state.Kd * std::floor(sDotn * levels) / levels;
+      return state.lightIntensity * (state.Ka + diffuse) * diffuseTexture;
+    }
+    case SPOTLIGHT: {
+      // spotlight.fs: Blinn-Phong with a smooth cone
+      vec3 s = state.spotPos.w == 0.0f ?
+        glm::normalize(vec3(state.spotPos)) :
+        glm::normalize(vec3(state.spotPos) - p);
+      float theta = glm::dot(-s, state.spotDir);
+      float epsilon = state.spotInnerCutOff - state.spotOuterCutOff;
+      float intensity = glm::clamp((theta - state.spotOuterCutOff) / epsilon,
+          0.0f, 1.0f);
+      float spotFactor = std::pow(theta, state.spotExp);
+      vec3 v = glm::normalize(-p);
+      vec3 h = glm::normalize(v + s);
+      vec3 ambient = state.spotIntensity * state.Ka;
+      vec3 diffuse = spotFactor * state.spotIntensity * intensity * state.Kd *
+        std::max(glm::dot(s, n), 0.0f);
+      specular = spotFactor * state.spotIntensity * intensity * state.Ks *
+        std::pow(std::max(glm::dot(h, n), 0.0f), state.alpha);
+      return (ambient + diffuse) * diffuseTexture + specular;
+    }
+    case FOG: {
+      vec3 lit = phong(state.lightPos, state.lightIntensity, state.Ka,
+          state.Kd, state.Ks, state.alpha, p, n, &specular);
+      lit = lit * diffuseTexture + specular;
+      float fogFactor = (state.fogMaxDist - std::fabs(p.z)) /
+        (state.fogMaxDist - state.fogMinDist);
+      fogFactor = glm::clamp(fogFactor, 0.0f, 1.0f);
+      return glm::mix(state.fogColor, lit, fogFactor);
+    }
+    default: {
+      vec3 lit = phong(state.lightPos, state.lightIntensity, state.Ka,
+          state.Kd, state.Ks, state.alpha, p, n, &specular);
+      return lit * diffuseTexture + specular;
+    }
+  }
+}
+
+}  // namespace agl
@@ -0,0 +1,287 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_SOFTWARERENDERER_H_
+#define AGL_SOFTWARERENDERER_H_
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "agl/aglm.h"
+#include "agl/image.h"
+
+namespace agl {
+
+class ThreadPool;
+
+/**
+ * @brief Draws triangle meshes on the CPU, for machines without a GL driver
+ *
+ * SoftwareRenderer follows the Renderer API for the subset that
+ * mesh-viewer uses: the camera and matrix stack, beginShader() with C++
+ * ports of the normals, only-color, phong-vertex, phong-pixel, spotlight,
+ * toon and fog shaders, a diffuse texture, cube() and indexed triangle
+ * meshes. Like Renderer, back faces are culled and depth is tested with
+ * GL_LESS. Shader parameters that the GL shaders read from uniform blocks
+ * are set with setLight(), setMaterial() and so on.
+ *
+ * Drawing is split into two passes. mesh() transforms vertices, clips
+ * triangles to the near plane and sorts them into 64x64 pixel tiles, in
+ * parallel over chunks of triangles. finish() then rasterizes the tiles in
+ * parallel, one tile per worker at a time, so no locks are needed. Within
+ * a tile, edge functions are evaluated four pixels at a time (SSE2) in
+ * 8x8 blocks, and blocks that are behind every triangle drawn so far are
+ * skipped using the farthest depth of each block.
+ *
+ * ```
+ * SoftwareRenderer renderer;
+ * renderer.resize(640, 480);
+ * renderer.clear();
+ * renderer.perspective(glm::radians(60.0f), 640.0f / 480.0f, 0.1f, 100.0f);
+ * renderer.lookAt(vec3(0, 0, 10), vec3(0));
+ * renderer.beginShader("phong-pixel");
+ * renderer.mesh(positions, normals, texCoords, indices);
+ * renderer.endShader();
+ * renderer.image().save("frame.png");
+ * ```
+ *
+ * Images are stored bottom row first, like pixels read from GL.
+ */
+class SoftwareRenderer {
+ public:
+  /**
+   * @brief Create a renderer with a 1x1 image
+   * @param numThreads The number of threads to draw with, or 0 for one per
+   * core
+   */
+  explicit SoftwareRenderer(int numThreads = 0);
+  virtual ~SoftwareRenderer();
+
+  /**
+   * @brief Set the size of the image drawn into
+   */
+  void resize(int width, int height);
+
+  int width() const { return _width; }
+  int height() const { return _height; }
+
+  /**
+   * @brief Return the number of threads that draw
+   */
+  int numThreads() const;
+
+  /**
+   * @brief Set the color that clear() fills the image with
+   */
+  void background(const glm::vec3& color);
+
+  /**
+   * @brief Start a new frame: the color and depth are cleared when the
+   * tiles are next rasterized
+   */
+  void clear();
+
+  /** @name Camera and transforms
+   * @see Renderer
+   */
+  ///@{
+  void perspective(float fovRadians, float aspect, float near, float far);
+  void ortho(float minx, float maxx, float miny, float maxy,
+      float minz, float maxz);
+  void lookAt(const glm::vec3& lookfrom, const glm::vec3& lookat,
+      const glm::vec3& up = glm::vec3(0, 1, 0));
+  glm::mat4 projectionMatrix() const { return _projectionMatrix; }
+  glm::mat4 viewMatrix() const { return _viewMatrix; }
+  void push();
+  void pop();
+  void identity();
+  void scale(const glm::vec3& xyz);
+  void translate(const glm::vec3& xyz);
+  void rotate(float angleRad, const glm::vec3& axis);
+  void transform(const glm::mat4& trs);
+  ///@}
+
+  /** @name Shading
+   */
+  ///@{
+  /**
+   * @brief Shade the following meshes like the GL shader with this name
+   *
+   * Supported: normals, only-color, unlit (like only-color), phong-vertex,
+   * phong-pixel, spotlight, toon and fog. Other names print a warning and
+   * draw normals.
+   */
+  void beginShader(const std::string& name);
+
+  /**
+   * @brief Go back to the default shader (normals)
+   */
+  void endShader();
+
+  /**
+   * @brief Set Light in the FrameBlock of the phong, toon and fog shaders
+   * @param pos The position in eye coordinates, or a direction when w is 0
+   */
+  void setLight(const glm::vec4& pos, const glm::vec3& intensity);
+
+  /**
+   * @brief Set Spot in the FrameBlock of the spotlight shader
+   * @param pos The position in eye coordinates
+   * @param dir The direction in eye coordinates
+   */
+  void setSpotlight(const glm::vec4& pos, const glm::vec3& intensity,
+      const glm::vec3& dir, float exponent, float innerCutOff,
+      float outerCutOff);
+
+  /**
+   * @brief Set Fog in the FrameBlock of the fog shader
+   */
+  void setFog(float minDist, float maxDist, const glm::vec3& color);
+
+  /**
+   * @brief Set the MaterialBlock of the lit shaders
+   */
+  void setMaterial(const glm::vec3& Ka, const glm::vec3& Kd,
+      const glm::vec3& Ks, float alpha);
+
+  /**
+   * @brief Set the color uniform of the only-color shader
+   */
+  void setColor(const glm::vec3& color);
+
+  /**
+   * @brief Set the diffuseTexture of meshes with texture coordinates
+   * @param image An RGBA image, which must stay alive until finish(), or 0
+   * for white. It is sampled bilinearly and repeated, without mipmaps.
+   */
+  void texture(const Image* image);
+  ///@}
+
+  /** @name Drawing
+   */
+  ///@{
+  /**
+   * @brief Queue an indexed triangle mesh with the current transform and
+   * shader
+   * @param positions x, y, z per vertex
+   * @param normals x, y, z per vertex
+   * @param texCoords s, t per vertex, or empty
+   * @param indices Three vertex indices per triangle
+   */
+  void mesh(const std::vector<float>& positions,
+      const std::vector<float>& normals,
+      const std::vector<float>& texCoords,
+      const std::vector<unsigned int>& indices);
+
+  /**
+   * @brief Queue a unit cube centered at the origin, like Renderer::cube()
+   */
+  void cube();
+
+  /**
+   * @brief Rasterize the queued triangles
+   */
+  void finish();
+
+  /**
+   * @brief Finish and return the image, bottom row first
+   */
+  const Image& image();
+  ///@}
+
+  /**
+   * @brief Counts since the last clear()
+   */
+  struct Stats {
+    int triangles;  // submitted
+    int binned;     // after culling and clipping
+    int tileEntries;  // triangle and tile pairs
+    int blocksSkipped;  // 8x8 blocks rejected by depth before testing pixels
+  };
+  Stats stats() const;
+
+ private:
+  enum Shading {
+    NORMALS,
+    ONLY_COLOR,
+    PHONG_VERTEX,
+    PHONG_PIXEL,
+    SPOTLIGHT,
+    TOON,
+    FOG
+  };
+
+  // shader inputs; one copy per mesh() call
+  struct DrawState {
+    Shading shading;
+    bool hasUV;
+    glm::vec4 lightPos;
+    glm::vec3 lightIntensity;
+    glm::vec4 spotPos;
+    glm::vec3 spotIntensity;
+    glm::vec3 spotDir;
+    float spotExp;
+    float spotInnerCutOff;
+    float spotOuterCutOff;
+    float fogMinDist;
+    float fogMaxDist;
+    glm::vec3 fogColor;
+    glm::vec3 Ka;
+    glm::vec3 Kd;
+    glm::vec3 Ks;
+    float alpha;
+    glm::vec3 color;
+    const Image* texture;
+  };
+
+  struct Vertex;
+  struct Triangle;
+  struct Chunk;
+  struct Tile;
+
+  void shadeVertex(const DrawState& state, const glm::mat4& mvp,
+      const glm::mat4& modelView, const glm::mat3& normalMatrix,
+      const float* p, const float* n, const float* uv, Vertex* out) const;
+  void setupTriangle(Chunk* chunk, int state, const Vertex* a,
+      const Vertex* b, const Vertex* c);
+  void clipTriangle(Chunk* chunk, int state, const Vertex* a,
+      const Vertex* b, const Vertex* c);
+  void rasterizeTile(int tileIndex);
+  void rasterizeTriangle(Tile* tile, const Triangle& triangle);
+  glm::vec3 shadePixel(const DrawState& state, const Triangle& triangle,
+      float l0, float l1, float l2) const;
+
+  int _width;
+  int _height;
+  int _tilesX;
+  int _tilesY;
+  glm::vec3 _background;
+  bool _needsClear;
+  bool _imageDirty;
+  std::vector<Tile> _tiles;
+  Image _image;
+
+  glm::mat4 _projectionMatrix;
+  glm::mat4 _viewMatrix;
+  glm::mat4 _trs;
+  std::vector<glm::mat4> _stack;
+
+  DrawState _state;
+  std::vector<DrawState> _states;  // one per queued mesh
+
+  // Triangles are binned per chunk, and tiles read the chunks in the order
+  // they were queued, which keeps the output independent of the threads
+  std::vector<std::unique_ptr<Chunk>> _chunks;
+  int _numChunks;  // chunks in use this frame
+  std::deque<std::vector<Vertex>> _vertices;  // per queued mesh
+  int _numVertexBuffers;
+  Stats _stats;
+
+  std::unique_ptr<ThreadPool> _pool;
+
+  SoftwareRenderer(const SoftwareRenderer&) = delete;
+  SoftwareRenderer& operator=(const SoftwareRenderer&) = delete;
+};
+
+}  // namespace agl
+#endif  // AGL_SOFTWARERENDERER_H_
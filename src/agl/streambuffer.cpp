@@ -0,0 +1,94 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/streambuffer.h"
+
+namespace agl {
+
+StreamBuffer::StreamBuffer(GLsizeiptr sectionSize, int numSections) :
+  _bufferId(0),
+  _sectionSize(sectionSize),
+  _numSections(numSections),
+  _section(0),
+  _used(0),
+  _committed(0),
+  _mapped(0) {
+  glGenBuffers(1, &_bufferId);
+  glBindBuffer(GL_ARRAY_BUFFER, _bufferId);
+
+#ifndef __APPLE__
+  if (GLEW_ARB_buffer_storage) {
+    GLbitfield flags = GL_MAP_WRITE_BIT |
+      GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLsizeiptr size = _sectionSize * _numSections;
+    glBufferStorage(GL_ARRAY_BUFFER, size, 0, flags);
+    _mapped = static_cast<char*>(
+        glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags));
+    _fences.resize(_numSections, 0);
+  }
+#endif
+
+  if (!_mapped) {
+    // fallback: a single section, orphaned on every advance
+    _numSections = 1;
+    _staging.resize(_sectionSize);
+    glBufferData(GL_ARRAY_BUFFER, _sectionSize, 0, GL_STREAM_DRAW);
+  }
+}
+
+StreamBuffer::~StreamBuffer() {
+  for (GLsync fence : _fences) {
+    if (fence) glDeleteSync(fence);
+  }
+  if (_mapped) {
+    glBindBuffer(GL_ARRAY_BUFFER, _bufferId);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+  }
+  glDeleteBuffers(1, &_bufferId);
+}
+
+void* StreamBuffer::reserve(GLsizeiptr bytes) {
+  if (_used + bytes > _sectionSize) return 0;
+
+  char* base = _mapped ? _mapped + _section * _sectionSize : &_staging[0];
+  void* ptr = base + _used;
+  _used += bytes;
+  return ptr;
+}
+
+GLintptr StreamBuffer::commit() {
+  GLintptr start = _committed;
+  _committed = _used;
+  if (_mapped) return _section * _sectionSize + start;
+
+  glBindBuffer(GL_ARRAY_BUFFER, _bufferId);
+  glBufferSubData(GL_ARRAY_BUFFER, start, _used - start, &_staging[start]);
+  return start;
+}
+
+void StreamBuffer::advance() {
+  if (_used == 0) return;
+  _used = 0;
+  _committed = 0;
+  if (!_mapped) {
+    glBindBuffer(GL_ARRAY_BUFFER, _bufferId);
+    glBufferData(GL_ARRAY_BUFFER, _sectionSize, 0, GL_STREAM_DRAW);
+    return;
+  }
+
+  _fences[_section] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  _section = (_section + 1) % _numSections;
+
+  GLsync fence = _fences[_section];
+  if (fence) {
+    // Usually already signaled: the section was drawn frames ago
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    while (status == GL_TIMEOUT_EXPIRED) {
+      status = glClientWaitSync(fence,
+          GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);  // 1 ms
+    }
+    glDeleteSync(fence);
+    _fences[_section] = 0;
+  }
+}
+
+}  // namespace agl
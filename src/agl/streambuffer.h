@@ -0,0 +1,104 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_STREAMBUFFER_H_
+#define AGL_STREAMBUFFER_H_
+
+#include <vector>
+#include "agl/agl.h"
+
+namespace agl {
+
+/**
+ * @brief Ring buffer for vertex data that is rewritten every frame
+ *
+ * The buffer is split into sections (three by default). Data is written
+ * directly into the current section with reserve(), and each commit()
+ * hands out the range written since the previous one, so a frame can
+ * draw many batches from one section. Once per frame, or when the section
+ * is full, advance() fences it and moves to the next section, waiting only
+ * if the GPU is still reading that one.
+ *
+ * When ARB_buffer_storage is available the buffer is persistently mapped.
+ * Otherwise writes go to a CPU staging copy which commit() uploads, and
+ * advance() orphans the buffer.
+ *
+ * ```
+ * StreamBuffer buffer(1 << 20);
+ * float* data = (float*) buffer.reserve(n * sizeof(float));
+ * // write n floats
+ * GLintptr offset = buffer.commit();
+ * // bind buffer.id() at offset and draw; reserve and commit more batches
+ * buffer.advance();  // at the end of the frame
+ * ```
+ */
+class StreamBuffer {
+ public:
+  /**
+   * @brief Create a stream buffer (requires a current GL context)
+   * @param sectionSize The number of bytes in each section
+   * @param numSections The number of sections in the ring
+   */
+  explicit StreamBuffer(GLsizeiptr sectionSize, int numSections = 3);
+  virtual ~StreamBuffer();
+
+  /**
+   * @brief Return the GL buffer id
+   */
+  GLuint id() const { return _bufferId; }
+
+  /**
+   * @brief Return true if the buffer is persistently mapped
+   */
+  bool persistent() const { return _mapped != 0; }
+
+  /**
+   * @brief Return the number of bytes in each section
+   */
+  GLsizeiptr sectionSize() const { return _sectionSize; }
+
+  /**
+   * @brief Return the number of bytes written to the current section
+   */
+  GLsizeiptr used() const { return _used; }
+
+  /**
+   * @brief Return the number of bytes still free in the current section
+   */
+  GLsizeiptr available() const { return _sectionSize - _used; }
+
+  /**
+   * @brief Reserve space in the current section and return where to write
+   * @param bytes The number of bytes to write
+   * @return A pointer to write to, or 0 if the section does not have space
+   */
+  void* reserve(GLsizeiptr bytes);
+
+  /**
+   * @brief Make the data written since the last commit visible to the GPU
+   * @return The byte offset of that data in the GL buffer
+   */
+  GLintptr commit();
+
+  /**
+   * @brief Fence the current section and move to the next one
+   *
+   * Call after the draws that read the current section have been issued:
+   * at the end of a frame, or when reserve() finds the section full. Does
+   * nothing if the section is empty.
+   */
+  void advance();
+
+ private:
+  GLuint _bufferId;
+  GLsizeiptr _sectionSize;
+  int _numSections;
+  int _section;
+  GLsizeiptr _used;
+  GLsizeiptr _committed;       // bytes of the section handed out by commit()
+  char* _mapped;               // persistent mapping (all sections)
+  std::vector<char> _staging;  // CPU copy when not persistently mapped
+  std::vector<GLsync> _fences;
+};
+
+}  // namespace agl
+#endif  // AGL_STREAMBUFFER_H_
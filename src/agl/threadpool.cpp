@@ -0,0 +1,90 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/threadpool.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include "agl/trace.h"
+
+namespace agl {
+
+ThreadPool::ThreadPool(int numThreads) : _stop(false) {
+  if (numThreads <= 0) {
+    numThreads = static_cast<int>(std::thread::hardware_concurrency());
+    if (numThreads <= 0) numThreads = 2;  // unknown core count
+  }
+  for (int i = 0; i < numThreads; i++) {
+    _threads.push_back(std::thread(&ThreadPool::work, this));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _wake.notify_all();
+  for (std::thread& thread : _threads) {
+    thread.join();
+  }
+}
+
+std::future<void> ThreadPool::run(std::function<void()> job) {
+  std::packaged_task<void()> task(job);
+  std::future<void> result = task.get_future();
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _jobs.push_back(std::move(task));
+  }
+  _wake.notify_one();
+  return result;
+}
+
+void ThreadPool::work() {
+  Trace::setThreadName("worker");
+  while (true) {
+    std::packaged_task<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _wake.wait(lock, [this]() { return _stop || !_jobs.empty(); });
+      if (_jobs.empty()) return;  // stopping, and nothing left to do
+      task = std::move(_jobs.front());
+      _jobs.pop_front();
+    }
+    TraceZone zone("ThreadPool task");
+    task();
+  }
+}
+
+void parallelFor(int n, ThreadPool* pool,
+    const std::function<void(int)>& body) {
+  struct State {
+    std::atomic<int> next;
+    int done;
+    std::mutex mutex;
+    std::condition_variable finished;
+  };
+  std::shared_ptr<State> state = std::make_shared<State>();
+  state->next = 0;
+  state->done = 0;
+
+  // body is only used while items remain, i.e. before this returns
+  const std::function<void(int)>* work = &body;
+  auto run = [state, work, n]() {
+    int i;
+    while ((i = state->next++) < n) {
+      (*work)(i);
+      std::lock_guard<std::mutex> lock(state->mutex);
+      if (++state->done == n) state->finished.notify_all();
+    }
+  };
+
+  int helpers = pool ? std::min(pool->size(), n - 1) : 0;
+  for (int i = 0; i < helpers; i++) pool->run(run);
+  run();
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->finished.wait(lock, [&state, n]() { return state->done == n; });
+}
+
+}  // namespace agl
@@ -0,0 +1,81 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_THREADPOOL_H_
+#define AGL_THREADPOOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace agl {
+
+/**
+ * @brief Fixed set of worker threads that run jobs in the order queued
+ *
+ * Jobs must not make GL calls: the GL context is only current on the
+ * thread that created the window.
+ *
+ * ```
+ * ThreadPool pool;
+ * std::future<void> done = pool.run([&]() { image.load(fileName); });
+ * // ...
+ * done.wait();
+ * ```
+ */
+class ThreadPool {
+ public:
+  /**
+   * @brief Start the worker threads
+   * @param numThreads The number of workers, or 0 for one per core
+   */
+  explicit ThreadPool(int numThreads = 0);
+
+  /**
+   * @brief Finish the queued jobs and stop the workers
+   */
+  virtual ~ThreadPool();
+
+  /**
+   * @brief Queue a job for the next free worker
+   * @return A future which becomes ready when the job has run. Exceptions
+   * thrown by the job are rethrown by future::get()
+   */
+  std::future<void> run(std::function<void()> job);
+
+  /**
+   * @brief Return the number of worker threads
+   */
+  int size() const { return static_cast<int>(_threads.size()); }
+
+ private:
+  void work();
+
+  std::vector<std::thread> _threads;
+  std::deque<std::packaged_task<void()>> _jobs;
+  std::mutex _mutex;
+  std::condition_variable _wake;
+  bool _stop;
+
+  // Workers hold a pointer to the pool, so it cannot be copied
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+};
+
+/**
+ * @brief Run body(0) ... body(n - 1) on the pool's workers and the calling
+ * thread, and return when all have finished
+ * @param pool The workers to help, or 0 to run everything on this thread
+ *
+ * Items are handed out one at a time, so uneven items balance out. The
+ * caller only waits for items that have started, so this cannot deadlock
+ * when called from a job running on the same pool.
+ */
+void parallelFor(int n, ThreadPool* pool,
+    const std::function<void(int)>& body);
+
+}  // namespace agl
+#endif  // AGL_THREADPOOL_H_
@@ -0,0 +1,241 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#include "agl/trace.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace agl {
+
+std::atomic<bool> Trace::_enabled(false);
+
+namespace {
+
+// Zones per chunk of a thread's buffer
+const int kChunkEvents = 256;
+
+// The name of the event that renames its thread; its detail is the name
+const char kThreadName[] = "thread_name";
+
+struct TraceEvent {
+  const char* name;
+  char detail[TraceZone::kMaxDetail + 1];
+  int64_t start;
+  int64_t end;
+};
+
+// Written by one thread, read by flush(): an event is complete once count
+// covers it, and a chunk is never written again once next is set
+struct Chunk {
+  TraceEvent events[kChunkEvents];
+  std::atomic<int> count;
+  std::atomic<Chunk*> next;
+  Chunk() : count(0), next(nullptr) {}
+};
+
+struct ThreadBuffer {
+  int tid;
+  Chunk* head;  // the oldest chunk not yet written, owned by flush()
+  int read;     // events of head already written
+  Chunk* tail;  // the chunk being filled, owned by the thread
+  std::string name;  // the last thread name, written again by start()
+};
+
+struct TraceState {
+  std::mutex mutex;  // guards buffers, their names, file and first
+  std::vector<ThreadBuffer*> buffers;  // kept after their threads exit
+  FILE* file = nullptr;
+  bool first = true;  // no event written yet
+  bool atExit = false;
+};
+
+// Never destroyed, so that stop() can run at exit
+TraceState& state() {
+  static TraceState* theState = new TraceState();
+  return *theState;
+}
+
+thread_local ThreadBuffer* theBuffer = nullptr;
+thread_local std::string theThreadName;  // given before the buffer exists
+
+void append(const char* name, const char* detail, int64_t start,
+    int64_t end);
+
+// Buffers are created on the first zone, so threads that are never traced
+// cost nothing
+ThreadBuffer* threadBuffer() {
+  if (theBuffer == nullptr) {
+    TraceState& s = state();
+    {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      Chunk* chunk = new Chunk();
+      theBuffer = new ThreadBuffer{static_cast<int>(s.buffers.size()) + 1,
+        chunk, 0, chunk, theThreadName};
+      s.buffers.push_back(theBuffer);
+    }
+    if (!theThreadName.empty()) {
+      append(kThreadName, theThreadName.c_str(), 0, 0);
+    }
+  }
+  return theBuffer;
+}
+
+void append(const char* name, const char* detail, int64_t start,
+    int64_t end) {
+  ThreadBuffer* buffer = threadBuffer();
+  Chunk* chunk = buffer->tail;
+  int count = chunk->count.load(std::memory_order_relaxed);
+  if (count == kChunkEvents) {
+    Chunk* next = new Chunk();
+    chunk->next.store(next, std::memory_order_release);
+    buffer->tail = chunk = next;
+    count = 0;
+  }
+  TraceEvent& event = chunk->events[count];
+  event.name = name;
+  snprintf(event.detail, sizeof(event.detail), "%s", detail);
+  event.start = start;
+  event.end = end;
+  chunk->count.store(count + 1, std::memory_order_release);
+}
+
+void writeString(FILE* file, const char* text) {
+  fputc('"', file);
+  for (const char* c = text; *c; c++) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(file, "\\%c", *c);
+    } else if (static_cast<unsigned char>(*c) < 0x20) {
+      fprintf(file, "\\u%04x", *c);
+    } else {
+      fputc(*c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+// The caller holds the mutex and has checked that there is a file
+void writeThreadName(TraceState& s, int tid, const char* name) {
+  fprintf(s.file, "%s\n", s.first ? "" : ",");
+  s.first = false;
+  fprintf(s.file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+      "\"tid\":%d,\"args\":{\"name\":", tid);
+  writeString(s.file, name);
+  fprintf(s.file, "}}");
+}
+
+// Writes (or with no file, drops) the complete events of every buffer;
+// the caller holds the mutex
+void drain(TraceState& s) {
+  for (ThreadBuffer* buffer : s.buffers) {
+    while (true) {
+      Chunk* chunk = buffer->head;
+      int count = chunk->count.load(std::memory_order_acquire);
+      for (; buffer->read < count; buffer->read++) {
+        if (!s.file) continue;
+        const TraceEvent& event = chunk->events[buffer->read];
+        if (event.name == kThreadName) {
+          writeThreadName(s, buffer->tid, event.detail);
+          continue;
+        }
+        fprintf(s.file, "%s\n", s.first ? "" : ",");
+        s.first = false;
+        fprintf(s.file, "{\"name\":");
+        writeString(s.file, event.name);
+        fprintf(s.file, ",\"cat\":\"agl\",\"ph\":\"X\",\"ts\":%.3f,"
+            "\"dur\":%.3f,\"pid\":1,\"tid\":%d", event.start / 1000.0,
+            (event.end - event.start) / 1000.0, buffer->tid);
+        if (event.detail[0]) {
+          fprintf(s.file, ",\"args\":{\"detail\":");
+          writeString(s.file, event.detail);
+          fprintf(s.file, "}");
+        }
+        fprintf(s.file, "}");
+      }
+      Chunk* next = chunk->next.load(std::memory_order_acquire);
+      if (next == nullptr || buffer->read < kChunkEvents) break;
+      // the thread has moved on to the next chunk
+      buffer->head = next;
+      buffer->read = 0;
+      delete chunk;
+    }
+  }
+}
+
+}  // namespace
+
+int64_t Trace::now() {
+  static const std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+bool Trace::start(const std::string& filename) {
+  stop();
+  TraceState& s = state();
+  {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    drain(s);  // zones that ended after an earlier stop()
+    s.file = fopen(filename.c_str(), "w");
+    if (!s.file) {
+      std::cout << "WARNING: cannot write trace " << filename << std::endl;
+      return false;
+    }
+    fprintf(s.file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    s.first = true;
+    // the names of threads that were named in an earlier trace
+    for (ThreadBuffer* buffer : s.buffers) {
+      if (!buffer->name.empty()) {
+        writeThreadName(s, buffer->tid, buffer->name.c_str());
+      }
+    }
+    if (!s.atExit) {
+      s.atExit = true;
+      atexit(Trace::stop);
+    }
+  }
+  now();  // start the clock
+  _enabled = true;
+  if (theThreadName.empty()) setThreadName("main");
+  return true;
+}
+
+void Trace::flush() {
+  TraceState& s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  drain(s);
+  if (s.file) fflush(s.file);
+}
+
+void Trace::stop() {
+  _enabled = false;
+  TraceState& s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  if (!s.file) return;
+  drain(s);
+  fprintf(s.file, "\n]}\n");
+  fclose(s.file);
+  s.file = nullptr;
+}
+
+void Trace::setThreadName(const std::string& name) {
+  theThreadName = name;
+  if (theBuffer != nullptr) {
+    {
+      std::lock_guard<std::mutex> lock(state().mutex);
+      theBuffer->name = name;
+    }
+    append(kThreadName, name.c_str(), 0, 0);
+  }
+}
+
+void Trace::zone(const char* name, const char* detail, int64_t start,
+    int64_t end) {
+  append(name, detail, start, end);
+}
+
+}  // namespace agl
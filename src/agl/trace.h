@@ -0,0 +1,122 @@
+// Copyright 2020, Savvy Sine, Aline Normoyle
+
+#ifndef AGL_TRACE_H_
+#define AGL_TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace agl {
+
+/**
+ * @brief Records timed zones from every thread into a Chrome trace file
+ *
+ * Open the file in chrome://tracing or https://ui.perfetto.dev to see
+ * where time goes, e.g. what a model switch spends in loading the file,
+ * creating buffers and compiling shaders, and what the workers do
+ * meanwhile. Set AGL_TRACE=trace.json to trace any Window application.
+ *
+ * ```
+ * Trace::start("trace.json");
+ * {
+ *   TraceZone zone("load model", fileName);
+ *   mesh.load(fileName);
+ * }
+ * Trace::stop();  // or at exit
+ * ```
+ *
+ * Each thread appends its zones to its own buffer without locks. flush()
+ * writes what the buffers hold so far; stop(), which also runs at exit,
+ * writes the rest and closes the file. When tracing is off, a zone costs
+ * one relaxed atomic load.
+ */
+class Trace {
+ public:
+  /**
+   * @brief Start recording zones into the given .json file
+   * @return (bool) Returns false if the file cannot be written
+   */
+  static bool start(const std::string& filename);
+
+  /**
+   * @brief Write the zones recorded so far, from any thread
+   */
+  static void flush();
+
+  /**
+   * @brief Stop recording, write the remaining zones and close the file
+   */
+  static void stop();
+
+  /**
+   * @brief Return whether zones are being recorded
+   */
+  static bool enabled() { return _enabled.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief Name the calling thread in the trace, e.g. "worker"
+   *
+   * Works before start() too, and the name is kept for later traces.
+   */
+  static void setThreadName(const std::string& name);
+
+  /**
+   * @brief Return the time in nanoseconds on the trace's clock
+   */
+  static int64_t now();
+
+  /**
+   * @brief Record a zone of the calling thread; TraceZone calls this
+   */
+  static void zone(const char* name, const char* detail, int64_t start,
+      int64_t end);
+
+ private:
+  static std::atomic<bool> _enabled;
+};
+
+/**
+ * @brief Times the enclosing scope as a zone of the trace
+ *
+ * The name must be a string literal (or otherwise outlive the trace); the
+ * optional detail, such as a file name, is copied, up to 63 characters.
+ */
+class TraceZone {
+ public:
+  explicit TraceZone(const char* name) : _name(0) {
+    if (Trace::enabled()) {
+      _name = name;
+      _detail[0] = '\0';
+      _start = Trace::now();
+    }
+  }
+
+  TraceZone(const char* name, const std::string& detail) : _name(0) {
+    if (Trace::enabled()) {
+      _name = name;
+      // keep the end, which tells file names apart
+      size_t skip = detail.size() > kMaxDetail ? detail.size() - kMaxDetail : 0;
+      memcpy(_detail, detail.c_str() + skip, detail.size() - skip + 1);
+      _start = Trace::now();
+    }
+  }
+
+  ~TraceZone() {
+    if (_name) Trace::zone(_name, _detail, _start, Trace::now());
+  }
+
+  static const size_t kMaxDetail = 63;
+
+ private:
+  const char* _name;  // 0 when not tracing
+  char _detail[kMaxDetail + 1];
+  int64_t _start;
+
+  TraceZone(const TraceZone&) = delete;
+  TraceZone& operator=(const TraceZone&) = delete;
+};
+
+}  // namespace agl
+#endif  // AGL_TRACE_H_
@@ -1,9 +1,21 @@
 // copyright 2020, savvy_sine, alinen
 
 #include "agl/window.h"
+#include <chrono>
+#include <cstdlib>
 #include <string>
+#include <vector>
 #include <algorithm>
 #include <glm/gtc/matrix_transform.hpp>
+#include "agl/framecapture.h"
+#include "agl/imagecodec.h"
+#include "agl/memorytracker.h"
+#include "agl/threadpool.h"
+#include "agl/trace.h"
+#ifdef AGL_HAS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 
 namespace agl {
 
@@ -14,24 +26,61 @@ using glm::mat4;
 
 static Window* theInstance = 0;
 
+// The frame step of benchmarks, in seconds
+static const float kBenchmarkStep = 1.0f / 60.0f;
+static const int kBenchmarkFrames = 600;  // without input or AGL_FRAMES
+
 static void error_callback(int error, const char* description) {
   fputs("\n", stderr);
   fputs(description, stderr);
   fputs("\n", stderr);
 }
 
-Window::Window() :
+// Seconds since the first call; GLFW's timer needs GLFW, which headless
+// windows may not initialize
+static double now() {
+  static const std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+}
+
+Window::Window() : Window(false) {
+}
+
+Window::Window(bool headless) :
   _windowWidth(500),
   _windowHeight(500),
   _backgroundColor(0.0f),
   _elapsedTime(0.0),
   _lastx(0), _lasty(0),
-  _dt(-1.0) {
-  init();
+  _dt(-1.0),
+  _firstFrameTime(-1.0),
+  _frame(0),
+  _maxFrames(0),
+  _shouldClose(false) {
+  init(headless);
 }
 
 Window::~Window() {
+  delete _capture;  // writes the frames still in flight
+  delete _encoders;
+  delete _recordLog;
+  delete _replayLog;
   renderer.cleanup();
+  if (_fbo) {
+    if (_resolveFbo != _fbo) glDeleteFramebuffers(1, &_resolveFbo);
+    glDeleteFramebuffers(1, &_fbo);
+    glDeleteRenderbuffers(3, _renderbuffers);
+  }
+#ifdef AGL_HAS_EGL
+  if (_eglContext) {
+    eglMakeCurrent(_eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE,
+        EGL_NO_CONTEXT);
+    eglDestroyContext(_eglDisplay, _eglContext);
+    eglTerminate(_eglDisplay);
+  }
+#endif
   glfwTerminate();
 }
 
@@ -42,7 +91,8 @@ void Window::background(const vec3& color) {
 }
 
 void Window::noLoop() {
-  glfwSetWindowShouldClose(_window, GL_TRUE);
+  _shouldClose = true;
+  if (_window) glfwSetWindowShouldClose(_window, GL_TRUE);
 }
 
 void Window::ortho(float minx, float maxx,
@@ -61,24 +111,154 @@ void Window::lookAt(const glm::vec3& camPos,
 }
 
 void Window::run() {
-  if (!_window) return;  // window wasn't initialized
-
-  setup();
+  if (!_initialized) return;  // window or framebuffer failed in init()
 
-  while (!glfwWindowShouldClose(_window)) {
-    float time = glfwGetTime();
-    _dt = time - _elapsedTime;
-    _elapsedTime = time;
+  {
+    TraceZone zone("Window::setup");
+    setup();
+  }
+  if (!_benchmarkFile.empty()) startBenchmark();
+  double frameStart = now();
+
+  while (!_shouldClose && !(_window && glfwWindowShouldClose(_window))) {
+    TraceZone frameZone("frame");
+    if (_benchmarkFile.empty()) {
+      float time = now();
+      _dt = time - _elapsedTime;
+      _elapsedTime = time;
+    } else {
+      _dt = kBenchmarkStep;  // the same frames on every run
+      _elapsedTime = _frame * kBenchmarkStep;
+    }
+    if (_replayLog) replayEvents();
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     renderer.identity();
-    draw();  // user function
-    renderer.cleanupShaders();
+    renderer.beginFrame();
+    {
+      TraceZone zone("Window::draw");
+      draw();  // user function
+      renderer.flushBatches();
+      renderer.cleanupShaders();
+    }
+    renderer.endFrame();
+    if (_capture) {
+      beginReadback();
+      _capture->endFrame();
+      endReadback();
+    }
+
+    if (_window) {
+      TraceZone zone("glfwSwapBuffers");
+      glfwSwapBuffers(_window);
+    } else {
+      TraceZone zone("glFlush");
+      glFlush();  // what swapping would do
+    }
+    if (_firstFrameTime < 0) _firstFrameTime = now();
+    if (!_benchmarkFile.empty()) {
+      double frameEnd = now();
+      _frameTimes.push_back(static_cast<float>((frameEnd - frameStart) * 1000));
+      frameStart = frameEnd;
+    }
+    _frame++;
+    MemoryTracker::update();
+    if (_maxFrames > 0 && _frame >= _maxFrames) _shouldClose = true;
+    if (_window) {
+      TraceZone zone("glfwPollEvents");
+      glfwPollEvents();
+    }
+  }
+
+  if (_capture) _capture->stop();
+  if (_recordLog && _recordLog->save(_recordFile)) {
+    std::cout << "saved input log " << _recordFile << std::endl;
+  }
+  if (!_benchmarkFile.empty()) {
+    double total = 0;
+    for (float ms : _frameTimes) total += ms;
+    printf("benchmark: %d frames in %.2f s, %.1f frames per second\n",
+        _frame, total / 1000, _frame / std::max(total / 1000, 1e-6));
+    if (renderer.profiler().save(_benchmarkFile, _frameTimes)) {
+      std::cout << "saved " << _benchmarkFile << std::endl;
+    } else {
+      std::cout << "WARNING: cannot write " << _benchmarkFile << std::endl;
+    }
+  }
+}
+
+void Window::recordInput(const std::string& filename) {
+  if (!_recordLog) _recordLog = new InputLog();
+  _recordFile = filename;
+}
 
-    glfwSwapBuffers(_window);
-    glfwPollEvents();
+bool Window::replayInput(const std::string& filename) {
+  InputLog* log = new InputLog();
+  if (!log->load(filename)) {
+    delete log;
+    return false;
+  }
+  delete _replayLog;
+  _replayLog = log;
+  return true;
+}
+
+void Window::benchmark(const std::string& filename, int frames) {
+  _benchmarkFile = filename;
+  _benchmarkFrames = frames;
+}
+
+void Window::startBenchmark() {
+  if (_benchmarkFrames > 0) {
+    _maxFrames = _benchmarkFrames;
+  } else if (_replayLog && _replayLog->lastFrame() >= 0) {
+    _maxFrames = _replayLog->lastFrame() + 1;
+  } else if (_maxFrames == 0) {
+    _maxFrames = kBenchmarkFrames;
   }
+  if (_window) glfwSwapInterval(0);  // vsync off
+
+  // otherwise the first frames depend on how fast things load
+  renderer.finishShaderLoads();
+  renderer.finishTextureLoads();
+  renderer.profiler().keepHistory(true);
+  _frame = 0;
+  std::cout << "benchmark: " << _maxFrames << " frames" <<
+    (_replayLog ? " of replayed input" : "") << std::endl;
+}
+
+void Window::replayEvents() {
+  InputLog::Event event;
+  while (_replayLog->next(_frame, &event)) {
+    switch (event.type) {
+      case InputLog::KEY_DOWN:
+        onKeyboard(event.code, 0, GLFW_PRESS, event.mods);
+        break;
+      case InputLog::KEY_UP:
+        onKeyboard(event.code, 0, GLFW_RELEASE, event.mods);
+        break;
+      case InputLog::MOUSE_DOWN:
+        onMouseButton(event.code, GLFW_PRESS, event.mods);
+        break;
+      case InputLog::MOUSE_UP:
+        onMouseButton(event.code, GLFW_RELEASE, event.mods);
+        break;
+      case InputLog::MOUSE_MOVE:
+        onMouseMotion(static_cast<int>(event.x), static_cast<int>(event.y));
+        break;
+      case InputLog::SCROLL:
+        onScroll(event.x, event.y);
+        break;
+    }
+  }
+}
+
+void Window::recordEvent(InputLog::Type type, int code, int mods,
+    float x, float y) {
+  if (!_recordLog) return;
+  InputLog::Event event = {_frame, type, code, mods, x, y};
+  _recordLog->add(event);
 }
 
 bool Window::screenshot(const std::string& filename) {
@@ -90,24 +270,47 @@ bool Window::screenshot(const std::string& filename) {
   int width = viewport[2];
   int height = viewport[3];
 
-  size_t size = static_cast<size_t>(width * height * 4);
-  unsigned char *data = static_cast<unsigned char*>(malloc(size));
+  // Pixels are read straight into the image and its strips are
+  // compressed on the encoder threads
+  Image image(width, height);
+  beginReadback();
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, image.data());
+  endReadback();
+  return writeImage(filename, image, true, encoders());
+}
 
-  if (!data) {
-    return false;
-  }
+void Window::screenshotAsync(const std::string& filename) {
+  capture()->save(filename);
+}
 
-  glPixelStorei(GL_PACK_ALIGNMENT, 1);
-  glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, data);
+bool Window::finishScreenshots() {
+  return _capture ? _capture->finish() : true;
+}
+
+bool Window::startRecording(const std::string& filename, int fps) {
+  return capture()->record(filename, fps);
+}
+
+void Window::stopRecording() {
+  if (_capture) _capture->stop();
+}
+
+bool Window::isRecording() const {
+  return _capture && _capture->recording();
+}
 
-  // Using Image introduces another copy but makes it easier to keep all
-  // stb code referenced from a single file (needed for header-only include)
-  Image image;
-  image.set(width, height, data);
-  bool result = image.save(filename);
+FrameCapture* Window::capture() {
+  if (_capture == 0) _capture = new FrameCapture();
+  return _capture;
+}
 
-  free(data);
-  return result;
+// The capture's encoders if it exists, so that a plain screenshot() does
+// not create the capture's pixel buffers
+ThreadPool* Window::encoders() {
+  if (_capture) return _capture->encoders();
+  if (_encoders == 0) _encoders = new ThreadPool();
+  return _encoders;
 }
 
 float Window::height() const {
@@ -126,18 +329,28 @@ float Window::elapsedTime() const {
   return _elapsedTime;
 }
 
+float Window::timeToFirstFrame() const {
+  return _firstFrameTime;
+}
+
 glm::vec2 Window::mousePosition() const {
+  if (_replayLog) return _replayLog->mousePosition();
+  if (!_window) return glm::vec2(0);  // headless
   double xpos, ypos;
   glfwGetCursorPos(_window, &xpos, &ypos);
   return glm::vec2(static_cast<float>(xpos), static_cast<float>(ypos));
 }
 
 bool Window::keyIsDown(int key) const {
+  if (_replayLog) return _replayLog->keyIsDown(key);
+  if (!_window) return false;
   int state = glfwGetKey(_window, key);
   return (state == GLFW_PRESS);
 }
 
 bool Window::mouseIsDown(int button) const {
+  if (_replayLog) return _replayLog->mouseIsDown(button);
+  if (!_window) return false;
   int state = glfwGetMouseButton(_window, button);
   return (state == GLFW_PRESS);
 }
@@ -146,54 +359,227 @@ void Window::setWindowSize(int w, int h) {
   if (_windowWidth == w && _windowHeight == h) return;
   _windowWidth = w;
   _windowHeight = h;
-  glfwSetWindowSize(_window, w, h);  
+  if (_window) {
+    glfwSetWindowSize(_window, w, h);
+  } else {
+    onResize(w, h);  // headless: no window to send the event
+  }
 }
 
-void Window::init() {
+void Window::init(bool headless) {
   theInstance = this;
-  glfwSetErrorCallback(error_callback);
-
-  if (!glfwInit()) {
-    fprintf(stderr, "ERROR: Cannot initialize GLFW\n");
+  now();  // start the clock
+
+  const char* mode = getenv("AGL_HEADLESS");
+  std::string backend = mode ? mode : "";
+  if (!backend.empty()) headless = (backend != "0");
+  const char* frames = getenv("AGL_FRAMES");
+  if (frames) _maxFrames = std::max(0, atoi(frames));
+  const char* trace = getenv("AGL_TRACE");
+  if (trace) Trace::start(trace);
+  const char* memory = getenv("AGL_MEMORY");
+  if (memory) MemoryTracker::printEvery(static_cast<float>(atof(memory)));
+
+  if (headless && backend != "glfw" && initEGL()) {
+    // rendering into a framebuffer object, no window or input
+  } else if (headless && backend == "egl") {
+    fprintf(stderr, "ERROR: Cannot create an EGL context\n");
     return;
+  } else {
+    glfwSetErrorCallback(error_callback);
+
+    if (!glfwInit()) {
+      fprintf(stderr, "ERROR: Cannot initialize GLFW\n");
+      return;
+    }
+
+    // Set the GLFW window creation hints - these are optional
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    glfwWindowHint(GLFW_SAMPLES, 4);  // Request 4x antialiasing
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (headless) glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+
+    _window = glfwCreateWindow(_windowWidth, _windowHeight,
+        "AGL Window", 0, 0);
+    if (!_window) {
+      fprintf(stderr, "ERROR: Cannot initialize GLFW window\n");
+      glfwTerminate();
+      return;
+    }
+
+    glfwMakeContextCurrent(_window);
+    glfwSetKeyCallback(_window, Window::onKeyboardCb);
+    glfwSetFramebufferSizeCallback(_window, Window::onResizeCb);
+    glfwSetMouseButtonCallback(_window, Window::onMouseButtonCb);
+    glfwSetCursorPosCallback(_window, Window::onMouseMotionCb);
+    glfwSetScrollCallback(_window, Window::onScrollCb);
   }
 
-  // Set the GLFW window creation hints - these are optional
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
-  glfwWindowHint(GLFW_SAMPLES, 4);  // Request 4x antialiasing
-  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-  _window = glfwCreateWindow(_windowWidth, _windowHeight, "AGL Window", 0, 0);
-  if (!_window) {
-    fprintf(stderr, "ERROR: Cannot initialize GLFW window\n");
-    glfwTerminate();
-    return;
-  }
-
-  glfwMakeContextCurrent(_window);
-  glfwSetKeyCallback(_window, Window::onKeyboardCb);
-  glfwSetFramebufferSizeCallback(_window, Window::onResizeCb);
-  glfwSetMouseButtonCallback(_window, Window::onMouseButtonCb);
-  glfwSetCursorPosCallback(_window, Window::onMouseMotionCb);
-  glfwSetScrollCallback(_window, Window::onScrollCb);
-
 #ifndef APPLE
-  if (glewInit() != GLEW_OK)
-  {
+  // With an EGL context, GLEW (built for GLX) loads the GL functions and
+  // then reports that there is no X display
+  GLenum status = glewInit();
+  if (status != GLEW_OK &&
+      !(_eglContext && status == GLEW_ERROR_NO_GLX_DISPLAY)) {
      std::cout << "Cannot initialize GLEW\n";
      return;
   }
 #endif
 
+  // Hidden windows have no visible pixels to draw into either
+  if (headless && !initFramebuffer()) return;
+
   // Initialize openGL and set default values
   glEnable(GL_MULTISAMPLE);
   renderer.init();
   background(vec3(0));
+  _initialized = true;
+}
+
+bool Window::initEGL() {
+#ifdef AGL_HAS_EGL
+  // Displays that need no window system, best first: Mesa's surfaceless
+  // platform (a GPU, or llvmpipe without one), the first GPU device
+  // (e.g. NVIDIA), then the default display
+  std::vector<EGLDisplay> displays;
+  const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  std::string extensions = clientExtensions ? clientExtensions : "";
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+    (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+      eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (getPlatformDisplay &&
+      extensions.find("EGL_MESA_platform_surfaceless") != std::string::npos) {
+    displays.push_back(getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+        EGL_DEFAULT_DISPLAY, 0));
+  }
+  PFNEGLQUERYDEVICESEXTPROC queryDevices =
+    (PFNEGLQUERYDEVICESEXTPROC) eglGetProcAddress("eglQueryDevicesEXT");
+  EGLDeviceEXT device;
+  EGLint numDevices = 0;
+  if (getPlatformDisplay && queryDevices &&
+      extensions.find("EGL_EXT_platform_device") != std::string::npos &&
+      queryDevices(1, &device, &numDevices) && numDevices > 0) {
+    displays.push_back(getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, 0));
+  }
+  displays.push_back(eglGetDisplay(EGL_DEFAULT_DISPLAY));
+
+  const EGLint configAttribs[] = {
+    EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_NONE};
+  const EGLint contextAttribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION_KHR, 4,
+    EGL_CONTEXT_MINOR_VERSION_KHR, 1,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR,
+    EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+    EGL_NONE};
+
+  for (EGLDisplay display : displays) {
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+      continue;
+    }
+    EGLConfig config = 0;
+    EGLint numConfigs = 0;
+    eglChooseConfig(display, configAttribs, &config, 1, &numConfigs);
+    EGLContext context = EGL_NO_CONTEXT;
+    if (eglBindAPI(EGL_OPENGL_API)) {
+      context = eglCreateContext(display,
+          numConfigs > 0 ? config : EGL_NO_CONFIG_KHR,
+          EGL_NO_CONTEXT, contextAttribs);
+    }
+    // no surface: everything is drawn into a framebuffer object
+    if (context != EGL_NO_CONTEXT &&
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+      _eglDisplay = display;
+      _eglContext = context;
+      return true;
+    }
+    if (context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+    eglTerminate(display);
+  }
+#endif
+  return false;
+}
+
+bool Window::initFramebuffer() {
+  if (_fbo) {
+    if (_resolveFbo != _fbo) glDeleteFramebuffers(1, &_resolveFbo);
+    glDeleteFramebuffers(1, &_fbo);
+    glDeleteRenderbuffers(3, _renderbuffers);
+  }
+
+  // multisampled like the window, then resolved when pixels are read
+  GLint maxSamples = 0;
+  glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+  GLsizei samples = std::min(4, static_cast<int>(maxSamples));
+  int w = _windowWidth;
+  int h = _windowHeight;
+
+  glGenRenderbuffers(3, _renderbuffers);
+  glGenFramebuffers(1, &_fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+  glBindRenderbuffer(GL_RENDERBUFFER, _renderbuffers[0]);
+  glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, w, h);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+      GL_RENDERBUFFER, _renderbuffers[0]);
+  glBindRenderbuffer(GL_RENDERBUFFER, _renderbuffers[1]);
+  glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples,
+      GL_DEPTH24_STENCIL8, w, h);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+      GL_RENDERBUFFER, _renderbuffers[1]);
+  bool complete =
+    glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+  _resolveFbo = _fbo;
+  if (samples > 0) {
+    glGenFramebuffers(1, &_resolveFbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, _resolveFbo);
+    glBindRenderbuffer(GL_RENDERBUFFER, _renderbuffers[2]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+        GL_RENDERBUFFER, _renderbuffers[2]);
+    complete = complete &&
+      glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+  glViewport(0, 0, w, h);
+  renderer.setScreenFramebuffer(_fbo);  // the old one was deleted on resize
+  if (!complete) {
+    fprintf(stderr, "ERROR: Cannot create the offscreen framebuffer\n");
+  }
+  return complete;
+}
+
+void Window::beginReadback() {
+  if (_resolveFbo == _fbo) return;  // a window, or not multisampled
+
+  // resolve only when drawing to the screen, not into a render texture
+  GLint draw = 0;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw);
+  if (static_cast<GLuint>(draw) != _fbo) return;
+
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _resolveFbo);
+  glBlitFramebuffer(0, 0, _windowWidth, _windowHeight,
+      0, 0, _windowWidth, _windowHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, _resolveFbo);
+}
+
+void Window::endReadback() {
+  if (_resolveFbo == _fbo) return;
+  GLint draw = 0;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, draw);
 }
 
 void Window::onMouseMotionCb(GLFWwindow* win, double pX, double pY) {
+  if (theInstance->_replayLog) return;  // the log is the input
+  theInstance->recordEvent(InputLog::MOUSE_MOVE, 0, 0,
+      static_cast<float>(pX), static_cast<float>(pY));
   theInstance->onMouseMotion(static_cast<int>(pX), static_cast<int>(pY));
 }
 
@@ -208,12 +594,15 @@ void Window::onMouseMotion(int pX, int pY) {
 
 void Window::onMouseButtonCb(GLFWwindow* win,
     int button, int action, int mods) {
+  if (theInstance->_replayLog) return;
+  theInstance->recordEvent(action == GLFW_PRESS ? InputLog::MOUSE_DOWN :
+      InputLog::MOUSE_UP, button, mods, 0, 0);
   theInstance->onMouseButton(button, action, mods);
 }
 
 void Window::onMouseButton(int button, int action, int mods) {
-  double xpos, ypos;
-  glfwGetCursorPos(_window, &xpos, &ypos);
+  glm::vec2 cursor = mousePosition();
+  double xpos = cursor.x, ypos = cursor.y;
 
   // ASN TODO: Save/pass modifiers so users can get it
   if (action == GLFW_PRESS) {
@@ -230,13 +619,18 @@ void Window::onMouseButton(int button, int action, int mods) {
 
 void Window::onKeyboardCb(GLFWwindow* w,
     int key, int scancode, int action, int mods) {
+  if (theInstance->_replayLog && key != GLFW_KEY_ESCAPE) return;
+  if (action != GLFW_REPEAT) {
+    theInstance->recordEvent(action == GLFW_PRESS ? InputLog::KEY_DOWN :
+        InputLog::KEY_UP, key, mods, 0, 0);
+  }
   theInstance->onKeyboard(key, scancode, action, mods);
 }
 
 void Window::onKeyboard(int key, int scancode, int action, int mods) {
   // Exit on ESC key.
   if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
-    glfwSetWindowShouldClose(_window, GL_TRUE);
+    noLoop();
   }
 
   if (action == GLFW_PRESS) {
@@ -247,6 +641,9 @@ void Window::onKeyboard(int key, int scancode, int action, int mods) {
 }
 
 void Window::onScrollCb(GLFWwindow* win, double xoffset, double yoffset) {
+  if (theInstance->_replayLog) return;
+  theInstance->recordEvent(InputLog::SCROLL, 0, 0,
+      static_cast<float>(xoffset), static_cast<float>(yoffset));
   theInstance->onScroll(
     static_cast<float>(xoffset),
     static_cast<float>(yoffset));
@@ -263,6 +660,7 @@ void Window::onResizeCb(GLFWwindow* window, int width, int height) {
 void Window::onResize(int width, int height) {
   _windowWidth = width;
   _windowHeight = height;
+  if (_fbo) initFramebuffer();
   glViewport(0, 0, width, height);
   resize(width, height);  // user function
 }
@@ -5,12 +5,17 @@
 
 #include <string>
 #include <map>
+#include <vector>
 #include "agl/agl.h"
 #include "agl/aglm.h"
+#include "agl/inputlog.h"
 #include "agl/renderer.h"
 
 namespace agl {
 
+class FrameCapture;
+class ThreadPool;
+
 /**
  * @brief Manages the window and user input.
  *
@@ -25,8 +30,29 @@ class Window {
    * Override this class to create a custom application.
    * The default window is sized 500x500 and draws an empty (black) scene.
    * @verbinclude empty.cpp
+   *
+   * Set the environment variable AGL_HEADLESS to render offscreen instead
+   * (see Window(bool)), e.g. `AGL_HEADLESS=1 AGL_FRAMES=100 ./mesh-viewer`.
    */
   Window();
+
+  /**
+   * @brief Create a window, or an offscreen context when headless is true
+   *
+   * Headless windows draw into a framebuffer object of the window size, so
+   * setup(), draw(), the Renderer API and screenshot() work as usual, but
+   * there is no input other than replayInput(). They use an EGL context
+   * without a display when agl is built with EGL (GPU drivers, or Mesa's
+   * llvmpipe on machines without one), and otherwise a hidden GLFW window.
+   * AGL_HEADLESS=egl or AGL_HEADLESS=glfw forces one of them;
+   * AGL_HEADLESS=0 shows a window.
+   *
+   * If AGL_FRAMES is set, run() returns after that many frames, in either
+   * mode. Headless windows otherwise run until noLoop() is called.
+   * AGL_MEMORY=seconds prints MemoryTracker's table at that interval, and
+   * AGL_TRACE=trace.json records a Chrome trace (see Trace).
+   */
+  explicit Window(bool headless);
   virtual ~Window();
 
   /**
@@ -48,12 +74,107 @@ class Window {
    * @param filename image file name (should be a .png file)
    * @return (bool) Returns false if the image cannot be saved; true otherwise
    *
-   * Filenames should include the png file extension.
+   * Filenames should include the png file extension, or qoi for faster,
+   * larger files.
    * Image with relative paths will be written relative to the directory
    * from which you run the executable. Images are saved in RGBA format.
    */
   bool screenshot(const std::string& filename);
 
+  /**
+   * @brief Save the current frame to a file without waiting for the GPU
+   * @param filename image file name (should be a .png file)
+   *
+   * The frame is read once draw() returns and is written by a background
+   * thread a frame or two later, so it can be called every frame without
+   * slowing the window down. Unlike screenshot(), errors are only reported
+   * as warnings; call finishScreenshots() to find out whether they failed.
+   */
+  void screenshotAsync(const std::string& filename);
+
+  /**
+   * @brief Wait until the frames from screenshotAsync() are written
+   * @return (bool) Returns false if a frame since the last call could not
+   * be saved
+   *
+   * Frames are read after draw() returns, so call it in the next draw() to
+   * include the frame saved in this one.
+   */
+  bool finishScreenshots();
+
+  /**
+   * @brief Save every frame until stopRecording() is called
+   * @param filename A .y4m video file, or a pattern for numbered images
+   * such as "frame%04d.png"
+   * @param fps The playback frame rate of a .y4m video
+   * @return (bool) Returns false if the file cannot be written
+   *
+   * Frames are captured with screenshotAsync(). Every drawn frame is kept,
+   * so move things by a fixed step per frame (rather than by dt()) for
+   * smooth playback. Convert a video with e.g.
+   * `ffmpeg -i orbit.y4m orbit.mp4`.
+   */
+  bool startRecording(const std::string& filename, int fps = 30);
+
+  /**
+   * @brief Stop recording and wait until the last frames are written
+   */
+  void stopRecording();
+
+  /**
+   * @brief Return true between startRecording() and stopRecording()
+   */
+  bool isRecording() const;
+
+  /** 
+   * @brief Return the time from window creation until the first frame was
+   * shown (in seconds)
+   *
+   * Includes creating the context, loading shaders in setup(), and drawing
+   * the first frame. Returns a negative value before the first frame.
+   */
+  float timeToFirstFrame() const;
+
+  /**
+   * @brief Return true if the window renders offscreen
+   */
+  bool isHeadless() const { return _fbo != 0; }
+
+  /**
+   * @brief Record the keyboard, mouse and scroll input of the session
+   * @param filename The input log written when run() returns
+   *
+   * Call before run(). Play the log back with replayInput().
+   * @see InputLog
+   */
+  void recordInput(const std::string& filename);
+
+  /**
+   * @brief Play back recorded or scripted input instead of the devices
+   * @param filename An input log
+   * @return (bool) Returns false if the log cannot be read
+   *
+   * Call before run(). The window ignores the real keyboard and mouse,
+   * except escape, and keyIsDown(), mouseIsDown() and mousePosition()
+   * report the played back state. Works in headless windows too.
+   * @see InputLog
+   */
+  bool replayInput(const std::string& filename);
+
+  /**
+   * @brief Run a fixed number of frames and report their times
+   * @param filename The .json report written when run() returns, see
+   * Profiler::save(); wall_ms times each frame from one swap to the next
+   * @param frames The number of frames; 0 runs until the replayed input
+   * ends, or for AGL_FRAMES frames, or 600
+   *
+   * Call before run(). Vsync is turned off, the shaders and textures
+   * loaded asynchronously in setup() are waited for before the first
+   * frame, and dt() is a fixed 1/60 s, so that with replayInput() every
+   * run draws the same frames.
+   */
+  void benchmark(const std::string& filename, int frames = 0);
+
  protected:
   /** @name Respond to events
    */
@@ -267,7 +388,16 @@ class Window {
       float miny, float maxy, float minz, float maxz);
 
  private:
-  void init();
+  void init(bool headless);
+  bool initEGL();
+  bool initFramebuffer();
+  void beginReadback();
+  void endReadback();
+  FrameCapture* capture();
+  ThreadPool* encoders();
+  void startBenchmark();
+  void replayEvents();
+  void recordEvent(InputLog::Type type, int code, int mods, float x, float y);
 
   static void onScrollCb(GLFWwindow* w, double xoffset, double yoffset);
   static void onMouseMotionCb(GLFWwindow* w, double x, double y);
@@ -289,10 +419,30 @@ class Window {
   int _windowWidth, _windowHeight;
   float _elapsedTime;
   float _dt;
+  float _firstFrameTime;
   float _lastx, _lasty;
   bool _cameraEnabled;
   glm::vec3 _backgroundColor;
+  int _frame;
+  int _maxFrames;  // from AGL_FRAMES, or 0 for no limit
+  bool _shouldClose;
+  bool _initialized = false;  // false if init() failed, so run() returns
   struct GLFWwindow* _window = 0;
+  FrameCapture* _capture = 0;  // created on first use
+  ThreadPool* _encoders = 0;   // for screenshot(), created on first use
+  InputLog* _recordLog = 0;
+  std::string _recordFile;
+  InputLog* _replayLog = 0;
+  std::string _benchmarkFile;  // empty unless benchmarking
+  int _benchmarkFrames = 0;
+  std::vector<float> _frameTimes;  // of the benchmark, in milliseconds
+
+  // headless rendering
+  void* _eglDisplay = 0;
+  void* _eglContext = 0;
+  GLuint _fbo = 0;          // multisampled, drawn into
+  GLuint _resolveFbo = 0;   // single sampled copy for reading pixels
+  GLuint _renderbuffers[3] = {0, 0, 0};  // color, depth, resolved color
 
  protected:
   inline GLFWwindow* window() const { return _window; }
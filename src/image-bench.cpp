@@ -0,0 +1,158 @@
+//--------------------------------------------------
+// Description: Compares image encoders on capture-sized images: stb's PNG
+// writer (Image::save), writeImage's strip PNG encoder on one and on all
+// threads, and QOI. Every file is loaded back and checked.
+//
+// Usage: image-bench [-j threads] [-n repeats] [--size WxH | --native]
+//                    [file.png | dir]...
+// Without files, every PNG in ../textures is scaled to 3840x2160.
+//--------------------------------------------------
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "agl/image.h"
+#include "agl/imagecodec.h"
+#include "agl/threadpool.h"
+#include "osutils.h"
+
+using namespace agl;
+using std::string;
+using std::vector;
+
+namespace {
+
+// Returns the fastest of several runs, in seconds
+double timeBest(int repeats, const std::function<bool()>& encode, bool* ok) {
+  double best = 1e30;
+  for (int i = 0; i < repeats; i++) {
+    auto start = std::chrono::steady_clock::now();
+    *ok = encode() && *ok;
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    best = std::min(best, seconds);
+  }
+  return best;
+}
+
+long fileSize(const string& fileName) {
+  FILE* file = fopen(fileName.c_str(), "rb");
+  if (!file) return -1;
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fclose(file);
+  return size;
+}
+
+bool sameImage(const Image& a, const string& fileName) {
+  Image b;
+  if (!b.load(fileName, false, a.channels())) return false;
+  return a.width() == b.width() && a.height() == b.height() &&
+    memcmp(a.data(), b.data(), a.width() * a.height() * a.channels()) == 0;
+}
+
+void report(const char* name, const Image& image, double seconds,
+    const string& fileName, bool ok) {
+  double megabytes = image.width() * image.height() * image.channels() / 1e6;
+  bool same = ok && sameImage(image, fileName);
+  printf("  %-22s %8.1f MB/s %8.1f ms %9.1f KB  %s\n", name,
+      megabytes / seconds, seconds * 1000, fileSize(fileName) / 1024.0,
+      same ? "ok" : "MISMATCH");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int numThreads = 0;
+  int repeats = 3;
+  int width = 3840, height = 2160;
+  vector<string> inputs;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "-j" && i + 1 < argc) {
+      numThreads = atoi(argv[++i]);
+    } else if (arg == "-n" && i + 1 < argc) {
+      repeats = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--size" && i + 1 < argc &&
+        sscanf(argv[i + 1], "%dx%d", &width, &height) == 2) {
+      i++;
+    } else if (arg == "--native") {
+      width = height = 0;
+    } else if (arg[0] == '-') {
+      std::cout << "usage: image-bench [-j threads] [-n repeats] "
+          "[--size WxH | --native] [file.png | dir]..." << std::endl;
+      return 1;
+    } else {
+      inputs.push_back(arg);
+    }
+  }
+  if (inputs.empty()) inputs.push_back("../textures");
+
+  vector<string> files;
+  for (const string& input : inputs) {
+    if (input.size() > 4 && input.substr(input.size() - 4) == ".png") {
+      files.push_back(input);
+      continue;
+    }
+    for (const string& name : GetFilenamesInDir(input, ".png")) {
+      files.push_back(input + "/" + name);
+    }
+  }
+  std::sort(files.begin(), files.end());
+
+  ThreadPool pool(numThreads);
+  char parallel[32];
+  snprintf(parallel, sizeof(parallel), "writeImage png x%d", pool.size());
+  const string pngName = "image-bench.png";
+  const string qoiName = "image-bench.qoi";
+  bool allOk = true;
+
+  for (const string& file : files) {
+    Image image;
+    if (!image.load(file)) {
+      std::cout << "WARNING: could not load " << file << std::endl;
+      continue;
+    }
+    if (width > 0) image = image.resize(width, height);
+    printf("%s: %dx%d, %.1f MB\n", file.c_str(), image.width(),
+        image.height(), image.width() * image.height() * 4 / 1e6);
+
+    bool ok = true;
+    double seconds = timeBest(repeats, [&]() {
+      return image.save(pngName, false);
+    }, &ok);
+    report("Image::save (stb)", image, seconds, pngName, ok);
+    allOk = allOk && ok && sameImage(image, pngName);
+
+    ok = true;
+    seconds = timeBest(repeats, [&]() {
+      return writeImage(pngName, image);
+    }, &ok);
+    report("writeImage png x1", image, seconds, pngName, ok);
+    allOk = allOk && ok && sameImage(image, pngName);
+
+    ok = true;
+    seconds = timeBest(repeats, [&]() {
+      return writeImage(pngName, image, false, &pool);
+    }, &ok);
+    report(parallel, image, seconds, pngName, ok);
+    allOk = allOk && ok && sameImage(image, pngName);
+
+    ok = true;
+    seconds = timeBest(repeats, [&]() {
+      return writeImage(qoiName, image);
+    }, &ok);
+    report("writeImage qoi", image, seconds, qoiName, ok);
+    allOk = allOk && ok && sameImage(image, qoiName);
+  }
+
+  std::remove(pngName.c_str());
+  std::remove(qoiName.c_str());
+  return allOk ? 0 : 1;
+}
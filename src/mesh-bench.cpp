@@ -0,0 +1,329 @@
+//--------------------------------------------------
+// Description: Benchmarks PLYMesh::load on every model in a directory and
+// on generated grids of increasing size. Each file is loaded several times
+// per loader mode, in a child process so that its peak memory is its own.
+// Results are written as JSON: MB/s, vertices/s, faces/s, peak resident
+// memory and the number of allocations per load.
+//
+// Usage: mesh-bench [-n repeats] [--faces N,N,...] [--data dir]
+//                   [-o file.json] [models dir]
+// Without arguments, ../models and grids of 10 thousand to 10 million
+// faces are loaded 3 times each, and mesh-bench.json is written.
+//--------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#include "plymesh.h"
+#include "osutils.h"
+
+using namespace agl;
+using std::string;
+using std::vector;
+
+// Every allocation in the program goes through these, so loads can be
+// charged with the allocations they make
+static std::atomic<long long> gAllocations(0);
+static std::atomic<long long> gAllocatedBytes(0);
+
+void* operator new(size_t size) {
+  gAllocations++;
+  gAllocatedBytes += size;
+  void* p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  free(p);
+}
+
+namespace {
+
+// PLYMesh only reads ASCII files. The cold mode evicts the file from the
+// OS page cache before every load, so it includes reading the disk; the
+// warm mode loads a file that is already cached.
+struct LoaderMode {
+  const char* name;
+  bool evict;
+};
+
+const LoaderMode kModes[] = {
+  {"ascii-cold", true},
+  {"ascii-warm", false}
+};
+
+struct Result {
+  int vertices;
+  int faces;
+  double minSeconds;
+  double medianSeconds;
+  long long allocations;  // per load
+  long long allocatedBytes;  // per load
+  long peakRssKB;  // -1 when unknown
+  bool ok;
+};
+
+long long fileSize(const string& fileName) {
+  struct stat info;
+  if (stat(fileName.c_str(), &info) != 0) return -1;
+  return info.st_size;
+}
+
+// Drop the file's pages from the OS cache (Linux and BSD)
+void evict(const string& fileName) {
+#if !defined(_WIN32) && defined(POSIX_FADV_DONTNEED)
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) return;
+  fdatasync(fd);  // dirty pages cannot be dropped
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+#endif
+}
+
+// A grid of about the given number of faces, with normals and texture
+// coordinates, in the format the models use
+string writeGrid(const string& dir, long long faces) {
+  char name[64];
+  snprintf(name, sizeof(name), "/grid-%lld.ply", faces);
+  string fileName = dir + name;
+  if (fileSize(fileName) > 0) return fileName;  // made by an earlier run
+
+  int columns = std::max(1, static_cast<int>(std::sqrt(faces / 2.0)));
+  int rows = static_cast<int>(std::max(1LL, faces / (2LL * columns)));
+  string tmpName = fileName + ".tmp";
+  FILE* file = fopen(tmpName.c_str(), "wb");
+  if (!file) {
+    std::cout << "WARNING: cannot write " << tmpName << std::endl;
+    return "";
+  }
+  fprintf(file, "ply\nformat ascii 1.0\ncomment mesh-bench grid\n");
+  fprintf(file, "element vertex %d\n", (columns + 1) * (rows + 1));
+  for (const char* property : {"x", "y", "z", "nx", "ny", "nz", "s", "t"}) {
+    fprintf(file, "property float %s\n", property);
+  }
+  fprintf(file, "element face %d\n", 2 * columns * rows);
+  fprintf(file, "property list uchar uint vertex_indices\nend_header\n");
+  for (int j = 0; j <= rows; j++) {
+    for (int i = 0; i <= columns; i++) {
+      float s = static_cast<float>(i) / columns;
+      float t = static_cast<float>(j) / rows;
+      // a gentle wave, so the values have varied digits
+      fprintf(file, "%f %f %f 0.000000 1.000000 0.000000 %f %f\n",
+          s * 2 - 1, 0.1f * std::sin(s * 20) * std::cos(t * 20), t * 2 - 1,
+          s, t);
+    }
+  }
+  for (int j = 0; j < rows; j++) {
+    for (int i = 0; i < columns; i++) {
+      int a = j * (columns + 1) + i;
+      int b = a + columns + 1;
+      fprintf(file, "3 %d %d %d\n3 %d %d %d\n", a, b, a + 1, a + 1, b, b + 1);
+    }
+  }
+  fclose(file);
+  rename(tmpName.c_str(), fileName.c_str());
+  return fileName;
+}
+
+Result measure(const string& fileName, const LoaderMode& mode,
+    int repeats) {
+  Result result = {};
+  vector<double> seconds;
+  for (int i = 0; i < repeats; i++) {
+    if (mode.evict) evict(fileName);
+    long long allocations = gAllocations;
+    long long allocatedBytes = gAllocatedBytes;
+    auto start = std::chrono::steady_clock::now();
+    {
+      PLYMesh mesh;
+      result.ok = mesh.load(fileName);
+      result.vertices = mesh.numVertices();
+      result.faces = mesh.numTriangles();
+    }
+    seconds.push_back(std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count());
+    result.allocations = gAllocations - allocations;
+    result.allocatedBytes = gAllocatedBytes - allocatedBytes;
+  }
+  std::sort(seconds.begin(), seconds.end());
+  result.minSeconds = seconds.front();
+  result.medianSeconds = seconds[seconds.size() / 2];
+  result.peakRssKB = -1;
+  return result;
+}
+
+// Measures in a child process, whose peak memory is only this file's
+Result measureIsolated(const string& fileName, const LoaderMode& mode,
+    int repeats) {
+#ifdef _WIN32
+  return measure(fileName, mode, repeats);
+#else
+  int fds[2];
+  if (pipe(fds) != 0) return measure(fileName, mode, repeats);
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    Result result = measure(fileName, mode, repeats);
+    ssize_t written = write(fds[1], &result, sizeof(result));
+    _exit(written == sizeof(result) ? 0 : 1);
+  }
+  close(fds[1]);
+  Result result = {};
+  bool received = pid > 0 &&
+    read(fds[0], &result, sizeof(result)) == sizeof(result);
+  close(fds[0]);
+  struct rusage usage = {};
+  int status = 0;
+  if (pid > 0) wait4(pid, &status, 0, &usage);
+  if (!received) {
+    std::cout << "WARNING: measuring " << fileName << " failed" << std::endl;
+    result.ok = false;
+    return result;
+  }
+#ifdef __APPLE__
+  result.peakRssKB = usage.ru_maxrss / 1024;  // bytes on macOS
+#else
+  result.peakRssKB = usage.ru_maxrss;
+#endif
+  return result;
+#endif
+}
+
+string jsonString(const string& value) {
+  string out = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\') out += '\\';
+    out += c;
+  }
+  return out + "\"";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int repeats = 3;
+  vector<long long> gridFaces = {10000, 100000, 1000000, 10000000};
+  string dataDir = "mesh-bench-data";
+  string output = "mesh-bench.json";
+  string modelDir = "../models";
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "-n" && i + 1 < argc) {
+      repeats = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--faces" && i + 1 < argc) {
+      gridFaces.clear();
+      for (char* s = argv[++i]; *s; ) {
+        char* end;
+        long long faces = strtoll(s, &end, 10);
+        if (end == s) break;
+        if (faces > 0) gridFaces.push_back(faces);
+        s = *end == ',' ? end + 1 : end;
+      }
+    } else if (arg == "--data" && i + 1 < argc) {
+      dataDir = argv[++i];
+    } else if (arg == "-o" && i + 1 < argc) {
+      output = argv[++i];
+    } else if (arg[0] == '-') {
+      std::cout << "usage: mesh-bench [-n repeats] [--faces N,N,...] "
+          "[--data dir] [-o file.json] [models dir]" << std::endl;
+      return 1;
+    } else {
+      modelDir = arg;
+    }
+  }
+
+  vector<string> files;
+  vector<string> models = GetFilenamesInDir(modelDir, "ply");
+  std::sort(models.begin(), models.end());
+  for (const string& model : models) files.push_back(modelDir + "/" + model);
+  if (!gridFaces.empty()) {
+#ifdef _WIN32
+    _mkdir(dataDir.c_str());
+#else
+    mkdir(dataDir.c_str(), 0755);
+#endif
+    for (long long faces : gridFaces) {
+      std::cout << "generating a grid of " << faces << " faces" << std::endl;
+      string fileName = writeGrid(dataDir, faces);
+      if (!fileName.empty()) files.push_back(fileName);
+    }
+  }
+
+  FILE* json = fopen(output.c_str(), "w");
+  if (!json) {
+    std::cout << "WARNING: cannot write " << output << std::endl;
+    return 1;
+  }
+  fprintf(json, "{\n  \"benchmark\": \"mesh-bench\",\n");
+  fprintf(json, "  \"repeats\": %d,\n  \"results\": [", repeats);
+
+  printf("  %-32s %-10s %9s %9s %10s %10s %10s\n", "file", "mode", "MB/s",
+      "Mverts/s", "ms", "peak MB", "allocs");
+  bool first = true;
+  for (const string& fileName : files) {
+    long long bytes = fileSize(fileName);
+    for (const LoaderMode& mode : kModes) {
+      Result r = measureIsolated(fileName, mode, repeats);
+      double seconds = std::max(r.medianSeconds, 1e-9);
+      string name = fileName.substr(fileName.find_last_of("/\\") + 1);
+      printf("  %-32s %-10s %9.1f %9.2f %10.2f %10.1f %10lld%s\n",
+          name.c_str(), mode.name, bytes / seconds / 1e6,
+          r.vertices / seconds / 1e6, seconds * 1000,
+          r.peakRssKB / 1024.0, r.allocations, r.ok ? "" : "  FAILED");
+
+      fprintf(json, "%s\n    {\"file\": %s, \"mode\": \"%s\", \"ok\": %s, "
+          "\"bytes\": %lld, \"vertices\": %d, \"faces\": %d, "
+          "\"seconds_min\": %.6f, \"seconds_median\": %.6f, "
+          "\"mb_per_s\": %.3f, \"vertices_per_s\": %.0f, "
+          "\"faces_per_s\": %.0f, \"peak_rss_kb\": ",
+          first ? "" : ",", jsonString(fileName).c_str(), mode.name,
+          r.ok ? "true" : "false", bytes, r.vertices, r.faces,
+          r.minSeconds, r.medianSeconds, bytes / seconds / 1e6,
+          r.vertices / seconds, r.faces / seconds);
+      if (r.peakRssKB >= 0) fprintf(json, "%ld", r.peakRssKB);
+      else fprintf(json, "null");
+      fprintf(json, ", \"allocations\": %lld, \"allocated_bytes\": %lld}",
+          r.allocations, r.allocatedBytes);
+      first = false;
+    }
+  }
+  fprintf(json, "\n  ]\n}\n");
+  fclose(json);
+  std::cout << "saved " << output << std::endl;
+  return 0;
+}
@@ -0,0 +1,576 @@
+//--------------------------------------------------
+// Description: Renders thumbnails of every model in a directory from
+// several orbit angles, plus contact sheets with one row per model.
+// Models are rendered by worker processes, each with its own headless
+// window, which take the next model from a shared counter. Models whose
+// file, shader and settings are unchanged since the last run are skipped.
+//
+// Usage: mesh-thumbs [-j workers] [-n angles] [--shader name] [--size N]
+//                    [--cell N] [--rows N] [-o dir] [--force] [models dir]
+// Without a directory, the models in ../models are rendered into thumbs/.
+//--------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#include "agl/image.h"
+#include "agl/imagecodec.h"
+#include "agl/resources.h"
+#include "agl/threadpool.h"
+#include "agl/window.h"
+#include "plymesh.h"
+#include "osutils.h"
+
+using namespace agl;
+using namespace glm;
+using std::string;
+using std::vector;
+
+namespace {
+
+// mirror the std140 blocks in the shaders (see mesh-viewer.cpp)
+struct LightBlock {
+  vec4 pos;
+  vec3 intensity;
+  float pad;
+};
+
+struct SpotBlock {
+  vec4 pos;
+  vec3 intensity;
+  float pad0;
+  vec3 dir;
+  float exp;
+  float innerCutOff;
+  float outerCutOff;
+  float pad1[2];
+};
+
+struct FogBlock {
+  float maxDist;
+  float minDist;
+  float pad0[2];
+  vec3 color;
+  float pad1;
+};
+
+struct FrameBlock {
+  mat4 view;
+  mat4 projection;
+  LightBlock light;
+  SpotBlock spot;
+  FogBlock fog;
+};
+
+struct MaterialBlock {
+  vec3 Ka;
+  float pad0;
+  vec3 Kd;
+  float pad1;
+  vec3 Ks;
+  float alpha;
+  vec3 outlineColor;
+  float pad2;
+};
+
+static_assert(sizeof(FrameBlock) == 256, "FrameBlock must match std140");
+static_assert(sizeof(MaterialBlock) == 64, "MaterialBlock must match std140");
+
+const int kFrameBinding = 0;
+const int kMaterialBinding = 1;
+
+struct Options {
+  int numWorkers = 0;
+  int numAngles = 8;
+  int size = 256;
+  int cell = 0;  // contact sheet cell size, 0 for min(size, 128)
+  int rows = 32;  // models per contact sheet
+  float elevation = 0.35f;  // radians above the equator
+  string shader = "phong-pixel";
+  string modelDir = "../models";
+  string outDir = "thumbs";
+  bool force = false;
+};
+
+// Shared by the workers: the next model to render and each model's result
+struct WorkQueue {
+  std::atomic<int> next;
+  std::atomic<int> done;
+  std::atomic<int> failed;
+  int total;
+  unsigned char status[1];  // [total]: 0 pending, 1 rendered, 2 failed
+};
+
+string thumbnailName(const Options& options, const string& model, int angle) {
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), "_%02d.png", angle);
+  return options.outDir + "/" + PruneName(model) + suffix;
+}
+
+string keyName(const Options& options, const string& model) {
+  return options.outDir + "/" + PruneName(model) + ".key";
+}
+
+bool readFile(const string& fileName, string* contents) {
+  FILE* file = fopen(fileName.c_str(), "rb");
+  if (!file) return false;
+  contents->clear();
+  char buffer[1 << 16];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    contents->append(buffer, n);
+  }
+  fclose(file);
+  return true;
+}
+
+bool fileExists(const string& fileName) {
+  struct stat info;
+  return stat(fileName.c_str(), &info) == 0;
+}
+
+// The cache key of a model's thumbnails: a 64-bit FNV-1a hash of the model
+// file, the shader sources and every setting that changes the pixels
+string cacheKey(const Options& options, const string& model) {
+  uint64_t hash = 14695981039346656037ull;
+  auto addBytes = [&hash](const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++) {
+      hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+  };
+  auto addString = [&addBytes](const string& str) {
+    addBytes(str.c_str(), str.size() + 1);
+  };
+
+  string contents;
+  if (!readFile(options.modelDir + "/" + model, &contents)) return "";
+  addString(contents);
+  for (const char* ext : {".vs", ".fs"}) {
+    string source;
+    readResource("../shaders/" + options.shader + ext, &source);
+    addString(source);
+  }
+  char settings[128];
+  snprintf(settings, sizeof(settings), "%s %d %d %.4f",
+      options.shader.c_str(), options.numAngles, options.size,
+      options.elevation);
+  addString(settings);
+
+  char key[32];
+  snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash));
+  return key;
+}
+
+// True if the thumbnails on disk were rendered from the same key
+bool upToDate(const Options& options, const string& model, const string& key) {
+  string saved;
+  if (key.empty() || !readFile(keyName(options, model), &saved)) return false;
+  if (saved.compare(0, key.size(), key) != 0) return false;
+  for (int i = 0; i < options.numAngles; i++) {
+    if (!fileExists(thumbnailName(options, model, i))) return false;
+  }
+  return true;
+}
+
+// A headless window that renders one orbit angle per frame and takes
+// models from the queue until it is empty
+class ThumbnailRenderer : public Window {
+ public:
+  ThumbnailRenderer(const Options& options, const vector<string>& models,
+      WorkQueue* queue) :
+    Window(true),
+    _options(options),
+    _models(models),
+    _queue(queue),
+    _current(-1),
+    _saving(-1),
+    _angle(0) {
+  }
+
+  void setup() {
+    setWindowSize(_options.size, _options.size);
+    background(vec3(0.15f));
+
+    renderer.uniformBlockBinding("FrameBlock", kFrameBinding);
+    renderer.uniformBlockBinding("MaterialBlock", kMaterialBinding);
+    string path = "../shaders/" + _options.shader;
+    renderer.loadShader(_options.shader, path + ".vs", path + ".fs");
+    renderer.loadTexture("default-white", "../textures/default-white.png", 0);
+    renderer.loadUniformBuffer("frame", kFrameBinding, sizeof(FrameBlock));
+
+    // the same materials as mesh-viewer
+    MaterialBlock material = {};
+    if (_options.shader == "toon") {
+      material.Ka = vec3(0.19225f);
+      material.Kd = vec3(0.75f, 0.6332f, 0.11f);
+      material.outlineColor = vec3(1.0f);
+    } else {
+      material.Ka = vec3(0.1f);
+      material.Kd = vec3(0.775f, 0.0f, 0.0f);
+      material.Ks = vec3(0.9f, 0.7f, 0.7f);
+    }
+    material.alpha = 128.0f * 0.25f;
+    renderer.loadUniformBuffer("material", kMaterialBinding,
+        sizeof(material), &material);
+
+    nextModel();
+  }
+
+  void draw() {
+    // the previous model's last angle was read after the last draw()
+    if (_saving >= 0) finishSaving();
+    if (_current < 0) {
+      noLoop();
+      return;
+    }
+
+    // fit the model in a 10 unit box at the origin, as mesh-viewer does
+    vec3 minBounds = _mesh->minBounds();
+    vec3 maxBounds = _mesh->maxBounds();
+    vec3 extent = maxBounds - minBounds;
+    float longest = std::max(std::max(extent.x, extent.y), extent.z);
+    float scale = longest > 0.000001f ? 10.0f / longest : 1.0f;
+
+    float azimuth = 2.0f * M_PI * _angle / _options.numAngles;
+    float radius = 14.0f;
+    vec3 eye = radius * vec3(sin(azimuth) * cos(_options.elevation),
+        sin(_options.elevation), cos(azimuth) * cos(_options.elevation));
+    renderer.perspective(radians(60.0f), 1.0f, 0.1f, 100.0f);
+    renderer.lookAt(eye, vec3(0), vec3(0, 1, 0));
+
+    // a light above and behind the camera
+    FrameBlock frame = {};
+    frame.view = renderer.viewMatrix();
+    frame.projection = renderer.projectionMatrix();
+    frame.light.pos = renderer.viewMatrix() * vec4(eye * 1.5f +
+        vec3(0, 8, 0), 1.0f);
+    frame.light.intensity = vec3(0.9f);
+    frame.spot.pos = frame.light.pos;
+    frame.spot.intensity = frame.light.intensity;
+    frame.spot.dir = renderer.viewMatrix() * vec4(-normalize(eye), 0.0f);
+    frame.spot.exp = 1.0f;
+    frame.spot.innerCutOff = cos(radians(15.0f));
+    frame.spot.outerCutOff = cos(radians(22.5f));
+    frame.fog.maxDist = 60.0f;
+    frame.fog.minDist = 30.0f;
+    frame.fog.color = vec3(0.1f);
+    renderer.updateUniformBuffer("frame", &frame, sizeof(frame));
+    renderer.uniformBuffer("frame");
+
+    renderer.push();
+      renderer.scale(vec3(scale));
+      renderer.translate(-(minBounds + maxBounds) * 0.5f);
+      renderer.beginShader(_options.shader);
+        renderer.uniformBuffer("material");
+        renderer.texture("diffuseTexture", "default-white");
+        renderer.mesh(*_mesh);
+      renderer.endShader();
+    renderer.pop();
+
+    // read back while the next angle is drawn, encoded on other threads
+    screenshotAsync(thumbnailName(_options, _models[_current], _angle));
+
+    if (++_angle == _options.numAngles) {
+      _saving = _current;
+      nextModel();
+    }
+  }
+
+ private:
+  // Take models until one loads
+  void nextModel() {
+    _current = -1;
+    _angle = 0;
+    int index;
+    while ((index = _queue->next++) < _queue->total) {
+      _mesh.reset(new PLYMesh());  // frees the last model's buffers
+      if (_mesh->load(_options.modelDir + "/" + _models[index]) &&
+          _mesh->numTriangles() > 0) {
+        _current = index;
+        return;
+      }
+      std::cout << "WARNING: cannot load " << _models[index] << std::endl;
+      _queue->status[index] = 2;
+      _queue->failed++;
+      finishModel();
+    }
+  }
+
+  // A model is rendered once all of its thumbnails are written; otherwise
+  // it fails, so that its key is not saved and the next run redoes it
+  void finishSaving() {
+    if (finishScreenshots()) {
+      _queue->status[_saving] = 1;
+    } else {
+      _queue->status[_saving] = 2;
+      _queue->failed++;
+    }
+    _saving = -1;
+    finishModel();
+  }
+
+  void finishModel() {
+    int done = ++_queue->done;
+    if (done % 16 == 0 || done == _queue->total) {
+      printf("%d/%d models\n", done, _queue->total);
+      fflush(stdout);
+    }
+  }
+
+  const Options& _options;
+  const vector<string>& _models;
+  WorkQueue* _queue;
+  std::unique_ptr<PLYMesh> _mesh;
+  int _current;  // index of the model being rendered, or -1 when done
+  int _saving;   // index of the model whose thumbnails are being written
+  int _angle;
+};
+
+// Render the queued models in this process; returns false if the window
+// cannot be created
+bool renderThumbnails(const Options& options, const vector<string>& models,
+    WorkQueue* queue) {
+  ThumbnailRenderer renderer(options, models, queue);
+  if (!renderer.isHeadless()) return false;
+  renderer.run();
+  return true;
+}
+
+// Start workers that share the queue and wait for all of them
+void runWorkers(const Options& options, const vector<string>& models,
+    WorkQueue* queue, int numWorkers) {
+#ifdef _WIN32
+  // no fork(): render in this process
+  renderThumbnails(options, models, queue);
+#else
+  // every worker rasterizes on one core; with llvmpipe each context would
+  // otherwise start a thread per core
+  setenv("LP_NUM_THREADS", "1", 0);
+
+  fflush(stdout);
+  vector<pid_t> workers;
+  for (int i = 0; i < numWorkers; i++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      bool ok = renderThumbnails(options, models, queue);
+      fflush(stdout);
+      _exit(ok ? 0 : 1);  // skip the parent's exit handlers
+    }
+    if (pid < 0) {
+      std::cout << "WARNING: cannot start worker " << i << std::endl;
+      break;
+    }
+    workers.push_back(pid);
+  }
+  if (workers.empty()) renderThumbnails(options, models, queue);
+
+  for (pid_t pid : workers) {
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      std::cout << "WARNING: worker " << pid << " failed" << std::endl;
+    }
+  }
+#endif
+}
+
+// Write contact sheets of options.rows models each, one cell per angle
+int writeContactSheets(const Options& options, const vector<string>& models,
+    ThreadPool* pool) {
+  int cell = options.cell > 0 ? options.cell : std::min(options.size, 128);
+  int numSheets = 0;
+  for (size_t first = 0; first < models.size(); first += options.rows) {
+    int rows = static_cast<int>(std::min(models.size() - first,
+        static_cast<size_t>(options.rows)));
+    int width = cell * options.numAngles;
+    Image sheet(width, cell * rows);
+    memset(sheet.data(), 0, width * cell * rows * 4);
+
+    // each row is loaded and scaled on its own thread
+    vector<std::future<void>> jobs;
+    for (int row = 0; row < rows; row++) {
+      const string& model = models[first + row];
+      jobs.push_back(pool->run([&options, &sheet, &model, row, cell, width]() {
+        for (int i = 0; i < options.numAngles; i++) {
+          Image thumb;
+          if (!thumb.load(thumbnailName(options, model, i))) continue;
+          if (thumb.width() != cell || thumb.height() != cell) {
+            thumb = thumb.resize(cell, cell);
+          }
+          for (int y = 0; y < cell; y++) {
+            memcpy(sheet.data() + ((row * cell + y) * width + i * cell) * 4,
+                thumb.data() + y * cell * 4, cell * 4);
+          }
+        }
+      }));
+    }
+    for (std::future<void>& job : jobs) job.wait();
+
+    char name[64];
+    snprintf(name, sizeof(name), "/contact-sheet-%03d", numSheets);
+    string base = options.outDir + name;
+    if (!writeImage(base + ".png", sheet, false, pool)) {
+      std::cout << "WARNING: cannot save " << base << ".png" << std::endl;
+    }
+    // which model is in which row
+    FILE* index = fopen((base + ".txt").c_str(), "w");
+    if (index) {
+      for (int row = 0; row < rows; row++) {
+        fprintf(index, "%s\n", models[first + row].c_str());
+      }
+      fclose(index);
+    }
+    numSheets++;
+  }
+  return numSheets;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "-j" && i + 1 < argc) {
+      options.numWorkers = atoi(argv[++i]);
+    } else if (arg == "-n" && i + 1 < argc) {
+      options.numAngles = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--shader" && i + 1 < argc) {
+      options.shader = argv[++i];
+    } else if (arg == "--size" && i + 1 < argc) {
+      options.size = std::max(16, atoi(argv[++i]));
+    } else if (arg == "--cell" && i + 1 < argc) {
+      options.cell = std::max(0, atoi(argv[++i]));
+    } else if (arg == "--rows" && i + 1 < argc) {
+      options.rows = std::max(1, atoi(argv[++i]));
+    } else if (arg == "-o" && i + 1 < argc) {
+      options.outDir = argv[++i];
+    } else if (arg == "--force") {
+      options.force = true;
+    } else if (arg[0] == '-') {
+      std::cout << "usage: mesh-thumbs [-j workers] [-n angles] "
+          "[--shader name] [--size N] [--cell N] [--rows N] [-o dir] "
+          "[--force] [models dir]" << std::endl;
+      return 1;
+    } else {
+      options.modelDir = arg;
+    }
+  }
+  if (options.numWorkers <= 0) {
+    options.numWorkers = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  vector<string> models = GetFilenamesInDir(options.modelDir, "ply");
+  std::sort(models.begin(), models.end());
+#ifdef _WIN32
+  _mkdir(options.outDir.c_str());
+#else
+  mkdir(options.outDir.c_str(), 0755);
+#endif
+
+  // Hash the models on all cores, then queue the stale ones largest first
+  // so that no worker is left with a big model at the end. The pool is
+  // gone before the workers are forked.
+  vector<string> keys(models.size());
+  vector<string> stale;
+  {
+    ThreadPool pool(options.numWorkers);
+    vector<std::future<void>> jobs;
+    for (size_t i = 0; i < models.size(); i++) {
+      jobs.push_back(pool.run([&options, &models, &keys, i]() {
+        keys[i] = cacheKey(options, models[i]);
+      }));
+    }
+    for (std::future<void>& job : jobs) job.wait();
+  }
+  vector<std::pair<long, int>> bySize;
+  for (size_t i = 0; i < models.size(); i++) {
+    if (!options.force && upToDate(options, models[i], keys[i])) continue;
+    struct stat info;
+    long size = stat((options.modelDir + "/" + models[i]).c_str(), &info) == 0 ?
+      static_cast<long>(info.st_size) : 0;
+    bySize.push_back(std::make_pair(-size, static_cast<int>(i)));
+  }
+  std::sort(bySize.begin(), bySize.end());
+  vector<int> staleIndex;
+  for (const std::pair<long, int>& entry : bySize) {
+    stale.push_back(models[entry.second]);
+    staleIndex.push_back(entry.second);
+  }
+  int numStale = static_cast<int>(stale.size());
+  printf("%d models, %d up to date, rendering %d with %d workers\n",
+      static_cast<int>(models.size()),
+      static_cast<int>(models.size()) - numStale, numStale,
+      std::min(options.numWorkers, std::max(1, numStale)));
+
+  int failed = 0;
+  if (!stale.empty()) {
+    size_t queueSize = sizeof(WorkQueue) + stale.size();
+#ifdef _WIN32
+    void* memory = calloc(1, queueSize);
+#else
+    // shared with the forked workers
+    void* memory = mmap(0, queueSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+      std::cout << "WARNING: cannot share memory with workers" << std::endl;
+      return 1;
+    }
+    memset(memory, 0, queueSize);
+#endif
+    WorkQueue* queue = new (memory) WorkQueue();
+    queue->next = 0;
+    queue->done = 0;
+    queue->failed = 0;
+    queue->total = static_cast<int>(stale.size());
+
+    runWorkers(options, stale, queue,
+        std::min(options.numWorkers, queue->total));
+
+    // record the keys of the models that were rendered
+    for (size_t i = 0; i < stale.size(); i++) {
+      if (queue->status[i] != 1) {
+        remove(keyName(options, stale[i]).c_str());  // from an earlier run
+        failed++;
+        continue;
+      }
+      FILE* file = fopen(keyName(options, stale[i]).c_str(), "w");
+      if (file) {
+        fprintf(file, "%s\n", keys[staleIndex[i]].c_str());
+        fclose(file);
+      }
+    }
+    queue->~WorkQueue();
+#ifdef _WIN32
+    free(memory);
+#else
+    munmap(memory, queueSize);
+#endif
+  }
+
+  ThreadPool pool(options.numWorkers);
+  int numSheets = writeContactSheets(options, models, &pool);
+  printf("%d contact sheets in %s/, %d models failed\n", numSheets,
+      options.outDir.c_str(), failed);
+  return failed == 0 ? 0 : 1;
+}
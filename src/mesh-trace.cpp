@@ -0,0 +1,171 @@
+//--------------------------------------------------
+// Description: Ray traces a model in mesh-viewer's scene (the model in a
+// 10 unit box, the red plastic material and the textured walls) on the
+// CPU. The image refines progressively and is saved at every doubling of
+// the samples per pixel, with the speed in millions of rays per second.
+//
+// Usage: mesh-trace [-j threads] [-n samples] [--size WxH] [--bounces N]
+//                   [--azimuth deg] [--elevation deg] [--light x,y,z]
+//                   [-o file] model.ply
+//--------------------------------------------------
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "agl/image.h"
+#include "agl/pathtracer.h"
+#include "plymesh.h"
+
+using namespace agl;
+using namespace glm;
+using std::string;
+using std::vector;
+
+namespace {
+
+const float kWallScale = 60.0f;
+
+// The inside faces of mesh-viewer's six wall cubes, facing the model
+void addWalls(PathTracer* tracer, const PathTracer::Material& material) {
+  float h = kWallScale / 2 - 0.05f;  // the walls are 0.1 thick
+  const vec3 normals[6] = {vec3(0, 1, 0), vec3(0, -1, 0), vec3(-1, 0, 0),
+    vec3(1, 0, 0), vec3(0, 0, -1), vec3(0, 0, 1)};
+  vector<float> positions, wallNormals, texCoords;
+  vector<unsigned int> indices;
+  for (int f = 0; f < 6; f++) {
+    vec3 n = normals[f];
+    vec3 u = std::fabs(n.y) > 0.5f ? vec3(1, 0, 0) : vec3(0, 1, 0);
+    vec3 v = cross(n, u);
+    const vec2 corners[4] = {vec2(-1, -1), vec2(1, -1), vec2(1, 1),
+      vec2(-1, 1)};
+    unsigned int base = static_cast<unsigned int>(positions.size() / 3);
+    for (const vec2& c : corners) {
+      vec3 p = -n * h + (c.x * u + c.y * v) * (kWallScale / 2);
+      positions.insert(positions.end(), {p.x, p.y, p.z});
+      wallNormals.insert(wallNormals.end(), {n.x, n.y, n.z});
+      texCoords.insert(texCoords.end(), {c.x * 0.5f + 0.5f,
+          c.y * 0.5f + 0.5f});
+    }
+    for (unsigned int i : {0u, 1u, 2u, 0u, 2u, 3u}) {
+      indices.push_back(base + i);
+    }
+  }
+  tracer->addMesh(positions, wallNormals, texCoords, indices, mat4(1.0f),
+      material);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int numThreads = 0;
+  int numSamples = 64;
+  int width = 1280, height = 720;
+  int bounces = 2;
+  float azimuth = 0.0f, elevation = 0.0f;
+  vec3 lightPosition(0.0f, 0.0f, -10.0f);  // mesh-viewer's
+  string output = "trace.png";
+  string modelFile;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "-j" && i + 1 < argc) {
+      numThreads = atoi(argv[++i]);
+    } else if (arg == "-n" && i + 1 < argc) {
+      numSamples = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--size" && i + 1 < argc &&
+        sscanf(argv[i + 1], "%dx%d", &width, &height) == 2) {
+      i++;
+    } else if (arg == "--bounces" && i + 1 < argc) {
+      bounces = atoi(argv[++i]);
+    } else if (arg == "--azimuth" && i + 1 < argc) {
+      azimuth = radians(static_cast<float>(atof(argv[++i])));
+    } else if (arg == "--elevation" && i + 1 < argc) {
+      elevation = radians(static_cast<float>(atof(argv[++i])));
+    } else if (arg == "--light" && i + 1 < argc &&
+        sscanf(argv[i + 1], "%f,%f,%f", &lightPosition.x, &lightPosition.y,
+            &lightPosition.z) == 3) {
+      i++;
+    } else if (arg == "-o" && i + 1 < argc) {
+      output = argv[++i];
+    } else if (arg[0] != '-' && modelFile.empty()) {
+      modelFile = arg;
+    } else {
+      modelFile.clear();
+      break;
+    }
+  }
+  if (modelFile.empty()) {
+    std::cout << "usage: mesh-trace [-j threads] [-n samples] [--size WxH] "
+        "[--bounces N] [--azimuth deg] [--elevation deg] [--light x,y,z] "
+        "[-o file] model.ply" << std::endl;
+    return 1;
+  }
+
+  PLYMesh mesh;
+  if (!mesh.load(modelFile)) {
+    std::cout << "WARNING: cannot load " << modelFile << std::endl;
+    return 1;
+  }
+  Image walls;
+  if (!walls.load("../textures/chess-board.png")) {
+    std::cout << "WARNING: cannot load chess-board.png, walls are white\n";
+  }
+
+  PathTracer tracer(numThreads);
+  tracer.resize(width, height);
+  tracer.background(vec3(0.0f));
+  tracer.setBounces(bounces);
+
+  float radius = 10.0f;
+  vec3 eye = radius * vec3(sin(azimuth) * cos(elevation), sin(elevation),
+      cos(azimuth) * cos(elevation));
+  tracer.perspective(radians(60.0f), static_cast<float>(width) / height,
+      0.1f, kWallScale * 1.5f);
+  tracer.lookAt(eye, vec3(0));
+  tracer.setLight(vec4(lightPosition, 1.0f), vec3(0.9f));
+
+  // the model, scaled into a 10 unit box at the origin
+  vec3 minBounds = mesh.minBounds();
+  vec3 maxBounds = mesh.maxBounds();
+  vec3 extent = maxBounds - minBounds;
+  float longest = std::max(std::max(extent.x, extent.y), extent.z);
+  float scale = longest > 0.000001f ? 10.0f / longest : 1.0f;
+  mat4 transform = glm::scale(mat4(1.0f), vec3(scale)) *
+    glm::translate(mat4(1.0f), -(minBounds + maxBounds) * 0.5f);
+  PathTracer::Material redPlastic = {vec3(0.1f), vec3(0.775f, 0.0f, 0.0f),
+    vec3(0.9f, 0.7f, 0.7f), 32.0f, 0};
+  tracer.addMesh(mesh.positions(), mesh.normals(), mesh.texCoords(),
+      mesh.indices(), transform, redPlastic);
+  PathTracer::Material wallMaterial = {vec3(0.1f), vec3(0.5f), vec3(0.9f),
+    32.0f, &walls};
+  addWalls(&tracer, wallMaterial);
+
+  printf("%s, %d triangles, %dx%d, %d bounces, %d threads\n",
+      modelFile.c_str(), mesh.numTriangles(), width, height, bounces,
+      tracer.numThreads());
+  printf("  %8s %10s %12s %10s\n", "samples", "seconds", "rays", "Mrays/s");
+
+  // the first pass also builds the BVH; saving is not timed
+  double seconds = 0;
+  int nextReport = 1;
+  for (int sample = 1; sample <= numSamples; sample++) {
+    auto start = std::chrono::steady_clock::now();
+    tracer.renderPass();
+    seconds += std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    if (sample == nextReport || sample == numSamples) {
+      printf("  %8d %10.2f %12lld %10.2f\n", sample, seconds,
+          static_cast<long long>(tracer.rays()),
+          tracer.rays() / seconds / 1e6);
+      tracer.image().save(output);
+      nextReport *= 2;
+    }
+  }
+  printf("  %d BVH nodes\n", tracer.bvh().numNodes());
+  std::cout << "saved " << output << std::endl;
+  return 0;
+}
@@ -8,6 +8,8 @@
 // Change the shader by pressing 's'
 // Change the texture by pressing 't'
 // Make the light move/stop by pressing 'm'
+// Benchmark with recorded input: mesh-viewer --record input.txt, then
+// mesh-viewer --replay input.txt --benchmark viewer.json
 // References: https://learnopengl.com/Lighting/Materials    
 // http://devernay.free.fr/cours/opengl/materials.html    (different materials)
 // https://learnopengl.com/Lighting/Light-casters (spotlight)
@@ -19,7 +21,9 @@
 // PINK MARBLE: https://i.pinimg.com/736x/c0/de/97/c0de974be4d6051e8c4efc2e4eb3d896.jpg
 // CHESS BOARD: https://static.vecteezy.com/system/resources/thumbnails/004/249/098/small/abstract-background-black-and-white-chessboard-pattern-optical-illusion-texture-for-your-design-free-vector.jpg
 
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
 #include <string>
 #include <vector>
 #include "agl/window.h"
@@ -30,6 +34,60 @@ using namespace std;
 using namespace glm;
 using namespace agl;
 
+// these mirror the std140 uniform blocks declared in the shaders, so the
+// padding fields keep every member at the offset the shader expects
+struct LightBlock {
+  vec4 pos; // position of light in eye coordinates
+  vec3 intensity;
+  float pad;
+};
+
+struct SpotBlock {
+  vec4 pos;
+  vec3 intensity;
+  float pad0;
+  vec3 dir;
+  float exp;
+  float innerCutOff;
+  float outerCutOff;
+  float pad1[2];
+};
+
+struct FogBlock {
+  float maxDist;
+  float minDist;
+  float pad0[2];
+  vec3 color;
+  float pad1;
+};
+
+// per frame state, uploaded once per frame to binding 0
+struct FrameBlock {
+  mat4 view;
+  mat4 projection;
+  LightBlock light;
+  SpotBlock spot;
+  FogBlock fog;
+};
+
+// per material state, one buffer for each material at binding 1
+struct MaterialBlock {
+  vec3 Ka;
+  float pad0;
+  vec3 Kd;
+  float pad1;
+  vec3 Ks;
+  float alpha;
+  vec3 outlineColor;
+  float pad2;
+};
+
+static_assert(sizeof(FrameBlock) == 256, "FrameBlock must match std140");
+static_assert(sizeof(MaterialBlock) == 64, "MaterialBlock must match std140");
+
+static const int kFrameBinding= 0;
+static const int kMaterialBinding= 1;
+
 class MeshViewer : public Window {
 public:
   MeshViewer() : Window() {
@@ -43,10 +101,15 @@ public:
     shaders.push_back("toon");
     shaders.push_back("fog");
     numShaders= shaders.size();
+
+    // the light, fog and material state lives in uniform buffers
+    renderer.uniformBlockBinding("FrameBlock", kFrameBinding);
+    renderer.uniformBlockBinding("MaterialBlock", kMaterialBinding);
     
+    // compiled in the background; drawing falls back to unlit until ready
     for (string shaderName: shaders) {
       string path= "../shaders/" + shaderName;
-      renderer.loadShader(shaderName, path + ".vs", path + ".fs");
+      renderer.loadShaderAsync(shaderName, path + ".vs", path + ".fs");
     }
 
     // this is for rendering objects with a specified color (not part of the main)
@@ -57,18 +120,47 @@ public:
     textures.push_back("pink-marble");
     numTextures= textures.size();
 
+    // decoded in parallel; each texture is created the first time it is used
     for (string textureName: textures) {
-      renderer.loadTexture(textureName, "../textures/" + textureName + ".png", 0);
+      renderer.loadTextureAsync(textureName, "../textures/" + textureName + ".png", 0);
     }
 
 
     models= GetFilenamesInDir("../models", "ply");
+    // same order on every machine, so replayed 'n' and 'p' keys pick the same models
+    std::sort(models.begin(), models.end());
     mesh.load("../models/" + models[curModel]);
     numModels= models.size();
 
     // change the light positions here
     this->lightPosition= vec4(0.0f, 0.0f, -10.0f, 1.0f); 
     this->lightIntensity= vec3(0.9f);
+
+    renderer.loadUniformBuffer("frame", kFrameBinding, sizeof(FrameBlock));
+    renderer.uniformBuffer("frame");
+
+    // default material color is red plastic
+    float shininess= 128.0f * 0.25f;
+    loadMaterial("red-plastic", vec3(0.1f), vec3(0.775f, 0.0f, 0.0f),
+      vec3(0.9f, 0.7f, 0.7f), shininess);
+
+    // green material for the toon shader, the outline is white
+    loadMaterial("toon", vec3(0.19225f), vec3(0.75, 0.6332, 0.11),
+      vec3(0.0f), shininess, vec3(1.0f));
+
+    // gray material for the walls
+    loadMaterial("walls", vec3(0.1f), vec3(0.5f), vec3(0.9f), shininess);
+  }
+
+  void loadMaterial(const string& name, vec3 Ka, vec3 Kd, vec3 Ks,
+    float alpha, vec3 outlineColor= vec3(0.0f)) {
+    MaterialBlock material= {};
+    material.Ka= Ka;
+    material.Kd= Kd;
+    material.Ks= Ks;
+    material.alpha= alpha;
+    material.outlineColor= outlineColor;
+    renderer.loadUniformBuffer(name, kMaterialBinding, sizeof(material), &material);
   }
 
   void mouseMotion(int x, int y, int dx, int dy) {
@@ -123,6 +215,22 @@ public:
       std::cout << "changed texture to: " << textures[curTexture] << std::endl;
     } else if (key == GLFW_KEY_M) {
       moveLight= !moveLight;
+    } else if (key == GLFW_KEY_H) {
+      showHud= !showHud;
+    } else if (key == GLFW_KEY_C && turntableFrame < 0) {
+      // one full orbit, a fixed step per frame so playback is smooth
+      if (startRecording("turntable%03d.png")) {
+        turntableFrame= 0;
+        turntableStart= azimuth;
+        std::cout << "recording turntable" << std::endl;
+      }
+    } else if (key == GLFW_KEY_V && turntableFrame < 0) {
+      if (isRecording()) {
+        stopRecording();
+        std::cout << "saved mesh-viewer.y4m" << std::endl;
+      } else if (startRecording("mesh-viewer.y4m")) {
+        std::cout << "recording mesh-viewer.y4m" << std::endl;
+      }
     }
   }
 
@@ -136,94 +244,44 @@ public:
 
   }
 
-  // this method sets the uniform variables for the shaders
-  // default material color is red plastic
-  void initShaderVars(string shaderType,
-    vec3 Ka= vec3(0.1f), 
-    vec3 Kd= vec3(0.775f, 0.0f, 0.0f),
-    vec3 Ks= vec3(0.9f, 0.7f, 0.7f)) {
-
-    float shininess= 128.0f * 0.25f;
-
-    // this is phong shader
-    if (shaderType == "phong-vertex" || shaderType == "phong-pixel") {
-
-      // to get desired light position in eye coordinates (so the MV * lightPos)
-      // undoes it
-      vec4 lightPos_eye= renderer.viewMatrix() * this->lightPosition;
-      
-      renderer.setUniform("Light.intensity", lightIntensity);
-      renderer.setUniform("Light.pos", lightPos_eye);
-      
-      renderer.setUniform("Material.Ka", Ka);
-      renderer.setUniform("Material.Kd", Kd);
-      renderer.setUniform("Material.Ks", Ks);
-      renderer.setUniform("Material.alpha", shininess);
-    } else if (shaderType == "spotlight") { // spotlight shader
-
-      // these positions and direction indicate the spotlight
-      // is right at the camera and the direction is forward
-      //vec4 lightPos_eye= vec4(0.0, 0.0, 0.0, 1.0f);
-      //vec3 lightDir= normalize(vec3(0, 0, -1));
-
-      // spotlight position and direction
-      vec4 lightPos_eye= renderer.viewMatrix() * this->lightPosition;
-      vec3 lightDir= renderer.viewMatrix() * vec4(normalize(vec3(0) - 
-        vec3(this->lightPosition)), 0.0f);
-
-      float lightExp= 1.0f;
-      float innerCutOff= cos(radians(15.0f));
-      float outerCutOff= cos(radians(22.5f));
-
-      renderer.setUniform("Spot.pos", lightPos_eye);
-      renderer.setUniform("Spot.intensity", lightIntensity);
-      renderer.setUniform("Spot.dir", lightDir);
-      renderer.setUniform("Spot.exp", lightExp);
-      renderer.setUniform("Spot.innerCutOff", innerCutOff);
-      renderer.setUniform("Spot.outerCutOff", outerCutOff);
-      
-      renderer.setUniform("Material.Ka", Ka);
-      renderer.setUniform("Material.Kd", Kd);
-      renderer.setUniform("Material.Ks", Ks);
-      renderer.setUniform("Material.alpha", shininess);
-    } else if (shaderType == "toon") { // toon shader
-
-      // to get desired light position in eye coordinates (so the MV * lightPos)
-      // undoes it
-      vec4 lightPos_eye= renderer.viewMatrix() * this->lightPosition;
-     
-      renderer.setUniform("Light.pos", lightPos_eye);
-      renderer.setUniform("Light.intensity", lightIntensity);
-
-      // green material 
-      vec3 Ka= vec3(0.19225f); // reflect ambiance
-      vec3 Kd= vec3(0.75, 0.6332, 0.11); // reflect diffusion
-      vec3 outlineColor= vec3(1.0f);
-
-      renderer.setUniform("Material.Ka", Ka);
-      renderer.setUniform("Material.Kd", Kd);
-      renderer.setUniform("Material.outlineColor", outlineColor);
-    } else if (shaderType == "fog") { // fog
-      // to get desired light position in eye coordinates (so the MV * lightPos)
-      // undoes it
-      vec4 lightPos_eye= renderer.viewMatrix() * this->lightPosition;
-      
-      renderer.setUniform("Light.intensity", lightIntensity);
-      renderer.setUniform("Light.pos", lightPos_eye);
-      
-      renderer.setUniform("Material.Ka", Ka);
-      renderer.setUniform("Material.Kd", Kd);
-      renderer.setUniform("Material.Ks", Ks);
-      renderer.setUniform("Material.alpha", shininess);
-
-      renderer.setUniform("Fog.maxDist", wallScale * 0.90f);
-      renderer.setUniform("Fog.minDist", wallScale/2);
-      // this is gray fog
-      vec3 c= vec3(0xab/255.0f, 0xae/255.0f, 0xb0/255.0f);
-      // but I like the black fog better
-      c= vec3(0.1f);
-      renderer.setUniform("Fog.color", c);
-    }
+  // this method writes the per frame uniform block (camera, lights and fog)
+  // it is called once per frame after the camera is set
+  void updateFrameBlock() {
+    FrameBlock frame= {};
+    frame.view= renderer.viewMatrix();
+    frame.projection= renderer.projectionMatrix();
+
+    // to get desired light position in eye coordinates (so the MV * lightPos)
+    // undoes it
+    vec4 lightPos_eye= renderer.viewMatrix() * this->lightPosition;
+    frame.light.pos= lightPos_eye;
+    frame.light.intensity= lightIntensity;
+
+    // these positions and direction indicate the spotlight
+    // is right at the camera and the direction is forward
+    //vec4 lightPos_eye= vec4(0.0, 0.0, 0.0, 1.0f);
+    //vec3 lightDir= normalize(vec3(0, 0, -1));
+
+    // spotlight position and direction
+    vec3 lightDir= renderer.viewMatrix() * vec4(normalize(vec3(0) - 
+      vec3(this->lightPosition)), 0.0f);
+
+    frame.spot.pos= lightPos_eye;
+    frame.spot.intensity= lightIntensity;
+    frame.spot.dir= lightDir;
+    frame.spot.exp= 1.0f;
+    frame.spot.innerCutOff= cos(radians(15.0f));
+    frame.spot.outerCutOff= cos(radians(22.5f));
+
+    frame.fog.maxDist= wallScale * 0.90f;
+    frame.fog.minDist= wallScale/2;
+    // this is gray fog
+    vec3 c= vec3(0xab/255.0f, 0xae/255.0f, 0xb0/255.0f);
+    // but I like the black fog better
+    c= vec3(0.1f);
+    frame.fog.color= c;
+
+    renderer.updateUniformBuffer("frame", &frame, sizeof(frame));
   }
 
   void draw() {
@@ -233,6 +291,16 @@ public:
     // this is to set the camera
     renderer.perspective(glm::radians(60.0f), aspect, 0.1f, wallScale*1.5f);
 
+    if (turntableFrame == numTurntableFrames) {
+      stopRecording();
+      std::cout << "saved " << numTurntableFrames << " turntable frames" << std::endl;
+      turntableFrame= -1;
+      azimuth= turntableStart;
+    } else if (turntableFrame >= 0) {
+      azimuth= turntableStart + 2 * M_PI * turntableFrame / numTurntableFrames;
+      turntableFrame++;
+    }
+
     // getting the camera pos
     eyePos.x= radius * sin(azimuth) * cos(elevation);
     eyePos.y= radius * sin(elevation);
@@ -244,6 +312,11 @@ public:
 
     renderer.lookAt(eyePos, lookPos, camY);
 
+    if (moveLight) {
+      changeLightPos();
+    }
+    updateFrameBlock();
+
     // get the bounding box
     vec3 maxBounds= mesh.maxBounds();
     vec3 minBounds= mesh.minBounds();
@@ -268,22 +341,21 @@ public:
     vec3 midPoint= (maxBounds + minBounds) * 0.5f;
     midPoint= -midPoint;
 
+    renderer.beginProfile("model");
     renderer.push();
       renderer.rotate(vec3(0,0,0));
       renderer.scale(scale);
       renderer.translate(midPoint);
 
       renderer.beginShader(shaders[curShader]);
-        initShaderVars(shaders[curShader]);
+        renderer.uniformBuffer(shaders[curShader] == "toon" ? "toon" : "red-plastic");
         renderer.texture("diffuseTexture", textures[curTexture]);
         renderer.mesh(mesh);
       renderer.endShader();
     renderer.pop();
+    renderer.endProfile();
 
-    if (moveLight) {
-      changeLightPos();
-    }
-
+    renderer.beginProfile("light cube");
     renderer.push();
       renderer.translate(this->lightPosition);
       renderer.scale(vec3(1.75f));
@@ -292,11 +364,12 @@ public:
         renderer.cube();
       renderer.endShader();
     renderer.pop();
-    
+    renderer.endProfile();
 
+    renderer.beginProfile("walls");
     renderer.beginShader("fog");
       renderer.texture("diffuseTexture", "chess-board");
-      initShaderVars("fog", vec3(0.1f), vec3(0.5f), vec3(0.9f));
+      renderer.uniformBuffer("walls");
 
 
       vec3 floorCoords= vec3(0, -wallScale/2, 0);
@@ -344,8 +417,15 @@ public:
         renderer.cube();
       renderer.pop();
     renderer.endShader();
-
-
+    renderer.endProfile();
+
+    // frame and pass times, toggled with 'h'
+    if (showHud) {
+      renderer.beginProfile("text");
+      renderer.fontSize(16);
+      renderer.profileHud(10, 10);
+      renderer.endProfile();
+    }
   }
 
 protected:
@@ -385,12 +465,39 @@ protected:
   float radius= 10.0f;
   float elevation= 0;
   float azimuth= 0;
+
+  bool showHud= false; // frame and pass times ('h')
+
+  // turntable capture ('c'), -1 when not recording
+  int turntableFrame= -1;
+  int numTurntableFrames= 120;
+  float turntableStart= 0;
 };
 
 int main(int argc, char** argv)
 {
   MeshViewer viewer;
+  string report;
+  int frames= 0;
+  for (int i= 1; i < argc; i++) {
+    string arg= argv[i];
+    if (arg == "--record" && i + 1 < argc) {
+      viewer.recordInput(argv[++i]);
+    } else if (arg == "--replay" && i + 1 < argc) {
+      if (!viewer.replayInput(argv[++i])) return 1;
+    } else if (arg == "--benchmark" && i + 1 < argc) {
+      report= argv[++i];
+    } else if (arg == "--frames" && i + 1 < argc) {
+      frames= atoi(argv[++i]);
+    } else {
+      cout << "usage: mesh-viewer [--record input.txt] [--replay input.txt] "
+        "[--benchmark report.json] [--frames N]" << endl;
+      return 1;
+    }
+  }
+  if (!report.empty()) viewer.benchmark(report, frames);
   viewer.run();
+  printf("time to first frame: %.3f s\n", viewer.timeToFirstFrame());
   return 0;
 }
 
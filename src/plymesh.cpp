@@ -8,6 +8,8 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include "agl/memorytracker.h"
+#include "agl/trace.h"
 
 using namespace std;
 using namespace glm;
@@ -31,6 +33,7 @@ namespace agl {
   }
 
   PLYMesh::~PLYMesh() {
+    MemoryTracker::release(&_positions);
   }
 
 
@@ -53,6 +56,7 @@ namespace agl {
   }
 
   bool PLYMesh::load(const std::string& filename) {
+    TraceZone zone("PLYMesh::load", filename);
     if (_positions.size() != 0) {
       std::cout << "WARNING: Cannot load different files with the same PLY mesh\n";
       return false;
@@ -226,6 +230,13 @@ namespace agl {
       }
       file.close();
     }
+
+    // the arrays stay in memory after they are uploaded; the buffers are
+    // reported under the same name
+    setName(filename);
+    size_t bytes= (_positions.capacity() + _normals.capacity() +
+      _texCoords.capacity()) * sizeof(GLfloat) + _faces.capacity() * sizeof(GLuint);
+    MemoryTracker::track(&_positions, MemoryTracker::CPU_MESH, filename, bytes);
     return true;
   }
 
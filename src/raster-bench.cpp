@@ -0,0 +1,242 @@
+//--------------------------------------------------
+// Description: Frames per second of the software renderer on the models in
+// a directory. Each model is drawn as mesh-viewer draws it (the model, the
+// light cube and the fogged walls) while the camera orbits. A check first
+// draws rectangles that start partway into the last 8x8 block of a tile.
+//
+// Usage: raster-bench [-j threads] [-n frames] [--size WxH]
+//                     [--shader name] [--save dir] [models dir]
+// Without a directory, every model in ../models is drawn at 1280x720.
+//--------------------------------------------------
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "agl/image.h"
+#include "agl/softwarerenderer.h"
+#include "plymesh.h"
+#include "osutils.h"
+
+using namespace agl;
+using namespace glm;
+using std::string;
+using std::vector;
+
+namespace {
+
+const float kWallScale = 60.0f;
+
+// The scene of mesh-viewer's draw(), at the given orbit angle
+void drawScene(SoftwareRenderer* renderer, const PLYMesh& mesh,
+    const string& shader, const Image& walls, float azimuth) {
+  float radius = 10.0f;
+  vec3 eye = radius * vec3(sin(azimuth), 0.0f, cos(azimuth));
+  renderer->perspective(radians(60.0f),
+      static_cast<float>(renderer->width()) / renderer->height(),
+      0.1f, kWallScale * 1.5f);
+  renderer->lookAt(eye, vec3(0), vec3(0, 1, 0));
+
+  vec4 lightPosition(0.0f, 0.0f, -10.0f, 1.0f);
+  vec3 lightIntensity(0.9f);
+  vec4 lightEye = renderer->viewMatrix() * lightPosition;
+  renderer->setLight(lightEye, lightIntensity);
+  renderer->setSpotlight(lightEye, lightIntensity,
+      vec3(renderer->viewMatrix() * vec4(normalize(-vec3(lightPosition)), 0)),
+      1.0f, cos(radians(15.0f)), cos(radians(22.5f)));
+  renderer->setFog(kWallScale / 2, kWallScale * 0.9f, vec3(0.1f));
+
+  // the model, scaled into a 10 unit box at the origin
+  vec3 minBounds = mesh.minBounds();
+  vec3 maxBounds = mesh.maxBounds();
+  vec3 extent = maxBounds - minBounds;
+  float longest = std::max(std::max(extent.x, extent.y), extent.z);
+  float scale = longest > 0.000001f ? 10.0f / longest : 1.0f;
+  renderer->push();
+    renderer->scale(vec3(scale));
+    renderer->translate(-(minBounds + maxBounds) * 0.5f);
+    renderer->beginShader(shader);
+      if (shader == "toon") {
+        renderer->setMaterial(vec3(0.19225f), vec3(0.75f, 0.6332f, 0.11f),
+            vec3(0.0f), 32.0f);
+      } else {
+        renderer->setMaterial(vec3(0.1f), vec3(0.775f, 0.0f, 0.0f),
+            vec3(0.9f, 0.7f, 0.7f), 32.0f);
+      }
+      renderer->texture(0);
+      renderer->mesh(mesh.positions(), mesh.normals(), mesh.texCoords(),
+          mesh.indices());
+    renderer->endShader();
+  renderer->pop();
+
+  renderer->push();
+    renderer->translate(vec3(lightPosition));
+    renderer->scale(vec3(1.75f));
+    renderer->beginShader("only-color");
+      renderer->setColor(lightIntensity);
+      renderer->cube();
+    renderer->endShader();
+  renderer->pop();
+
+  // floor, ceiling and walls
+  renderer->beginShader("fog");
+    renderer->setMaterial(vec3(0.1f), vec3(0.5f), vec3(0.9f), 32.0f);
+    renderer->texture(&walls);
+    float h = kWallScale / 2;
+    const vec3 offsets[6] = {vec3(0, -h, 0), vec3(0, h, 0), vec3(h, 0, 0),
+      vec3(-h, 0, 0), vec3(0, 0, h), vec3(0, 0, -h)};
+    const vec3 sizes[3] = {vec3(kWallScale, 0.1f, kWallScale),
+      vec3(0.1f, kWallScale, kWallScale), vec3(kWallScale, kWallScale, 0.1f)};
+    for (int i = 0; i < 6; i++) {
+      renderer->push();
+        renderer->translate(offsets[i]);
+        renderer->scale(sizes[i / 2]);
+        renderer->cube();
+      renderer->pop();
+    }
+  renderer->endShader();
+}
+
+// Draw a white 4 pixel high rectangle along the top of each 64x64 tile in
+// a row, from 56 + i pixels into tile i to its right edge, so that each
+// rectangle starts at a different offset into the last block of the
+// tile's last rows. Returns false if the wrong number of pixels is drawn.
+bool checkBlockEdges(int numThreads) {
+  const int kTile = 64;
+  const int kBlock = 8;
+  const int kHeight = 4;
+  SoftwareRenderer renderer(numThreads);
+  renderer.resize(kTile * kBlock, kTile);
+  renderer.background(vec3(0.0f));
+  renderer.clear();
+  renderer.ortho(0.0f, kTile * kBlock, 0.0f, kTile, -10.0f, 10.0f);
+  renderer.lookAt(vec3(0, 0, 1), vec3(0), vec3(0, 1, 0));
+
+  vector<float> positions, normals, texCoords;
+  vector<unsigned int> indices;
+  int expected = 0;
+  for (int tile = 0; tile < kBlock; tile++) {
+    float x0 = static_cast<float>(tile * kTile + kTile - kBlock + tile);
+    float x1 = static_cast<float>((tile + 1) * kTile);
+    float y0 = static_cast<float>(kTile - kHeight);
+    float y1 = static_cast<float>(kTile);
+    unsigned int first = static_cast<unsigned int>(positions.size() / 3);
+    const float corners[4][2] = {{x0, y0}, {x1, y0}, {x1, y1}, {x0, y1}};
+    for (const float* corner : corners) {
+      positions.insert(positions.end(), {corner[0], corner[1], 0.0f});
+      normals.insert(normals.end(), {0.0f, 0.0f, 1.0f});
+    }
+    indices.insert(indices.end(), {first, first + 1, first + 2,
+        first, first + 2, first + 3});
+    expected += (kBlock - tile) * kHeight;
+  }
+  renderer.beginShader("only-color");
+    renderer.setColor(vec3(1.0f));
+    renderer.mesh(positions, normals, texCoords, indices);
+  renderer.endShader();
+
+  const Image& image = renderer.image();
+  int drawn = 0;
+  for (int y = 0; y < image.height(); y++) {
+    for (int x = 0; x < image.width(); x++) {
+      if (image.get(y, x).r > 0) drawn++;
+    }
+  }
+  if (drawn != expected) {
+    printf("block edge check FAILED: %d pixels drawn, expected %d\n", drawn,
+        expected);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int numThreads = 0;
+  int numFrames = 30;
+  int width = 1280, height = 720;
+  string shader = "phong-pixel";
+  string saveDir;
+  string modelDir = "../models";
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "-j" && i + 1 < argc) {
+      numThreads = atoi(argv[++i]);
+    } else if (arg == "-n" && i + 1 < argc) {
+      numFrames = std::max(1, atoi(argv[++i]));
+    } else if (arg == "--size" && i + 1 < argc &&
+        sscanf(argv[i + 1], "%dx%d", &width, &height) == 2) {
+      i++;
+    } else if (arg == "--shader" && i + 1 < argc) {
+      shader = argv[++i];
+    } else if (arg == "--save" && i + 1 < argc) {
+      saveDir = argv[++i];
+    } else if (arg[0] == '-') {
+      std::cout << "usage: raster-bench [-j threads] [-n frames] "
+          "[--size WxH] [--shader name] [--save dir] [models dir]" <<
+          std::endl;
+      return 1;
+    } else {
+      modelDir = arg;
+    }
+  }
+
+  if (!checkBlockEdges(numThreads)) return 1;
+
+  Image walls;
+  if (!walls.load("../textures/chess-board.png")) {
+    std::cout << "WARNING: cannot load chess-board.png, walls are white\n";
+  }
+
+  SoftwareRenderer renderer(numThreads);
+  renderer.resize(width, height);
+  renderer.background(vec3(0.0f));
+  printf("%dx%d, %s, %d threads, %d frames per model\n", width, height,
+      shader.c_str(), renderer.numThreads(), numFrames);
+  printf("  %-24s %10s %8s %8s %10s\n", "model", "triangles", "fps",
+      "ms", "skipped");
+
+  vector<string> models = GetFilenamesInDir(modelDir, "ply");
+  std::sort(models.begin(), models.end());
+  double totalSeconds = 0;
+  int totalFrames = 0;
+  for (const string& model : models) {
+    PLYMesh mesh;
+    if (!mesh.load(modelDir + "/" + model)) {
+      std::cout << "WARNING: cannot load " << model << std::endl;
+      continue;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    SoftwareRenderer::Stats stats = {};
+    for (int frame = 0; frame < numFrames; frame++) {
+      renderer.clear();
+      drawScene(&renderer, mesh, shader, walls,
+          2.0f * M_PI * frame / numFrames);
+      renderer.finish();
+      SoftwareRenderer::Stats frameStats = renderer.stats();
+      stats.blocksSkipped += frameStats.blocksSkipped;
+    }
+    double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    totalSeconds += seconds;
+    totalFrames += numFrames;
+    printf("  %-24s %10d %8.1f %8.2f %10d\n", model.c_str(),
+        mesh.numTriangles(), numFrames / seconds, 1000 * seconds / numFrames,
+        stats.blocksSkipped / numFrames);
+
+    if (!saveDir.empty()) {
+      renderer.image().save(saveDir + "/" + PruneName(model) + ".png");
+    }
+  }
+  if (totalFrames > 0) {
+    printf("average %.1f fps over %d models\n", totalFrames / totalSeconds,
+        static_cast<int>(models.size()));
+  }
+  return 0;
+}
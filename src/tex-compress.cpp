@@ -0,0 +1,505 @@
+//--------------------------------------------------
+// Description: Offline texture compressor. Encodes PNGs to BC1 or BC7
+// with a full mip chain and saves them as .ktx2 next to the source, where
+// Renderer::loadTexture picks them up instead of the PNG.
+//
+// Usage: tex-compress [--bc1 | --bc7] [-j threads] [file.png | dir]...
+// Without files, every PNG in ../textures is compressed.
+//--------------------------------------------------
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "agl/compressedimage.h"
+#include "agl/image.h"
+#include "agl/threadpool.h"
+#include "osutils.h"
+
+using namespace agl;
+using std::string;
+using std::vector;
+
+namespace {
+
+// A 4x4 block of RGBA pixels, row by row
+struct Block {
+  float pixels[16][4];
+};
+
+// Copies the block at (bx, by), clamping at the right and bottom edges
+Block readBlock(const Image& image, int bx, int by) {
+  Block block;
+  for (int i = 0; i < 16; i++) {
+    int x = std::min(bx * 4 + i % 4, image.width() - 1);
+    int y = std::min(by * 4 + i / 4, image.height() - 1);
+    const unsigned char* p = image.data() + (y * image.width() + x) * 4;
+    for (int c = 0; c < 4; c++) block.pixels[i][c] = p[c];
+  }
+  return block;
+}
+
+// Finds the line through the pixels that best fits them (the principal
+// axis of their covariance) and returns the extreme points along it
+void fitEndpoints(const Block& block, int channels, float e0[4], float e1[4]) {
+  float mean[4] = {0, 0, 0, 0};
+  for (int i = 0; i < 16; i++) {
+    for (int c = 0; c < channels; c++) mean[c] += block.pixels[i][c] / 16.0f;
+  }
+
+  float cov[4][4] = {};
+  for (int i = 0; i < 16; i++) {
+    for (int a = 0; a < channels; a++) {
+      for (int b = 0; b < channels; b++) {
+        cov[a][b] += (block.pixels[i][a] - mean[a]) *
+            (block.pixels[i][b] - mean[b]);
+      }
+    }
+  }
+
+  // power iteration, starting from the luminance direction
+  float axis[4] = {1, 1, 1, 1};
+  for (int iter = 0; iter < 8; iter++) {
+    float next[4] = {0, 0, 0, 0};
+    float length = 0;
+    for (int a = 0; a < channels; a++) {
+      for (int b = 0; b < channels; b++) next[a] += cov[a][b] * axis[b];
+      length = std::max(length, std::fabs(next[a]));
+    }
+    if (length < 1e-6f) break;  // flat block
+    for (int a = 0; a < channels; a++) axis[a] = next[a] / length;
+  }
+
+  float lo = 0, hi = 0;
+  for (int i = 0; i < 16; i++) {
+    float t = 0;
+    for (int c = 0; c < channels; c++) {
+      t += (block.pixels[i][c] - mean[c]) * axis[c];
+    }
+    lo = std::min(lo, t);
+    hi = std::max(hi, t);
+  }
+  float axisLength2 = 0;
+  for (int c = 0; c < channels; c++) axisLength2 += axis[c] * axis[c];
+  if (axisLength2 < 1e-6f) axisLength2 = 1;
+
+  for (int c = 0; c < 4; c++) {
+    float dir = c < channels ? axis[c] / axisLength2 : 0;
+    e0[c] = std::min(255.0f, std::max(0.0f, mean[c] + lo * dir));
+    e1[c] = std::min(255.0f, std::max(0.0f, mean[c] + hi * dir));
+  }
+}
+
+float distance2(const float* a, const float* b, int channels) {
+  float d = 0;
+  for (int c = 0; c < channels; c++) d += (a[c] - b[c]) * (a[c] - b[c]);
+  return d;
+}
+
+// Returns the index of the palette entry closest to each pixel
+void chooseIndices(const Block& block, const float palette[][4],
+    int paletteSize, int channels, int indices[16]) {
+  for (int i = 0; i < 16; i++) {
+    float best = 1e30f;
+    for (int j = 0; j < paletteSize; j++) {
+      float d = distance2(block.pixels[i], palette[j], channels);
+      if (d < best) {
+        best = d;
+        indices[i] = j;
+      }
+    }
+  }
+}
+
+// Moves the endpoints to the least-squares fit for the given indices,
+// where index j sits at weights[j] (0..1) between them
+void refineEndpoints(const Block& block, const int indices[16],
+    const float* weights, int channels, float e0[4], float e1[4]) {
+  float aa = 0, ab = 0, bb = 0;
+  float ax[4] = {0, 0, 0, 0}, bx[4] = {0, 0, 0, 0};
+  for (int i = 0; i < 16; i++) {
+    float w = weights[indices[i]];
+    aa += (1 - w) * (1 - w);
+    ab += (1 - w) * w;
+    bb += w * w;
+    for (int c = 0; c < channels; c++) {
+      ax[c] += (1 - w) * block.pixels[i][c];
+      bx[c] += w * block.pixels[i][c];
+    }
+  }
+  float det = aa * bb - ab * ab;
+  if (std::fabs(det) < 1e-6f) return;  // all pixels use one index
+
+  for (int c = 0; c < channels; c++) {
+    e0[c] = std::min(255.0f, std::max(0.0f, (bb * ax[c] - ab * bx[c]) / det));
+    e1[c] = std::min(255.0f, std::max(0.0f, (aa * bx[c] - ab * ax[c]) / det));
+  }
+}
+
+//--------------------------------------------------
+// BC1: two RGB565 endpoints and 2-bit indices (8 bytes per block)
+
+uint16_t packRGB565(const float color[4]) {
+  int r = static_cast<int>(color[0] * 31 / 255.0f + 0.5f);
+  int g = static_cast<int>(color[1] * 63 / 255.0f + 0.5f);
+  int b = static_cast<int>(color[2] * 31 / 255.0f + 0.5f);
+  return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+void unpackRGB565(uint16_t packed, float color[4]) {
+  color[0] = ((packed >> 11) & 31) * 255 / 31.0f;
+  color[1] = ((packed >> 5) & 63) * 255 / 63.0f;
+  color[2] = (packed & 31) * 255 / 31.0f;
+  color[3] = 255;
+}
+
+// Builds the palette as the GPU decodes it
+int bc1Palette(uint16_t c0, uint16_t c1, float palette[4][4]) {
+  unpackRGB565(c0, palette[0]);
+  unpackRGB565(c1, palette[1]);
+  for (int c = 0; c < 4; c++) {
+    if (c0 > c1) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    } else {
+      palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+      palette[3][c] = 0;  // transparent black
+    }
+  }
+  return c0 > c1 ? 4 : 3;
+}
+
+void encodeBC1(const Block& block, unsigned char* out) {
+  bool transparent = false;
+  for (int i = 0; i < 16; i++) {
+    if (block.pixels[i][3] < 128) transparent = true;
+  }
+
+  float e0[4], e1[4];
+  fitEndpoints(block, 3, e0, e1);
+
+  // two passes: fit, then refine the endpoints for the chosen indices
+  uint16_t c0 = 0, c1 = 0;
+  int indices[16];
+  for (int pass = 0; pass < 2; pass++) {
+    c0 = packRGB565(e0);
+    c1 = packRGB565(e1);
+    // the endpoint order selects the mode: c0 > c1 for four colors,
+    // c0 <= c1 for three colors plus transparent
+    if ((c0 < c1) != transparent) std::swap(c0, c1);
+
+    float palette[4][4];
+    int numColors = bc1Palette(c0, c1, palette);
+    chooseIndices(block, palette, numColors, 3, indices);
+    if (transparent) {
+      for (int i = 0; i < 16; i++) {
+        if (block.pixels[i][3] < 128) indices[i] = 3;
+      }
+    }
+    if (pass == 1 || transparent) break;
+
+    static const float kWeights[4] = {0, 1, 1 / 3.0f, 2 / 3.0f};
+    unpackRGB565(c0, e0);
+    unpackRGB565(c1, e1);
+    refineEndpoints(block, indices, kWeights, 3, e0, e1);
+  }
+  if (c0 == c1) {
+    // every color index decodes to c0; keep the transparent texels
+    for (int i = 0; i < 16; i++) {
+      if (!transparent || indices[i] != 3) indices[i] = 0;
+    }
+  }
+
+  uint32_t bits = 0;
+  for (int i = 0; i < 16; i++) {
+    bits |= static_cast<uint32_t>(indices[i]) << (2 * i);
+  }
+  memcpy(out, &c0, 2);
+  memcpy(out + 2, &c1, 2);
+  memcpy(out + 4, &bits, 4);
+}
+
+void decodeBC1(const unsigned char* in, unsigned char pixels[16][4]) {
+  uint16_t c0, c1;
+  uint32_t bits;
+  memcpy(&c0, in, 2);
+  memcpy(&c1, in + 2, 2);
+  memcpy(&bits, in + 4, 4);
+
+  float palette[4][4];
+  bc1Palette(c0, c1, palette);
+  for (int i = 0; i < 16; i++) {
+    const float* color = palette[(bits >> (2 * i)) & 3];
+    for (int c = 0; c < 4; c++) {
+      pixels[i][c] = static_cast<unsigned char>(color[c] + 0.5f);
+    }
+  }
+}
+
+//--------------------------------------------------
+// BC7 mode 6: one RGBA subset, 7-bit endpoints with a shared low bit per
+// endpoint and 4-bit indices (16 bytes per block)
+
+const int kBC7Weights[16] =
+    {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+void writeBits(unsigned char* out, int* pos, uint32_t value, int count) {
+  for (int i = 0; i < count; i++, (*pos)++) {
+    if (value & (1u << i)) out[*pos / 8] |= 1 << (*pos % 8);
+  }
+}
+
+uint32_t readBits(const unsigned char* in, int* pos, int count) {
+  uint32_t value = 0;
+  for (int i = 0; i < count; i++, (*pos)++) {
+    if (in[*pos / 8] & (1 << (*pos % 8))) value |= 1u << i;
+  }
+  return value;
+}
+
+// Quantizes an endpoint to 7 bits per channel plus the p-bit which gives
+// the smallest error
+void quantizeBC7(const float endpoint[4], int q[4], int* pbit) {
+  float bestError = 1e30f;
+  for (int p = 0; p < 2; p++) {
+    int candidate[4];
+    float error = 0;
+    for (int c = 0; c < 4; c++) {
+      int v = static_cast<int>(std::floor((endpoint[c] - p) / 2 + 0.5f));
+      candidate[c] = std::min(127, std::max(0, v));
+      float d = (candidate[c] * 2 + p) - endpoint[c];
+      error += d * d;
+    }
+    if (error < bestError) {
+      bestError = error;
+      *pbit = p;
+      memcpy(q, candidate, sizeof(candidate));
+    }
+  }
+}
+
+void bc7Palette(const int q0[4], int p0, const int q1[4], int p1,
+    float palette[16][4]) {
+  for (int j = 0; j < 16; j++) {
+    for (int c = 0; c < 4; c++) {
+      int a = q0[c] * 2 + p0;
+      int b = q1[c] * 2 + p1;
+      palette[j][c] = static_cast<float>(
+          ((64 - kBC7Weights[j]) * a + kBC7Weights[j] * b + 32) >> 6);
+    }
+  }
+}
+
+void encodeBC7(const Block& block, unsigned char* out) {
+  float e0[4], e1[4];
+  fitEndpoints(block, 4, e0, e1);
+
+  int q0[4], q1[4], p0 = 0, p1 = 0;
+  int indices[16];
+  for (int pass = 0; pass < 2; pass++) {
+    quantizeBC7(e0, q0, &p0);
+    quantizeBC7(e1, q1, &p1);
+
+    float palette[16][4];
+    bc7Palette(q0, p0, q1, p1, palette);
+    chooseIndices(block, palette, 16, 4, indices);
+    if (pass == 1) break;
+
+    float weights[16];
+    for (int j = 0; j < 16; j++) weights[j] = kBC7Weights[j] / 64.0f;
+    refineEndpoints(block, indices, weights, 4, e0, e1);
+  }
+
+  // the first index is stored without its high bit, so it must be < 8
+  if (indices[0] >= 8) {
+    std::swap(q0, q1);
+    std::swap(p0, p1);
+    for (int i = 0; i < 16; i++) indices[i] = 15 - indices[i];
+  }
+
+  memset(out, 0, 16);
+  int pos = 0;
+  writeBits(out, &pos, 1 << 6, 7);  // mode 6
+  for (int c = 0; c < 4; c++) {
+    writeBits(out, &pos, q0[c], 7);
+    writeBits(out, &pos, q1[c], 7);
+  }
+  writeBits(out, &pos, p0, 1);
+  writeBits(out, &pos, p1, 1);
+  for (int i = 0; i < 16; i++) {
+    writeBits(out, &pos, indices[i], i == 0 ? 3 : 4);
+  }
+}
+
+// Only decodes mode 6, the one encodeBC7 writes
+void decodeBC7(const unsigned char* in, unsigned char pixels[16][4]) {
+  int pos = 7;
+  int q0[4], q1[4];
+  for (int c = 0; c < 4; c++) {
+    q0[c] = readBits(in, &pos, 7);
+    q1[c] = readBits(in, &pos, 7);
+  }
+  int p0 = readBits(in, &pos, 1);
+  int p1 = readBits(in, &pos, 1);
+
+  float palette[16][4];
+  bc7Palette(q0, p0, q1, p1, palette);
+  for (int i = 0; i < 16; i++) {
+    const float* color = palette[readBits(in, &pos, i == 0 ? 3 : 4)];
+    for (int c = 0; c < 4; c++) {
+      pixels[i][c] = static_cast<unsigned char>(color[c]);
+    }
+  }
+}
+
+//--------------------------------------------------
+
+// Encodes one mip level, splitting its block rows between the workers
+vector<unsigned char> compressLevel(const Image& image, bool bc1,
+    ThreadPool* pool) {
+  int blocksX = (image.width() + 3) / 4;
+  int blocksY = (image.height() + 3) / 4;
+  int blockSize = bc1 ? 8 : 16;
+  vector<unsigned char> blocks(blocksX * blocksY * blockSize);
+
+  int rowsPerJob = std::max(1, blocksY / (pool->size() * 4));
+  vector<std::future<void>> jobs;
+  for (int start = 0; start < blocksY; start += rowsPerJob) {
+    int end = std::min(blocksY, start + rowsPerJob);
+    jobs.push_back(pool->run([&, start, end]() {
+      for (int by = start; by < end; by++) {
+        for (int bx = 0; bx < blocksX; bx++) {
+          Block block = readBlock(image, bx, by);
+          unsigned char* out = &blocks[(by * blocksX + bx) * blockSize];
+          if (bc1) {
+            encodeBC1(block, out);
+          } else {
+            encodeBC7(block, out);
+          }
+        }
+      }
+    }));
+  }
+  for (std::future<void>& job : jobs) job.get();
+  return blocks;
+}
+
+// Peak signal-to-noise ratio of the decoded first level, in dB
+double psnr(const Image& image, const CompressedImage& compressed, bool bc1) {
+  int blocksX = (image.width() + 3) / 4;
+  double error = 0;
+  int count = 0;
+  for (int by = 0; by * 4 < image.height(); by++) {
+    for (int bx = 0; bx < blocksX; bx++) {
+      const unsigned char* in =
+          compressed.data(0) + (by * blocksX + bx) * (bc1 ? 8 : 16);
+      unsigned char pixels[16][4];
+      if (bc1) {
+        decodeBC1(in, pixels);
+      } else {
+        decodeBC7(in, pixels);
+      }
+
+      Block block = readBlock(image, bx, by);
+      int channels = bc1 ? 3 : 4;  // opaque BC1 pixels all have alpha 255
+      for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < channels; c++) {
+          double d = pixels[i][c] - block.pixels[i][c];
+          error += d * d;
+          count++;
+        }
+      }
+    }
+  }
+  if (error == 0) return 99.0;
+  return 10.0 * std::log10(255.0 * 255.0 / (error / count));
+}
+
+bool compress(const string& fileName, bool bc1, ThreadPool* pool) {
+  Image image;
+  if (!image.load(fileName)) {
+    std::cout << "WARNING: could not load " << fileName << std::endl;
+    return false;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  GLenum format = bc1 ? GL_COMPRESSED_RGBA_S3TC_DXT1_EXT :
+      GL_COMPRESSED_RGBA_BPTC_UNORM;
+  CompressedImage compressed(format, image.width(), image.height());
+
+  Image level = image;
+  while (true) {
+    vector<unsigned char> blocks = compressLevel(level, bc1, pool);
+    compressed.addLevel(blocks.data(), blocks.size());
+    if (level.width() == 1 && level.height() == 1) break;
+    level = level.downsample();
+  }
+  double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+
+  string outName = fileName.substr(0, fileName.find_last_of('.')) + ".ktx2";
+  if (!compressed.save(outName)) {
+    std::cout << "WARNING: could not save " << outName << std::endl;
+    return false;
+  }
+
+  size_t size = 0;
+  for (int i = 0; i < compressed.numLevels(); i++) {
+    size += compressed.level(i).size;
+  }
+  printf("%s: %dx%d, %d levels, %.1f KB -> %.1f KB, PSNR %.2f dB, %.0f ms\n",
+      outName.c_str(), image.width(), image.height(), compressed.numLevels(),
+      image.width() * image.height() * 4 * 4 / 3 / 1024.0, size / 1024.0,
+      psnr(image, compressed, bc1), seconds * 1000);
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  bool bc1 = false;
+  int numThreads = 0;
+  vector<string> inputs;
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--bc1") {
+      bc1 = true;
+    } else if (arg == "--bc7") {
+      bc1 = false;
+    } else if (arg == "-j" && i + 1 < argc) {
+      numThreads = atoi(argv[++i]);
+    } else if (arg[0] == '-') {
+      std::cout << "usage: tex-compress [--bc1 | --bc7] [-j threads] "
+          "[file.png | dir]..." << std::endl;
+      return 1;
+    } else {
+      inputs.push_back(arg);
+    }
+  }
+  if (inputs.empty()) inputs.push_back("../textures");
+
+  vector<string> files;
+  for (const string& input : inputs) {
+    if (input.size() > 4 && input.substr(input.size() - 4) == ".png") {
+      files.push_back(input);
+      continue;
+    }
+    for (const string& name : GetFilenamesInDir(input, ".png")) {
+      files.push_back(input + "/" + name);
+    }
+  }
+  std::sort(files.begin(), files.end());
+
+  ThreadPool pool(numThreads);
+  int failures = 0;
+  for (const string& file : files) {
+    if (!compress(file, bc1, &pool)) failures++;
+  }
+  return failures == 0 ? 0 : 1;
+}